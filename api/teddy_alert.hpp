@@ -0,0 +1,209 @@
+/* Teddy alert rule engine definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_ALERT_HPP
+#define TEDDY_ALERT_HPP
+
+/**
+ * @file teddy_alert.hpp
+ * This file defines an alert rule engine for decoded sensor
+ * readings.  A rule is an expression over the fields of the
+ * readings, compiled once into a compact bytecode, with an optional
+ * count of readings in a row for which it must hold, e.g.:
+ *
+ *   temperature < -5 for 3 readings
+ *   dropsThisPeriod > 0 while gpsSpeed > 10
+ *   batteryMV < 3300 and chargeState != CHARGING_ON
+ *
+ * The fields are named as in PipelineReadings_t or by their path in
+ * SensorReadings_t (e.g. powerState.batteryMV), in the units on the
+ * air; ORIENTATION_x and CHARGING_x may be used as constants.  The
+ * operators are, loosest first: "or" (||), "and" (&&, "while"),
+ * "not" (!), the comparisons < <= > >= == (=) !=, + and -, unary -
+ * and brackets.  Everything is worked out in 64-bit integers, a
+ * comparison or logical operator giving 0 or 1; a rule holds if its
+ * expression is non-zero.
+ *
+ * A rule is only evaluated against readings in which all of the
+ * sensors it refers to are present; other readings leave it be.
+ * For each device and rule the engine keeps the number of readings
+ * in a row for which the rule has held, in a byte, and calls back
+ * once when that reaches the count required (the alert is raised)
+ * and once when the rule next fails to hold (the alert is cleared),
+ * so transitions are reported rather than levels.
+ *
+ * Evaluation reads the fields of a reading once and then runs the
+ * bytecode of each rule in turn in a tight loop; a comparison of a
+ * field with a constant, by far the most common term, is a single
+ * instruction.  Rules are all added before init(), after which they
+ * are fixed.  The per-device state is sharded by device like the
+ * SensorStore: each shard must only be fed from one thread, the
+ * callback being made on that thread, and nothing is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum length of the bytecode of one rule, in 32-bit words
+#define ALERT_MAX_RULE_CODE 256
+
+/// The maximum depth of the evaluation stack of one rule
+#define ALERT_MAX_STACK_DEPTH 32
+
+/// The maximum number of readings in a row that a rule may require
+#define ALERT_MAX_IN_A_ROW 255
+
+/// The maximum number of rules
+#define ALERT_MAX_RULES 65536
+
+/// The maximum number of shards
+#define ALERT_MAX_SHARDS 64
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Called when an alert is raised or cleared.
+// \param pContext   The context pointer given to init().
+// \param deviceId   The device.
+// \param ruleId     The ID of the rule, as given to addRule().
+// \param raised     true if the alert has been raised, false if it
+//                   has been cleared.
+// \param pReadings  The readings that raised or cleared it.
+typedef void (*AlertCallback_t) (void * pContext,
+                                 DeviceId_t deviceId,
+                                 uint32_t ruleId,
+                                 bool raised,
+                                 const PipelineReadings_t * pReadings);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The alert rule engine.
+class AlertEngine {
+public:
+
+    AlertEngine (void);
+    ~AlertEngine (void);
+
+    /// Compile and add a rule; must be called before init().
+    // \param ruleId        An ID for the rule, given to the callback.
+    // \param pText         The rule, an expression optionally followed
+    //                      by "for <n> [readings]".
+    // \param pErrorOffset  A place to put the offset into pText at
+    //                      which compilation failed, may be NULL.
+    // \return              true if successful, otherwise false.
+    bool addRule (uint32_t ruleId, const char * pText, uint32_t * pErrorOffset);
+
+    /// Add the rules in a text file, one per line: "<id> <rule>";
+    // blank lines and lines starting with # are ignored.
+    // \param pFileName  The file.
+    // \return           true if the whole file was added, otherwise
+    //                   false.
+    bool addFile (const char * pFileName);
+
+    /// Set up the per-device state for the rules added so far.
+    // \param numShards   The number of shards.
+    // \param maxDevices  The maximum number of devices.
+    // \param pCallback   The callback for alerts, may be NULL if they
+    //                    are only to be counted.
+    // \param pContext    A context pointer for the callback, may be
+    //                    NULL.
+    // \return            true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices,
+               AlertCallback_t pCallback, void * pContext);
+
+    /// Get the shard that a device is fed through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Evaluate all of the rules against a reading.  Only one thread
+    // may evaluate through a given shard.
+    // \param shardIndex     The shard, from getShardIndex().
+    // \param deviceId       The device.
+    // \param pReadings      The readings.
+    // \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+    // \return               The number of alerts raised or cleared.
+    uint32_t evaluate (uint32_t shardIndex, DeviceId_t deviceId,
+                       const PipelineReadings_t * pReadings, uint8_t presentBitmap);
+
+    /// As evaluate() but from a pipeline record; records that are not
+    // sensor reports are ignored.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \return            The number of alerts raised or cleared.
+    uint32_t evaluateRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord);
+
+    /// Get the number of rules.
+    // \return  The number of rules.
+    uint32_t getNumRules (void);
+
+    /// Get the number of readings evaluated and alerts raised and
+    // cleared.
+    // \param pNumReadings  A place to put the number of readings, may
+    //                      be NULL.
+    // \param pNumRaised    A place to put the number of alerts raised,
+    //                      may be NULL.
+    // \param pNumCleared   A place to put the number of alerts cleared,
+    //                      may be NULL.
+    void getStats (uint64_t * pNumReadings, uint64_t * pNumRaised, uint64_t * pNumCleared);
+
+private:
+    /// A compiled rule.
+    typedef struct RuleTag_t
+    {
+        uint32_t ruleId;
+        uint32_t codeOffset;                 //!< Into mp_code.
+        uint8_t requiredBitmap;              //!< PIPELINE_PRESENT_x of the fields used.
+        uint8_t numInARow;
+    } Rule_t;
+
+    /// A shard: a table of the devices fed through it, each with a
+    // count per rule.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        uint8_t * pCounts;                   //!< Per slot, one per rule.
+        uint64_t numReadings;
+        uint64_t numRaised;
+        uint64_t numCleared;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, creating it if needed.
+    int64_t getSlot (Shard_t * pShard, DeviceId_t deviceId);
+
+    Rule_t * mp_rules;
+    uint32_t m_numRules;
+    uint32_t m_maxRules;
+    int32_t * mp_code;
+    uint32_t m_codeSize;
+    uint32_t m_maxCodeSize;
+    AlertCallback_t mp_callback;
+    void * mp_callbackContext;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
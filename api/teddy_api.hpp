@@ -20,6 +20,39 @@
 
 #include <teddy_msgs.hpp>
 
+// ----------------------------------------------------------------
+// BUILD PROFILES
+// ----------------------------------------------------------------
+
+// By default the whole codec is built, both directions, as the
+// servers, the tools and the DLL need it.  A device only encodes
+// uplink messages and decodes downlink ones so, to save flash,
+// MESSAGE_CODEC_DEVICE (the device profile of bld_arm/Makefile)
+// compiles out the rest; its two halves, MESSAGE_CODEC_NO_DL_ENCODE
+// and MESSAGE_CODEC_NO_UL_DECODE, may also be defined on their own.
+// The optional message types can be compiled out as well:
+// MESSAGE_CODEC_NO_DEBUG_IND removes DebugInd and
+// MESSAGE_CODEC_NO_TRAFFIC_REPORT the three TrafficReport messages,
+// a TrafficReportGetReq then decoding as DECODE_RESULT_UNKNOWN_MSG_ID.
+// What is compiled out is not declared either, so using it is a
+// compile error.  The on-air message IDs and the DecodeResult_t
+// values are the same whatever is compiled out.
+// The encode functions write the encoded bytes as they are unless
+// MESSAGE_CODEC_ENCODE_HEX is defined, in which case they write each
+// byte as two upper-case hex characters instead: that is for the
+// device, where the datagram goes to the modem as the hex data of
+// an AT socket-send command, see ENCODED OUTPUT below.  Either way
+// there is only the one output in a build and nothing is checked
+// per byte; the device profile is binary unless it is added.
+#ifdef MESSAGE_CODEC_DEVICE
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
+#define MESSAGE_CODEC_NO_DL_ENCODE
+#endif
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
+#define MESSAGE_CODEC_NO_UL_DECODE
+#endif
+#endif
+
 // ----------------------------------------------------------------
 // GENERAL COMPILE-TIME CONSTANTS
 // ----------------------------------------------------------------
@@ -39,22 +72,91 @@
 /// The maximum length of a raw datagram in bytes
 #define MAX_DATAGRAM_SIZE_RAW 122
 
+#ifdef MESSAGE_CODEC_ENCODE_HEX
+/// The room to leave in front of the hex of an AT socket-send
+// command, see MessageCodec::finishAtCommand(), for the command
+// prefix (e.g. "AT+NSOST=0,255.255.255.255,65535,"), the length of
+// the datagram and the comma after it
+#define AT_COMMAND_HEADER_ROOM 48
+
+/// The size of a buffer that will hold any AT socket-send command
+// for one datagram, including the null terminator
+#define MAX_AT_COMMAND_SIZE (AT_COMMAND_HEADER_ROOM + (MAX_DATAGRAM_SIZE_RAW * 2) + 1)
+#endif
+
 /// How often a sensor report is sent to the network
 #define DEFAULT_REPORTING_INTERVAL_MINUTES 1
 
 /// How often the sensors are read
 #define DEFAULT_HEARTBEAT_SECONDS   10
+
+#ifdef MESSAGE_CODEC_METRICS
+/// The number of bits of each latency below the top one that pick the
+// bucket of a latency histogram, so each bucket is 1/8th of a power
+// of two wide and a latency is known to within 12.5%
+#define MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS 3
+
+/// The number of buckets in a latency histogram, enough for any
+// 64-bit latency
+#define MESSAGE_CODEC_METRICS_NUM_LATENCY_BUCKETS ((64 - MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS + 1) << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS)
+
+/// The number of on-air message IDs for which decode failures are
+// counted separately; failures of messages with higher IDs, or with
+// no ID at all, are counted together
+#define MESSAGE_CODEC_METRICS_MAX_MSG_IDS 16
+
+/// Padding either side of the metrics, so that the codecs of
+// different threads never share a cache line
+#define MESSAGE_CODEC_METRICS_CACHE_LINE_SIZE 64
+
+/// A buffer of this size is always big enough for printMetrics()
+#define MESSAGE_CODEC_METRICS_MAX_TEXT_SIZE 65536
+#endif
+
 // ----------------------------------------------------------------
 // CLASSES
 // ----------------------------------------------------------------
 
+/// A row of the table of message formats, private to the codec.
+struct MsgFormatTag_t;
+
 class MessageCodec {
 public:
 
+    MessageCodec (void);
+
     // ----------------------------------------------------------------
     // MESSAGE ENCODING FUNCTIONS
     // ----------------------------------------------------------------
 
+#ifdef MESSAGE_CODEC_ENCODE_HEX
+    // ENCODED OUTPUT: with MESSAGE_CODEC_ENCODE_HEX the encode
+    // functions write hex straight into an AT socket-send command, to
+    // save converting and copying the datagram there: encode the
+    // messages into an AT command buffer of MAX_AT_COMMAND_SIZE from
+    // AT_COMMAND_HEADER_ROOM onwards and then call finishAtCommand()
+    // to put the prefix and the length in front.  The buffer for each
+    // encode function must have twice the room and the return value
+    // is the number of characters written, twice the number of bytes
+    // encoded, so that the messages of a datagram can be added one
+    // after another just the same.
+
+    /// Complete an AT socket-send command, e.g. the AT+NSOST of the
+    // C027N's modem, for the hex encoded at pBuffer +
+    // AT_COMMAND_HEADER_ROOM: the prefix, the length of the datagram
+    // in bytes and a comma are written immediately in front of the
+    // hex and a null terminator after it.  No end-of-line is added.
+    // \param pBuffer  The command buffer, MAX_AT_COMMAND_SIZE long.
+    // \param pPrefix  The command up to the length, e.g.
+    //                 "AT+NSOST=0,10.20.30.40,5065,".
+    // \param hexSize  The number of hex characters encoded, the total
+    //                 returned by the encode functions.
+    // \return         The start of the command, within the first
+    //                 AT_COMMAND_HEADER_ROOM bytes of pBuffer, or NULL
+    //                 if the prefix is too long or hexSize too big.
+    static char * finishAtCommand (char * pBuffer, const char * pPrefix, uint32_t hexSize);
+#endif
+
     /// Encode an uplink message that is sent at power-on of the
     // teddy.  Indicates that the device has been initialised.  After
     // transmission of this message sensor readings will be taken
@@ -66,6 +168,7 @@ public:
     uint32_t encodeInitIndUlMsg (char * pBuffer,
                                  InitIndUlMsg_t * pMsg);
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
     /// Encode a downlink message that reboots the device.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
@@ -73,7 +176,9 @@ public:
     // \return  The number of bytes encoded.
     uint32_t encodeRebootReqDlMsg (char * pBuffer,
     		                       RebootReqDlMsg_t *pMsg);
+#endif
 
+#ifndef MESSAGE_CODEC_NO_DEBUG_IND
     /// Encode an uplink message that contains a debug string.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
@@ -81,7 +186,9 @@ public:
     // \return  The number of bytes encoded.
     uint32_t encodeDebugIndUlMsg (char * pBuffer,
                                   DebugIndUlMsg_t * pMsg);
+#endif
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
     /// Encode a downlink message that retrieves the reading and
     // reporting intervals.
     // \param pBuffer  A pointer to the buffer to encode into.  The
@@ -89,6 +196,7 @@ public:
     // \param pMsg  A pointer to the message to send.
     // \return  The number of bytes encoded.
     uint32_t encodeIntervalsGetReqDlMsg (char * pBuffer);
+#endif
 
     /// Encode an uplink message that is sent as a response to a
     // IntervalsGetReqDlMsg.
@@ -99,12 +207,14 @@ public:
     uint32_t encodeIntervalsGetCnfUlMsg (char * pBuffer,
                                          IntervalsGetCnfUlMsg_t * pMsg);
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
     /// Encode a downlink message that sets the sensor reporting interval.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
     // \return  The number of bytes encoded.
     uint32_t encodeReportingIntervalSetReqDlMsg (char * pBuffer,
                                                  ReportingIntervalSetReqDlMsg_t * pMsg);
+#endif
 
     /// Encode an uplink message that is sent as a response to a
     // ReportingIntervalSetReqDlMsg.
@@ -115,12 +225,14 @@ public:
     uint32_t encodeReportingIntervalSetCnfUlMsg (char * pBuffer,
                                                  ReportingIntervalSetCnfUlMsg_t * pMsg);
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
     /// Encode a downlink message that sets the heartbeat.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
     // \return  The number of bytes encoded.
     uint32_t encodeHeartbeatSetReqDlMsg (char * pBuffer,
                                          HeartbeatSetReqDlMsg_t * pMsg);
+#endif
 
     /// Encode an uplink message that is sent as a response to a
     // HeartbeatSetReqDlMsg.
@@ -137,12 +249,14 @@ public:
     // buffer length must be at least MAX_MESSAGE_SIZE long
     uint32_t encodePollIndUlMsg (char * pBuffer);
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
     /// Encode a downlink message that retrieves the sensor readings.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
     // \param pMsg  A pointer to the message to send.
     // \return  The number of bytes encoded.
     uint32_t encodeSensorsReportGetReqDlMsg (char * pBuffer);
+#endif
 
     /// Encode an uplink message that is sent as a response to a
     // SensorReportGetReqDlMsg.
@@ -167,13 +281,16 @@ public:
     uint32_t encodeSensorsReportIndUlMsg (char * pBuffer,
                                           SensorsReportIndUlMsg_t * pMsg);
 
+#if !defined (MESSAGE_CODEC_NO_DL_ENCODE) && !defined (MESSAGE_CODEC_NO_TRAFFIC_REPORT)
     /// Encode a downlink message that retrieves a traffic report.
     // \param pBuffer  A pointer to the buffer to encode into.  The
     // buffer length must be at least MAX_MESSAGE_SIZE long
     // \param pMsg  A pointer to the message to send.
     // \return  The number of bytes encoded.
     uint32_t encodeTrafficReportGetReqDlMsg (char * pBuffer);
+#endif
 
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
     /// Encode an uplink message that is sent as a response to a
     // TrafficReportGetReqDlMsg.
     // Values should be those accumulated since the InitIndUlMsg was
@@ -194,6 +311,7 @@ public:
     // \return  The number of bytes encoded.
     uint32_t encodeTrafficReportIndUlMsg (char * pBuffer,
                                           TrafficReportIndUlMsg_t * pMsg);
+#endif
 
     // ----------------------------------------------------------------
     // MESSAGE DECODING FUNCTIONS
@@ -264,12 +382,14 @@ public:
                                 uint32_t sizeInBuffer,
                                 DlMsgUnion_t * pOutBuffer);
 
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
     /// Decode an uplink message. When a datagram has been received
     // this function should be called iteratively to decode all the
     // messages contained within it.  The result, in pOutputBuffer,
     // should be cast by the calling function to UlMsgUnion_t and
     // the relevant member selected according to the
-    // DecodeResult_t code.
+    // DecodeResult_t code.  The string of a DebugIndUlMsg is not
+    // copied: debugIndUlMsg.pString points into the input buffer.
     // \param ppInBuffer  A pointer to the pointer to decode from.
     // On completion this is pointing to the next byte that
     // could be decoded, after the currently decoded message,
@@ -282,6 +402,7 @@ public:
     DecodeResult_t decodeUlMsg (const char ** ppInBuffer,
                                 uint32_t sizeInBuffer,
                                 UlMsgUnion_t * pOutBuffer);
+#endif
 
     // ----------------------------------------------------------------
     // MISC FUNCTIONS
@@ -295,13 +416,113 @@ public:
     /// User callback function for "printf()" logging.  
     static void (*mp_guiPrintToConsole) (const char *);
 
+#ifdef MESSAGE_CODEC_METRICS
+    // ----------------------------------------------------------------
+    // METRICS FUNCTIONS
+    // ----------------------------------------------------------------
+
+    // With MESSAGE_CODEC_METRICS defined, each MessageCodec counts
+    // what it encodes and decodes and, if a clock has been given with
+    // setMetricsClock(), how long each call takes.  The counters are
+    // plain integers in the MessageCodec, padded out to their own
+    // cache lines, so a codec should be used by one thread at a time,
+    // the usual case being a codec per thread; the metrics of several
+    // codecs are added together with mergeMetrics().  A decode with no
+    // output buffer, which only reads the message ID, is not counted.
+    // Without MESSAGE_CODEC_METRICS none of this is compiled in.
+
+    /// The direction of a message, for the decode failure counts.
+    typedef enum MetricsDirectionTag_t
+    {
+        METRICS_DIRECTION_DL = 0,
+        METRICS_DIRECTION_UL,
+        METRICS_NUM_DIRECTIONS
+    } MetricsDirection_t;
+
+    /// A latency histogram, in the ticks of the metrics clock.  A
+    // latency of less than 1 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS
+    // ticks has a bucket to itself, above that each power of two is
+    // split into 1 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS buckets.
+    typedef struct MetricsHistogramTag_t
+    {
+        uint64_t count;
+        uint64_t totalTicks;
+        uint64_t maxTicks;
+        uint64_t buckets[MESSAGE_CODEC_METRICS_NUM_LATENCY_BUCKETS];
+    } MetricsHistogram_t;
+
+    /// The metrics of a codec.
+    typedef struct MetricsTag_t
+    {
+        char padBefore[MESSAGE_CODEC_METRICS_CACHE_LINE_SIZE];
+        uint64_t numDecodes[MAX_NUM_DECODE_RESULTS];          //!< By DecodeResult_t.
+        uint64_t numDecodeFailures[METRICS_NUM_DIRECTIONS]
+                                  [MESSAGE_CODEC_METRICS_MAX_MSG_IDS + 1]
+                                  [DECODE_RESULT_BAD_MSG_FORMAT + 1]; //!< By on-air message ID and DecodeResult_t.
+        uint64_t numEncodes[MAX_NUM_DECODE_RESULTS];          //!< By the DecodeResult_t of the message.
+        uint64_t numBytesDecoded;
+        uint64_t numBytesEncoded;
+        MetricsHistogram_t decodeLatency;
+        MetricsHistogram_t encodeLatency;
+        char padAfter[MESSAGE_CODEC_METRICS_CACHE_LINE_SIZE];
+    } Metrics_t;
+
+    /// Get a copy of the metrics of this codec.  If the codec is in use
+    // by another thread at the time the copy may be a count or two out
+    // here and there, but no count ever goes backwards.
+    // \param pSnapshot  A place to put the copy.
+    void getMetrics (Metrics_t * pSnapshot);
+
+    /// Zero the metrics of this codec.
+    void resetMetrics (void);
+
+    /// Set the clock used to time encodes and decodes, for all codecs;
+    // until it is set nothing is timed.
+    // \param pGetTicks  A function returning a monotonic time in ticks,
+    //                   e.g. nanoseconds, or NULL to stop timing.
+    static void setMetricsClock (uint64_t (*pGetTicks) (void));
+
+    /// Add one set of metrics to another.
+    // \param pTotal    The metrics to add to.
+    // \param pMetrics  The metrics to add.
+    static void mergeMetrics (Metrics_t * pTotal, const Metrics_t * pMetrics);
+
+    /// Get a quantile of a latency histogram.
+    // \param pHistogram  The histogram.
+    // \param permille    The quantile in thousandths, e.g. 990 for the
+    //                    99th percentile.
+    // \return            The upper bound of the bucket the quantile
+    //                    falls in, in ticks, zero if the histogram is
+    //                    empty.
+    static uint64_t getLatencyQuantile (const MetricsHistogram_t * pHistogram, uint32_t permille);
+
+    /// Write metrics out as text, in the Prometheus exposition format;
+    // only counters that are not zero are written.
+    // \param pMetrics  The metrics.
+    // \param pBuffer   A place to put the text, which is NULL
+    //                  terminated.
+    // \param size      The room at pBuffer, at most
+    //                  MESSAGE_CODEC_METRICS_MAX_TEXT_SIZE needed.
+    // \return          The length of the text, or -1 if there isn't
+    //                  room.
+    static int32_t printMetrics (const Metrics_t * pMetrics, char * pBuffer, uint32_t size);
+#endif
+
 private:
-    /// Encode a boolean value.
-    // \param pBuffer  A pointer to where the encoded
-    // value should be placed.
-    // \param value The Boolean value.
-    // \return  The number of bytes encoded.
-    uint32_t encodeBool (char * pBuffer, bool value);
+    /// Encode a message made of fixed-size fields from its row of
+    // the table.
+    // \param pBuffer  A pointer to the buffer to encode into.
+    // \param pFormat  The row of the table.
+    // \param pMsg     The message structure, NULL if it has no fields.
+    // \return         The number of bytes encoded.
+    uint32_t encodeMsg (char * pBuffer, const MsgFormatTag_t * pFormat, const void * pMsg);
+    /// Write one byte of encoded output, as it is or, with
+    // MESSAGE_CODEC_ENCODE_HEX, as two hex characters; everything
+    // the encode functions write goes through here.
+    // \param pBuffer  A pointer to where the output should be placed.
+    // \param value    The byte.
+    // \return         The number of characters written.
+    uint32_t writeByte (char * pBuffer, uint8_t value);
     /// Decode a Boolean value.
     // \param ppBuffer  A pointer to the pointer to decode.
     // On completion this points to the location after the
@@ -323,26 +544,31 @@ private:
     // \param value The value.
     // \return  The number of bytes encoded.
     uint32_t encodeUint24 (char * pBuffer, uint32_t value);
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
     /// Decode a uint24_t value.
     // \param ppBuffer  A pointer to the pointer to decode.
     // On completion this points to the location after the
     // uint24_t in the input buffer.
     uint32_t decodeUint24 (const char ** ppBuffer);
+#endif
     /// Encode a uint16_t value.
     // \param pBuffer  A pointer to the value to decode.
     // \param value The value.
     // \return  The number of bytes encoded.
     uint32_t encodeUint16 (char * pBuffer, uint16_t value);
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
     /// Decode a uint16_t value.
     // \param ppBuffer  A pointer to the pointer to decode.
     // On completion this points to the location after the
     // uint16_t in the input buffer.
     uint32_t decodeUint16 (const char ** ppBuffer);
+#endif
     /// Encode the sensor readings.
     // \param pBuffer         A pointer to the sensor readings to decode.
     // \param pSensorReadings A pointer to the sensor readings.
     // \return  The number of bytes encoded.
     uint32_t encodeSensorReadings (char * pBuffer, SensorReadings_t * pSensorReadings);
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
     /// Decode the sensor readings into pValue.
     // \param ppBuffer        A pointer to the pointer to decode.
     // On completion this points to the location after the
@@ -350,9 +576,37 @@ private:
     // \param pSensorReadings A place to put the sensor readings.
     // \return true if the decode is successful, otherwise false.
     bool decodeSensorReadings (const char ** ppBuffer, SensorReadings_t * pSensorReadings);
+#endif
     /// Log a message for debugging, "printf()" style.
     // \param pFormat The printf() stle parameters.
     void logMsg (const char * pFormat, ...);
+
+#ifdef MESSAGE_CODEC_METRICS
+    /// Read the metrics clock.
+    // \return  The time in ticks, zero if there is no clock.
+    static uint64_t metricsTicks (void);
+    /// Count a decode.
+    // \param direction   The direction of the message.
+    // \param pMsgStart   Where the message started.
+    // \param pMsgEnd     Where the decode finished.
+    // \param sizeIn      The number of bytes that there were to decode.
+    // \param result      The result of the decode.
+    // \param startTicks  The metrics clock at the start of the decode.
+    void addDecodeMetrics (MetricsDirection_t direction, const char * pMsgStart, const char * pMsgEnd,
+                           uint32_t sizeIn, DecodeResult_t result, uint64_t startTicks);
+    /// Count an encode.
+    // \param msgType     The DecodeResult_t of the message encoded.
+    // \param numBytes    The number of bytes encoded.
+    // \param startTicks  The metrics clock at the start of the encode.
+    void addEncodeMetrics (DecodeResult_t msgType, uint32_t numBytes, uint64_t startTicks);
+    /// Add a latency to a histogram.
+    static void addLatency (MetricsHistogram_t * pHistogram, uint64_t ticks);
+    /// Get the name of a DecodeResult_t, without the DECODE_RESULT_.
+    static const char * getResultName (uint32_t result);
+
+    Metrics_t m_metrics;
+    static uint64_t (*mp_metricsClock) (void);
+#endif
 };
 
 #endif
@@ -0,0 +1,230 @@
+/* Teddy change-data-capture definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_CDC_HPP
+#define TEDDY_CDC_HPP
+
+/**
+ * @file teddy_cdc.hpp
+ * This file defines a change-data-capture stage for sensor readings:
+ * rather than forwarding every reading in full, the CdcEncoder
+ * compares each with the previous reading of the same device and
+ * encodes a compact change record carrying only the fields whose
+ * values have changed.  Consecutive readings from a teddy mostly
+ * repeat the orientation, charge state, RSSI and temperature, so the
+ * records are a fraction of the size of the readings.
+ *
+ * A change record is, in network byte order like the on-air
+ * messages:
+ *
+ * - the device ID (8 bytes),
+ * - the reading time (4 bytes),
+ * - a per-device sequence number (1 byte),
+ * - CDC_RECORD_FLAG_x flags (1 byte),
+ * - the presence bitmap of the reading, PIPELINE_PRESENT_x (1 byte),
+ * - a bitmap of the fields carried, 1 << CDC_FIELD_x (2 bytes),
+ * - the value of each field carried, in CDC_FIELD_x order, each at
+ *   its width in PipelineReadings_t.
+ *
+ * A field is carried if it is present and either it wasn't present
+ * last time or its value has changed.  The first record of a device,
+ * and every so often after that, is a key record carrying every
+ * field present, so that a consumer joining the stream part way
+ * through can pick up from there.
+ *
+ * On the consumer side cdcApply() rebuilds the full readings of a
+ * device from its records, in order, into a CdcState_t; a gap in the
+ * sequence numbers means a record was lost and the state is not
+ * trusted again until the next key record.
+ *
+ * The encoder is sharded by device like the SensorStore: each shard
+ * must only be fed from one thread, e.g. a pipeline sink, and nothing
+ * is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The size of the fixed part of a change record
+#define CDC_RECORD_HEADER_SIZE 17
+
+/// The maximum size of a change record
+#define CDC_MAX_RECORD_SIZE (CDC_RECORD_HEADER_SIZE + 34)
+
+/// The default number of records of a device between key records
+#define CDC_DEFAULT_KEY_INTERVAL 64
+
+/// The maximum number of shards
+#define CDC_MAX_SHARDS 64
+
+/// Bits of the flags of a change record
+#define CDC_RECORD_FLAG_KEY 0x01 //!< Carries every field present.
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The fields of PipelineReadings_t, other than the time, that a
+// change record can carry.
+typedef enum
+{
+    CDC_FIELD_GPS_LATITUDE,
+    CDC_FIELD_GPS_LONGITUDE,
+    CDC_FIELD_GPS_ELEVATION,
+    CDC_FIELD_GPS_SPEED,
+    CDC_FIELD_ENERGY_UWH,
+    CDC_FIELD_SOUND_LEVEL,
+    CDC_FIELD_LUMINOSITY,
+    CDC_FIELD_BATTERY_MV,
+    CDC_FIELD_ORIENTATION,
+    CDC_FIELD_HUGS,
+    CDC_FIELD_SLAPS,
+    CDC_FIELD_DROPS,
+    CDC_FIELD_NUDGES,
+    CDC_FIELD_TEMPERATURE,
+    CDC_FIELD_RSSI,
+    CDC_FIELD_CHARGE_STATE,
+    MAX_NUM_CDC_FIELDS
+} CdcField_t;
+
+/// The state of a device as rebuilt by a consumer.
+typedef struct CdcStateTag_t
+{
+    DeviceId_t deviceId;
+    PipelineReadings_t readings;     //!< Only those in presentBitmap are valid.
+    uint8_t presentBitmap;           //!< PIPELINE_PRESENT_x.
+    uint8_t sequence;                //!< Of the last record applied.
+    bool synced;                     //!< false until a key record is applied.
+} CdcState_t;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Get the device ID and size of a change record, e.g. to find the
+// state to apply it to.
+// \param pRecord     The record.
+// \param size        The number of bytes available at pRecord.
+// \param pDeviceId   A place to put the device ID, may be NULL.
+// \return            The size of the record, zero if it is
+//                    incomplete.
+uint32_t cdcRecordInfo (const char * pRecord, uint32_t size, DeviceId_t * pDeviceId);
+
+/// Apply a change record to the state of its device, which should
+// be zeroed before the first record.
+// \param pRecord  The record.
+// \param size     The number of bytes available at pRecord.
+// \param pState   The state of the device.
+// \return         true if the state is now a complete copy of the
+//                 readings of the device, false if the record was
+//                 incomplete or for another device, or if a record
+//                 has been lost since the last key record.
+bool cdcApply (const char * pRecord, uint32_t size, CdcState_t * pState);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The producer side of the change-data-capture stage.
+class CdcEncoder {
+public:
+
+    CdcEncoder (void);
+    ~CdcEncoder (void);
+
+    /// Set up the encoder.
+    // \param numShards    The number of shards.
+    // \param maxDevices   The maximum number of devices.
+    // \param keyInterval  The number of records of a device between
+    //                     key records, zero for the default.
+    // \return             true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices, uint32_t keyInterval);
+
+    /// Get the shard that a device is fed through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Encode the change record for a reading.  Only one thread may
+    // encode through a given shard.
+    // \param shardIndex     The shard, from getShardIndex().
+    // \param deviceId       The device.
+    // \param pReadings      The readings.
+    // \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+    // \param pBuffer        A place to put the record, at least
+    //                       CDC_MAX_RECORD_SIZE bytes.
+    // \return               The size of the record, zero if there was
+    //                       no room for the device.
+    uint32_t encode (uint32_t shardIndex, DeviceId_t deviceId,
+                     const PipelineReadings_t * pReadings, uint8_t presentBitmap,
+                     char * pBuffer);
+
+    /// As encode() but from a pipeline record; records that are not
+    // sensor reports are ignored.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \param pBuffer     A place to put the change record, at least
+    //                    CDC_MAX_RECORD_SIZE bytes.
+    // \return            The size of the change record, zero if none.
+    uint32_t encodeRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord,
+                           char * pBuffer);
+
+    /// Get the number of change records encoded, the bytes they took
+    // and the bytes the same readings would have taken as full
+    // SensorReadings_t.
+    // \param pNumRecords    A place to put the number of records, may
+    //                       be NULL.
+    // \param pNumBytes      A place to put the bytes encoded, may be NULL.
+    // \param pNumFullBytes  A place to put the bytes as full readings,
+    //                       may be NULL.
+    void getStats (uint64_t * pNumRecords, uint64_t * pNumBytes, uint64_t * pNumFullBytes);
+
+private:
+    /// The last reading of a device.
+    typedef struct DeviceTag_t
+    {
+        PipelineReadings_t readings;
+        uint8_t presentBitmap;
+        uint8_t sequence;                    //!< Of the next record.
+        uint16_t numSinceKey;                //!< Records since the last key record.
+    } Device_t;
+
+    /// A shard: a table of the devices fed through it.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        Device_t * pDevices;
+        uint64_t numRecords;
+        uint64_t numBytes;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, creating it if needed.
+    // \param pIsNew  Set to true if the device was created.
+    int64_t getSlot (Shard_t * pShard, DeviceId_t deviceId, bool * pIsNew);
+
+    uint32_t m_keyInterval;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,113 @@
+/* Teddy column codec definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_COLUMN_CODEC_HPP
+#define TEDDY_COLUMN_CODEC_HPP
+
+/**
+ * @file teddy_column_codec.hpp
+ * This file defines the codecs used to compress the columns of
+ * sealed SensorStore segments.
+ *
+ * - COLUMN_CODEC_DELTA_OF_DELTA, for time: heartbeat-spaced times
+ *   have a delta-of-delta of zero.
+ * - COLUMN_CODEC_DELTA, for integer sensor values: the difference
+ *   from the previous value, zig-zag encoded so that small negative
+ *   differences are small numbers too.
+ * - COLUMN_CODEC_RLE, for the presence bitmap and enumerations such
+ *   as Orientation_t and ChargeState_t: value and run length pairs.
+ *
+ * For the two delta codecs the first value (and, for delta-of-delta,
+ * the first delta) is stored as a varint and the zig-zagged numbers
+ * that follow are bit-packed in blocks of COLUMN_CODEC_BLOCK_SIZE,
+ * each block at the width of its widest member, given in a leading
+ * byte.  A varint never takes less than a byte per value, which is
+ * no saving at all on the 8-bit columns; a block of unchanging values
+ * costs one byte in all, which is where most of the saving on static
+ * GPS positions and regular times comes from.  Decoding a block is a
+ * fixed-width unpack, with no branches per value.
+ */
+
+#include <stdint.h>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of values in a bit-packed block
+#define COLUMN_CODEC_BLOCK_SIZE 64
+
+/// The number of bytes after the end of encoded data that the
+// decoder may read (but not use); a buffer handed to a decoder
+// should either have this much slack or the decoder will take a
+// slower path for the final bytes.
+#define COLUMN_CODEC_READ_SLACK 8
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The codecs.
+typedef enum
+{
+    COLUMN_CODEC_RAW,                  //!< Stored as is.
+    COLUMN_CODEC_DELTA_OF_DELTA,
+    COLUMN_CODEC_DELTA,
+    COLUMN_CODEC_RLE,
+    MAX_NUM_COLUMN_CODECS
+} ColumnCodec_t;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Get the worst-case encoded size of a column, for sizing buffers.
+// \param numValues    The number of values.
+// \param elementSize  The size of each value: 1, 2 or 4 bytes.
+// \return             The worst-case size in bytes.
+uint32_t columnCodecMaxEncodedSize (uint32_t numValues, uint32_t elementSize);
+
+/// Encode a column.
+// \param codec        The codec.
+// \param pValues      The values.
+// \param numValues    The number of values.
+// \param elementSize  The size of each value: 1, 2 or 4 bytes.
+// \param isSigned     true if the values are signed.
+// \param pOut         A place to put the encoded column.
+// \param outSize      The space at pOut; if it isn't enough for the
+//                     worst case (see columnCodecMaxEncodedSize())
+//                     the encoding may fail.
+// \return             The number of bytes encoded, zero on failure.
+uint32_t columnEncode (ColumnCodec_t codec,
+                       const void * pValues, uint32_t numValues,
+                       uint32_t elementSize, bool isSigned,
+                       uint8_t * pOut, uint32_t outSize);
+
+/// Decode a column.
+// \param codec        The codec.
+// \param pIn          The encoded column.
+// \param inSize       The size of the encoded column.
+// \param numValues    The number of values to decode.
+// \param elementSize  The size of each value: 1, 2 or 4 bytes.
+// \param isSigned     true if the values are signed.
+// \param pValues      A place to put the values, numValues *
+//                     elementSize bytes.
+// \return             true if successful, false if the encoded
+//                     column is malformed.
+bool columnDecode (ColumnCodec_t codec,
+                   const uint8_t * pIn, uint32_t inSize,
+                   uint32_t numValues, uint32_t elementSize, bool isSigned,
+                   void * pValues);
+
+#endif
+
+// End Of File
@@ -0,0 +1,162 @@
+/* Teddy DebugInd template table definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_DEBUG_TEMPLATE_HPP
+#define TEDDY_DEBUG_TEMPLATE_HPP
+
+/**
+ * @file teddy_debug_template.hpp
+ * This file defines a table of DebugInd string templates.  The debug
+ * strings that a fleet sends are, for the most part, a few hundred
+ * distinct strings with different numbers in them, e.g. "RSSI 23" or
+ * "retry 3 of 5".  Each string is split into a template, the string
+ * with each decimal number replaced by DEBUG_TEMPLATE_PARAM_CHAR, and
+ * the numbers themselves, its parameters; the template is interned
+ * and the string is then carried and stored as just a template ID and
+ * the parameters, which also groups the strings by what they are
+ * about for nothing.
+ *
+ * The split is lossless: format() gives back exactly the original
+ * string.  So a number is only made a parameter if it has at most
+ * DEBUG_TEMPLATE_MAX_PARAM_DIGITS digits and no leading zero, and
+ * only the first DEBUG_TEMPLATE_MAX_PARAMS numbers are; any others
+ * stay in the template.  A minus sign stays in the template too.  A
+ * string that already contains DEBUG_TEMPLATE_PARAM_CHAR is not
+ * interned.
+ *
+ * The table is fixed in size at init() and templates are never
+ * removed, so a template ID, and the template text it gives, stays
+ * valid for the life of the table.  Lookups and inserts may be made
+ * from any number of threads at once, e.g. the pipeline decode
+ * workers, and take no lock: a slot is claimed with a compare and
+ * swap, filled in and then published; a lookup that meets a slot
+ * still being filled in waits the few nanoseconds until it is.
+ * Once the table is full, strings with new templates are not
+ * interned.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <teddy_msgs.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The template ID meaning "not interned"
+#define DEBUG_TEMPLATE_ID_NONE 0
+
+/// The maximum number of parameters of a template
+#define DEBUG_TEMPLATE_MAX_PARAMS 8
+
+/// The maximum number of digits in a parameter, so that it fits in
+// 32 bits
+#define DEBUG_TEMPLATE_MAX_PARAM_DIGITS 9
+
+/// The character that stands for a parameter in a template
+#define DEBUG_TEMPLATE_PARAM_CHAR '\x1F'
+
+/// The default maximum number of templates
+#define DEBUG_TEMPLATE_DEFAULT_MAX_TEMPLATES 4096
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The DebugInd template table.
+class DebugTemplateTable {
+public:
+
+    DebugTemplateTable (void);
+    ~DebugTemplateTable (void);
+
+    /// Set up the table.
+    // \param maxTemplates  The maximum number of templates, zero for
+    //                      DEBUG_TEMPLATE_DEFAULT_MAX_TEMPLATES.
+    // \return              true if successful, otherwise false.
+    bool init (uint32_t maxTemplates);
+
+    /// Split a debug string into a template and parameters and intern
+    // the template.  May be called from any thread.
+    // \param pString      The string (not NULL terminated), e.g.
+    //                     DebugIndUlMsg_t.pString.
+    // \param size         The size of the string, at most
+    //                     MAX_DEBUG_STRING_SIZE.
+    // \param pParams      A place to put the parameters, room for
+    //                     DEBUG_TEMPLATE_MAX_PARAMS.
+    // \param pNumParams   A place to put the number of parameters.
+    // \return             The template ID, DEBUG_TEMPLATE_ID_NONE if the
+    //                     string could not be interned, in which case
+    //                     pParams and pNumParams are unchanged.
+    uint32_t intern (const char * pString, uint32_t size,
+                     uint32_t * pParams, uint32_t * pNumParams);
+
+    /// Get the text of a template.
+    // \param templateId  The template ID.
+    // \param pSize       A place to put the size of the text.
+    // \return            The text (not NULL terminated), with
+    //                    DEBUG_TEMPLATE_PARAM_CHAR for each parameter,
+    //                    or NULL if there is no such template.
+    const char * getTemplate (uint32_t templateId, uint32_t * pSize);
+
+    /// Put a template and its parameters back together into the
+    // original string.
+    // \param templateId  The template ID.
+    // \param pParams     The parameters.
+    // \param numParams   The number of parameters.
+    // \param pBuffer     A place to put the string, which is NULL
+    //                    terminated; MAX_DEBUG_STRING_SIZE + 1 bytes is
+    //                    always enough.
+    // \param size        The room at pBuffer.
+    // \return            The length of the string, or -1 if there is
+    //                    no such template, the parameters don't match
+    //                    it or there isn't room.
+    int32_t format (uint32_t templateId, const uint32_t * pParams, uint32_t numParams,
+                    char * pBuffer, uint32_t size);
+
+    /// Get the number of templates and the number of strings that
+    // could not be interned.
+    // \param pNumTemplates    A place to put the number of templates,
+    //                         may be NULL.
+    // \param pNumNotInterned  A place to put the number of strings not
+    //                         interned, may be NULL.
+    void getStats (uint32_t * pNumTemplates, uint64_t * pNumNotInterned);
+
+private:
+    /// The states of a slot.
+    typedef enum
+    {
+        SLOT_EMPTY = 0,
+        SLOT_FILLING,
+        SLOT_READY
+    } SlotState_t;
+
+    /// A slot of the table: a template.
+    typedef struct SlotTag_t
+    {
+        std::atomic<uint32_t> state;         //!< A SlotState_t.
+        uint32_t hash;
+        uint8_t size;
+        uint8_t numParams;
+        char text[MAX_DEBUG_STRING_SIZE];
+    } Slot_t;
+
+    uint32_t m_capacity;
+    uint32_t m_maxTemplates;
+    std::atomic<uint32_t> m_numTemplates;
+    std::atomic<uint64_t> m_numNotInterned;
+    Slot_t * mp_slots;
+};
+
+#endif
+
+// End Of File
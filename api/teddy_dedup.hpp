@@ -0,0 +1,146 @@
+/* Teddy duplicate datagram filter definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_DEDUP_HPP
+#define TEDDY_DEDUP_HPP
+
+/**
+ * @file teddy_dedup.hpp
+ * This file defines a filter that spots uplink datagrams which have
+ * been seen recently from the same device, e.g. a SensorsReportInd
+ * retransmitted because the network lost the acknowledgement, so
+ * that they can be dropped before they are decoded.
+ *
+ * Each datagram is reduced to a 64-bit fingerprint of the device ID
+ * and the datagram bytes.  The fingerprint is first tested against a
+ * blocked Bloom filter: the bits of one key all fall in the same
+ * cache line, one bit in each of its eight 64-bit words, so a test
+ * or an insert touches exactly one line.  Almost every datagram is
+ * new and stops there.  On a hit the fingerprint is looked up in an
+ * exact table, one cache line of eight fingerprints per set, and only
+ * if it is found there is the datagram a duplicate; Bloom false
+ * positives are counted and passed.  A fingerprint pushed out of a
+ * full set of the exact table is simply forgotten, so the filter can
+ * miss a duplicate but never drops a datagram that it hasn't seen.
+ *
+ * Memory is fixed at init(): the filter and table are split into two
+ * generations, each covering a window of time.  New fingerprints go
+ * into the current generation and both are tested; when the window
+ * of the current generation is over the older generation is cleared
+ * and becomes the current one.  A duplicate is therefore caught if
+ * it arrives within one to two windows of the original.
+ *
+ * The filter is sharded by device like the SensorStore: each shard
+ * must only be used from one thread, e.g. a pipeline decode worker,
+ * and nothing is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The default memory, in bytes, for all shards and generations
+#define DEDUP_DEFAULT_MEMORY_BYTES (16 * 1024 * 1024)
+
+/// The default length of a generation, in seconds
+#define DEDUP_DEFAULT_WINDOW_SECONDS 60
+
+/// The maximum number of shards
+#define DEDUP_MAX_SHARDS 64
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The duplicate datagram filter.
+class DedupFilter {
+public:
+
+    DedupFilter (void);
+    ~DedupFilter (void);
+
+    /// Set up the filter.  One eighth of the memory of each
+    // generation goes to the Bloom filter and the rest to the exact
+    // table, which holds one fingerprint per eight bytes.
+    // \param numShards      The number of shards.
+    // \param memoryBytes    The memory to use, for all shards.
+    // \param windowSeconds  The length of a generation.
+    // \return               true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t memoryBytes, uint32_t windowSeconds);
+
+    /// Get the shard that a device is checked through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Check whether a datagram has been seen recently and, if not,
+    // remember it.  Only one thread may check against a given shard.
+    // \param shardIndex  The shard.
+    // \param deviceId    The device the datagram came from.
+    // \param pDatagram   The datagram.
+    // \param size        The size of the datagram.
+    // \param nowUs       The time now, serverTimeUs().
+    // \return            true if the datagram is a duplicate.
+    bool check (uint32_t shardIndex, DeviceId_t deviceId,
+                const char * pDatagram, uint32_t size, uint64_t nowUs);
+
+    /// Get the number of datagrams checked, found to be duplicates
+    // and passed after a Bloom filter false positive.
+    // \param pNumChecked         A place to put the number checked,
+    //                            may be NULL.
+    // \param pNumDuplicates      A place to put the number of
+    //                            duplicates, may be NULL.
+    // \param pNumFalsePositives  A place to put the number of false
+    //                            positives, may be NULL.
+    void getStats (uint64_t * pNumChecked, uint64_t * pNumDuplicates,
+                   uint64_t * pNumFalsePositives);
+
+private:
+    /// A shard: two generations, each a Bloom filter and an exact
+    // table, in one allocation.
+    typedef struct ShardTag_t
+    {
+        uint64_t * pBlocks[2];               //!< Bloom filter, 8 words per block.
+        uint64_t * pSets[2];                 //!< Exact table, 8 fingerprints per set.
+        uint32_t current;                    //!< The generation being added to.
+        uint64_t generationStartUs;
+        bool started;
+        uint64_t numChecked;
+        uint64_t numDuplicates;
+        uint64_t numFalsePositives;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Form the fingerprint of a datagram, never zero.
+    static uint64_t fingerprint (DeviceId_t deviceId, const char * pDatagram, uint32_t size);
+    /// Test whether the Bloom filter of a generation has a fingerprint.
+    bool bloomTest (const uint64_t * pBlocks, uint64_t key);
+    /// Add a fingerprint to the Bloom filter of a generation.
+    void bloomAdd (uint64_t * pBlocks, uint64_t key);
+    /// Find a fingerprint in the exact table of a generation.
+    bool exactFind (const uint64_t * pSets, uint64_t key);
+    /// Add a fingerprint to the exact table of a generation.
+    void exactAdd (uint64_t * pSets, uint64_t key);
+
+    uint32_t m_numBlocks;                    //!< Per generation.
+    uint32_t m_numSets;                      //!< Per generation.
+    uint64_t m_windowUs;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,340 @@
+/* Teddy device registry definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_DEVICE_REGISTRY_HPP
+#define TEDDY_DEVICE_REGISTRY_HPP
+
+/**
+ * @file teddy_device_registry.hpp
+ * This file defines the device registry: the per-device session
+ * state that every consumer of decodeUlMsg() would otherwise build
+ * for itself (last InitInd, current intervals, last PollInd time,
+ * last traffic counters), kept up to date straight from decoded
+ * messages.
+ *
+ * The registry is split into shards, chosen with deviceIdShard(), so
+ * that if it has as many shards as the IngestPipeline has decode
+ * workers each worker only ever touches its own shard.  Each shard is
+ * an open-addressing (linear probing) hash table; the device IDs are
+ * in a column of their own so that a probe only walks along one
+ * dense array, and the state lives in parallel columns, one per
+ * field, so that an update only touches the columns it changes.
+ * The columns are kept narrow: the wake-up code and revision level
+ * share 16 bits, the revision level saturating at
+ * DEVICE_REVISION_LEVEL_MAX, and there is no last-seen time of its
+ * own, get() giving the latest of the InitInd, PollInd and
+ * SensorsReportInd times instead.  Each slot costs 31 bytes so, at
+ * the default load factor, each device costs 39 bytes, or 44 bytes
+ * with the slack given to each of several shards: 10 million devices
+ * take 390 to 440 Mbytes.
+ *
+ * Optionally, initLiveness() gives each shard a TimerWheel with two
+ * timers per device, re-armed as messages are decoded, so that a
+ * device that misses its PollInd or its SensorsReportInd is noticed
+ * without scanning the fleet; this costs another 45 to 51 bytes per
+ * device.
+ *
+ * Also optionally, initTrafficAccounting() keeps, per device, the
+ * last traffic report, the server's own counts of the datagrams to
+ * and from the device and running totals, so that each traffic
+ * report can be turned into a TrafficDelta_t (see
+ * teddy_traffic_accounting.hpp) and an estimate of loss in each
+ * direction; this costs another 68 bytes per slot, 85 to 96 bytes
+ * per device.  Without it get() gives no traffic counters.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_timer_wheel.hpp>
+#include <teddy_traffic_accounting.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of shards
+#define DEVICE_REGISTRY_MAX_SHARDS 256
+
+/// How late, as a percentage of the interval, a PollInd or
+// SensorsReportInd may be before the device is reported
+#define DEVICE_LIVENESS_GRACE_PERCENT 150
+
+/// The bits of the 16-bit column holding the wake-up code and
+// revision level that are the revision level; the wake-up code
+// has the rest
+#define DEVICE_REVISION_LEVEL_BITS 12
+
+/// The largest revision level kept; larger ones are kept as this
+#define DEVICE_REVISION_LEVEL_MAX ((1 << DEVICE_REVISION_LEVEL_BITS) - 1)
+
+/// Bits in DeviceState_t.flags
+#define DEVICE_STATE_INIT_IND_SEEN           0x01
+#define DEVICE_STATE_INTERVALS_KNOWN         0x02 //!< Both intervals from an IntervalsGetCnf.
+#define DEVICE_STATE_POLL_IND_SEEN           0x04
+#define DEVICE_STATE_TRAFFIC_SEEN            0x08
+#define DEVICE_STATE_SENSORS_REPORT_SEEN     0x10
+#define DEVICE_STATE_POLL_IND_OVERDUE        0x20 //!< Until the next PollInd.
+#define DEVICE_STATE_SENSORS_REPORT_OVERDUE  0x40 //!< Until the next SensorsReportInd.
+#define DEVICE_STATE_RESTARTED_SINCE_TRAFFIC 0x80 //!< An InitInd since the last traffic report.
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A copy of the state of one device.
+typedef struct DeviceStateTag_t
+{
+    DeviceId_t deviceId;
+    uint8_t flags;                       //!< DEVICE_STATE_x bits.
+    uint8_t wakeUpCode;                  //!< From the last InitInd.
+    uint16_t revisionLevel;              //!< From the last InitInd, at most DEVICE_REVISION_LEVEL_MAX.
+    uint32_t heartbeatSeconds;           //!< From the last Cnf carrying it.
+    uint32_t reportingIntervalMinutes;   //!< From the last Cnf carrying it.
+    uint32_t lastInitIndTime;            //!< Server UTC seconds.
+    uint32_t lastPollIndTime;            //!< Server UTC seconds.
+    uint32_t lastSensorsReportTime;      //!< Server UTC seconds.
+    uint32_t lastSeenTime;               //!< The latest of the three times above.
+    TrafficReportIndUlMsg_t traffic;     //!< From the last traffic report, zero without traffic accounting.
+} DeviceState_t;
+
+/// The ways in which a device can fall silent.
+typedef enum
+{
+    DEVICE_LIVENESS_POLL_IND_MISSED,       //!< No PollInd within the reporting interval.
+    DEVICE_LIVENESS_SENSORS_REPORT_MISSED  //!< No SensorsReportInd within the heartbeat period.
+} DeviceLiveness_t;
+
+/// Called when a device falls silent.  It is called with the device's
+// shard locked so it must not call back into the DeviceRegistry.
+// \param pContext  The context pointer given to initLiveness().
+// \param deviceId  The device.
+// \param what      What the device has missed.
+// \param lastTime  When the message was last received (or, if never,
+//                  when the interval became known), UTC seconds.
+// \param dueTime   When the message was due by, UTC seconds.
+typedef void (*DeviceLivenessCallback_t) (void * pContext,
+                                          DeviceId_t deviceId,
+                                          DeviceLiveness_t what,
+                                          uint32_t lastTime,
+                                          uint32_t dueTime);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+class DeviceRegistry {
+public:
+
+    DeviceRegistry (void);
+    ~DeviceRegistry (void);
+
+    /// Allocate the registry.  All the memory is allocated here,
+    // there is no resizing later.
+    // \param maxDevices  The maximum number of devices.
+    // \param numShards   The number of shards, ideally the number of
+    //                    threads that will update the registry.
+    // \return            true if successful, otherwise false.
+    bool init (uint32_t maxDevices, uint32_t numShards);
+
+    /// Switch on liveness detection; must be called after init()
+    // and before any devices are added.  From then on the PollInd
+    // of a device with a known reporting interval, and the
+    // SensorsReportInd of a device with a known heartbeat, is
+    // expected within DEVICE_LIVENESS_GRACE_PERCENT of the interval
+    // after the last one.  Since sensor reports go at multiples of
+    // the heartbeat, the heartbeat period used is the smallest
+    // multiple of it that covers the reporting interval.
+    // \param callback  Called for each device that misses a message.
+    // \param pContext  Passed to the callback.
+    // \param now       The server time in UTC seconds.
+    // \return          true if successful, otherwise false.
+    bool initLiveness (DeviceLivenessCallback_t callback, void * pContext, uint32_t now);
+
+    /// Fire the callback for the devices that have fallen silent
+    // since the last call; call this every second or so.  The cost
+    // depends on the number of devices that fall silent, not on the
+    // number of devices.
+    // \param now  The server time in UTC seconds.
+    // \return     The number of callbacks made.
+    uint32_t checkLiveness (uint32_t now);
+
+    /// Switch on traffic accounting; must be called after init()
+    // and before any devices are added.  From then on each traffic
+    // report is turned into deltas against the last one and compared
+    // with what was given to countServerTraffic() in between.  The
+    // interval across a restart of the device is passed to the
+    // callback but left out of the totals, as what the server counted
+    // before the restart can't be separated out.
+    // \param callback  Called for each traffic report, may be NULL.
+    // \param pContext  Passed to the callback.
+    // \return          true if successful, otherwise false.
+    bool initTrafficAccounting (TrafficDeltaCallback_t callback, void * pContext);
+
+    /// Count traffic to and from a device as seen by the server;
+    // call this for each datagram before decoding it, so that a
+    // traffic report is counted before it is accounted.  The device
+    // is added if it is new.
+    // \param deviceId        The device.
+    // \param numUlDatagrams  Uplink datagrams received from it.
+    // \param numUlBytes      Uplink bytes received from it.
+    // \param numDlDatagrams  Downlink datagrams sent to it.
+    // \param numDlBytes      Downlink bytes sent to it.
+    // \return                false if traffic accounting is off or
+    //                         the device is new and the registry is
+    //                         full, otherwise true.
+    bool countServerTraffic (DeviceId_t deviceId,
+                             uint32_t numUlDatagrams, uint32_t numUlBytes,
+                             uint32_t numDlDatagrams, uint32_t numDlBytes);
+
+    /// Get the running traffic totals for a device.
+    // \param deviceId  The device.
+    // \param pTotals   A place to put the totals.
+    // \return          true if the device is known and traffic
+    //                  accounting is on, otherwise false.
+    bool getTrafficTotals (DeviceId_t deviceId, TrafficTotals_t * pTotals);
+
+    /// Update the state of a device from a decoded uplink message,
+    // adding the device if it is new.
+    // \param deviceId  The device.
+    // \param result    The result from decodeUlMsg().
+    // \param pMsg      The message decoded by decodeUlMsg().
+    // \param now       The server time in UTC seconds.
+    // \return          false if the device is new and the registry
+    //                  is full, otherwise true.
+    bool update (DeviceId_t deviceId,
+                 MessageCodec::DecodeResult_t result,
+                 const UlMsgUnion_t * pMsg,
+                 uint32_t now);
+
+    /// As update() but from a pipeline record.
+    // \param pRecord  The record.
+    // \param now      The server time in UTC seconds.
+    // \return         false if the device is new and the registry
+    //                 is full, otherwise true.
+    bool updateFromRecord (const PipelineRecord_t * pRecord, uint32_t now);
+
+    /// Get a copy of the state of a device.
+    // \param deviceId  The device.
+    // \param pState    A place to put the state.
+    // \return          true if the device is known, otherwise false.
+    bool get (DeviceId_t deviceId, DeviceState_t * pState);
+
+    /// Remove a device.
+    // \param deviceId  The device.
+    // \return          true if the device was known, otherwise false.
+    bool remove (DeviceId_t deviceId);
+
+    /// Get the number of devices in the registry.
+    // \return  The number of devices.
+    uint32_t getNumDevices (void);
+
+    /// Get the number of shards.
+    // \return  The number of shards.
+    uint32_t getNumShards (void);
+
+    /// Get the amount of memory allocated for the registry.
+    // \return  The number of bytes.
+    uint64_t getMemoryUsed (void);
+
+private:
+    /// A shard: the columns of one open-addressing table.
+    typedef struct ShardTag_t
+    {
+        std::atomic_flag lock;           //!< Uncontended if one thread per shard.
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;         //!< DEVICE_ID_INVALID for empty slots.
+        uint8_t * pFlags;
+        uint16_t * pWakeUpRevisions;     //!< Packed as DEVICE_REVISION_LEVEL_BITS says.
+        uint32_t * pHeartbeatSeconds;
+        uint32_t * pReportingIntervalMinutes;
+        uint32_t * pLastInitIndTimes;
+        uint32_t * pLastPollIndTimes;
+        uint32_t * pLastSensorsReportTimes;
+        // Only used for liveness detection: each device has a handle
+        // that doesn't change as entries move, giving it timers
+        // 2 * handle (PollInd) and 2 * handle + 1 (SensorsReportInd)
+        uint32_t * pHandles;             //!< A column, per entry.
+        DeviceId_t * pHandleDeviceIds;   //!< Per handle.
+        uint32_t * pFreeHandles;         //!< A stack.
+        uint32_t numFreeHandles;
+        TimerWheel wheel;
+        // Only used for traffic accounting, columns
+        TrafficReportIndUlMsg_t * pTraffic;    //!< The last report.
+        TrafficServerCounts_t * pServerCounts; //!< Since the last report.
+        TrafficTotals_t * pTrafficTotals;
+        uint32_t * pLastTrafficTimes;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Passed through TimerWheel::advance() to timerCallback().
+    typedef struct TimerContextTag_t
+    {
+        DeviceRegistry * pRegistry;
+        Shard_t * pShard;
+        uint32_t numFired;
+    } TimerContext_t;
+
+    /// Called by the TimerWheel of a shard.
+    static void timerCallback (void * pContext, uint32_t timerIndex, uint32_t expiryTick);
+
+    /// Find a device's slot, optionally adding it.
+    // \param pShard    The shard, which must be locked.
+    // \param deviceId  The device.
+    // \param add       true if the device should be added if absent.
+    // \return          The slot or -1.
+    int64_t findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add);
+    /// Lock and unlock a shard.
+    void lockShard (Shard_t * pShard);
+    void unlockShard (Shard_t * pShard);
+    /// Set the state in a slot from the parts of a message.
+    void updateSlot (Shard_t * pShard, uint32_t slot,
+                     MessageCodec::DecodeResult_t result,
+                     uint32_t reportingIntervalMinutes,
+                     uint32_t heartbeatSeconds,
+                     uint8_t wakeUpCode,
+                     uint16_t revisionLevel,
+                     const TrafficReportIndUlMsg_t * pTraffic,
+                     uint32_t now);
+    /// How long after the last PollInd, or SensorsReportInd, of
+    // the device in a slot it is reported as silent; zero if the
+    // interval isn't known.
+    static uint32_t livenessSeconds (Shard_t * pShard, uint32_t slot, bool sensorsNotPoll);
+    /// Arm the liveness timers of a slot after a message.
+    void armLiveness (Shard_t * pShard, uint32_t slot,
+                      MessageCodec::DecodeResult_t result,
+                      uint32_t now);
+    /// Account a traffic report against the baseline in a slot.
+    void accountTraffic (Shard_t * pShard, uint32_t slot,
+                         const TrafficReportIndUlMsg_t * pTraffic,
+                         uint32_t now);
+    /// Move an entry from one slot to another.
+    void moveSlot (Shard_t * pShard, uint32_t to, uint32_t from);
+    /// Free the columns of a shard.
+    void freeShard (Shard_t * pShard);
+
+    uint32_t m_numShards;
+    uint64_t m_memoryUsed;
+    DeviceLivenessCallback_t m_livenessCallback;
+    void * mp_livenessContext;
+    TrafficDeltaCallback_t m_trafficCallback;
+    void * mp_trafficContext;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -25,6 +25,136 @@ extern "C" {
 
     #define DLL __declspec(dllexport)
 
+    /// The size of CsSensorReadings_t; the C# definition must match
+    #define CS_SENSOR_READINGS_SIZE 76
+
+    /// Sensor readings flattened for C#: every field is four bytes
+    // at a fixed offset and presence is a bitmap rather than bools,
+    // so the structure is blittable and can be filled in place, one
+    // or an array of them, with no marshalling.  !!! THE LAYOUT MUST
+    // align with CSSensorReadings in teddy_dll_wrapper.cs !!!
+    typedef struct CsSensorReadingsTag_t
+    {
+        uint32_t msgType;                    //!< 0: the DecodeResult_t of the message.
+        uint32_t presentBitmap;              //!< 4: (1 << SENSOR_x) for each sensor present.
+        uint32_t time;                       //!< 8
+        int32_t gpsPositionLatitude;         //!< 12
+        int32_t gpsPositionLongitude;        //!< 16
+        int32_t gpsPositionElevation;        //!< 20
+        int32_t gpsPositionSpeed;            //!< 24
+        uint32_t lclPositionOrientation;     //!< 28
+        uint32_t lclPositionHugsThisPeriod;  //!< 32
+        uint32_t lclPositionSlapsThisPeriod; //!< 36
+        uint32_t lclPositionDropsThisPeriod; //!< 40
+        uint32_t lclPositionNudgesThisPeriod;//!< 44
+        uint32_t soundLevel;                 //!< 48
+        uint32_t luminosity;                 //!< 52
+        int32_t temperature;                 //!< 56
+        uint32_t rssi;                       //!< 60
+        uint32_t powerStateChargeState;      //!< 64
+        uint32_t powerStateBatteryMV;        //!< 68
+        uint32_t powerStateEnergyUWH;        //!< 72
+    } CsSensorReadings_t;
+
+    /// The version of CodecApi_t; a new version only ever adds
+    // functions to the end of the table, so a table of one version
+    // serves a caller that asks for any earlier version
+    #define CODEC_API_VERSION 1
+
+    /// The whole of the C API below as one table of function pointers,
+    // returned by getCodecApi(), so that a wrapper can bind to all of
+    // it with one lookup, and check the version it gets, rather than
+    // looking up each function by name.  !!! THE LAYOUT MUST align
+    // with CSCodecApi in teddy_dll_wrapper.cs !!!
+    typedef struct CodecApiTag_t
+    {
+        uint32_t version;                    //!< The CODEC_API_VERSION of the DLL.
+        uint32_t size;                       //!< The sizeof (CodecApi_t) of the DLL.
+        uint32_t (__cdecl *maxDatagramSizeRaw) (void);
+        uint32_t (__cdecl *maxDebugStringSize) (void);
+        uint32_t (__cdecl *revisionLevel) (void);
+        uint32_t (__cdecl *encodeRebootReqDlMsg) (char * pBuffer,
+                                                  bool devModeOnNotOff);
+        uint32_t (__cdecl *encodeIntervalsGetReqDlMsg) (char * pBuffer);
+        uint32_t (__cdecl *encodeReportingIntervalSetReqDlMsg) (char * pBuffer,
+                                                                uint32_t reportingIntervalMinutes);
+        uint32_t (__cdecl *encodeHeartbeatSetReqDlMsg) (char * pBuffer,
+                                                        uint32_t heartbeatSeconds);
+        uint32_t (__cdecl *encodeSensorsReportGetReqDlMsg) (char * pBuffer);
+        uint32_t (__cdecl *encodeTrafficReportGetReqDlMsg) (char * pBuffer);
+        uint32_t (__cdecl *decodeUlMsgType) (const char * pInBuffer,
+                                             uint32_t sizeInBuffer);
+        bool (__cdecl *decodeUlMsgInitInd) (const char ** ppInBuffer,
+                                            uint32_t sizeInBuffer,
+                                            uint32_t * pWakeUpCode,
+                                            uint32_t * pRevision);
+        bool (__cdecl *decodeUlMsgIntervalsGetCnf) (const char ** ppInBuffer,
+                                                    uint32_t sizeInBuffer,
+                                                    uint32_t * pReportingIntervalMinutes,
+                                                    uint32_t * pHeartbeatSeconds);
+        bool (__cdecl *decodeUlMsgReportingIntervalSetCnf) (const char ** ppInBuffer,
+                                                            uint32_t sizeInBuffer,
+                                                            uint32_t * pReportingIntervalMinutes);
+        bool (__cdecl *decodeUlMsgHeartbeatSetCnf) (const char ** ppInBuffer,
+                                                    uint32_t sizeInBuffer,
+                                                    uint32_t * pHeartbeatSeconds);
+        bool (__cdecl *decodeUlMsgPollInd) (const char ** ppInBuffer,
+                                            uint32_t sizeInBuffer);
+        bool (__cdecl *decodeUlMsgSensorsReportxxx) (const char ** ppInBuffer,
+                                                     uint32_t sizeInBuffer,
+                                                     uint32_t * pTime,
+                                                     bool * pGpsPositionPresent,
+                                                     int32_t * pGpsPositionLatitude,
+                                                     int32_t * pGpsPositionLongitude,
+                                                     int32_t * pGpsPositionElevation,
+                                                     int32_t * pGpsPositionSpeed,
+                                                     bool * pLclPositionPresent,
+                                                     uint32_t * pLclPositionOrientation,
+                                                     uint32_t * pLclPositionHugsThisPeriod,
+                                                     uint32_t * pLclPositionSlapsThisPeriod,
+                                                     uint32_t * pLclPositionDropsThisPeriod,
+                                                     uint32_t * pLclPositionNudgesThisPeriod,
+                                                     bool * pSoundLevelPresent,
+                                                     uint32_t * pSoundLevel,
+                                                     bool * pLuminosityPresent,
+                                                     uint32_t * pLuminosity,
+                                                     bool * pTemperaturePresent,
+                                                     int32_t * pTemperature,
+                                                     bool * pRssiPresent,
+                                                     uint32_t *pRssi,
+                                                     bool * pPowerStatePresent,
+                                                     uint32_t *pPowerStateChargeState,
+                                                     uint32_t *pPowerStateBatteryMV,
+                                                     uint32_t *pPowerStateEnergyUWH);
+        uint32_t (__cdecl *decodeUlMsgSensorsReport) (const char ** ppInBuffer,
+                                                      uint32_t sizeInBuffer,
+                                                      CsSensorReadings_t * pReadings);
+        uint32_t (__cdecl *decodeSensorsReportBatch) (const char * pDatagrams,
+                                                      const uint32_t * pDatagramSizes,
+                                                      uint32_t numDatagrams,
+                                                      CsSensorReadings_t * pReadings,
+                                                      uint32_t * pDatagramIndexes,
+                                                      uint32_t maxReadings,
+                                                      uint32_t * pNumDatagramsDecoded);
+        bool (__cdecl *decodeUlMsgTrafficReportGetCnf) (const char ** ppInBuffer,
+                                                        uint32_t sizeInBuffer,
+                                                        uint32_t * pNumDatagramsSent,
+                                                        uint32_t * pNumBytesSent,
+                                                        uint32_t * pNumDatagramsReceived,
+                                                        uint32_t * pNumBytesReceived);
+        bool (__cdecl *decodeUlMsgTrafficReportInd) (const char ** ppInBuffer,
+                                                     uint32_t sizeInBuffer,
+                                                     uint32_t * pNumDatagramsSent,
+                                                     uint32_t * pNumBytesSent,
+                                                     uint32_t * pNumDatagramsReceived,
+                                                     uint32_t * pNumBytesReceived);
+        bool (__cdecl *decodeUlMsgDebugInd) (const char ** ppInBuffer,
+                                             uint32_t sizeInBuffer,
+                                             uint32_t * pSizeOfString,
+                                             char * pString);
+        void (__cdecl *initDll) (void (*guiPrintToConsole) (const char *));
+    } CodecApi_t;
+
     DLL uint32_t __cdecl maxDatagramSizeRaw (void);
     DLL uint32_t __cdecl maxDebugStringSize (void);
     DLL uint32_t __cdecl revisionLevel (void);
@@ -81,6 +211,41 @@ extern "C" {
                                                   uint32_t *pPowerStateChargeState,
                                                   uint32_t *pPowerStateBatteryMV,
                                                   uint32_t *pPowerStateEnergyUWH);
+    DLL uint32_t __cdecl decodeUlMsgSensorsReport (const char ** ppInBuffer,
+                                                   uint32_t sizeInBuffer,
+                                                   CsSensorReadings_t * pReadings);
+    /// Decode all of the sensor readings in a batch of datagrams, laid
+    // end to end in pDatagrams with their sizes in pDatagramSizes, in
+    // one call.  The readings go into pReadings and, if
+    // pDatagramIndexes is not NULL, the index of the datagram that
+    // each came from into pDatagramIndexes.  A datagram's readings
+    // are returned whole or not at all: decoding stops before a
+    // datagram whose readings won't all fit in what is left of
+    // pReadings, so that the caller can carry on from there in the
+    // next call.  A datagram with more readings than maxReadings, which
+    // would never fit, is instead consumed and reported as one entry
+    // with msgType DECODE_RESULT_OUTPUT_TOO_SHORT and no sensors
+    // present.  The rest of a datagram is skipped after a message
+    // that can't be decoded.
+    // \param pDatagrams           The datagrams, end to end.
+    // \param pDatagramSizes       The size of each datagram.
+    // \param numDatagrams         The number of datagrams.
+    // \param pReadings            Where to put the readings.
+    // \param pDatagramIndexes     Where to put the datagram index of
+    //                             each reading, may be NULL.
+    // \param maxReadings          The number of entries at pReadings
+    //                             (and pDatagramIndexes), at least 1.
+    // \param pNumDatagramsDecoded Where to put the number of datagrams
+    //                             consumed, may be NULL; the next call
+    //                             should start from that datagram.
+    // \return                     The number of entries in pReadings.
+    DLL uint32_t __cdecl decodeSensorsReportBatch (const char * pDatagrams,
+                                                   const uint32_t * pDatagramSizes,
+                                                   uint32_t numDatagrams,
+                                                   CsSensorReadings_t * pReadings,
+                                                   uint32_t * pDatagramIndexes,
+                                                   uint32_t maxReadings,
+                                                   uint32_t * pNumDatagramsDecoded);
     DLL bool __cdecl decodeUlMsgTrafficReportGetCnf (const char ** ppInBuffer,
                                                      uint32_t sizeInBuffer,
                                                      uint32_t * pNumDatagramsSent,
@@ -100,6 +265,13 @@ extern "C" {
 
     DLL void  initDll (void (*guiPrintToConsole) (const char *)); 
 
+    /// Get the whole of the API above as a table of function pointers.
+    // \param version  The CODEC_API_VERSION that the caller was built
+    //                 against.
+    // \return         The table, which may be of a later version, or
+    //                 NULL if this DLL is older than version.
+    DLL const CodecApi_t * __cdecl getCodecApi (uint32_t version);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,220 @@
+/* Teddy geofence engine definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_GEOFENCE_HPP
+#define TEDDY_GEOFENCE_HPP
+
+/**
+ * @file teddy_geofence.hpp
+ * This file defines a geofence engine: given a GPS position it finds
+ * the fences, circles (which also serve for "within so many metres
+ * of") and polygons, that contain it.
+ *
+ * Everything works in the units of GpsPosition_t, thousandths of a
+ * minute of arc, with integer arithmetic; positions are never turned
+ * into floating point.  A polygon is treated as flat in those units,
+ * which is fine for fences of a few tens of kilometres; fences must
+ * not cross the antimeridian.  A circle is tested against an ellipse
+ * in those units, the longitude being scaled by the cosine of the
+ * latitude of its centre.
+ *
+ * The fences are indexed by a uniform grid laid over the area that
+ * they cover, with cells a power of two in size so that finding the
+ * cell of a position is two subtractions, two shifts and a
+ * multiply.  Each cell lists the fences that reach it, each marked
+ * as either covering the whole cell, in which case a position in
+ * the cell is inside the fence without further ado, or only part
+ * of it, in which case the exact test is made; the cost of a check
+ * therefore depends on how many fence edges pass through the cell,
+ * not on how many fences there are.
+ *
+ * Fences are added and then build() makes the grid; once built the
+ * engine is only read and may be used from any number of threads.
+ * Adding more fences means calling build() again, which must not
+ * happen while checks are in progress.
+ */
+
+#include <stdint.h>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of GpsPosition_t units in a degree
+#define GEOFENCE_UNITS_PER_DEGREE 60000
+
+/// The maximum number of vertices of a polygon
+#define GEOFENCE_MAX_VERTICES 65536
+
+/// The maximum number of cells in the grid
+#define GEOFENCE_MAX_CELLS (1 << 22)
+
+/// The number of cells in the grid that build() aims for, per fence
+#define GEOFENCE_CELLS_PER_FENCE 16
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A position found to be inside a fence by checkBatch().
+typedef struct GeofenceHitTag_t
+{
+    uint32_t pointIndex;             //!< The index of the position.
+    uint32_t fenceId;                //!< The fence ID given when it was added.
+} GeofenceHit_t;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The geofence engine.
+class GeofenceEngine {
+public:
+
+    GeofenceEngine (void);
+    ~GeofenceEngine (void);
+
+    /// Add a circular fence.
+    // \param fenceId       An ID for the fence, returned by checks.
+    // \param latitude      The latitude of the centre, GpsPosition_t units.
+    // \param longitude     The longitude of the centre, GpsPosition_t units.
+    // \param radiusMetres  The radius in metres.
+    // \return              true if successful, otherwise false.
+    bool addCircle (uint32_t fenceId, int32_t latitude, int32_t longitude,
+                    uint32_t radiusMetres);
+
+    /// Add a polygonal fence; the last vertex joins back to the first.
+    // \param fenceId      An ID for the fence, returned by checks.
+    // \param pLatitudes   The latitudes of the vertices, GpsPosition_t units.
+    // \param pLongitudes  The longitudes of the vertices, GpsPosition_t units.
+    // \param numVertices  The number of vertices, at least three.
+    // \return             true if successful, otherwise false.
+    bool addPolygon (uint32_t fenceId, const int32_t * pLatitudes,
+                     const int32_t * pLongitudes, uint32_t numVertices);
+
+    /// Add the fences in a text file, one per line:
+    // "circle <id> <latitude> <longitude> <radius metres>" or
+    // "polygon <id> <latitude> <longitude> <latitude> <longitude> ...",
+    // positions being in GpsPosition_t units; blank lines and lines
+    // starting with # are ignored.
+    // \param pFileName  The file.
+    // \return           true if the whole file was added, otherwise
+    //                   false.
+    bool addFile (const char * pFileName);
+
+    /// Build the grid over the fences added so far.
+    // \return  true if successful, otherwise false.
+    bool build (void);
+
+    /// Find the fences that contain a position.
+    // \param latitude     The latitude, GpsPosition_t units.
+    // \param longitude    The longitude, GpsPosition_t units.
+    // \param pFenceIds    A place to put the IDs of the fences, may be
+    //                     NULL if maxFenceIds is zero.
+    // \param maxFenceIds  The room at pFenceIds.
+    // \return             The number of fences containing the
+    //                     position, which may be more than maxFenceIds.
+    uint32_t check (int32_t latitude, int32_t longitude,
+                    uint32_t * pFenceIds, uint32_t maxFenceIds);
+
+    /// Find the fences that contain each of a column of positions,
+    // e.g. a span of the gpsLatitude and gpsLongitude columns of a
+    // SensorSegment; the cells of a block of positions are worked out
+    // in one tight loop before any fences are tested.
+    // \param pLatitudes          The latitudes, GpsPosition_t units.
+    // \param pLongitudes         The longitudes, GpsPosition_t units.
+    // \param numPoints           The number of positions.
+    // \param pHits               A place to put the hits, in position
+    //                            order.
+    // \param maxHits             The room at pHits.
+    // \param pNumPointsChecked   A place to put the number of positions
+    //                            checked, less than numPoints if pHits
+    //                            filled up, in which case call again
+    //                            from there; may be NULL.
+    // \return                    The number of hits.
+    uint32_t checkBatch (const int32_t * pLatitudes, const int32_t * pLongitudes,
+                         uint32_t numPoints, GeofenceHit_t * pHits, uint32_t maxHits,
+                         uint32_t * pNumPointsChecked);
+
+    /// Get the number of fences.
+    // \return  The number of fences.
+    uint32_t getNumFences (void);
+
+    /// Get the size of the grid made by build().
+    // \param pNumCells    A place to put the number of cells, may be
+    //                     NULL.
+    // \param pNumEntries  A place to put the number of fence entries
+    //                     in all the cells, may be NULL.
+    // \param pCellSize    A place to put the size of a cell in
+    //                     GpsPosition_t units, may be NULL.
+    void getGridInfo (uint32_t * pNumCells, uint32_t * pNumEntries, uint32_t * pCellSize);
+
+private:
+    /// A fence.
+    typedef struct FenceTag_t
+    {
+        uint32_t fenceId;
+        bool isCircle;
+        int32_t minLatitude;                 //!< The bounding box.
+        int32_t maxLatitude;
+        int32_t minLongitude;
+        int32_t maxLongitude;
+        int32_t latitude;                    //!< Circle centre.
+        int32_t longitude;
+        uint32_t cosQ16;                     //!< Circle longitude scale, 1.0 = 65536.
+        uint64_t radiusSquared;              //!< Circle, in units squared.
+        uint32_t firstVertex;                //!< Polygon.
+        uint32_t numVertices;
+    } Fence_t;
+
+    /// How a fence covers a cell.
+    typedef enum
+    {
+        COVER_NONE,
+        COVER_PART,
+        COVER_ALL
+    } Cover_t;
+
+    /// Add a fence, growing the array if needed.
+    bool addFence (const Fence_t * pFence);
+    /// Test whether a fence contains a position exactly.
+    bool contains (const Fence_t * pFence, int32_t latitude, int32_t longitude);
+    /// Work out how a fence covers a cell.
+    Cover_t cover (const Fence_t * pFence, int32_t minLatitude, int32_t minLongitude,
+                   int32_t maxLatitude, int32_t maxLongitude);
+    /// Get the cell of a position, or -1 if it is outside the grid.
+    inline int64_t getCell (int32_t latitude, int32_t longitude);
+    /// Free the grid.
+    void freeGrid (void);
+
+    Fence_t * mp_fences;
+    uint32_t m_numFences;
+    uint32_t m_maxFences;
+    int32_t * mp_vertexLatitudes;
+    int32_t * mp_vertexLongitudes;
+    uint32_t m_numVertices;
+    uint32_t m_maxVertices;
+    // The grid, built by build()
+    bool m_built;
+    int32_t m_gridLatitude;                  //!< The south-west corner.
+    int32_t m_gridLongitude;
+    uint32_t m_cellShift;                    //!< log2 of the cell size.
+    uint32_t m_numRows;
+    uint32_t m_numColumns;
+    uint32_t * mp_cellStarts;                //!< numRows * numColumns + 1.
+    uint32_t * mp_entries;                   //!< Fence index, top bit if COVER_ALL.
+    uint32_t m_numEntries;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,209 @@
+/* Teddy hex log reader definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_HEX_LOG_HPP
+#define TEDDY_HEX_LOG_HPP
+
+/**
+ * @file teddy_hex_log.hpp
+ * This file defines a reader of logs of uplink datagrams written as
+ * hex text, e.g. modem or gateway logs, for reprocessing stored
+ * traffic through the codec.  Each line of a log is one datagram:
+ *
+ *   [anything else] <a.b.c.d:port> <hex>
+ *
+ * i.e. the last field is the datagram in hex, upper or lower case,
+ * and the field before it is the IPv4 address and UDP port that it
+ * came from, which give the device ID; anything before that, e.g. a
+ * timestamp, is ignored.  Fields are separated by any number of
+ * spaces, tabs, commas or double quotes, lines may end with CR LF
+ * and lines that are empty or start with '#' are skipped.  Any
+ * other line is counted as bad.
+ *
+ * Lines are found with memchr(), the hex field by searching back
+ * from the end of the line for a separator, and the hex is checked
+ * and converted to binary 32 (AVX2) or 16 (SSE4.1) characters at a
+ * time, whichever the CPU supports, with a scalar loop for the
+ * remainder and for other CPUs.  The datagrams are converted a batch
+ * at a time into slots like the receive slots of an IngestServer and
+ * the batch then decoded straight out of them, each datagram and
+ * each message decoded being passed to callbacks of the same form
+ * as those of an IngestServer, so that the same code can consume
+ * both; there is no downlink so dlSpace is always zero.
+ *
+ * A reader is not thread safe: to use more than one core, give each
+ * thread its own reader and its own logs, or its own part of one.
+ */
+
+#include <stdint.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ingest_server.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of datagrams converted from hex before they are decoded
+#define HEX_LOG_BATCH_SIZE INGEST_BATCH_SIZE
+
+/// The longest line, including any end of line, that can hold a
+// datagram; longer lines are counted as bad without being looked at
+#define HEX_LOG_MAX_LINE_SIZE 1024
+
+/// The size of the reads made by ingestFile()
+#define HEX_LOG_READ_SIZE (1024 * 1024)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The ways of converting hex to binary.
+typedef enum
+{
+    HEX_LOG_PATH_SCALAR,
+    HEX_LOG_PATH_SSE4,
+    HEX_LOG_PATH_AVX2,
+    MAX_NUM_HEX_LOG_PATHS
+} HexLogPath_t;
+
+/// The counters of a reader.
+typedef struct HexLogStatsTag_t
+{
+    uint64_t numChars;              //!< Of log text processed.
+    uint64_t numLines;
+    uint64_t numLinesSkipped;       //!< Empty lines and comments.
+    uint64_t numBadLines;           //!< Lines that are not a device and a datagram.
+    uint64_t numDatagrams;
+    uint64_t numBytes;              //!< Of the datagrams, i.e. binary.
+    uint64_t numMsgsDecoded;
+    uint64_t numDecodeFailures;     //!< Datagrams abandoned part way through.
+    uint64_t hexTimeUs;             //!< Total time spent splitting lines and converting hex.
+    uint64_t decodeTimeUs;          //!< Total time spent decoding.
+} HexLogStats_t;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+class HexLogReader {
+public:
+
+    HexLogReader (void);
+    ~HexLogReader (void);
+
+    /// Set up the reader, choosing the fastest hex conversion that
+    // the CPU supports.
+    // \param msgCallback       Called for each decoded message, may
+    //                          be NULL; pDlBuffer is NULL and dlSpace
+    //                          zero and the return value is ignored.
+    // \param datagramCallback  Called for each datagram, may be NULL;
+    //                          if it returns false the datagram is
+    //                          not decoded.
+    // \param pContext          Passed to the callbacks.
+    // \param index             Passed to the callbacks as the
+    //                          threadIndex, e.g. to tell readers apart.
+    // \return                  true if successful, otherwise false.
+    bool init (IngestMsgCallback_t msgCallback,
+               IngestDatagramCallback_t datagramCallback,
+               void * pContext,
+               uint32_t index);
+
+    /// Choose how hex is converted, e.g. to compare them.
+    // \param path  The path.
+    // \return      true if successful, false if the CPU does not
+    //              support the path.
+    bool setPath (HexLogPath_t path);
+
+    /// Get how hex is being converted.
+    // \return  The path.
+    HexLogPath_t getPath (void);
+
+    /// Get the fastest hex conversion that the CPU supports.
+    // \return  The path.
+    static HexLogPath_t getBestPath (void);
+
+    /// Get the name of a hex conversion path.
+    // \param path  The path.
+    // \return      The name, e.g. "AVX2".
+    static const char * getPathName (HexLogPath_t path);
+
+    /// Check and convert hex to binary.
+    // \param pHex     The hex, upper or lower case.
+    // \param size     The number of hex characters.
+    // \param pBinary  A place to put size / 2 bytes.
+    // \param path     The path to use, which the CPU must support.
+    // \return         The number of bytes, or -1 if size is odd or
+    //                 there is a character that is not hex, in which
+    //                 case pBinary may have been written to.
+    static int32_t hexToBinary (const char * pHex, uint32_t size, char * pBinary,
+                                HexLogPath_t path);
+
+    /// Process the lines of some log text; the callbacks have been
+    // made for all of the datagrams in it by the time this returns.
+    // \param pText  The text.
+    // \param size   The number of characters at pText.
+    // \param final  true if pText ends the log, in which case all of
+    //               it is processed, whether it ends with an end of
+    //               line or not.
+    // \return       The number of characters processed; unless final
+    //               is true any partial line at the end is left, to
+    //               be passed again at the start of the next call.
+    uint32_t ingest (const char * pText, uint32_t size, bool final);
+
+    /// Process a whole log file.
+    // \param pFileName  The file, "-" for stdin, e.g. the output of
+    //                   zcat.
+    // \return           true if the file was read to the end,
+    //                   otherwise false.
+    bool ingestFile (const char * pFileName);
+
+    /// Get a copy of the counters.
+    // \param pStats  A place to put the counters.
+    void getStats (HexLogStats_t * pStats);
+
+    /// Get the codec that the reader decodes with, e.g. for its
+    // metrics.
+    // \return  The codec.
+    MessageCodec * getCodec (void);
+
+private:
+    /// Process one line, without its end of line, adding any datagram
+    // to the batch and decoding the batch if that fills it.
+    void processLine (const char * pLine, const char * pEnd);
+    /// Decode the datagrams of the batch and empty it.
+    void decodeBatch (void);
+    /// Find the last separator between pStart and pEnd.
+    // \return  The separator or NULL if there is none.
+    static const char * findLastSeparator (const char * pStart, const char * pEnd,
+                                           HexLogPath_t path);
+    /// Parse an "a.b.c.d:port" field into a device ID.
+    // \return  The device ID or DEVICE_ID_INVALID if the field is not one.
+    static DeviceId_t parseDevice (const char * pStart, const char * pEnd);
+
+    IngestMsgCallback_t m_msgCallback;
+    IngestDatagramCallback_t m_datagramCallback;
+    void * mp_context;
+    uint32_t m_index;
+    HexLogPath_t m_path;
+    bool m_skipLine;                     //!< In the middle of a line too long to look at.
+    uint32_t m_batchSize;
+    HexLogStats_t m_stats;
+    MessageCodec m_codec;
+    DeviceId_t m_deviceIds[HEX_LOG_BATCH_SIZE];
+    uint32_t m_sizes[HEX_LOG_BATCH_SIZE];
+    char m_slots[HEX_LOG_BATCH_SIZE][INGEST_SLOT_SIZE];
+};
+
+#endif
+
+// End Of File
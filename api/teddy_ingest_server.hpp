@@ -0,0 +1,240 @@
+/* Teddy UDP ingest server definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_INGEST_SERVER_HPP
+#define TEDDY_INGEST_SERVER_HPP
+
+/**
+ * @file teddy_ingest_server.hpp
+ * This file defines a reference Linux UDP server that receives
+ * uplink datagrams from teddies and decodes them with the message
+ * codec.  Datagrams are received in batches with recvmmsg() and
+ * decoded straight out of the receive buffers; any downlink
+ * responses are gathered up and sent in one go with sendmmsg().
+ * There is one receive thread per core, each with its own socket
+ * bound to the same port with SO_REUSEPORT so that the kernel
+ * spreads devices across the cores.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of datagrams received (or sent) in one system call
+#define INGEST_BATCH_SIZE 64
+
+/// The default UDP port to listen on
+#define INGEST_DEFAULT_PORT 5065
+
+/// The maximum number of receive threads (i.e. cores) supported
+#define INGEST_MAX_THREADS 64
+
+/// The receive timeout, which sets how quickly a stop() is noticed
+#define INGEST_RECEIVE_TIMEOUT_MS 100
+
+/// The size of each receive slot; a whole raw datagram plus room
+// for a maximum-sized message so that a truncated message at the
+// end of a datagram can never cause a read off the end of the slot
+#define INGEST_SLOT_SIZE (MAX_DATAGRAM_SIZE_RAW + MAX_MESSAGE_SIZE)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Per-thread counters.  Each set is only written by its own receive
+// thread and lives in that thread's own cache-line-aligned block of
+// memory so that the threads don't fight over it.
+typedef struct IngestThreadStatsTag_t
+{
+    uint64_t numBatches;            //!< Calls to recvmmsg() that returned data.
+    uint64_t numDatagramsReceived;
+    uint64_t numBytesReceived;
+    uint64_t numTruncated;          //!< Datagrams longer than MAX_DATAGRAM_SIZE_RAW,
+                                    //! cut short by the kernel and dropped.
+    uint64_t numMsgsDecoded;
+    uint64_t numDecodeFailures;     //!< Datagrams abandoned part way through.
+    uint64_t numDatagramsSent;
+    uint64_t numSendFailures;
+    uint64_t decodeTimeUs;          //!< Total time spent decoding.
+} IngestThreadStats_t;
+
+/// Callback made for every datagram received, before any decoding.
+// If this returns false the datagram is not decoded by the server;
+// use this to hand datagrams off elsewhere (e.g. to a pipeline)
+// rather than decoding them on the receive thread.
+// \param pContext     The context pointer given to init().
+// \param threadIndex  The index of the receive thread.
+// \param deviceId     The device the datagram came from.
+// \param pDatagram    The datagram, valid only for the duration
+//                     of the callback.
+// \param size         The size of the datagram.
+// \return             true if the server should decode the
+//                     datagram, otherwise false.
+typedef bool (*IngestDatagramCallback_t) (void * pContext,
+                                          uint32_t threadIndex,
+                                          DeviceId_t deviceId,
+                                          const char * pDatagram,
+                                          uint32_t size);
+
+/// Callback made for every uplink message decoded.  Any downlink
+// messages to be sent back to the device may be encoded into
+// pDlBuffer; everything encoded in response to all of the messages
+// in one uplink datagram is sent back as a single downlink datagram.
+// \param pContext     The context pointer given to init().
+// \param threadIndex  The index of the receive thread.
+// \param deviceId     The device the message came from.
+// \param result       The decode result, always an uplink message.
+// \param pMsg         The decoded message.
+// \param pDlBuffer    A place to encode any downlink messages.
+// \param dlSpace      The space left at pDlBuffer, at least
+//                     MAX_MESSAGE_SIZE if a downlink may be added.
+// \param pCodec       The codec owned by this receive thread,
+//                     for encoding.
+// \return             The number of bytes encoded into pDlBuffer.
+typedef uint32_t (*IngestMsgCallback_t) (void * pContext,
+                                         uint32_t threadIndex,
+                                         DeviceId_t deviceId,
+                                         MessageCodec::DecodeResult_t result,
+                                         const UlMsgUnion_t * pMsg,
+                                         char * pDlBuffer,
+                                         uint32_t dlSpace,
+                                         MessageCodec * pCodec);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+class IngestServer {
+public:
+
+    IngestServer (void);
+    ~IngestServer (void);
+
+    /// Set up the server.  This creates the sockets, one per thread,
+    // all bound to the same port, but does not start receiving.
+    // \param port              The UDP port to listen on.
+    // \param numThreads        The number of receive threads, zero
+    //                          meaning one per online core.
+    // \param msgCallback       Called for each decoded message, may
+    //                          be NULL in which case the default
+    //                          responder is used (see
+    //                          defaultMsgCallback()).
+    // \param datagramCallback  Called for each raw datagram, may be
+    //                          NULL.
+    // \param pContext          Passed to the callbacks.
+    // \return                  true if successful, otherwise false.
+    bool init (uint16_t port,
+               uint32_t numThreads,
+               IngestMsgCallback_t msgCallback,
+               IngestDatagramCallback_t datagramCallback,
+               void * pContext);
+
+    /// Start the receive threads.
+    // \return  true if successful, otherwise false.
+    bool start (void);
+
+    /// Stop the receive threads and wait for them to exit.
+    void stop (void);
+
+    /// Get the number of receive threads.
+    // \return  The number of receive threads.
+    uint32_t getNumThreads (void);
+
+    /// Get a copy of the counters of one receive thread.  The
+    // copy is not atomic but each counter only ever increases.
+    // \param threadIndex  The index of the receive thread.
+    // \param pStats       A place to put the counters.
+    void getStats (uint32_t threadIndex, IngestThreadStats_t * pStats);
+
+#ifdef MESSAGE_CODEC_METRICS
+    /// Get the codec metrics of all the receive threads added
+    // together; only exact once the threads have stopped.
+    // \param pMetrics  A place to put the metrics.
+    void getCodecMetrics (MessageCodec::Metrics_t * pMetrics);
+#endif
+
+    /// Print the per-thread throughput since the last call.
+    // \param intervalUs  The time since the last call, in
+    //                    microseconds, used to work out rates.
+    void printThroughput (uint64_t intervalUs);
+
+    /// The default response policy: an InitInd is answered with an
+    // IntervalsGetReq (so that we learn the device's intervals) and a
+    // PollInd with a TrafficReportGetReq.  Has the same signature as
+    // IngestMsgCallback_t.
+    static uint32_t defaultMsgCallback (void * pContext,
+                                        uint32_t threadIndex,
+                                        DeviceId_t deviceId,
+                                        MessageCodec::DecodeResult_t result,
+                                        const UlMsgUnion_t * pMsg,
+                                        char * pDlBuffer,
+                                        uint32_t dlSpace,
+                                        MessageCodec * pCodec);
+
+private:
+    /// Everything a receive thread needs, allocated per thread
+    // so that nothing on the hot path is shared.
+    typedef struct ThreadTag_t
+    {
+        IngestServer * pServer;
+        uint32_t index;
+        int socket;
+        pthread_t thread;
+        bool threadRunning;
+        MessageCodec codec;
+        IngestThreadStats_t stats;
+        IngestThreadStats_t lastPrintedStats;
+        char rxSlots[INGEST_BATCH_SIZE][INGEST_SLOT_SIZE];
+        char txSlots[INGEST_BATCH_SIZE][MAX_DATAGRAM_SIZE_RAW];
+    } Thread_t;
+
+    /// The receive thread entry point.
+    // \param pParam  A pointer to the Thread_t.
+    static void * receiveThread (void * pParam);
+    /// Receive and process one batch of datagrams.
+    // \param pThread  The thread.
+    // \return         false if the socket has failed, otherwise true.
+    bool processBatch (Thread_t * pThread);
+    /// Decode all the messages in one datagram, building up any
+    // downlink response.
+    // \param pThread    The thread.
+    // \param deviceId   The device the datagram came from.
+    // \param pDatagram  The datagram.
+    // \param size       The size of the datagram.
+    // \param pDlBuffer  Where to encode any response.
+    // \return           The size of the response.
+    uint32_t decodeDatagram (Thread_t * pThread,
+                             DeviceId_t deviceId,
+                             const char * pDatagram,
+                             uint32_t size,
+                             char * pDlBuffer);
+    /// Open a socket bound to m_port with SO_REUSEPORT.
+    // \return  The socket or -1 on failure.
+    int openSocket (void);
+
+    uint16_t m_port;
+    uint32_t m_numThreads;
+    volatile bool m_stop;
+    IngestMsgCallback_t m_msgCallback;
+    IngestDatagramCallback_t m_datagramCallback;
+    void * mp_context;
+    Thread_t * mp_threads[INGEST_MAX_THREADS];
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,160 @@
+/* Teddy last-known-state cache definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_LAST_STATE_HPP
+#define TEDDY_LAST_STATE_HPP
+
+/**
+ * @file teddy_last_state.hpp
+ * This file defines an in-memory cache of the last known state of
+ * each device, so that "what is this teddy doing right now" can be
+ * answered without going to the SensorStore: the latest value of
+ * each sensor reading, with the time it was read, and the latest
+ * InitInd and interval settings.
+ *
+ * Readings may arrive out of order, so the value of each sensor only
+ * replaces the one held if it was read at the same time or later.
+ *
+ * The cache is sharded by device like the SensorStore and each shard
+ * must only be updated from one thread, e.g. a pipeline sink.  It may
+ * be read from any number of other threads at the same time without
+ * locks: each entry has a sequence number, a seqlock, that the writer
+ * makes odd while it changes the entry, and a reader copies the entry
+ * out and tries again if the sequence number was odd or changed
+ * while it did so.  Readers never write to shared memory so they
+ * don't slow the writer or each other.  Devices are never removed or
+ * moved, which is what lets a reader probe a table that is being
+ * added to: an entry is filled in before its device ID is published.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of shards
+#define LAST_STATE_MAX_SHARDS 64
+
+/// Bits in LastState_t.flags
+#define LAST_STATE_INIT_IND_SEEN           0x01
+#define LAST_STATE_REPORTING_INTERVAL_SEEN 0x02
+#define LAST_STATE_HEARTBEAT_SEEN          0x04
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The last known state of a device.
+typedef struct LastStateTag_t
+{
+    DeviceId_t deviceId;
+    PipelineReadings_t readings;            //!< The latest value of each sensor
+                                            //! in presentBitmap; readings.time is
+                                            //! the latest of sensorTimes[].
+    uint32_t sensorTimes[MAX_NUM_SENSORS];  //!< Device UTC seconds, by SENSOR_x.
+    uint32_t reportingIntervalMinutes;      //!< If LAST_STATE_REPORTING_INTERVAL_SEEN.
+    uint32_t heartbeatSeconds;              //!< If LAST_STATE_HEARTBEAT_SEEN.
+    uint32_t intervalsTime;                 //!< Server UTC seconds, last interval Cnf.
+    uint32_t initIndTime;                   //!< Server UTC seconds, last InitInd.
+    uint32_t lastSeenTime;                  //!< Server UTC seconds, any message.
+    uint16_t revisionLevel;                 //!< From the last InitInd.
+    uint8_t wakeUpCode;                     //!< From the last InitInd.
+    uint8_t presentBitmap;                  //!< The sensors ever reported, PIPELINE_PRESENT_x.
+    uint8_t flags;                          //!< LAST_STATE_x bits.
+} LastState_t;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The last-known-state cache.
+class LastStateCache {
+public:
+
+    LastStateCache (void);
+    ~LastStateCache (void);
+
+    /// Allocate the cache.  All the memory is allocated here, there
+    // is no resizing later.
+    // \param numShards   The number of shards.
+    // \param maxDevices  The maximum number of devices.
+    // \return            true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices);
+
+    /// Get the shard that a device is updated through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Update the state of a device from a pipeline record, adding
+    // the device if it is new.  Only one thread may update a given
+    // shard.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \param now         The server time in UTC seconds.
+    // \return            false if the device is new and there is no
+    //                    room for it, otherwise true.
+    bool updateFromRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord,
+                           uint32_t now);
+
+    /// Get a consistent copy of the state of a device; may be called
+    // from any thread at any time.
+    // \param deviceId  The device.
+    // \param pState    A place to put the state.
+    // \return          true if the device is known, otherwise false.
+    bool get (DeviceId_t deviceId, LastState_t * pState);
+
+    /// Get the number of devices in the cache and the number of
+    // updates made.
+    // \param pNumDevices  A place to put the number of devices, may
+    //                     be NULL.
+    // \param pNumUpdates  A place to put the number of updates, may
+    //                     be NULL.
+    void getStats (uint32_t * pNumDevices, uint64_t * pNumUpdates);
+
+private:
+    /// An entry: the state of a device and its seqlock.
+    typedef struct EntryTag_t
+    {
+        std::atomic<uint32_t> sequence;      //!< Odd while being written.
+        LastState_t state;
+    } Entry_t;
+
+    /// A shard: a table of the devices updated through it.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        std::atomic<DeviceId_t> * pDeviceIds; //!< DEVICE_ID_INVALID for empty slots.
+        Entry_t * pEntries;
+        uint64_t numUpdates;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, optionally adding it.
+    int64_t findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add);
+    /// Copy the value of one sensor from one set of readings to another.
+    static void copySensor (PipelineReadings_t * pTo, const PipelineReadings_t * pFrom,
+                            uint32_t sensor);
+
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -349,10 +349,17 @@ typedef struct TrafficReportGetCnfUlMsgTag_t
 } TrafficReportGetCnfUlMsg_t;
 
 /// DebugIndUlMsg_t.  A generic message containing a debug string.
+// When encoding the string is taken from string[].  When decoding
+// the string is not copied: pString points to it in the input
+// buffer, so is only valid for as long as that is, and string[] is
+// left alone.
 typedef struct DebugIndUlMsgTag_t
 {
     uint32_t sizeOfString;              //!< String size in bytes
-    char string[MAX_DEBUG_STRING_SIZE]; //!< The string (not NULL terminated).
+    char string[MAX_DEBUG_STRING_SIZE]; //!< Encode only: the string to encode (not NULL
+                                        //! terminated); decodeUlMsg() leaves it alone,
+                                        //! read pString instead.
+    const char * pString;               //!< Decode only: the decoded string (not NULL terminated).
 } DebugIndUlMsg_t;
 
 // ----------------------------------------------------------------
@@ -0,0 +1,404 @@
+/* Teddy staged ingest pipeline definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_PIPELINE_HPP
+#define TEDDY_PIPELINE_HPP
+
+/**
+ * @file teddy_pipeline.hpp
+ * This file defines a staged ingest pipeline around the message
+ * codec, so that a slow consumer of decoded messages never stalls
+ * reception:
+ *
+ * receive threads --MPSC--> decode workers --SPSC--> sinks
+ *
+ * - The receive stage is the receive threads of an IngestServer;
+ *   each datagram is copied into a pooled block and pushed onto the
+ *   ring of the decode worker that owns the device (devices are
+ *   sharded across workers by ID, so the messages of a device are
+ *   always decoded, and arrive at every sink, in order).
+ * - Each decode worker decodes its datagrams into compact pooled
+ *   PipelineRecord_ts and pushes a pointer to each onto an SPSC ring
+ *   per sink; the record is reference counted and goes back to the
+ *   pool when the last sink has finished with it.
+ * - Each sink (store, aggregates, alerts, ...) runs on its own thread
+ *   and is just a callback.
+ *
+ * Optionally, the string of each DebugInd is split into a template
+ * and numeric parameters and the template interned in a
+ * DebugTemplateTable shared by the decode workers, so that the
+ * record carries only the template ID and parameters.
+ *
+ * Optionally, each decode worker first checks the datagrams that
+ * start with a sensor or traffic report against a DedupFilter and
+ * drops those it has seen recently, i.e. retransmissions, before
+ * decoding them.  Other datagrams, a lone PollInd for instance, can
+ * legitimately be repeated byte for byte and are always decoded.
+ *
+ * If a sink falls behind its rings fill and the decode workers stall
+ * waiting for it; their rings then fill and the receive stage starts
+ * dropping datagrams.  Backpressure is signalled, with hysteresis,
+ * as each decode worker ring crosses its watermarks.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ring.hpp>
+#include <teddy_ingest_server.hpp>
+#include <teddy_dedup.hpp>
+#include <teddy_debug_template.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of decode workers
+#define PIPELINE_MAX_WORKERS 32
+
+/// The maximum number of sinks
+#define PIPELINE_MAX_SINKS 16
+
+/// The maximum length of a sink name, including terminator
+#define PIPELINE_MAX_SINK_NAME_LEN 16
+
+/// The number of buckets in a latency histogram; bucket n counts
+// latencies of less than 2^n microseconds (and at least 2^(n - 1))
+#define PIPELINE_NUM_LATENCY_BUCKETS 32
+
+/// Default sizes
+#define PIPELINE_DEFAULT_WORKER_RING_SIZE 4096
+#define PIPELINE_DEFAULT_SINK_RING_SIZE 4096
+#define PIPELINE_DEFAULT_NUM_DATAGRAMS 65536
+#define PIPELINE_DEFAULT_NUM_RECORDS 262144
+
+/// The fill levels of a decode worker ring, in eighths, at which
+// backpressure is switched on and off again
+#define PIPELINE_BACKPRESSURE_ON_EIGHTHS 7
+#define PIPELINE_BACKPRESSURE_OFF_EIGHTHS 4
+
+/// How long a stage sleeps when it has nothing to do
+#define PIPELINE_IDLE_SLEEP_US 50
+
+/// Bits of PipelineRecord_t.presentBitmap; these are the same as the
+// bits of the on-air itemsBitmap of a sensor report
+#define PIPELINE_PRESENT_GPS_POSITION (1 << SENSOR_GPS_POSITION)
+#define PIPELINE_PRESENT_LCL_POSITION (1 << SENSOR_LCL_POSITION)
+#define PIPELINE_PRESENT_SOUND_LEVEL  (1 << SENSOR_SOUND_LEVEL)
+#define PIPELINE_PRESENT_LUMINOSITY   (1 << SENSOR_LUMINOSITY)
+#define PIPELINE_PRESENT_TEMPERATURE  (1 << SENSOR_TEMPERATURE)
+#define PIPELINE_PRESENT_RSSI         (1 << SENSOR_RSSI)
+#define PIPELINE_PRESENT_POWER_STATE  (1 << SENSOR_POWER_STATE)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Sensor readings packed down to the width of the values actually
+// carried on the air; which are valid is given by presentBitmap in
+// the PipelineRecord_t.
+typedef struct PipelineReadingsTag_t
+{
+    uint32_t time;
+    int32_t gpsLatitude;
+    int32_t gpsLongitude;
+    int32_t gpsElevation;
+    int32_t gpsSpeed;
+    uint32_t energyUWH;
+    uint16_t soundLevel;
+    uint16_t luminosity;
+    uint16_t batteryMV;
+    uint8_t orientation;
+    uint8_t hugsThisPeriod;
+    uint8_t slapsThisPeriod;
+    uint8_t dropsThisPeriod;
+    uint8_t nudgesThisPeriod;
+    int8_t temperature;
+    uint8_t rssi;
+    uint8_t chargeState;
+} PipelineReadings_t;
+
+/// A decoded uplink message as it travels down the pipeline: one
+// cache line, allocated from a pool.
+typedef struct PipelineRecordTag_t
+{
+    DeviceId_t deviceId;
+    uint64_t receiveTimeUs;            //!< serverTimeUs() at reception.
+    std::atomic<uint8_t> refCount;     //!< Sinks yet to finish with it.
+    uint8_t msgType;                   //!< A MessageCodec::DecodeResult_t.
+    uint8_t presentBitmap;             //!< For sensor reports, see PIPELINE_PRESENT_x.
+    uint8_t workerIndex;               //!< The decode worker (i.e. shard).
+    union
+    {
+        struct
+        {
+            uint8_t wakeUpCode;
+            uint16_t revisionLevel;
+        } initInd;
+        struct
+        {
+            uint32_t reportingIntervalMinutes; //!< Zero if not carried.
+            uint32_t heartbeatSeconds;         //!< Zero if not carried.
+        } intervals;                           //!< For all three interval Cnfs.
+        PipelineReadings_t readings;           //!< For SensorsReportInd/GetCnf.
+        TrafficReportIndUlMsg_t traffic;       //!< For TrafficReportInd/GetCnf.
+        struct
+        {
+            uint32_t templateId;               //!< DEBUG_TEMPLATE_ID_NONE if not interned.
+            uint8_t numParams;                 //!< If interned.
+            uint8_t sizeOfString;              //!< If not interned.
+            union
+            {
+                uint32_t params[DEBUG_TEMPLATE_MAX_PARAMS];
+                char string[MAX_DEBUG_STRING_SIZE];
+            };
+        } debugInd;                            //!< See IngestPipeline::enableDebugTemplates().
+    } u;
+} PipelineRecord_t;
+
+/// A sink callback, called on the sink's own thread for each record
+// in the order that the records for any one device were received.
+// The record must not be kept after the callback returns.
+// \param pContext  The context pointer given to addSink().
+// \param pRecord   The record.
+typedef void (*PipelineSinkCallback_t) (void * pContext,
+                                        const PipelineRecord_t * pRecord);
+
+/// Called when backpressure on a decode worker switches on or off.
+// Called from a receive thread so must be quick.
+// \param pContext     The context pointer given to init().
+// \param workerIndex  The decode worker.
+// \param on           true if backpressure has just come on.
+typedef void (*PipelineBackpressureCallback_t) (void * pContext,
+                                                uint32_t workerIndex,
+                                                bool on);
+
+/// The counters for a stage (or for one thread of a stage).
+typedef struct PipelineStageStatsTag_t
+{
+    uint64_t numIn;                  //!< Items arriving at the stage.
+    uint64_t numOut;                 //!< Items passed on (or consumed, for a sink).
+    uint64_t numDropped;             //!< Items thrown away, e.g. a full ring.
+    uint64_t numStalls;              //!< Times a push had to wait for space.
+    uint64_t numBackpressureOn;      //!< Times backpressure switched on.
+    uint32_t queueDepth;             //!< Current depth of the input ring(s).
+    uint32_t maxQueueDepth;          //!< Deepest the input ring(s) have been.
+    uint64_t latencyTotalUs;         //!< Sum of reception-to-done times.
+    uint64_t latencyMaxUs;
+    uint64_t latencyBuckets[PIPELINE_NUM_LATENCY_BUCKETS];
+} PipelineStageStats_t;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+class IngestPipeline {
+public:
+
+    IngestPipeline (void);
+    ~IngestPipeline (void);
+
+    /// Set up the pipeline, including the IngestServer used as the
+    // receive stage.
+    // \param port                  The UDP port to listen on.
+    // \param numReceiveThreads     The number of receive threads,
+    //                              zero for one per core.
+    // \param numWorkers            The number of decode workers.
+    // \param backpressureCallback  May be NULL.
+    // \param pContext              Passed to backpressureCallback.
+    // \return                      true if successful, otherwise false.
+    bool init (uint16_t port,
+               uint32_t numReceiveThreads,
+               uint32_t numWorkers,
+               PipelineBackpressureCallback_t backpressureCallback,
+               void * pContext);
+
+    /// Add a sink; must be called after init() and before start().
+    // \param pName         A name for the sink, used when printing.
+    // \param callback      Called for each record.
+    // \param pContext      Passed to the callback.
+    // \param ringCapacity  The capacity of the ring from each decode
+    //                      worker to this sink, zero for the default.
+    // \return              The index of the sink or -1 on failure.
+    int32_t addSink (const char * pName,
+                     PipelineSinkCallback_t callback,
+                     void * pContext,
+                     uint32_t ringCapacity);
+
+    /// Drop duplicate sensor and traffic report datagrams before they
+    // are decoded; must be called after init() and before start().
+    // \param memoryBytes    The memory for the DedupFilter, zero for
+    //                       DEDUP_DEFAULT_MEMORY_BYTES.
+    // \param windowSeconds  The length of a DedupFilter generation,
+    //                       zero for DEDUP_DEFAULT_WINDOW_SECONDS.
+    // \return               true if successful, otherwise false.
+    bool enableDedup (uint32_t memoryBytes, uint32_t windowSeconds);
+
+    /// Carry DebugInd strings as a template ID and parameters rather
+    // than as strings; must be called after init() and before start().
+    // \param maxTemplates  The maximum number of templates, zero for
+    //                      DEBUG_TEMPLATE_DEFAULT_MAX_TEMPLATES; once
+    //                      there are that many, strings with new
+    //                      templates are carried as strings.
+    // \return              true if successful, otherwise false.
+    bool enableDebugTemplates (uint32_t maxTemplates);
+
+    /// Get the table of DebugInd templates, e.g. for a sink to turn a
+    // record back into a string with DebugTemplateTable::format().
+    // \return  The table, NULL if enableDebugTemplates() has not been
+    //          called.
+    DebugTemplateTable * getDebugTemplates (void);
+
+    /// Start all the stages.
+    // \return  true if successful, otherwise false.
+    bool start (void);
+
+    /// Stop all the stages, draining what is already in the rings.
+    void stop (void);
+
+    /// Find out whether any decode worker is under backpressure.
+    // \return  true if backpressure is on anywhere.
+    bool isBackpressured (void);
+
+    /// Get the counters for the receive stage (just the hand-off to
+    // the decode workers, the socket counters are in the IngestServer).
+    // \param pStats  A place to put the counters.
+    void getReceiveStats (PipelineStageStats_t * pStats);
+
+    /// Get the counters for the decode stage, summed over workers.
+    // \param pStats  A place to put the counters.
+    void getDecodeStats (PipelineStageStats_t * pStats);
+
+    /// Get the counters for a sink.
+    // \param sinkIndex  The index returned by addSink().
+    // \param pStats     A place to put the counters.
+    void getSinkStats (uint32_t sinkIndex, PipelineStageStats_t * pStats);
+
+    /// Get the counters of the duplicate filter, all zero if it
+    // isn't enabled.
+    // \param pNumChecked     A place to put the number of datagrams
+    //                        checked, may be NULL.
+    // \param pNumDuplicates  A place to put the number dropped as
+    //                        duplicates, may be NULL.
+    void getDedupStats (uint64_t * pNumChecked, uint64_t * pNumDuplicates);
+
+#ifdef MESSAGE_CODEC_METRICS
+    /// Get the codec metrics of all the decode workers added together;
+    // only exact once the pipeline has stopped.
+    // \param pMetrics  A place to put the metrics.
+    void getCodecMetrics (MessageCodec::Metrics_t * pMetrics);
+#endif
+
+    /// Print the counters of all the stages.
+    void printStats (void);
+
+    /// Get the IngestServer that forms the receive stage.
+    // \return  The IngestServer.
+    IngestServer * getIngestServer (void);
+
+    /// Convert a record of a sensor report back into the full
+    // SensorReadings_t form.
+    // \param pRecord    The record.
+    // \param pReadings  A place to put the readings.
+    static void recordToSensorReadings (const PipelineRecord_t * pRecord,
+                                        SensorReadings_t * pReadings);
+
+private:
+    /// A datagram waiting for a decode worker
+    typedef struct DatagramTag_t
+    {
+        DeviceId_t deviceId;
+        uint64_t receiveTimeUs;
+        uint32_t size;
+        char data[INGEST_SLOT_SIZE];
+    } Datagram_t;
+
+    /// A decode worker
+    typedef struct WorkerTag_t
+    {
+        IngestPipeline * pPipeline;
+        uint32_t index;
+        pthread_t thread;
+        bool threadRunning;
+        MessageCodec codec;
+        MpmcRing inRing;                      //!< From all the receive threads.
+        SpscRing * pOutRings[PIPELINE_MAX_SINKS];
+        std::atomic<bool> backpressure;
+        PipelineStageStats_t stats;
+    } Worker_t;
+
+    /// A sink
+    typedef struct SinkTag_t
+    {
+        IngestPipeline * pPipeline;
+        uint32_t index;
+        char name[PIPELINE_MAX_SINK_NAME_LEN];
+        PipelineSinkCallback_t callback;
+        void * pContext;
+        pthread_t thread;
+        bool threadRunning;
+        PipelineStageStats_t stats;
+    } Sink_t;
+
+    /// The IngestDatagramCallback_t of the receive stage.
+    static bool receiveCallback (void * pContext,
+                                 uint32_t threadIndex,
+                                 DeviceId_t deviceId,
+                                 const char * pDatagram,
+                                 uint32_t size);
+    /// The decode worker thread.
+    static void * workerThread (void * pParam);
+    /// The sink thread.
+    static void * sinkThread (void * pParam);
+    /// Check whether a datagram is a duplicate that should be dropped.
+    bool isDuplicate (Worker_t * pWorker, const Datagram_t * pDatagram);
+    /// Decode a datagram into records and pass them to the sinks.
+    void decodeDatagram (Worker_t * pWorker, Datagram_t * pDatagram);
+    /// Fill in a record from a decoded message.
+    // \return  false if the message is not one that is passed on.
+    bool fillRecord (PipelineRecord_t * pRecord,
+                     MessageCodec::DecodeResult_t result,
+                     const UlMsgUnion_t * pMsg);
+    /// Hand a record to every sink, waiting for space if necessary.
+    void publishRecord (Worker_t * pWorker, PipelineRecord_t * pRecord);
+    /// Drop a sink's reference to a record.
+    void releaseRecord (PipelineRecord_t * pRecord);
+    /// Add a latency to a stage's counters.
+    static void addLatency (PipelineStageStats_t * pStats, uint64_t latencyUs);
+    /// Add one set of counters to another.
+    static void addStats (PipelineStageStats_t * pTotal, const PipelineStageStats_t * pStats);
+    /// Print one set of counters.
+    static void printStageStats (const char * pName, const PipelineStageStats_t * pStats);
+
+    IngestServer m_ingestServer;
+    BlockPool m_datagramPool;
+    BlockPool m_recordPool;
+    DedupFilter m_dedup;
+    bool m_dedupEnabled;
+    DebugTemplateTable m_debugTemplates;
+    bool m_debugTemplatesEnabled;
+    uint32_t m_numWorkers;
+    uint32_t m_numSinks;
+    volatile bool m_stopWorkers;
+    volatile bool m_stopSinks;
+    PipelineBackpressureCallback_t m_backpressureCallback;
+    void * mp_context;
+    PipelineStageStats_t * mp_receiveStats; //!< One per receive thread.
+    Worker_t * mp_workers[PIPELINE_MAX_WORKERS];
+    Sink_t * mp_sinks[PIPELINE_MAX_SINKS];
+};
+
+#endif
+
+// End Of File
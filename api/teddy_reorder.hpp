@@ -0,0 +1,192 @@
+/* Teddy per-device reorder buffer definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_REORDER_HPP
+#define TEDDY_REORDER_HPP
+
+/**
+ * @file teddy_reorder.hpp
+ * This file defines a bounded, per-device reorder stage that turns
+ * sensor readings arriving out of time order (queued reports sent
+ * after a PollInd, cellular retries) into a time-ordered stream per
+ * device.
+ *
+ * Each device has a binary min-heap of up to a fixed number of
+ * readings, keyed on time, and a watermark: the latest reading time
+ * seen from it less a configured delay.  Readings at or below the
+ * watermark are released, in time order, through a callback.  If the
+ * heap is full the earliest reading is released early, so memory per
+ * device is constant and each reading costs O(log depth).  A reading
+ * earlier than one already released for the same device can't be put
+ * in order, so it is counted and dropped.
+ *
+ * The watermark of a device only moves when it sends, so readings
+ * held for a device that has gone quiet are released by
+ * releaseIdle(), which should be called every so often.
+ *
+ * The stage is sharded by device like the SensorStore: each shard
+ * must only be fed from one thread, e.g. a pipeline sink, the
+ * callback being made on that thread, and nothing is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The default number of readings held per device
+#define REORDER_DEFAULT_DEPTH 16
+
+/// The maximum number of readings held per device
+#define REORDER_MAX_DEPTH 1024
+
+/// The default delay, in seconds, between the latest reading time of
+// a device and its watermark
+#define REORDER_DEFAULT_DELAY_SECONDS 60
+
+/// The maximum number of shards
+#define REORDER_MAX_SHARDS 64
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Called with each reading as it is released, in time order for
+// the device.
+// \param pContext       The context pointer given to init().
+// \param deviceId       The device.
+// \param pReadings      The readings.
+// \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+typedef void (*ReorderCallback_t) (void * pContext,
+                                   DeviceId_t deviceId,
+                                   const PipelineReadings_t * pReadings,
+                                   uint8_t presentBitmap);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The reorder stage.
+class ReorderBuffer {
+public:
+
+    ReorderBuffer (void);
+    ~ReorderBuffer (void);
+
+    /// Set up the reorder stage.
+    // \param numShards     The number of shards.
+    // \param maxDevices    The maximum number of devices.
+    // \param depth         The readings held per device, zero for
+    //                      the default; at most REORDER_MAX_DEPTH.
+    // \param delaySeconds  How far the watermark of a device trails
+    //                      its latest reading time.
+    // \param callback      Called with released readings.
+    // \param pContext      Passed to callback.
+    // \return              true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices, uint32_t depth,
+               uint32_t delaySeconds, ReorderCallback_t callback,
+               void * pContext);
+
+    /// Get the shard that a device is fed through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Add a reading, releasing whatever it makes ready.  Only one
+    // thread may add to a given shard.
+    // \param shardIndex     The shard, from getShardIndex().
+    // \param deviceId       The device.
+    // \param pReadings      The readings.
+    // \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+    // \return               true if the reading was taken, false if
+    //                       it was too late or there was no room for
+    //                       the device.
+    bool add (uint32_t shardIndex, DeviceId_t deviceId,
+              const PipelineReadings_t * pReadings, uint8_t presentBitmap);
+
+    /// As add() but from a pipeline record; records that are not
+    // sensor reports are ignored.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \return            true if the reading was taken, otherwise false.
+    bool addRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord);
+
+    /// Release, in order, everything held for the devices of a shard
+    // that haven't had a reading added for a while, from the thread
+    // that adds to it.
+    // \param shardIndex  The shard.
+    // \param nowUs       The time now, serverTimeUs().
+    // \param idleUs      How long a device must have been quiet; zero
+    //                    releases everything, e.g. at shutdown.
+    // \return            The number of readings released.
+    uint32_t releaseIdle (uint32_t shardIndex, uint64_t nowUs, uint64_t idleUs);
+
+    /// Get the number of readings added, dropped for being too late
+    // and released early because a heap was full.
+    // \param pNumAdded   A place to put the number added, may be NULL.
+    // \param pNumLate    A place to put the number dropped, may be NULL.
+    // \param pNumForced  A place to put the number released early,
+    //                    may be NULL.
+    void getStats (uint64_t * pNumAdded, uint64_t * pNumLate, uint64_t * pNumForced);
+
+private:
+    /// A held reading.
+    typedef struct EntryTag_t
+    {
+        PipelineReadings_t readings;
+        uint8_t presentBitmap;
+    } Entry_t;
+
+    /// The state of a device.
+    typedef struct DeviceTag_t
+    {
+        Entry_t * pHeap;                     //!< depth entries, a min-heap on time.
+        uint64_t lastAddTimeUs;
+        uint32_t numHeld;
+        uint32_t latestTime;                 //!< The latest reading time seen.
+        uint32_t releasedTime;               //!< The time of the last reading released.
+        bool released;                       //!< true once anything has been released.
+    } Device_t;
+
+    /// A shard: a table of the devices fed through it.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        Device_t * pDevices;
+        uint64_t numAdded;
+        uint64_t numLate;
+        uint64_t numForced;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, creating it if needed.
+    int64_t getSlot (Shard_t * pShard, DeviceId_t deviceId);
+    /// Remove the earliest reading of a device and release it.
+    void releaseTop (DeviceId_t deviceId, Device_t * pDevice);
+
+    uint32_t m_depth;
+    uint32_t m_delaySeconds;
+    ReorderCallback_t m_callback;
+    void * mp_callbackContext;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
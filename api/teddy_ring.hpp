@@ -0,0 +1,163 @@
+/* Teddy server-side lock-free rings definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_RING_HPP
+#define TEDDY_RING_HPP
+
+/**
+ * @file teddy_ring.hpp
+ * This file defines the bounded lock-free rings used to pass
+ * pointers between server threads, plus a fixed-block pool built
+ * on top of them.  All of them are allocated once, up front, and
+ * never grow: a push into a full ring fails and it is up to the
+ * caller to decide whether to retry or to drop.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <teddy_server.hpp>
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// A single-producer single-consumer ring of pointers.  Each side
+// keeps a cached copy of the other side's index so that the shared
+// cache lines are only touched when the ring looks full/empty.
+class SpscRing {
+public:
+
+    SpscRing (void);
+    ~SpscRing (void);
+
+    /// Allocate the ring.
+    // \param capacity  The number of entries, rounded up to a
+    //                  power of two.
+    // \return          true if successful, otherwise false.
+    bool init (uint32_t capacity);
+
+    /// Push an entry; call only from the producer thread.
+    // \param pItem  The entry, must not be NULL.
+    // \return       true if successful, false if the ring is full.
+    bool push (void * pItem);
+
+    /// Pop an entry; call only from the consumer thread.
+    // \return  The entry or NULL if the ring is empty.
+    void * pop (void);
+
+    /// Get the number of entries in the ring; approximate if
+    // called from other than the producer or consumer thread.
+    // \return  The number of entries.
+    uint32_t getDepth (void);
+
+    /// Get the capacity of the ring.
+    // \return  The capacity.
+    uint32_t getCapacity (void);
+
+private:
+    void ** mp_slots;
+    uint32_t m_mask;
+    char m_pad0[SERVER_CACHE_LINE_SIZE];
+    std::atomic<uint32_t> m_head;   //!< Written by the consumer.
+    uint32_t m_cachedTail;          //!< Consumer's copy of m_tail.
+    char m_pad1[SERVER_CACHE_LINE_SIZE];
+    std::atomic<uint32_t> m_tail;   //!< Written by the producer.
+    uint32_t m_cachedHead;          //!< Producer's copy of m_head.
+    char m_pad2[SERVER_CACHE_LINE_SIZE];
+};
+
+/// A multi-producer multi-consumer ring of pointers, after Dmitry
+// Vyukov's bounded queue: each slot carries a sequence number so
+// that producers and consumers only ever contend on the one index
+// that they advance with a compare-and-swap.  Used where there is
+// more than one producer (e.g. all receive threads feeding one
+// decode worker) and as the free list of BlockPool.
+class MpmcRing {
+public:
+
+    MpmcRing (void);
+    ~MpmcRing (void);
+
+    /// Allocate the ring.
+    // \param capacity  The number of entries, rounded up to a
+    //                  power of two.
+    // \return          true if successful, otherwise false.
+    bool init (uint32_t capacity);
+
+    /// Push an entry.
+    // \param pItem  The entry, must not be NULL.
+    // \return       true if successful, false if the ring is full.
+    bool push (void * pItem);
+
+    /// Pop an entry.
+    // \return  The entry or NULL if the ring is empty.
+    void * pop (void);
+
+    /// Get the (approximate) number of entries in the ring.
+    // \return  The number of entries.
+    uint32_t getDepth (void);
+
+    /// Get the capacity of the ring.
+    // \return  The capacity.
+    uint32_t getCapacity (void);
+
+private:
+    typedef struct SlotTag_t
+    {
+        std::atomic<uint64_t> sequence;
+        void * pItem;
+    } Slot_t;
+
+    Slot_t * mp_slots;
+    uint64_t m_mask;
+    char m_pad0[SERVER_CACHE_LINE_SIZE];
+    std::atomic<uint64_t> m_enqueuePos;
+    char m_pad1[SERVER_CACHE_LINE_SIZE];
+    std::atomic<uint64_t> m_dequeuePos;
+    char m_pad2[SERVER_CACHE_LINE_SIZE];
+};
+
+/// A pool of fixed-size, cache-line-aligned blocks that may be
+// allocated and freed from any thread without locking.
+class BlockPool {
+public:
+
+    BlockPool (void);
+    ~BlockPool (void);
+
+    /// Allocate the pool.
+    // \param blockSize  The size of each block, rounded up to a
+    //                   multiple of the cache line size.
+    // \param numBlocks  The number of blocks.
+    // \return           true if successful, otherwise false.
+    bool init (uint32_t blockSize, uint32_t numBlocks);
+
+    /// Take a block from the pool.
+    // \return  The block or NULL if the pool is exhausted.
+    void * alloc (void);
+
+    /// Return a block to the pool.
+    // \param pBlock  A block previously returned by alloc().
+    void free (void * pBlock);
+
+    /// Get the (approximate) number of free blocks.
+    // \return  The number of free blocks.
+    uint32_t getNumFree (void);
+
+private:
+    char * mp_memory;
+    MpmcRing m_freeList;
+};
+
+#endif
+
+// End Of File
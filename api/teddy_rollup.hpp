@@ -0,0 +1,264 @@
+/* Teddy sensor readings rollup definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_ROLLUP_HPP
+#define TEDDY_ROLLUP_HPP
+
+/**
+ * @file teddy_rollup.hpp
+ * This file defines an incremental rollup engine for sensor
+ * readings and the store that its output goes to.
+ *
+ * Each reading is added, as it is decoded, to a per-device tumbling
+ * window at each of a number of resolutions (minute, hour, day),
+ * chosen by the time of the reading.  A RollupRow_t keeps what the
+ * dashboards show: the count and sum (hence the average), minimum and
+ * maximum of temperature, the maximum sound level, the total hugs,
+ * slaps, drops and nudges, the minimum battery voltage and the total
+ * energy; only readings that are present count.
+ *
+ * Readings may arrive late or out of order.  Each device has a
+ * watermark, the latest reading time seen from it, and a window is
+ * only closed once the watermark has passed its end by the lateness
+ * allowed.  A reading for a window that has already closed is counted
+ * and dropped.  Closed windows are queued and appended, on flush(),
+ * to one file per device per resolution, in the directory given,
+ * named <resolution>/<xx>/<deviceId>.rol with <xx> as for the
+ * SensorStore.  These files are nothing but RollupRow_t, 48 bytes
+ * a window.
+ *
+ * A window may be written more than once: flush() can be asked to
+ * close windows early, e.g. at shutdown, and a reading for that
+ * window arriving afterwards opens it again.  rollupRead() merges
+ * rows for the same window, which is always possible since every
+ * aggregate is a sum, a minimum or a maximum.
+ *
+ * The engine is sharded by device like the SensorStore: each shard
+ * must only be fed from one thread, e.g. a pipeline sink, and nothing
+ * is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_sensor_store.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum lateness that can be allowed, in seconds
+#define ROLLUP_MAX_LATENESS_SECONDS 3600
+
+/// The default lateness allowed, in seconds
+#define ROLLUP_DEFAULT_LATENESS_SECONDS 120
+
+/// The maximum number of shards
+#define ROLLUP_MAX_SHARDS 64
+
+/// The value of RollupRow_t.batteryMVMin when no battery voltage
+// was present
+#define ROLLUP_NO_BATTERY_MV 0xFFFF
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The resolutions of the rollups.
+typedef enum
+{
+    ROLLUP_RESOLUTION_MINUTE,
+    ROLLUP_RESOLUTION_HOUR,
+    ROLLUP_RESOLUTION_DAY,
+    MAX_NUM_ROLLUP_RESOLUTIONS
+} RollupResolution_t;
+
+/// The aggregates of one window of one device.
+typedef struct RollupRowTag_t
+{
+    uint32_t windowStart;              //!< Device UTC seconds.
+    uint32_t numReadings;              //!< Sensor reports in the window.
+    int32_t temperatureSum;
+    uint32_t numTemperatures;          //!< Readings with a temperature.
+    uint64_t energyUWH;                //!< Total.
+    uint32_t hugs;                     //!< Total.
+    uint32_t slaps;                    //!< Total.
+    uint32_t drops;                    //!< Total.
+    uint32_t nudges;                   //!< Total.
+    uint16_t soundLevelMax;
+    uint16_t batteryMVMin;             //!< ROLLUP_NO_BATTERY_MV if none.
+    int8_t temperatureMin;             //!< Only valid if numTemperatures > 0.
+    int8_t temperatureMax;             //!< Only valid if numTemperatures > 0.
+    uint8_t presenceUnion;             //!< The OR of the PIPELINE_PRESENT_x bits.
+    uint8_t pad;
+} RollupRow_t;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Get the length of the windows of a resolution.
+// \param resolution  The resolution.
+// \return            The window length in seconds.
+uint32_t rollupResolutionSeconds (RollupResolution_t resolution);
+
+/// Form the path of the rollup file of a device.
+// \param pDirectory  The rollup directory.
+// \param resolution  The resolution.
+// \param deviceId    The device.
+// \param pPath       A place to put the path, at least
+//                    SENSOR_STORE_MAX_PATH_LEN long.
+// \return            true if the path fitted, otherwise false.
+bool rollupPath (const char * pDirectory, RollupResolution_t resolution,
+                 DeviceId_t deviceId, char * pPath);
+
+/// Merge one row for a window into another for the same window.
+// \param pInto  The row to merge into.
+// \param pFrom  The row to merge.
+void rollupMerge (RollupRow_t * pInto, const RollupRow_t * pFrom);
+
+/// Read the rollups of a device for a time range, in window order,
+// with any rows for the same window merged.
+// \param pDirectory  The rollup directory.
+// \param resolution  The resolution.
+// \param deviceId    The device.
+// \param startTime   The first time to include.
+// \param endTime     The first time not to include.
+// \param ppRows      A place to put a pointer to the rows, which the
+//                    caller must free(); set to NULL if there are
+//                    none.
+// \return            The number of rows.
+uint32_t rollupRead (const char * pDirectory, RollupResolution_t resolution,
+                     DeviceId_t deviceId, uint32_t startTime, uint32_t endTime,
+                     RollupRow_t ** ppRows);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The rollup engine.
+class RollupEngine {
+public:
+
+    RollupEngine (void);
+    ~RollupEngine (void);
+
+    /// Set up the engine, creating the directory structure if needed.
+    // \param pDirectory       The rollup directory.
+    // \param numShards        The number of shards.
+    // \param maxDevices       The maximum number of devices.
+    // \param latenessSeconds  How late a reading may be, relative to
+    //                         the latest from the same device, and
+    //                         still count; at most
+    //                         ROLLUP_MAX_LATENESS_SECONDS.
+    // \return                 true if successful, otherwise false.
+    bool init (const char * pDirectory, uint32_t numShards,
+               uint32_t maxDevices, uint32_t latenessSeconds);
+
+    /// Get the shard that a device is fed through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Add a reading.  Only one thread may add to a given shard.
+    // \param shardIndex     The shard, from getShardIndex().
+    // \param deviceId       The device.
+    // \param pReadings      The readings.
+    // \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+    // \return               true if the reading counted, false if it
+    //                       was too late or there was no room for the
+    //                       device.
+    bool add (uint32_t shardIndex, DeviceId_t deviceId,
+              const PipelineReadings_t * pReadings, uint8_t presentBitmap);
+
+    /// As add() but from a pipeline record; records that are not
+    // sensor reports are ignored.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \return            true if the reading counted, otherwise false.
+    bool addRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord);
+
+    /// Write out the closed windows of a shard, from the thread that
+    // adds to it.
+    // \param shardIndex  The shard.
+    // \param closeAll    true to close and write out the open windows
+    //                    too, e.g. at shutdown.
+    // \return            true if successful, otherwise false.
+    bool flush (uint32_t shardIndex, bool closeAll);
+
+    /// Get the rollup directory.
+    // \return  The directory.
+    const char * getDirectory (void);
+
+    /// Get the number of readings added, readings dropped for being
+    // too late and rows written.
+    // \param pNumReadings     A place to put the number of readings
+    //                         added, may be NULL.
+    // \param pNumLate         A place to put the number dropped for
+    //                         being too late for all resolutions, may
+    //                         be NULL.
+    // \param pNumRowsWritten  A place to put the number of rows
+    //                         written, may be NULL.
+    void getStats (uint64_t * pNumReadings, uint64_t * pNumLate,
+                   uint64_t * pNumRowsWritten);
+
+private:
+    /// A closed window waiting to be written.
+    typedef struct PendingTag_t
+    {
+        DeviceId_t deviceId;
+        uint32_t resolution;
+        uint32_t sequence;                   //!< For a stable sort.
+        RollupRow_t row;
+    } Pending_t;
+
+    /// A shard: a table of the devices fed through it, each with its
+    // watermark and open windows.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        uint32_t * pWatermarks;
+        RollupRow_t ** ppWindows;            //!< The window rings of each device.
+        Pending_t * pPending;
+        uint32_t numPending;
+        uint32_t maxPending;
+        uint64_t numReadings;
+        uint64_t numLate;
+        uint64_t numRowsWritten;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, creating it if needed.
+    int64_t getSlot (Shard_t * pShard, DeviceId_t deviceId);
+    /// Queue a window to be written and mark it empty.
+    bool closeWindow (Shard_t * pShard, DeviceId_t deviceId, uint32_t resolution,
+                      RollupRow_t * pWindow);
+    /// Order pending windows for writing, for qsort().
+    static int comparePending (const void * pA, const void * pB);
+    /// Write out the queued windows of a shard.
+    bool writePending (Shard_t * pShard);
+
+    char m_directory[SENSOR_STORE_MAX_PATH_LEN];
+    uint32_t m_latenessSeconds;
+    uint32_t m_numWindows[MAX_NUM_ROLLUP_RESOLUTIONS]; //!< Ring size per resolution.
+    uint32_t m_firstWindow[MAX_NUM_ROLLUP_RESOLUTIONS]; //!< Ring offset per resolution.
+    uint32_t m_windowsPerDevice;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
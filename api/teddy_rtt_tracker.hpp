@@ -0,0 +1,256 @@
+/* Teddy downlink request round-trip time tracker definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_RTT_TRACKER_HPP
+#define TEDDY_RTT_TRACKER_HPP
+
+/**
+ * @file teddy_rtt_tracker.hpp
+ * This file defines a tracker of the round-trip time of downlink
+ * requests: the time from a Req being encoded for a device to the
+ * matching Cnf being decoded from it, for each of the five pairs:
+ *
+ *   IntervalsGetReq         -> IntervalsGetCnf
+ *   HeartbeatSetReq         -> HeartbeatSetCnf
+ *   ReportingIntervalSetReq -> ReportingIntervalSetCnf
+ *   SensorsReportGetReq     -> SensorsReportGetCnf
+ *   TrafficReportGetReq     -> TrafficReportGetCnf
+ *
+ * The messages carry no transaction ID, so each device is only timed
+ * for one Req of each type at a time: a Req sent while another of
+ * the same type is outstanding is counted as overlapping but not
+ * timed, and a Cnf is matched with the first Req of its type that is
+ * outstanding, Cnfs usually coming back in order.  A Req that is not
+ * confirmed within the timeout has timed out, and a Cnf that matches
+ * no outstanding Req (it came after the timeout, or it answers an
+ * overlapping Req) is counted as unmatched.
+ *
+ * The tracker is split into shards, chosen with deviceIdShard(), each
+ * an open-addressing table like those of the DeviceRegistry, and
+ * devices are never removed, so the memory is fixed per device at
+ * init(): 29 bytes of columns (the device ID, a bitmap of the Reqs
+ * outstanding and a 32-bit send time per Req type) plus a TimerWheel
+ * timer of 14 bytes, all divided by the load factor.  Both recording
+ * a Req and matching a Cnf are a probe of the table and a few stores.
+ * The timer of a device is armed when it has a Req outstanding and
+ * none is armed already; timeouts are found by checkTimeouts(), which
+ * need only be called every second or so, since a Cnf that arrives
+ * after the timeout is treated as a timeout whether or not
+ * checkTimeouts() has got there first.
+ *
+ * Send times are kept to the microsecond in 32 bits, so
+ * checkTimeouts() must be called at least once every half an hour
+ * or so.  Each shard is locked while it is used, the lock being
+ * uncontended if, as in the IngestServer, each device is only ever
+ * handled by one thread.
+ */
+
+#include <stdint.h>
+#include <atomic>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_timer_wheel.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of shards
+#define RTT_TRACKER_MAX_SHARDS 256
+
+/// The longest timeout, in milliseconds, that keeps the send times
+// within 32 bits of microseconds with room to spare
+#define RTT_TRACKER_MAX_TIMEOUT_MS (30 * 60 * 1000)
+
+/// The number of bits of sub-bucket within each power of two of the
+// RTT histograms, giving a resolution of 1 in 8
+#define RTT_TRACKER_SUB_BUCKET_BITS 3
+
+/// The number of buckets of an RTT histogram, covering 32 bits of
+// microseconds
+#define RTT_TRACKER_NUM_BUCKETS ((32 - RTT_TRACKER_SUB_BUCKET_BITS + 1) << RTT_TRACKER_SUB_BUCKET_BITS)
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The Req types that are tracked.
+typedef enum
+{
+    RTT_REQ_INTERVALS_GET,
+    RTT_REQ_HEARTBEAT_SET,
+    RTT_REQ_REPORTING_INTERVAL_SET,
+    RTT_REQ_SENSORS_REPORT_GET,
+    RTT_REQ_TRAFFIC_REPORT_GET,
+    MAX_NUM_RTT_REQS
+} RttReq_t;
+
+/// The statistics of one Req type.
+typedef struct RttStatsTag_t
+{
+    uint64_t numSent;                    //!< Reqs recorded.
+    uint64_t numConfirmed;               //!< Matched by a Cnf in time.
+    uint64_t numTimedOut;                //!< Not confirmed in time.
+    uint64_t numOverlapped;              //!< Sent while one was outstanding, not timed.
+    uint64_t numUnmatched;               //!< Cnfs with no Req outstanding.
+    uint64_t numNotTracked;              //!< Reqs not recorded as the table was full.
+    uint64_t totalUs;                    //!< Sum of the RTTs of numConfirmed.
+    uint32_t maxUs;
+    uint32_t buckets[RTT_TRACKER_NUM_BUCKETS]; //!< Log-linear, see getQuantileUs().
+} RttStats_t;
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The round-trip time tracker.
+class RttTracker {
+public:
+
+    RttTracker (void);
+    ~RttTracker (void);
+
+    /// Set up the tracker.
+    // \param numShards   The number of shards, e.g. the number of
+    //                    receive threads.
+    // \param maxDevices  The maximum number of devices.
+    // \param timeoutMs   The time within which a Req must be confirmed,
+    //                    at most RTT_TRACKER_MAX_TIMEOUT_MS.
+    // \param nowUs       The current time from serverTimeUs().
+    // \return            true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices,
+               uint32_t timeoutMs, uint64_t nowUs);
+
+    /// Get the Req type that a message type is or is the Cnf to.
+    // \param result  A decode result of decodeDlMsg() or decodeUlMsg().
+    // \return        The Req type, MAX_NUM_RTT_REQS if the message is
+    //                neither a tracked Req nor a Cnf to one.
+    static RttReq_t getReq (MessageCodec::DecodeResult_t result);
+
+    /// Record that a Req has been sent to a device.
+    // \param deviceId  The device.
+    // \param result    The Req, as decodeDlMsg() would give it, e.g.
+    //                  DECODE_RESULT_INTERVALS_GET_REQ_DL_MSG; anything
+    //                  other than a tracked Req is ignored.
+    // \param nowUs     The current time from serverTimeUs().
+    // \return          true if the Req was recorded, otherwise false.
+    bool reqSent (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                  uint64_t nowUs);
+
+    /// Record all of the Reqs in a downlink buffer, as given by the
+    // encode functions of MessageCodec.
+    // \param deviceId  The device.
+    // \param pBuffer   The encoded messages.
+    // \param size      The number of bytes at pBuffer.
+    // \param pCodec    A codec with which to decode the messages, in
+    //                  whose metrics they are counted as downlink
+    //                  decodes.
+    // \param nowUs     The current time from serverTimeUs().
+    // \return          The number of Reqs recorded.
+    uint32_t dlMsgsSent (DeviceId_t deviceId, const char * pBuffer, uint32_t size,
+                         MessageCodec * pCodec, uint64_t nowUs);
+
+    /// Match a decoded uplink message against the Reqs outstanding
+    // for the device; may be called for every message decoded,
+    // anything other than a Cnf to a tracked Req being ignored.
+    // \param deviceId  The device.
+    // \param result    The result of decodeUlMsg().
+    // \param nowUs     The current time from serverTimeUs().
+    // \return          The RTT in microseconds if the message
+    //                  confirmed a Req in time, otherwise -1.
+    int64_t ulMsgReceived (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                           uint64_t nowUs);
+
+    /// Time out the Reqs that have not been confirmed in time.
+    // \param nowUs  The current time from serverTimeUs().
+    // \return       The number of Reqs that timed out.
+    uint32_t checkTimeouts (uint64_t nowUs);
+
+    /// Get the statistics of a Req type, summed over the shards.
+    // \param req     The Req type.
+    // \param pStats  A place to put the statistics.
+    void getStats (RttReq_t req, RttStats_t * pStats);
+
+    /// Get a quantile of the RTTs in some statistics, to within the
+    // resolution of the histogram.
+    // \param pStats    The statistics.
+    // \param permille  The quantile in thousandths, e.g. 990 for p99.
+    // \return          The RTT in microseconds, zero if there are none.
+    static uint32_t getQuantileUs (const RttStats_t * pStats, uint32_t permille);
+
+    /// Get the name of a Req type.
+    // \param req  The Req type.
+    // \return     The name, e.g. "IntervalsGet".
+    static const char * getReqName (RttReq_t req);
+
+    /// Get the number of devices being tracked.
+    // \return  The number of devices.
+    uint32_t getNumDevices (void);
+
+    /// Get the amount of memory allocated for the tracker.
+    // \return  The number of bytes.
+    uint64_t getMemoryUsed (void);
+
+private:
+    /// A shard: the columns of one open-addressing table, the timers
+    // of its devices (the timer index being the slot) and the
+    // statistics of the Reqs sent through it.
+    typedef struct ShardTag_t
+    {
+        std::atomic_flag lock;           //!< Uncontended if one thread per shard.
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;         //!< DEVICE_ID_INVALID for empty slots.
+        uint8_t * pOutstanding;          //!< A bit per RttReq_t.
+        uint32_t * pSentTimes;           //!< MAX_NUM_RTT_REQS per slot, microseconds.
+        TimerWheel wheel;                //!< Ticks are milliseconds.
+        RttStats_t stats[MAX_NUM_RTT_REQS];
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Passed through TimerWheel::advance() to timerCallback().
+    typedef struct TimerContextTag_t
+    {
+        RttTracker * pTracker;
+        Shard_t * pShard;
+        uint32_t nowUs;
+        uint32_t numTimedOut;
+    } TimerContext_t;
+
+    /// Called by the TimerWheel of a shard.
+    static void timerCallback (void * pContext, uint32_t timerIndex, uint32_t expiryTick);
+
+    /// Find a device's slot, optionally adding it.
+    // \param pShard    The shard, which must be locked.
+    // \param deviceId  The device.
+    // \param add       true if the device should be added if absent.
+    // \return          The slot or -1.
+    int64_t findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add);
+    /// Lock and unlock a shard.
+    void lockShard (Shard_t * pShard);
+    void unlockShard (Shard_t * pShard);
+    /// Time out the Reqs of a slot that are overdue and re-arm its
+    // timer for the first of the rest.
+    uint32_t timeOutSlot (Shard_t * pShard, uint32_t slot, uint32_t nowUs);
+    /// Add an RTT to the statistics of a Req type.
+    static void addRtt (RttStats_t * pStats, uint32_t rttUs);
+
+    uint32_t m_timeoutUs;
+    uint32_t m_numShards;
+    uint64_t m_memoryUsed;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,137 @@
+/* Teddy sensor readings query definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_SENSOR_QUERY_HPP
+#define TEDDY_SENSOR_QUERY_HPP
+
+/**
+ * @file teddy_sensor_query.hpp
+ * This file defines queries over the readings in a SensorStore:
+ * for a set of devices and a time range, the rows that meet all of
+ * a list of simple predicates, returning only the columns asked for.
+ *
+ * A query runs in two phases, each spread across a number of
+ * threads.  First the index of each device (see SensorIndexEntry_t)
+ * is read and every full segment whose time range or zone map rules
+ * it out is dropped without being opened; segments beyond the end of
+ * an index (the open segment and any that the index lags) are kept.
+ * Then the remaining segments are shared out among the threads, one
+ * segment at a time, and scanned: only the columns that the query
+ * needs are mapped and, if compressed, decoded.
+ *
+ * Predicates apply to the stored values, in which absent readings
+ * are zero; to ask only for rows where a reading is present, add a
+ * SENSOR_PREDICATE_ALL_BITS_SET predicate on SENSOR_COLUMN_PRESENCE
+ * with the PIPELINE_PRESENT_x bits of the readings.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_sensor_store.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of threads a query can use
+#define SENSOR_QUERY_MAX_THREADS 64
+
+/// The bit for a column in SensorQuery_t.columns
+#define SENSOR_QUERY_COLUMN(column) (1UL << (column))
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// How a predicate compares a column with its value.
+typedef enum
+{
+    SENSOR_PREDICATE_EQ,
+    SENSOR_PREDICATE_NE,
+    SENSOR_PREDICATE_LT,
+    SENSOR_PREDICATE_LE,
+    SENSOR_PREDICATE_GT,
+    SENSOR_PREDICATE_GE,
+    SENSOR_PREDICATE_ALL_BITS_SET,     //!< (column & value) == value.
+    MAX_NUM_SENSOR_PREDICATE_OPS
+} SensorPredicateOp_t;
+
+/// A predicate.
+typedef struct SensorPredicateTag_t
+{
+    SensorColumn_t column;
+    SensorPredicateOp_t op;
+    int64_t value;
+} SensorPredicate_t;
+
+/// A query.
+typedef struct SensorQueryTag_t
+{
+    const DeviceId_t * pDeviceIds;     //!< The devices to look at.
+    uint32_t numDeviceIds;
+    uint32_t startTime;                //!< The first time to include.
+    uint32_t endTime;                  //!< The first time not to include.
+    uint32_t columns;                  //!< SENSOR_QUERY_COLUMN() bits of the columns to return.
+    const SensorPredicate_t * pPredicates; //!< All must be met, may be NULL.
+    uint32_t numPredicates;
+} SensorQuery_t;
+
+/// What a query did.
+typedef struct SensorQueryStatsTag_t
+{
+    uint64_t numSegments;              //!< Segments of the devices.
+    uint64_t numSegmentsSkippedByTime; //!< Ruled out by their time range.
+    uint64_t numSegmentsSkippedByZoneMap; //!< Ruled out by their zone maps.
+    uint64_t numSegmentsScanned;
+    uint64_t numRowsScanned;
+    uint64_t numRowsMatched;
+} SensorQueryStats_t;
+
+/// Called with the matching rows of a segment.  It is called from
+// the query's threads, as many at once as there are threads.
+// \param pContext      The context pointer given to sensorQueryRun().
+// \param deviceId      The device.
+// \param segmentNumber The segment.
+// \param numRows       The number of matching rows.
+// \param ppColumns     An array, indexed by SensorColumn_t, of the
+//                      matching rows of each column asked for, NULL for
+//                      the others; cast as for SensorColumnSpan_t.
+//                      Valid only for the duration of the call.
+typedef void (*SensorQueryCallback_t) (void * pContext,
+                                       DeviceId_t deviceId,
+                                       uint32_t segmentNumber,
+                                       uint32_t numRows,
+                                       const void * const * ppColumns);
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Run a query.
+// \param pDirectory  The store directory.
+// \param pQuery      The query.
+// \param numThreads  The number of threads to use, at most
+//                    SENSOR_QUERY_MAX_THREADS; zero means one.
+// \param callback    Called with the matching rows.
+// \param pContext    Passed to callback.
+// \param pStats      A place to put what the query did, may be NULL.
+// \return            true if successful, false if the query is
+//                    invalid, a thread could not be started or there
+//                    was no memory; a segment that can't be read is
+//                    skipped.
+bool sensorQueryRun (const char * pDirectory, const SensorQuery_t * pQuery,
+                     uint32_t numThreads, SensorQueryCallback_t callback,
+                     void * pContext, SensorQueryStats_t * pStats);
+
+#endif
+
+// End Of File
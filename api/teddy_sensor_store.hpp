@@ -0,0 +1,371 @@
+/* Teddy sensor readings store definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_SENSOR_STORE_HPP
+#define TEDDY_SENSOR_STORE_HPP
+
+/**
+ * @file teddy_sensor_store.hpp
+ * This file defines an embedded, append-only, columnar store for
+ * decoded sensor readings.
+ *
+ * The readings of each device go into a sequence of segment files,
+ * each holding up to a fixed number of rows.  Within a segment file
+ * the readings are laid out by column (time, GPS latitude, ...,
+ * energy) followed by a presence column holding, per row, the same
+ * bitmap as the on-air itemsBitmap (see PIPELINE_PRESENT_x).  The
+ * file is an exact image of the segment as it was built in memory,
+ * so writing is a single write() of the whole image and reading is
+ * a mmap() of the file, with each column handed out as a span that
+ * points straight into the mapping.
+ *
+ * Writes are batched: rows are appended to an in-memory image of the
+ * device's open segment, which is written out when it fills (and
+ * then never changes again) or when flush() is called (in which case
+ * it is rewritten, atomically, when next flushed).  The writer is
+ * sharded by device and each shard must only ever be written from
+ * one thread, e.g. a pipeline sink, so nothing on the write path
+ * is locked.  Memory use is one segment image (see
+ * sensorSegmentFileSize()) per device written to.
+ *
+ * A segment that has filled may instead be written compressed, see
+ * teddy_column_codec.hpp, each column with the codec that suits it:
+ * the header then gives the codec and encoded size of each column.
+ * A compressed column is decoded on first access into memory owned
+ * by the SensorSegment; any column left uncompressed (because it
+ * would not have got smaller) is still handed out from the mapping.
+ * Partly-filled segments are never compressed, since they are
+ * rewritten as they grow.
+ *
+ * The segment files of a device are named <deviceId>_<segment>.seg,
+ * in hex, in one of 256 subdirectories chosen by deviceIdHash() so
+ * that no directory grows too large.
+ *
+ * Alongside them, <deviceId>.idx is a sparse index of the device's
+ * full segments: one SensorIndexEntry_t per segment, appended as it
+ * is sealed, giving its time range and, per column, the lowest and
+ * highest value (a "zone map").  A reader can rule segments out
+ * from the index alone, without opening them; see
+ * teddy_sensor_query.hpp.  The index may lag the segments (e.g. if
+ * the server stopped between writing a segment and its entry), so
+ * segments beyond the end of the index must be treated as unindexed.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_column_codec.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The magic number at the start of a segment file, "TSEG"
+#define SENSOR_SEGMENT_MAGIC 0x47455354
+
+/// The version of the segment file format
+#define SENSOR_SEGMENT_VERSION 2
+
+/// Bits in SensorSegmentHeader_t.flags
+#define SENSOR_SEGMENT_FLAG_COMPRESSED 0x01 //!< Columns are as columnCodecs[] says.
+
+/// The default number of rows in a segment
+#define SENSOR_STORE_DEFAULT_ROWS_PER_SEGMENT 256
+
+/// The maximum number of writer shards
+#define SENSOR_STORE_MAX_SHARDS 64
+
+/// The maximum length of a segment file path, including terminator
+#define SENSOR_STORE_MAX_PATH_LEN 256
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The columns of a segment, in the order they are in the file.
+typedef enum
+{
+    SENSOR_COLUMN_TIME,                //!< uint32_t, device UTC seconds.
+    SENSOR_COLUMN_GPS_LATITUDE,        //!< int32_t
+    SENSOR_COLUMN_GPS_LONGITUDE,       //!< int32_t
+    SENSOR_COLUMN_GPS_ELEVATION,       //!< int32_t
+    SENSOR_COLUMN_GPS_SPEED,           //!< int32_t
+    SENSOR_COLUMN_ORIENTATION,         //!< uint8_t
+    SENSOR_COLUMN_HUGS,                //!< uint8_t
+    SENSOR_COLUMN_SLAPS,               //!< uint8_t
+    SENSOR_COLUMN_DROPS,               //!< uint8_t
+    SENSOR_COLUMN_NUDGES,              //!< uint8_t
+    SENSOR_COLUMN_SOUND_LEVEL,         //!< uint16_t
+    SENSOR_COLUMN_LUMINOSITY,          //!< uint16_t
+    SENSOR_COLUMN_TEMPERATURE,         //!< int8_t
+    SENSOR_COLUMN_RSSI,                //!< uint8_t
+    SENSOR_COLUMN_CHARGE_STATE,        //!< uint8_t
+    SENSOR_COLUMN_BATTERY_MV,          //!< uint16_t
+    SENSOR_COLUMN_ENERGY_UWH,          //!< uint32_t
+    SENSOR_COLUMN_PRESENCE,            //!< uint8_t, PIPELINE_PRESENT_x bits.
+    MAX_NUM_SENSOR_COLUMNS
+} SensorColumn_t;
+
+/// The header at the start of a segment file.
+typedef struct SensorSegmentHeaderTag_t
+{
+    uint32_t magic;                    //!< SENSOR_SEGMENT_MAGIC.
+    uint16_t version;                  //!< SENSOR_SEGMENT_VERSION.
+    uint16_t headerSize;               //!< Offset of the first column.
+    DeviceId_t deviceId;
+    uint32_t segmentNumber;
+    uint32_t capacity;                 //!< Rows that the columns have room for.
+    uint32_t numRows;                  //!< Rows that are valid.
+    uint32_t firstTime;                //!< Lowest time in the segment.
+    uint32_t lastTime;                 //!< Highest time in the segment.
+    uint32_t flags;                    //!< SENSOR_SEGMENT_FLAG_x bits.
+    uint32_t columnOffsets[MAX_NUM_SENSOR_COLUMNS]; //!< From the start of the file.
+    uint32_t columnSizes[MAX_NUM_SENSOR_COLUMNS];   //!< Bytes in the file.
+    uint8_t columnCodecs[MAX_NUM_SENSOR_COLUMNS];   //!< ColumnCodec_t of each column.
+} SensorSegmentHeader_t;
+
+/// An entry in the index of a device's full segments.  Absent
+// readings are stored as zero and count towards the zone map.
+typedef struct SensorIndexEntryTag_t
+{
+    uint32_t segmentNumber;
+    uint32_t numRows;
+    uint32_t firstTime;                //!< Lowest time in the segment.
+    uint32_t lastTime;                 //!< Highest time in the segment.
+    int64_t columnMin[MAX_NUM_SENSOR_COLUMNS]; //!< Lowest value in each column.
+    int64_t columnMax[MAX_NUM_SENSOR_COLUMNS]; //!< Highest value in each column.
+    uint8_t presenceUnion;             //!< The OR of the presence column.
+    uint8_t pad[7];
+} SensorIndexEntry_t;
+
+/// A column of a segment, pointing into the memory-mapped file (no
+// copy is made) or, for a compressed column, into the decoded copy
+// held by the SensorSegment.  Cast pData according to the
+// SensorColumn_t.
+typedef struct SensorColumnSpanTag_t
+{
+    const void * pData;
+    uint32_t numRows;
+    uint32_t elementSize;
+} SensorColumnSpan_t;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Get the size of the elements of a column.
+// \param column  The column.
+// \return        The size of each element in bytes.
+uint32_t sensorColumnElementSize (SensorColumn_t column);
+
+/// Get the codec used for a column when a segment is compressed.
+// \param column  The column.
+// \return        The codec.
+ColumnCodec_t sensorColumnCodec (SensorColumn_t column);
+
+/// Get the size of an uncompressed segment file (and of its
+// in-memory image).
+// \param rowsPerSegment  The number of rows in a segment.
+// \return                The size in bytes.
+uint32_t sensorSegmentFileSize (uint32_t rowsPerSegment);
+
+/// Form the path of a segment file.
+// \param pDirectory     The store directory.
+// \param deviceId       The device.
+// \param segmentNumber  The segment.
+// \param pPath          A place to put the path, at least
+//                       SENSOR_STORE_MAX_PATH_LEN long.
+// \return               true if the path fitted, otherwise false.
+bool sensorSegmentPath (const char * pDirectory, DeviceId_t deviceId,
+                        uint32_t segmentNumber, char * pPath);
+
+/// Get a value from a column, widened.
+// \param column  The column.
+// \param pData   The column data, e.g. from a SensorColumnSpan_t.
+// \param row     The row.
+// \return        The value.
+int64_t sensorColumnGet (SensorColumn_t column, const void * pData, uint32_t row);
+
+/// Form the path of the index file of a device.
+// \param pDirectory  The store directory.
+// \param deviceId    The device.
+// \param pPath       A place to put the path, at least
+//                    SENSOR_STORE_MAX_PATH_LEN long.
+// \return            true if the path fitted, otherwise false.
+bool sensorIndexPath (const char * pDirectory, DeviceId_t deviceId, char * pPath);
+
+/// Read the index of a device; only the entries that are intact and
+// in segment order, from segment zero, are returned.
+// \param pDirectory  The store directory.
+// \param deviceId    The device.
+// \param ppEntries   A place to put a pointer to the entries, which
+//                    the caller must free(); set to NULL if there
+//                    are none.
+// \return            The number of entries.
+uint32_t sensorIndexRead (const char * pDirectory, DeviceId_t deviceId,
+                          SensorIndexEntry_t ** ppEntries);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// A segment, mapped read-only for reading.  A SensorSegment is not
+// thread-safe: give each reading thread its own.
+class SensorSegment {
+public:
+
+    SensorSegment (void);
+    ~SensorSegment (void);
+
+    /// Map a segment file.
+    // \param pDirectory     The store directory.
+    // \param deviceId       The device.
+    // \param segmentNumber  The segment.
+    // \return               true if the segment exists and is valid,
+    //                       otherwise false.
+    bool open (const char * pDirectory, DeviceId_t deviceId, uint32_t segmentNumber);
+
+    /// Unmap the segment, freeing any decoded columns; all spans
+    // become invalid.
+    void close (void);
+
+    /// Get the header of the segment.
+    // \return  The header, NULL if not open.
+    const SensorSegmentHeader_t * getHeader (void);
+
+    /// Get a column of the segment, decoding it if it is compressed
+    // and hasn't been asked for before.
+    // \param column  The column.
+    // \param pSpan   A place to put the span, valid until close().
+    // \return        true if successful, false if the segment isn't
+    //                open, there is no memory to decode into or the
+    //                column is corrupt.
+    bool getColumn (SensorColumn_t column, SensorColumnSpan_t * pSpan);
+
+private:
+    const uint8_t * mp_mapping;
+    uint32_t m_mappingSize;
+    uint8_t * mp_decoded[MAX_NUM_SENSOR_COLUMNS]; //!< NULL until decoded.
+};
+
+/// The writer, and the means of finding segments to read.
+class SensorStore {
+public:
+
+    SensorStore (void);
+    ~SensorStore (void);
+
+    /// Set up the store, creating the directory structure if needed.
+    // \param pDirectory      The store directory.
+    // \param numShards       The number of writer shards.
+    // \param maxDevices      The maximum number of devices written to.
+    // \param rowsPerSegment  Rows per segment, zero for the default.
+    // \param compress        true to write segments compressed once
+    //                        they are full.
+    // \return                true if successful, otherwise false.
+    bool init (const char * pDirectory, uint32_t numShards,
+               uint32_t maxDevices, uint32_t rowsPerSegment, bool compress);
+
+    /// Get the shard that a device is written through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Append a row of readings for a device.  Only one thread may
+    // append to a given shard.
+    // \param shardIndex     The shard, from getShardIndex().
+    // \param deviceId       The device.
+    // \param pReadings      The readings.
+    // \param presentBitmap  Which readings are present, PIPELINE_PRESENT_x.
+    // \return               true if successful, otherwise false.
+    bool append (uint32_t shardIndex, DeviceId_t deviceId,
+                 const PipelineReadings_t * pReadings, uint8_t presentBitmap);
+
+    /// As append() but from a pipeline record; records that are not
+    // sensor reports are ignored.
+    // \param shardIndex  The shard, from getShardIndex().
+    // \param pRecord     The record.
+    // \return            true if successful, otherwise false.
+    bool appendRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord);
+
+    /// Write out the partly-filled segments of a shard, from the
+    // thread that appends to it.
+    // \param shardIndex  The shard.
+    // \return            true if successful, otherwise false.
+    bool flush (uint32_t shardIndex);
+
+    /// Find out how many segments a device has on disk, including
+    // any partly-filled one that has been flushed.
+    // \param deviceId  The device.
+    // \return          The number of segments, numbered from zero.
+    uint32_t getNumSegments (DeviceId_t deviceId);
+
+    /// Get the store directory.
+    // \return  The directory.
+    const char * getDirectory (void);
+
+    /// Get the number of rows appended and segment files written.
+    // \param pNumRows            A place to put the number of rows, may
+    //                            be NULL.
+    // \param pNumSegmentWrites   A place to put the number of segment
+    //                            file writes, may be NULL.
+    // \param pNumSegmentsSealed  A place to put the number of segments
+    //                            written because they filled, may be
+    //                            NULL.
+    // \param pNumBytesSealed     A place to put the number of bytes
+    //                            written for those segments, may be
+    //                            NULL; compare with sensorSegmentFileSize()
+    //                            for each of them to get the
+    //                            compression ratio.
+    void getStats (uint64_t * pNumRows, uint64_t * pNumSegmentWrites,
+                   uint64_t * pNumSegmentsSealed, uint64_t * pNumBytesSealed);
+
+private:
+    /// A writer shard: a table of the devices written through it,
+    // each with the image of its open segment.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        uint8_t ** ppImages;                 //!< The open segment of each device.
+        bool * pDirty;                       //!< Rows added since the image was written.
+        uint8_t * pCompressed;               //!< Where a full image is compressed into.
+        uint64_t numRows;
+        uint64_t numSegmentWrites;
+        uint64_t numSegmentsSealed;
+        uint64_t numBytesSealed;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, creating it and its open
+    // segment image (picking up from what is on disk) if needed.
+    int64_t getSlot (Shard_t * pShard, DeviceId_t deviceId);
+    /// Compress a full image into the shard's compression buffer.
+    uint32_t compressImage (Shard_t * pShard, const uint8_t * pImage);
+    /// Append the index entry of a full image to the device's index.
+    bool writeIndexEntry (const uint8_t * pImage);
+    /// Write out a segment, compressed or not.
+    bool writeSegment (Shard_t * pShard, const uint8_t * pSegment, uint32_t size);
+
+    char m_directory[SENSOR_STORE_MAX_PATH_LEN];
+    uint32_t m_rowsPerSegment;
+    uint32_t m_imageSize;
+    bool m_compress;
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
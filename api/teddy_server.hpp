@@ -0,0 +1,178 @@
+/* Teddy server-side common definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_SERVER_HPP
+#define TEDDY_SERVER_HPP
+
+/**
+ * @file teddy_server.hpp
+ * This file defines the things that are common to all of the
+ * server-side (i.e. Linux, not device) modules built around
+ * the message codec.
+ */
+
+#include <stdint.h>
+#include <atomic>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// A device ID that no real device will ever have
+#define DEVICE_ID_INVALID 0
+
+/// The size of a cache line on the server, used for padding
+// things that are written by different threads
+#define SERVER_CACHE_LINE_SIZE 64
+
+/// The fill level, in percent, that the per-device open-addressing
+// tables are sized for; linear probing stays short up to about here
+#define SHARD_LOAD_FACTOR_PERCENT 80
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The identity of a teddy as seen by the server.  The messages
+// themselves carry no identity so this is formed from the IPv4
+// source address (upper 32 bits) and UDP source port (lower 16 bits)
+// that the datagram arrived from.
+typedef uint64_t DeviceId_t;
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Hash a device ID.  Everything that shards or indexes by device
+// uses this so that, for instance, the decode worker that owns a
+// device also owns the device's shard of the DeviceRegistry.  Take
+// the upper 32 bits to choose a shard and the lower 32 bits to
+// index within it.  Inline as it is on every hot path.
+// \param deviceId  The device ID.
+// \return          The hash.
+inline uint64_t deviceIdHash (DeviceId_t deviceId)
+{
+    uint64_t hash = deviceId * 0x9E3779B97F4A7C15ULL;
+
+    return hash ^ (hash >> 29);
+}
+
+/// Choose a shard for a device.
+// \param deviceId   The device ID.
+// \param numShards  The number of shards.
+// \return           The shard index, 0 to numShards - 1.
+inline uint32_t deviceIdShard (DeviceId_t deviceId, uint32_t numShards)
+{
+    return (uint32_t) (((deviceIdHash (deviceId) >> 32) * numShards) >> 32);
+}
+
+/// Size the shards of a per-device open-addressing (linear probing)
+// table, as kept by the DeviceRegistry and by most of the stages
+// after it.  Devices won't spread perfectly evenly across several
+// shards so each is given some slack, and each is sized for
+// SHARD_LOAD_FACTOR_PERCENT.
+// \param maxDevices   The maximum number of devices in all shards.
+// \param numShards    The number of shards, greater than zero.
+// \param pMaxEntries  A place to put the maximum number of devices
+//                     in each shard.
+// \return             The number of slots in each shard, always more
+//                     than *pMaxEntries so that a probe always ends.
+uint32_t shardCapacity (uint32_t maxDevices, uint32_t numShards, uint32_t * pMaxEntries);
+
+/// The slot in a shard of the given capacity where the probe for a
+// device starts; the multiply-shift means the capacity need not be
+// a power of two.
+// \param deviceId  The device ID.
+// \param capacity  The number of slots in the shard.
+// \return          The home slot of the device.
+inline uint32_t shardHomeSlot (DeviceId_t deviceId, uint32_t capacity)
+{
+    return (uint32_t) (((deviceIdHash (deviceId) & 0xFFFFFFFF) * capacity) >> 32);
+}
+
+/// Read the device ID in a slot of the key column of a shard; a
+// column of std::atomic is for a shard with lock-free readers, the
+// acquire pairing with the release in which a writer publishes a
+// new device.
+inline DeviceId_t shardDeviceIdAt (const DeviceId_t * pDeviceIds, uint32_t slot)
+{
+    return pDeviceIds[slot];
+}
+inline DeviceId_t shardDeviceIdAt (const std::atomic<DeviceId_t> * pDeviceIds, uint32_t slot)
+{
+    return pDeviceIds[slot].load (std::memory_order_acquire);
+}
+
+/// Find a device in a shard sized with shardCapacity(), walking
+// only the key column.  Inline as it is on every hot path.
+// \param pDeviceIds  The key column of the shard, DEVICE_ID_INVALID
+//                    for empty slots.
+// \param capacity    The number of slots in the shard.
+// \param deviceId    The device ID.
+// \return            The slot holding the device or, if it isn't
+//                    there, the empty slot where it would go.
+template <typename T>
+inline uint32_t shardProbe (const T * pDeviceIds, uint32_t capacity, DeviceId_t deviceId)
+{
+    uint32_t x = shardHomeSlot (deviceId, capacity);
+    DeviceId_t slotDeviceId = shardDeviceIdAt (pDeviceIds, x);
+
+    while ((slotDeviceId != deviceId) && (slotDeviceId != DEVICE_ID_INVALID))
+    {
+        x++;
+        if (x >= capacity)
+        {
+            x = 0;
+        }
+        slotDeviceId = shardDeviceIdAt (pDeviceIds, x);
+    }
+
+    return x;
+}
+
+/// Allocate a zeroed column of a shard, adding its size to a
+// running total.
+// \param numEntries  The number of entries in the column.
+// \param entrySize   The size of each entry.
+// \param pTotal      The running total of bytes allocated.
+// \return            The column, NULL if out of memory.
+void * shardAllocColumn (uint32_t numEntries, uint32_t entrySize, uint64_t * pTotal);
+
+/// Form a device ID from an IPv4 address and port.
+// \param ipAddress  The IPv4 address in host byte order.
+// \param port       The UDP port in host byte order.
+// \return           The device ID.
+DeviceId_t deviceIdFromAddress (uint32_t ipAddress, uint16_t port);
+
+/// Recover the IPv4 address and port from a device ID.
+// \param deviceId    The device ID.
+// \param pIpAddress  A place to put the IPv4 address, host byte order.
+// \param pPort       A place to put the UDP port, host byte order.
+void deviceIdToAddress (DeviceId_t deviceId, uint32_t * pIpAddress, uint16_t * pPort);
+
+/// Get a monotonic time in microseconds, for measuring things.
+// \return  The time in microseconds since some arbitrary start point.
+uint64_t serverTimeUs (void);
+
+/// Get a monotonic time in nanoseconds, e.g. for timing the codec
+// with MessageCodec::setMetricsClock().
+// \return  The time in nanoseconds since some arbitrary start point.
+uint64_t serverTimeNs (void);
+
+/// Get the wall-clock time in UTC seconds, for comparison with
+// the time field of SensorReadings_t.
+// \return  The time in UTC seconds.
+uint32_t serverTimeUtcSeconds (void);
+
+#endif
+
+// End Of File
@@ -0,0 +1,369 @@
+/* Teddy mergeable sketch definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_SKETCH_HPP
+#define TEDDY_SKETCH_HPP
+
+/**
+ * @file teddy_sketch.hpp
+ * This file defines small, fixed-size summaries of a stream of
+ * decoded messages for fleet-wide statistics:
+ *
+ * - HyperLogLog: the approximate number of distinct keys (e.g.
+ *   devices) seen, to about 1.04 / sqrt(2^precision).
+ * - ValueHistogram: counts in fixed-width buckets over a range, for
+ *   quantiles.  The readings summarised this way are all quantised
+ *   on the air to at most 256 levels, so a histogram no coarser than
+ *   the on-air step gives exact quantiles in a few kbytes, which no
+ *   approximate quantile sketch can better.
+ * - SpaceSaving: the heavy hitters among keys, each count being an
+ *   overestimate by at most the error given with it, which is at
+ *   most the total count divided by the number of counters.
+ *
+ * Each sketch is updated by one thread only, nothing being locked, so
+ * each thread keeps its own and they are merged for reporting; a
+ * merge must not happen while the sketch being merged in is being
+ * updated.  Each can also be serialised, in network byte order, and
+ * merged in from that form, so that sketches can be combined across
+ * nodes.  Merging two sketches gives the same result, within the
+ * stated bounds, as one sketch fed with both streams.
+ *
+ * FleetSketch puts them together for the stream from decodeUlMsg():
+ * distinct devices, RSSI, battery voltage and temperature
+ * distributions, the devices sending the most DebugInds and the most
+ * InitInds with a watchdog wake-up code, and exact counts per
+ * message type and per wake-up code, those being small enumerations.
+ */
+
+#include <stdint.h>
+#include <teddy_msgs.hpp>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The smallest and largest precision of a HyperLogLog
+#define SKETCH_HLL_MIN_PRECISION 4
+#define SKETCH_HLL_MAX_PRECISION 18
+
+/// The precision of the HyperLogLog of a FleetSketch: 16 kbytes and
+// about 0.8% error
+#define SKETCH_FLEET_HLL_PRECISION 14
+
+/// The maximum number of buckets of a ValueHistogram
+#define SKETCH_MAX_HISTOGRAM_BUCKETS 65536
+
+/// The maximum number of counters of a SpaceSaving
+#define SKETCH_MAX_SPACE_SAVING_COUNTERS 65536
+
+/// The default number of counters of each SpaceSaving of a
+// FleetSketch
+#define SKETCH_FLEET_DEFAULT_HEAVY_HITTERS 64
+
+/// The width, in mV, of the battery voltage buckets of a FleetSketch,
+// a quarter of the on-air step of 10000 / 63 mV
+#define SKETCH_FLEET_BATTERY_MV_BUCKET_WIDTH 40
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// A HyperLogLog sketch of the number of distinct keys.
+class HyperLogLog {
+public:
+
+    HyperLogLog (void);
+    ~HyperLogLog (void);
+
+    /// Set up the sketch.
+    // \param precision  log2 of the number of registers,
+    //                   SKETCH_HLL_MIN_PRECISION to
+    //                   SKETCH_HLL_MAX_PRECISION.
+    // \return           true if successful, otherwise false.
+    bool init (uint32_t precision);
+
+    /// Add a key, which must already be a well-mixed 64-bit hash.
+    // \param hash  The hash of the key.
+    void add (uint64_t hash);
+
+    /// Estimate the number of distinct keys added.
+    // \return  The estimate.
+    uint64_t estimate (void);
+
+    /// Merge another sketch of the same precision into this one.
+    // \param pOther  The other sketch.
+    // \return        true if successful, otherwise false.
+    bool merge (const HyperLogLog * pOther);
+
+    /// Forget everything added.
+    void clear (void);
+
+    /// Get the size of the serialised form.
+    // \return  The size in bytes.
+    uint32_t getSerialisedSize (void);
+
+    /// Serialise the sketch.
+    // \param pBuffer  A place to put it.
+    // \param size     The room at pBuffer.
+    // \return         The number of bytes written, zero if there
+    //                 wasn't room.
+    uint32_t serialise (char * pBuffer, uint32_t size);
+
+    /// Merge a serialised sketch of the same precision into this one.
+    // \param pBuffer  The serialised sketch.
+    // \param size     The number of bytes at pBuffer.
+    // \return         The number of bytes used, zero if it wasn't a
+    //                 compatible sketch.
+    uint32_t mergeSerialised (const char * pBuffer, uint32_t size);
+
+private:
+    uint32_t m_precision;
+    uint8_t * mp_registers;
+};
+
+/// A histogram of integer values in fixed-width buckets.
+class ValueHistogram {
+public:
+
+    ValueHistogram (void);
+    ~ValueHistogram (void);
+
+    /// Set up the histogram to cover minValue to
+    // minValue + bucketWidth * numBuckets - 1; values outside that are
+    // counted in the first or last bucket.
+    // \param minValue     The smallest value.
+    // \param bucketWidth  The width of a bucket.
+    // \param numBuckets   The number of buckets.
+    // \return             true if successful, otherwise false.
+    bool init (int32_t minValue, uint32_t bucketWidth, uint32_t numBuckets);
+
+    /// Add a value.
+    // \param value  The value.
+    void add (int32_t value);
+
+    /// Get the number of values added.
+    // \return  The number of values.
+    uint64_t getCount (void);
+
+    /// Get a quantile.
+    // \param fraction  The quantile, 0.0 to 1.0, e.g. 0.5 for the
+    //                  median.
+    // \return          The smallest value of the bucket holding the
+    //                  quantile, zero if there are no values.
+    int32_t quantile (double fraction);
+
+    /// Merge another histogram of the same shape into this one.
+    // \param pOther  The other histogram.
+    // \return        true if successful, otherwise false.
+    bool merge (const ValueHistogram * pOther);
+
+    /// Forget everything added.
+    void clear (void);
+
+    /// Get the size of the serialised form.
+    // \return  The size in bytes.
+    uint32_t getSerialisedSize (void);
+
+    /// Serialise the histogram.
+    // \param pBuffer  A place to put it.
+    // \param size     The room at pBuffer.
+    // \return         The number of bytes written, zero if there
+    //                 wasn't room.
+    uint32_t serialise (char * pBuffer, uint32_t size);
+
+    /// Merge a serialised histogram of the same shape into this one.
+    // \param pBuffer  The serialised histogram.
+    // \param size     The number of bytes at pBuffer.
+    // \return         The number of bytes used, zero if it wasn't a
+    //                 compatible histogram.
+    uint32_t mergeSerialised (const char * pBuffer, uint32_t size);
+
+private:
+    int32_t m_minValue;
+    uint32_t m_bucketWidth;
+    uint32_t m_numBuckets;
+    uint64_t m_count;
+    uint64_t * mp_buckets;
+};
+
+/// A Space-Saving sketch of the heavy hitters among keys.
+class SpaceSaving {
+public:
+
+    SpaceSaving (void);
+    ~SpaceSaving (void);
+
+    /// Set up the sketch.
+    // \param numCounters  The number of keys counted at once.
+    // \return             true if successful, otherwise false.
+    bool init (uint32_t numCounters);
+
+    /// Count a key.
+    // \param key    The key.
+    // \param count  How many times to count it.
+    void add (uint64_t key, uint64_t count);
+
+    /// Get the heaviest keys, heaviest first.
+    // \param pKeys     A place to put the keys.
+    // \param pCounts   A place to put their counts, each an
+    //                  overestimate by at most the error, may be NULL.
+    // \param pErrors   A place to put the errors, may be NULL.
+    // \param maxKeys   The room at pKeys, pCounts and pErrors.
+    // \return          The number of keys returned.
+    uint32_t getTop (uint64_t * pKeys, uint64_t * pCounts, uint64_t * pErrors, uint32_t maxKeys);
+
+    /// Get the total count of all keys added.
+    // \return  The total.
+    uint64_t getTotal (void);
+
+    /// Merge another sketch into this one, keeping the number of
+    // counters of this one.
+    // \param pOther  The other sketch.
+    // \return        true if successful, otherwise false.
+    bool merge (const SpaceSaving * pOther);
+
+    /// Forget everything added.
+    void clear (void);
+
+    /// Get the size of the serialised form.
+    // \return  The size in bytes.
+    uint32_t getSerialisedSize (void);
+
+    /// Serialise the sketch.
+    // \param pBuffer  A place to put it.
+    // \param size     The room at pBuffer.
+    // \return         The number of bytes written, zero if there
+    //                 wasn't room.
+    uint32_t serialise (char * pBuffer, uint32_t size);
+
+    /// Merge a serialised sketch into this one.
+    // \param pBuffer  The serialised sketch.
+    // \param size     The number of bytes at pBuffer.
+    // \return         The number of bytes used, zero if it wasn't a
+    //                 valid sketch.
+    uint32_t mergeSerialised (const char * pBuffer, uint32_t size);
+
+private:
+    /// Find the index slot of a key, or the empty slot where it would go.
+    uint32_t findSlot (uint64_t key);
+    /// Remove a key from the index.
+    void removeSlot (uint32_t slot);
+    /// Restore the heap order at a counter whose count has gone up.
+    void siftDown (uint32_t position);
+    /// Restore the heap order at a counter whose count has gone down.
+    void siftUp (uint32_t position);
+    /// Swap two counters in the heap.
+    void swap (uint32_t a, uint32_t b);
+    /// Replace the contents with the heaviest of a set of counters.
+    bool rebuild (uint64_t * pKeys, uint64_t * pCounts, uint64_t * pErrors, uint32_t num);
+
+    uint32_t m_numCounters;
+    uint32_t m_numUsed;
+    uint64_t m_total;
+    // The counters, a min-heap on count
+    uint64_t * mp_keys;
+    uint64_t * mp_counts;
+    uint64_t * mp_errors;
+    uint32_t * mp_slots;                     //!< The index slot of each counter.
+    // The index, open addressing on the key
+    uint32_t m_indexMask;
+    uint32_t * mp_index;                     //!< Counter position + 1, 0 for empty.
+};
+
+/// The sketches of the fleet statistics.
+class FleetSketch {
+public:
+
+    FleetSketch (void);
+    ~FleetSketch (void);
+
+    /// Set up the sketches.
+    // \param numHeavyHitters  The number of counters of each
+    //                         SpaceSaving, zero for the default.
+    // \return                 true if successful, otherwise false.
+    bool init (uint32_t numHeavyHitters);
+
+    /// Add a message decoded by decodeUlMsg().
+    // \param deviceId  The device it came from.
+    // \param result    The result of decodeUlMsg().
+    // \param pMsg      The message.
+    void addMsg (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                 const UlMsgUnion_t * pMsg);
+
+    /// Add a message as a pipeline record.
+    // \param pRecord  The record.
+    void addRecord (const PipelineRecord_t * pRecord);
+
+    /// Merge another FleetSketch into this one.
+    // \param pOther  The other sketch.
+    // \return        true if successful, otherwise false.
+    bool merge (FleetSketch * pOther);
+
+    /// Forget everything added, e.g. at the start of an hour.
+    void clear (void);
+
+    /// Get the size of the serialised form.
+    // \return  The size in bytes.
+    uint32_t getSerialisedSize (void);
+
+    /// Serialise the sketches.
+    // \param pBuffer  A place to put them.
+    // \param size     The room at pBuffer.
+    // \return         The number of bytes written, zero if there
+    //                 wasn't room.
+    uint32_t serialise (char * pBuffer, uint32_t size);
+
+    /// Merge serialised sketches into these.
+    // \param pBuffer  The serialised sketches.
+    // \param size     The number of bytes at pBuffer.
+    // \return         The number of bytes used, zero if they weren't
+    //                 compatible.
+    uint32_t mergeSerialised (const char * pBuffer, uint32_t size);
+
+    /// Get the parts, to read.
+    HyperLogLog * getDevices (void);
+    ValueHistogram * getRssi (void);
+    ValueHistogram * getBatteryMV (void);
+    ValueHistogram * getTemperature (void);
+    SpaceSaving * getDebugIndDevices (void);
+    SpaceSaving * getWatchdogDevices (void);
+
+    /// Get the number of messages of a type.
+    // \param result  The type, as returned by decodeUlMsg().
+    // \return        The number of messages.
+    uint64_t getNumMsgs (MessageCodec::DecodeResult_t result);
+
+    /// Get the number of InitInds with a wake-up code.
+    // \param wakeUpCode  The wake-up code.
+    // \return            The number of InitInds.
+    uint64_t getNumWakeUps (WakeUpCode_t wakeUpCode);
+
+private:
+    /// Add what the decoded messages and pipeline records share.
+    void addCommon (DeviceId_t deviceId, uint32_t result);
+
+    HyperLogLog m_devices;
+    ValueHistogram m_rssi;
+    ValueHistogram m_batteryMV;
+    ValueHistogram m_temperature;
+    SpaceSaving m_debugIndDevices;
+    SpaceSaving m_watchdogDevices;
+    uint64_t m_numMsgs[MessageCodec::MAX_NUM_DECODE_RESULTS];
+    uint64_t m_numWakeUps[MAX_NUM_WAKE_UP_CODES];
+};
+
+#endif
+
+// End Of File
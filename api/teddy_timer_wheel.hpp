@@ -0,0 +1,141 @@
+/* Teddy server-side hierarchical timer wheel definition
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_TIMER_WHEEL_HPP
+#define TEDDY_TIMER_WHEEL_HPP
+
+/**
+ * @file teddy_timer_wheel.hpp
+ * This file defines a hierarchical timer wheel: a fixed population
+ * of timers, each identified by an index chosen by the user, that
+ * can be armed, re-armed and cancelled in O(1) and that fire in O(1)
+ * amortised time per timer as the wheel is advanced.
+ *
+ * Time is in ticks, a uint32_t, with the tick length up to the user
+ * (the DeviceRegistry uses seconds).  There are four levels of 256
+ * slots: a timer due within 256 ticks sits in level 0, one due
+ * within 65536 ticks in level 1 and so on, and as the wheel turns
+ * the timers in a higher level slot are cascaded down into the
+ * lower levels.  Each timer is only ever cascaded at most three
+ * times, however often it is re-armed; re-arming is just an unlink
+ * and link of a doubly-linked list node.
+ *
+ * A TimerWheel is not thread-safe: give each thread (or shard) its
+ * own.
+ */
+
+#include <stdint.h>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of levels in the wheel
+#define TIMER_WHEEL_NUM_LEVELS 4
+
+/// The number of bits of the tick count consumed by each level
+#define TIMER_WHEEL_LEVEL_BITS 8
+
+/// The number of slots in each level
+#define TIMER_WHEEL_SLOTS_PER_LEVEL (1 << TIMER_WHEEL_LEVEL_BITS)
+
+/// An index that is not a timer, used to terminate lists
+#define TIMER_WHEEL_INDEX_NONE 0xFFFFFFFF
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Called for each timer that expires.  The timer is no longer
+// armed when this is called and may be re-armed from within it.
+// \param pContext     The context pointer given to advance().
+// \param timerIndex   The timer.
+// \param expiryTick   The tick at which the timer was due.
+typedef void (*TimerWheelCallback_t) (void * pContext,
+                                      uint32_t timerIndex,
+                                      uint32_t expiryTick);
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+class TimerWheel {
+public:
+
+    TimerWheel (void);
+    ~TimerWheel (void);
+
+    /// Allocate the wheel.
+    // \param numTimers  The number of timers, which will have indexes
+    //                   0 to numTimers - 1.
+    // \param nowTick    The current tick.
+    // \return           true if successful, otherwise false.
+    bool init (uint32_t numTimers, uint32_t nowTick);
+
+    /// Arm a timer, or re-arm it if it is already armed.  A timer
+    // armed for a tick that has already been reached fires on the
+    // next tick.
+    // \param timerIndex  The timer.
+    // \param expiryTick  The tick at which it should fire.
+    void arm (uint32_t timerIndex, uint32_t expiryTick);
+
+    /// Cancel a timer; does nothing if it is not armed.
+    // \param timerIndex  The timer.
+    void cancel (uint32_t timerIndex);
+
+    /// Find out if a timer is armed.
+    // \param timerIndex  The timer.
+    // \return            true if the timer is armed.
+    bool isArmed (uint32_t timerIndex);
+
+    /// Get the tick at which a timer is due.
+    // \param timerIndex  The timer.
+    // \return            The expiry tick, only meaningful if armed.
+    uint32_t getExpiry (uint32_t timerIndex);
+
+    /// Turn the wheel up to and including the given tick, firing
+    // the timers that fall due on the way.
+    // \param nowTick   The current tick.
+    // \param callback  The callback for each expired timer.
+    // \param pContext  Passed to the callback.
+    // \return          The number of timers that fired.
+    uint32_t advance (uint32_t nowTick, TimerWheelCallback_t callback, void * pContext);
+
+    /// Get the number of timers that are armed.
+    // \return  The number of armed timers.
+    uint32_t getNumArmed (void);
+
+    /// Get the amount of memory allocated for the wheel.
+    // \return  The number of bytes.
+    uint64_t getMemoryUsed (void);
+
+private:
+    /// Put a timer into the slot for its expiry.
+    void link (uint32_t timerIndex, bool cascading);
+    /// Take a timer out of its slot.
+    void unlink (uint32_t timerIndex);
+    /// Re-file the timers in a higher level slot.
+    void cascade (uint32_t level, uint32_t slot);
+
+    uint32_t m_numTimers;
+    uint32_t m_numArmed;
+    uint32_t m_now;                          //!< The last tick processed.
+    uint32_t * mp_next;                      //!< Per timer.
+    uint32_t * mp_prev;                      //!< Per timer.
+    uint32_t * mp_expiry;                    //!< Per timer.
+    uint16_t * mp_slot;                      //!< Per timer, the list it is in or NOT_ARMED.
+    uint32_t m_heads[TIMER_WHEEL_NUM_LEVELS * TIMER_WHEEL_SLOTS_PER_LEVEL];
+};
+
+#endif
+
+// End Of File
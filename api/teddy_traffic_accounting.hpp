@@ -0,0 +1,129 @@
+/* Teddy traffic accounting definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_TRAFFIC_ACCOUNTING_HPP
+#define TEDDY_TRAFFIC_ACCOUNTING_HPP
+
+/**
+ * @file teddy_traffic_accounting.hpp
+ * This file defines the types and functions for turning the
+ * cumulative counters of TrafficReportIndUlMsg_t (and
+ * TrafficReportGetCnfUlMsg_t, which carries the same structure) into
+ * per-interval deltas and comparing them with what the server itself
+ * counted, to estimate uplink and downlink loss.
+ *
+ * The device counters run from the last InitInd and are 32 bits
+ * wide, so a report may show a counter lower than the last one for
+ * two reasons: the counter has wrapped or the device has restarted
+ * without the server seeing the InitInd.  A fall from the top
+ * quarter of the range into the bottom quarter is taken as a wrap,
+ * anything else as a restart.
+ *
+ * The per-device state (the baseline report, the server counts
+ * since it and the running totals) is kept by the DeviceRegistry,
+ * see DeviceRegistry::initTrafficAccounting(); all of the work is
+ * incremental, done as each report is decoded.
+ */
+
+#include <stdint.h>
+#include <teddy_msgs.hpp>
+#include <teddy_server.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// A counter that falls from at least this to below
+// TRAFFIC_WRAP_TO is taken to have wrapped
+#define TRAFFIC_WRAP_FROM 0xC0000000UL
+#define TRAFFIC_WRAP_TO   0x40000000UL
+
+/// Bits in TrafficDelta_t.flags
+#define TRAFFIC_DELTA_FIRST   0x01 //!< No earlier report: the deltas run from the InitInd.
+#define TRAFFIC_DELTA_WRAPPED 0x02 //!< At least one counter wrapped.
+#define TRAFFIC_DELTA_RESET   0x04 //!< The device restarted unseen: the deltas run from then.
+#define TRAFFIC_DELTA_RESTART 0x08 //!< The interval spans a restart so isn't in the totals.
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// What the server counted for a device between traffic reports,
+// in the device's terms: uplink is what the device sent.
+typedef struct TrafficServerCountsTag_t
+{
+    uint32_t numUlDatagrams;
+    uint32_t numUlBytes;
+    uint32_t numDlDatagrams;
+    uint32_t numDlBytes;
+} TrafficServerCounts_t;
+
+/// The traffic of one device over the interval between two
+// traffic reports.
+typedef struct TrafficDeltaTag_t
+{
+    TrafficReportIndUlMsg_t device;      //!< Deltas of the device's own counters.
+    TrafficServerCounts_t server;        //!< What the server counted over the same interval.
+    uint32_t intervalSeconds;            //!< Zero for the first report.
+    uint8_t flags;                       //!< TRAFFIC_DELTA_x bits.
+} TrafficDelta_t;
+
+/// The running totals for a device, summed over the deltas.
+typedef struct TrafficTotalsTag_t
+{
+    uint64_t numUlDatagramsSent;         //!< By the device.
+    uint64_t numUlDatagramsReceived;     //!< By the server.
+    uint64_t numDlDatagramsSent;         //!< By the server.
+    uint64_t numDlDatagramsReceived;     //!< By the device.
+} TrafficTotals_t;
+
+/// Called for each traffic report decoded.  It is called with the
+// device's shard of the DeviceRegistry locked so it must not call
+// back into the DeviceRegistry.
+// \param pContext  The context pointer given to initTrafficAccounting().
+// \param deviceId  The device.
+// \param pDelta    The traffic since the last report.
+// \param pTotals   The running totals including this delta.
+typedef void (*TrafficDeltaCallback_t) (void * pContext,
+                                        DeviceId_t deviceId,
+                                        const TrafficDelta_t * pDelta,
+                                        const TrafficTotals_t * pTotals);
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Work out the delta between two cumulative traffic reports.
+// \param pPrevious  The previous report, NULL if there isn't one
+//                   since the last InitInd.
+// \param pCurrent   The new report.
+// \param pDelta     A place to put the deltas.
+// \return           TRAFFIC_DELTA_x flags.
+uint8_t trafficReportDelta (const TrafficReportIndUlMsg_t * pPrevious,
+                            const TrafficReportIndUlMsg_t * pCurrent,
+                            TrafficReportIndUlMsg_t * pDelta);
+
+/// Add a delta to the running totals.
+// \param pTotals  The totals.
+// \param pDelta   The delta.
+void trafficAddDelta (TrafficTotals_t * pTotals, const TrafficDelta_t * pDelta);
+
+/// Estimate the loss in one direction.
+// \param numSent      The number of datagrams sent.
+// \param numReceived  The number of datagrams received.
+// \return             The percentage lost, 0 to 100; 0 if nothing
+//                     was sent or more was received than sent.
+double trafficLossPercent (uint64_t numSent, uint64_t numReceived);
+
+#endif
+
+// End Of File
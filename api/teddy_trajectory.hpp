@@ -0,0 +1,157 @@
+/* Teddy GPS trajectory simplifier definitions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+#ifndef TEDDY_TRAJECTORY_HPP
+#define TEDDY_TRAJECTORY_HPP
+
+/**
+ * @file teddy_trajectory.hpp
+ * This file defines an online simplifier for the GPS positions in a
+ * time-ordered stream of sensor readings, e.g. the output of a
+ * ReorderBuffer on its way to a SensorStore.  A teddy that sits
+ * still, or moves slowly, reports long runs of nearly the same
+ * position; only those positions needed to follow its track to
+ * within a given error are kept.
+ *
+ * The bound is by dead reckoning: each device has the last position
+ * kept and a velocity, worked out from the last two positions kept,
+ * and a new position is dropped if it is within the error of where
+ * the velocity says the device should be by then.  So a device that
+ * is still keeps only its first position, one moving steadily keeps
+ * a position each time it turns or changes speed, and the decision
+ * on each position is made as it arrives, nothing being held back.
+ * A reader that dead-reckons from the positions kept, or for a still
+ * device just holds the last one, is within the error throughout.
+ *
+ * Only the GPS position is simplified; the rest of a reading is left
+ * alone.  When a position is dropped PIPELINE_PRESENT_GPS_POSITION is
+ * cleared in the presence bitmap of the reading and its GPS fields
+ * are set to those of the last position kept, so that a store with
+ * delta-coded columns spends next to nothing on them.
+ *
+ * Memory per device is constant.  The simplifier is sharded by device
+ * like the SensorStore: each shard must only be fed from one thread
+ * and nothing is locked.
+ */
+
+#include <stdint.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The default error, in metres
+#define TRAJECTORY_DEFAULT_ERROR_METRES 25
+
+/// The maximum number of shards
+#define TRAJECTORY_MAX_SHARDS 64
+
+// ----------------------------------------------------------------
+// CLASSES
+// ----------------------------------------------------------------
+
+/// The trajectory simplifier.
+class TrajectorySimplifier {
+public:
+
+    TrajectorySimplifier (void);
+    ~TrajectorySimplifier (void);
+
+    /// Set up the simplifier.
+    // \param numShards    The number of shards.
+    // \param maxDevices   The maximum number of devices.
+    // \param errorMetres  The error allowed, zero for the default.
+    // \return             true if successful, otherwise false.
+    bool init (uint32_t numShards, uint32_t maxDevices, uint32_t errorMetres);
+
+    /// Get the shard that a device is fed through.
+    // \param deviceId  The device.
+    // \return          The shard index.
+    uint32_t getShardIndex (DeviceId_t deviceId);
+
+    /// Simplify the GPS position of a reading, which must be no
+    // earlier than the previous reading of the device.  Only one
+    // thread may simplify through a given shard.
+    // \param shardIndex      The shard, from getShardIndex().
+    // \param deviceId        The device.
+    // \param pReadings       The readings; if the position is dropped
+    //                        its GPS fields are overwritten.
+    // \param pPresentBitmap  Which readings are present,
+    //                        PIPELINE_PRESENT_x; if the position is
+    //                        dropped PIPELINE_PRESENT_GPS_POSITION is
+    //                        cleared.
+    // \return                true if the position was dropped, false
+    //                        if it was kept, or if there was none, or
+    //                        no room for the device.
+    bool simplify (uint32_t shardIndex, DeviceId_t deviceId,
+                   PipelineReadings_t * pReadings, uint8_t * pPresentBitmap);
+
+    /// Get the positions kept and dropped for one device.  Must be
+    // called from the thread that feeds the device's shard.
+    // \param deviceId      The device.
+    // \param pNumKept      A place to put the positions kept, may be
+    //                      NULL.
+    // \param pNumDropped   A place to put the positions dropped, may
+    //                      be NULL.
+    // \return              true if the device is known, otherwise false.
+    bool getDeviceStats (DeviceId_t deviceId, uint32_t * pNumKept, uint32_t * pNumDropped);
+
+    /// Get the positions kept and dropped for all devices.
+    // \param pNumKept     A place to put the positions kept, may be NULL.
+    // \param pNumDropped  A place to put the positions dropped, may be
+    //                     NULL.
+    void getStats (uint64_t * pNumKept, uint64_t * pNumDropped);
+
+private:
+    /// The track of a device.
+    typedef struct DeviceTag_t
+    {
+        uint32_t time;                       //!< Of the last position kept.
+        int32_t gpsLatitude;                 //!< The last position kept.
+        int32_t gpsLongitude;
+        int32_t gpsElevation;
+        int32_t gpsSpeed;
+        int32_t latitudeVelocityQ16;         //!< Units per second, 1.0 = 65536.
+        int32_t longitudeVelocityQ16;
+        uint32_t cosQ16;                     //!< Longitude scale at the last position kept.
+        uint32_t numKept;
+        uint32_t numDropped;
+    } Device_t;
+
+    /// A shard: a table of the devices fed through it.
+    typedef struct ShardTag_t
+    {
+        uint32_t capacity;
+        uint32_t maxEntries;
+        uint32_t numEntries;
+        DeviceId_t * pDeviceIds;             //!< DEVICE_ID_INVALID for empty slots.
+        Device_t * pDevices;
+        uint64_t numKept;
+        uint64_t numDropped;
+        char pad[SERVER_CACHE_LINE_SIZE];
+    } Shard_t;
+
+    /// Find the slot of a device in a shard, adding it if asked to.
+    int64_t findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add);
+    /// Keep the position of a reading as the latest of a device.
+    void keep (Device_t * pDevice, const PipelineReadings_t * pReadings, bool isFirst);
+
+    uint64_t m_errorSquared;                 //!< In 256ths of a GpsPosition_t unit, squared.
+    uint32_t m_numShards;
+    Shard_t * mp_shards;
+};
+
+#endif
+
+// End Of File
@@ -0,0 +1,952 @@
+/* Teddy alert rule engine
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_alert.cpp
+ * This file implements the alert rule compiler and engine.
+ */
+
+#include <stdint.h>
+#include <stddef.h> // for offsetof()
+#include <stdio.h>  // for fopen() and getline()
+#include <stdlib.h> // for malloc(), calloc(), realloc(), posix_memalign(), strtoll(), strtoul() and free()
+#include <string.h> // for memset(), memcpy(), strlen() and strncmp()
+#include <ctype.h>  // for isspace(), isalpha(), isalnum() and isdigit()
+#include <teddy_msgs.hpp>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_alert.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The initial sizes of the growable arrays
+#define INITIAL_MAX_RULES 64
+#define INITIAL_MAX_CODE_SIZE 1024
+
+/// The number of bits the operand of an instruction is shifted by.
+#define OPERAND_SHIFT 8
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// The instructions; each is a 32-bit word, an Op_t in the bottom
+// byte and, for those that take a field, the field index above it.
+// The constant of OP_CONST follows it as two words, low then high;
+// that of a fused comparison, which must fit 32 bits, as one word.
+typedef enum
+{
+    OP_END,
+    OP_FIELD,
+    OP_CONST,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_NOT,
+    OP_AND,
+    OP_OR,
+    OP_LT,                          // The comparisons must be in this
+    OP_LE,                          // order, matching the fused
+    OP_GT,                          // comparisons of a field with a
+    OP_GE,                          // constant below
+    OP_EQ,
+    OP_NE,
+    OP_FIELD_LT_CONST,
+    OP_FIELD_LE_CONST,
+    OP_FIELD_GT_CONST,
+    OP_FIELD_GE_CONST,
+    OP_FIELD_EQ_CONST,
+    OP_FIELD_NE_CONST
+} Op_t;
+
+/// A field that a rule can refer to.
+typedef struct FieldTag_t
+{
+    const char * pName;              //!< As in PipelineReadings_t.
+    const char * pPath;              //!< As in SensorReadings_t.
+    uint8_t offset;                  //!< Into PipelineReadings_t.
+    uint8_t size;
+    bool isSigned;
+    uint8_t presentBit;              //!< The PIPELINE_PRESENT_x it belongs to, 0 for always.
+} Field_t;
+
+/// A named constant.
+typedef struct ConstantTag_t
+{
+    const char * pName;
+    int32_t value;
+} Constant_t;
+
+/// The state of the compilation of a rule.
+typedef struct CompilerTag_t
+{
+    const char * pText;
+    const char * pPosition;
+    bool ok;
+    int32_t code[ALERT_MAX_RULE_CODE];
+    uint32_t size;
+    uint32_t depth;
+    uint32_t maxDepth;
+    uint8_t requiredBitmap;
+} Compiler_t;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The fields, the index into this table being the operand of
+// OP_FIELD.
+static const Field_t gFields[] =
+{
+    {"time",             "time",                          offsetof (PipelineReadings_t, time),             4, false, 0},
+    {"gpsLatitude",      "gpsPosition.latitude",          offsetof (PipelineReadings_t, gpsLatitude),      4, true,  PIPELINE_PRESENT_GPS_POSITION},
+    {"gpsLongitude",     "gpsPosition.longitude",         offsetof (PipelineReadings_t, gpsLongitude),     4, true,  PIPELINE_PRESENT_GPS_POSITION},
+    {"gpsElevation",     "gpsPosition.elevation",         offsetof (PipelineReadings_t, gpsElevation),     4, true,  PIPELINE_PRESENT_GPS_POSITION},
+    {"gpsSpeed",         "gpsPosition.speed",             offsetof (PipelineReadings_t, gpsSpeed),         4, true,  PIPELINE_PRESENT_GPS_POSITION},
+    {"orientation",      "lclPosition.orientation",       offsetof (PipelineReadings_t, orientation),      1, false, PIPELINE_PRESENT_LCL_POSITION},
+    {"hugsThisPeriod",   "lclPosition.hugsThisPeriod",    offsetof (PipelineReadings_t, hugsThisPeriod),   1, false, PIPELINE_PRESENT_LCL_POSITION},
+    {"slapsThisPeriod",  "lclPosition.slapsThisPeriod",   offsetof (PipelineReadings_t, slapsThisPeriod),  1, false, PIPELINE_PRESENT_LCL_POSITION},
+    {"dropsThisPeriod",  "lclPosition.dropsThisPeriod",   offsetof (PipelineReadings_t, dropsThisPeriod),  1, false, PIPELINE_PRESENT_LCL_POSITION},
+    {"nudgesThisPeriod", "lclPosition.nudgesThisPeriod",  offsetof (PipelineReadings_t, nudgesThisPeriod), 1, false, PIPELINE_PRESENT_LCL_POSITION},
+    {"soundLevel",       "soundLevel",                    offsetof (PipelineReadings_t, soundLevel),       2, false, PIPELINE_PRESENT_SOUND_LEVEL},
+    {"luminosity",       "luminosity",                    offsetof (PipelineReadings_t, luminosity),       2, false, PIPELINE_PRESENT_LUMINOSITY},
+    {"temperature",      "temperature",                   offsetof (PipelineReadings_t, temperature),      1, true,  PIPELINE_PRESENT_TEMPERATURE},
+    {"rssi",             "rssi",                          offsetof (PipelineReadings_t, rssi),             1, false, PIPELINE_PRESENT_RSSI},
+    {"chargeState",      "powerState.chargeState",        offsetof (PipelineReadings_t, chargeState),      1, false, PIPELINE_PRESENT_POWER_STATE},
+    {"batteryMV",        "powerState.batteryMV",          offsetof (PipelineReadings_t, batteryMV),        2, false, PIPELINE_PRESENT_POWER_STATE},
+    {"energyUWH",        "powerState.energyUWH",          offsetof (PipelineReadings_t, energyUWH),        4, false, PIPELINE_PRESENT_POWER_STATE}
+};
+
+/// The number of fields.
+#define NUM_FIELDS (sizeof (gFields) / sizeof (gFields[0]))
+
+/// The named constants.
+static const Constant_t gConstants[] =
+{
+    {"ORIENTATION_UNCERTAIN",     ORIENTATION_UNCERTAIN},
+    {"ORIENTATION_FACE_UP",       ORIENTATION_FACE_UP},
+    {"ORIENTATION_FACE_DOWN",     ORIENTATION_FACE_DOWN},
+    {"ORIENTATION_UPRIGHT",       ORIENTATION_UPRIGHT},
+    {"ORIENTATION_UPSIDE_DOWN",   ORIENTATION_UPSIDE_DOWN},
+    {"ORIENTATION_ON_LEFT_SIDE",  ORIENTATION_ON_LEFT_SIDE},
+    {"ORIENTATION_ON_RIGHT_SIDE", ORIENTATION_ON_RIGHT_SIDE},
+    {"CHARGING_UNKNOWN",          CHARGING_UNKNOWN},
+    {"CHARGING_OFF",              CHARGING_OFF},
+    {"CHARGING_ON",               CHARGING_ON},
+    {"CHARGING_FAULT",            CHARGING_FAULT}
+};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void compileOr (Compiler_t * pCompiler);
+
+/// Add an instruction, noting its effect on the stack depth.
+static void emit (Compiler_t * pCompiler, int32_t op, int32_t operand, int32_t depthChange)
+{
+    if (pCompiler->size < ALERT_MAX_RULE_CODE)
+    {
+        pCompiler->code[pCompiler->size] = op | (operand << OPERAND_SHIFT);
+        pCompiler->size++;
+    }
+    else
+    {
+        pCompiler->ok = false;
+    }
+    pCompiler->depth += depthChange;
+    if (pCompiler->depth > pCompiler->maxDepth)
+    {
+        pCompiler->maxDepth = pCompiler->depth;
+    }
+}
+
+/// Add a constant, following its instruction.
+static void emitConstant (Compiler_t * pCompiler, int64_t value)
+{
+    if (pCompiler->size + 2 <= ALERT_MAX_RULE_CODE)
+    {
+        pCompiler->code[pCompiler->size] = (int32_t) (uint32_t) value;
+        pCompiler->code[pCompiler->size + 1] = (int32_t) (uint32_t) ((uint64_t) value >> 32);
+        pCompiler->size += 2;
+    }
+    else
+    {
+        pCompiler->ok = false;
+    }
+}
+
+/// Read back a constant.
+static inline int64_t readConstant (const int32_t * pCode)
+{
+    return (int64_t) (((uint64_t) (uint32_t) pCode[1] << 32) | (uint32_t) pCode[0]);
+}
+
+static void skipSpace (Compiler_t * pCompiler)
+{
+    while (isspace ((unsigned char) *pCompiler->pPosition))
+    {
+        pCompiler->pPosition++;
+    }
+}
+
+static bool isNameCharacter (char character)
+{
+    return isalnum ((unsigned char) character) || (character == '_') || (character == '.');
+}
+
+/// Get the length of the name at the current position, zero if there
+// isn't one.
+static uint32_t nameLength (Compiler_t * pCompiler)
+{
+    uint32_t length = 0;
+
+    skipSpace (pCompiler);
+    if (isalpha ((unsigned char) *pCompiler->pPosition) || (*pCompiler->pPosition == '_'))
+    {
+        while (isNameCharacter (pCompiler->pPosition[length]))
+        {
+            length++;
+        }
+    }
+
+    return length;
+}
+
+/// Move past a keyword if it is next.
+static bool matchWord (Compiler_t * pCompiler, const char * pWord)
+{
+    bool matched = false;
+    uint32_t length = nameLength (pCompiler);
+
+    if ((length == strlen (pWord)) && (strncmp (pCompiler->pPosition, pWord, length) == 0))
+    {
+        pCompiler->pPosition += length;
+        matched = true;
+    }
+
+    return matched;
+}
+
+/// Move past a symbol if it is next.
+static bool matchSymbol (Compiler_t * pCompiler, const char * pSymbol)
+{
+    bool matched = false;
+    uint32_t length = strlen (pSymbol);
+
+    skipSpace (pCompiler);
+    if (strncmp (pCompiler->pPosition, pSymbol, length) == 0)
+    {
+        pCompiler->pPosition += length;
+        matched = true;
+    }
+
+    return matched;
+}
+
+/// primary := number | field | constant | "(" or ")" | "-" primary
+static void compilePrimary (Compiler_t * pCompiler)
+{
+    uint32_t length;
+    uint32_t start;
+    char * pEnd;
+    int64_t value;
+    bool found = false;
+
+    if (!pCompiler->ok)
+    {
+        // Give up
+    }
+    else if (matchSymbol (pCompiler, "("))
+    {
+        compileOr (pCompiler);
+        if (!matchSymbol (pCompiler, ")"))
+        {
+            pCompiler->ok = false;
+        }
+    }
+    else if (matchSymbol (pCompiler, "-"))
+    {
+        start = pCompiler->size;
+        compilePrimary (pCompiler);
+        if (pCompiler->ok && (pCompiler->size == start + 3) && (pCompiler->code[start] == OP_CONST))
+        {
+            // Fold the negative into the constant
+            pCompiler->size = start + 1;
+            emitConstant (pCompiler, -readConstant (&(pCompiler->code[start + 1])));
+        }
+        else
+        {
+            emit (pCompiler, OP_NEG, 0, 0);
+        }
+    }
+    else if (isdigit ((unsigned char) *pCompiler->pPosition))
+    {
+        value = strtoll (pCompiler->pPosition, &pEnd, 10);
+        pCompiler->pPosition = pEnd;
+        emit (pCompiler, OP_CONST, 0, 1);
+        emitConstant (pCompiler, value);
+    }
+    else
+    {
+        length = nameLength (pCompiler);
+        for (uint32_t x = 0; (length > 0) && !found && (x < NUM_FIELDS); x++)
+        {
+            if (((strlen (gFields[x].pName) == length) && (strncmp (pCompiler->pPosition, gFields[x].pName, length) == 0)) ||
+                ((strlen (gFields[x].pPath) == length) && (strncmp (pCompiler->pPosition, gFields[x].pPath, length) == 0)))
+            {
+                emit (pCompiler, OP_FIELD, (int32_t) x, 1);
+                pCompiler->requiredBitmap |= gFields[x].presentBit;
+                found = true;
+            }
+        }
+        for (uint32_t x = 0; (length > 0) && !found && (x < sizeof (gConstants) / sizeof (gConstants[0])); x++)
+        {
+            if ((strlen (gConstants[x].pName) == length) && (strncmp (pCompiler->pPosition, gConstants[x].pName, length) == 0))
+            {
+                emit (pCompiler, OP_CONST, 0, 1);
+                emitConstant (pCompiler, gConstants[x].value);
+                found = true;
+            }
+        }
+        if (found)
+        {
+            pCompiler->pPosition += length;
+        }
+        else
+        {
+            pCompiler->ok = false;
+        }
+    }
+}
+
+/// sum := primary (("+" | "-") primary)*
+static void compileSum (Compiler_t * pCompiler)
+{
+    compilePrimary (pCompiler);
+    while (pCompiler->ok)
+    {
+        if (matchSymbol (pCompiler, "+"))
+        {
+            compilePrimary (pCompiler);
+            emit (pCompiler, OP_ADD, 0, -1);
+        }
+        else if (matchSymbol (pCompiler, "-"))
+        {
+            compilePrimary (pCompiler);
+            emit (pCompiler, OP_SUB, 0, -1);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+/// comparison := sum [("<" | "<=" | ">" | ">=" | "==" | "=" | "!=") sum]
+static void compileComparison (Compiler_t * pCompiler)
+{
+    int32_t op = OP_END;
+    uint32_t left;
+    uint32_t right;
+    int32_t field;
+    int64_t value;
+
+    left = pCompiler->size;
+    compileSum (pCompiler);
+    if (!pCompiler->ok)
+    {
+        // Give up
+    }
+    else if (matchSymbol (pCompiler, "<="))
+    {
+        op = OP_LE;
+    }
+    else if (matchSymbol (pCompiler, ">="))
+    {
+        op = OP_GE;
+    }
+    else if (matchSymbol (pCompiler, "=="))
+    {
+        op = OP_EQ;
+    }
+    else if (matchSymbol (pCompiler, "!="))
+    {
+        op = OP_NE;
+    }
+    else if (matchSymbol (pCompiler, "<"))
+    {
+        op = OP_LT;
+    }
+    else if (matchSymbol (pCompiler, ">"))
+    {
+        op = OP_GT;
+    }
+    else if (matchSymbol (pCompiler, "="))
+    {
+        op = OP_EQ;
+    }
+
+    if (op != OP_END)
+    {
+        right = pCompiler->size;
+        compileSum (pCompiler);
+        if (pCompiler->ok)
+        {
+            // A field and a constant, either way round, become a
+            // single instruction
+            if ((right == left + 1) && (pCompiler->size == right + 3) &&
+                ((pCompiler->code[left] & 0xFF) == OP_FIELD) && (pCompiler->code[right] == OP_CONST))
+            {
+                field = pCompiler->code[left] >> OPERAND_SHIFT;
+                value = readConstant (&(pCompiler->code[right + 1]));
+            }
+            else if ((right == left + 3) && (pCompiler->size == right + 1) &&
+                     (pCompiler->code[left] == OP_CONST) && ((pCompiler->code[right] & 0xFF) == OP_FIELD))
+            {
+                field = pCompiler->code[right] >> OPERAND_SHIFT;
+                value = readConstant (&(pCompiler->code[left + 1]));
+                switch (op)
+                {
+                    case OP_LT:
+                        op = OP_GT;
+                    break;
+                    case OP_LE:
+                        op = OP_GE;
+                    break;
+                    case OP_GT:
+                        op = OP_LT;
+                    break;
+                    case OP_GE:
+                        op = OP_LE;
+                    break;
+                    default:
+                    break;
+                }
+            }
+            else
+            {
+                field = -1;
+            }
+            if ((field >= 0) && (value >= INT32_MIN) && (value <= INT32_MAX))
+            {
+                pCompiler->size = left;
+                pCompiler->depth -= 2;
+                emit (pCompiler, op + (OP_FIELD_LT_CONST - OP_LT), field, 1);
+                emit (pCompiler, (int32_t) value, 0, 0);
+                op = OP_END;
+            }
+        }
+        if (op != OP_END)
+        {
+            emit (pCompiler, op, 0, -1);
+        }
+    }
+}
+
+/// not := ("not" | "!") not | comparison
+static void compileNot (Compiler_t * pCompiler)
+{
+    skipSpace (pCompiler);
+    if (matchWord (pCompiler, "not") ||
+        ((pCompiler->pPosition[0] == '!') && (pCompiler->pPosition[1] != '=') && matchSymbol (pCompiler, "!")))
+    {
+        compileNot (pCompiler);
+        emit (pCompiler, OP_NOT, 0, 0);
+    }
+    else
+    {
+        compileComparison (pCompiler);
+    }
+}
+
+/// and := not (("and" | "while" | "&&") not)*
+static void compileAnd (Compiler_t * pCompiler)
+{
+    compileNot (pCompiler);
+    while (pCompiler->ok &&
+           (matchWord (pCompiler, "and") || matchWord (pCompiler, "while") || matchSymbol (pCompiler, "&&")))
+    {
+        compileNot (pCompiler);
+        emit (pCompiler, OP_AND, 0, -1);
+    }
+}
+
+/// or := and (("or" | "||") and)*
+static void compileOr (Compiler_t * pCompiler)
+{
+    compileAnd (pCompiler);
+    while (pCompiler->ok && (matchWord (pCompiler, "or") || matchSymbol (pCompiler, "||")))
+    {
+        compileAnd (pCompiler);
+        emit (pCompiler, OP_OR, 0, -1);
+    }
+}
+
+/// Read the fields of a reading, in gFields order.
+static void readFields (const PipelineReadings_t * pReadings, int64_t * pFields)
+{
+    const uint8_t * pBase = (const uint8_t *) pReadings;
+
+    for (uint32_t x = 0; x < NUM_FIELDS; x++)
+    {
+        const uint8_t * pField = pBase + gFields[x].offset;
+
+        switch (gFields[x].size)
+        {
+            case 1:
+                pFields[x] = gFields[x].isSigned ? (int64_t) *(const int8_t *) pField : (int64_t) *pField;
+            break;
+            case 2:
+                pFields[x] = *(const uint16_t *) pField;
+            break;
+            default:
+                pFields[x] = gFields[x].isSigned ? (int64_t) *(const int32_t *) pField :
+                                                   (int64_t) *(const uint32_t *) pField;
+            break;
+        }
+    }
+}
+
+/// Run the bytecode of a rule.
+static inline int64_t run (const int32_t * pCode, const int64_t * pFields)
+{
+    int64_t stack[ALERT_MAX_STACK_DEPTH + 1];
+    int64_t * pTop = stack;   // The next free entry
+    int32_t word;
+
+    for (;;)
+    {
+        word = *pCode;
+        pCode++;
+        switch (word & 0xFF)
+        {
+            case OP_FIELD:
+                *pTop = pFields[word >> OPERAND_SHIFT];
+                pTop++;
+            break;
+            case OP_CONST:
+                *pTop = readConstant (pCode);
+                pTop++;
+                pCode += 2;
+            break;
+            case OP_ADD:
+                pTop--;
+                pTop[-1] += *pTop;
+            break;
+            case OP_SUB:
+                pTop--;
+                pTop[-1] -= *pTop;
+            break;
+            case OP_NEG:
+                pTop[-1] = -pTop[-1];
+            break;
+            case OP_NOT:
+                pTop[-1] = (pTop[-1] == 0);
+            break;
+            case OP_AND:
+                pTop--;
+                pTop[-1] = (pTop[-1] != 0) && (*pTop != 0);
+            break;
+            case OP_OR:
+                pTop--;
+                pTop[-1] = (pTop[-1] != 0) || (*pTop != 0);
+            break;
+            case OP_LT:
+                pTop--;
+                pTop[-1] = pTop[-1] < *pTop;
+            break;
+            case OP_LE:
+                pTop--;
+                pTop[-1] = pTop[-1] <= *pTop;
+            break;
+            case OP_GT:
+                pTop--;
+                pTop[-1] = pTop[-1] > *pTop;
+            break;
+            case OP_GE:
+                pTop--;
+                pTop[-1] = pTop[-1] >= *pTop;
+            break;
+            case OP_EQ:
+                pTop--;
+                pTop[-1] = pTop[-1] == *pTop;
+            break;
+            case OP_NE:
+                pTop--;
+                pTop[-1] = pTop[-1] != *pTop;
+            break;
+            case OP_FIELD_LT_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] < *pCode;
+                pTop++;
+                pCode++;
+            break;
+            case OP_FIELD_LE_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] <= *pCode;
+                pTop++;
+                pCode++;
+            break;
+            case OP_FIELD_GT_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] > *pCode;
+                pTop++;
+                pCode++;
+            break;
+            case OP_FIELD_GE_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] >= *pCode;
+                pTop++;
+                pCode++;
+            break;
+            case OP_FIELD_EQ_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] == *pCode;
+                pTop++;
+                pCode++;
+            break;
+            case OP_FIELD_NE_CONST:
+                *pTop = pFields[word >> OPERAND_SHIFT] != *pCode;
+                pTop++;
+                pCode++;
+            break;
+            default: // OP_END
+                return stack[0];
+            break;
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t AlertEngine::getSlot (Shard_t * pShard, DeviceId_t deviceId)
+{
+    int64_t slot = -1;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (pShard->numEntries < pShard->maxEntries)
+    {
+        // The counts of an empty slot are already zero
+        pShard->pDeviceIds[x] = deviceId;
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+AlertEngine::AlertEngine (void)
+{
+    mp_rules = NULL;
+    m_numRules = 0;
+    m_maxRules = 0;
+    mp_code = NULL;
+    m_codeSize = 0;
+    m_maxCodeSize = 0;
+    mp_callback = NULL;
+    mp_callbackContext = NULL;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+AlertEngine::~AlertEngine (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        free (mp_shards[x].pDeviceIds);
+        free (mp_shards[x].pCounts);
+    }
+    free (mp_shards);
+    free (mp_rules);
+    free (mp_code);
+}
+
+bool AlertEngine::addRule (uint32_t ruleId, const char * pText, uint32_t * pErrorOffset)
+{
+    bool success = false;
+    Compiler_t * pCompiler = (Compiler_t *) malloc (sizeof (Compiler_t));
+    char * pEnd;
+    unsigned long numInARow = 1;
+    Rule_t * pRules;
+    int32_t * pCode;
+    uint32_t maxRules;
+    uint32_t maxCodeSize;
+
+    if ((pCompiler != NULL) && (mp_shards == NULL) && (m_numRules < ALERT_MAX_RULES))
+    {
+        memset (pCompiler, 0, sizeof (*pCompiler));
+        pCompiler->pText = pText;
+        pCompiler->pPosition = pText;
+        pCompiler->ok = true;
+        compileOr (pCompiler);
+        emit (pCompiler, OP_END, 0, 0);
+        if (pCompiler->ok && matchWord (pCompiler, "for"))
+        {
+            skipSpace (pCompiler);
+            numInARow = strtoul (pCompiler->pPosition, &pEnd, 10);
+            pCompiler->ok = (pEnd != pCompiler->pPosition) && (numInARow > 0) && (numInARow <= ALERT_MAX_IN_A_ROW);
+            pCompiler->pPosition = pEnd;
+            if (!matchWord (pCompiler, "readings"))
+            {
+                matchWord (pCompiler, "reading");
+            }
+        }
+        skipSpace (pCompiler);
+        success = pCompiler->ok && (*pCompiler->pPosition == 0) && (pCompiler->depth == 1) &&
+                  (pCompiler->maxDepth <= ALERT_MAX_STACK_DEPTH);
+
+        if (success && (m_numRules >= m_maxRules))
+        {
+            maxRules = (m_maxRules == 0) ? INITIAL_MAX_RULES : m_maxRules * 2;
+            pRules = (Rule_t *) realloc (mp_rules, sizeof (Rule_t) * maxRules);
+            success = (pRules != NULL);
+            if (success)
+            {
+                mp_rules = pRules;
+                m_maxRules = maxRules;
+            }
+        }
+        if (success && (m_codeSize + pCompiler->size > m_maxCodeSize))
+        {
+            maxCodeSize = (m_maxCodeSize == 0) ? INITIAL_MAX_CODE_SIZE : m_maxCodeSize;
+            while (maxCodeSize < m_codeSize + pCompiler->size)
+            {
+                maxCodeSize *= 2;
+            }
+            pCode = (int32_t *) realloc (mp_code, sizeof (int32_t) * maxCodeSize);
+            success = (pCode != NULL);
+            if (success)
+            {
+                mp_code = pCode;
+                m_maxCodeSize = maxCodeSize;
+            }
+        }
+        if (success)
+        {
+            memcpy (mp_code + m_codeSize, pCompiler->code, sizeof (int32_t) * pCompiler->size);
+            mp_rules[m_numRules].ruleId = ruleId;
+            mp_rules[m_numRules].codeOffset = m_codeSize;
+            mp_rules[m_numRules].requiredBitmap = pCompiler->requiredBitmap;
+            mp_rules[m_numRules].numInARow = (uint8_t) numInARow;
+            m_codeSize += pCompiler->size;
+            m_numRules++;
+        }
+        if (!success && (pErrorOffset != NULL))
+        {
+            *pErrorOffset = (uint32_t) (pCompiler->pPosition - pText);
+        }
+    }
+    free (pCompiler);
+
+    return success;
+}
+
+bool AlertEngine::addFile (const char * pFileName)
+{
+    bool success = false;
+    FILE * pFile = fopen (pFileName, "r");
+    char * pLine = NULL;
+    size_t lineSize = 0;
+    char * pText;
+    char * pEnd;
+    unsigned long ruleId;
+
+    if (pFile != NULL)
+    {
+        success = true;
+        while (success && (getline (&pLine, &lineSize, pFile) >= 0))
+        {
+            pText = pLine;
+            while (isspace ((unsigned char) *pText))
+            {
+                pText++;
+            }
+            if ((*pText != 0) && (*pText != '#'))
+            {
+                ruleId = strtoul (pText, &pEnd, 10);
+                success = (pEnd != pText) && addRule ((uint32_t) ruleId, pEnd, NULL);
+            }
+        }
+        free (pLine);
+        fclose (pFile);
+    }
+
+    return success;
+}
+
+bool AlertEngine::init (uint32_t numShards, uint32_t maxDevices,
+                        AlertCallback_t pCallback, void * pContext)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= ALERT_MAX_SHARDS) &&
+        (maxDevices > 0) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        mp_callback = pCallback;
+        mp_callbackContext = pContext;
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+            // At least one byte per slot so that there's something to
+            // allocate with no rules
+            pShard->pCounts = (uint8_t *) calloc ((size_t) capacity * ((m_numRules > 0) ? m_numRules : 1), sizeof (uint8_t));
+            if ((pShard->pDeviceIds == NULL) || (pShard->pCounts == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t AlertEngine::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+uint32_t AlertEngine::evaluate (uint32_t shardIndex, DeviceId_t deviceId,
+                                const PipelineReadings_t * pReadings, uint8_t presentBitmap)
+{
+    uint32_t numAlerts = 0;
+    Shard_t * pShard = NULL;
+    int64_t slot = -1;
+    int64_t fields[NUM_FIELDS];
+    uint8_t * pCounts;
+    const Rule_t * pRule;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID) && (m_numRules > 0))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = getSlot (pShard, deviceId);
+    }
+
+    if (slot >= 0)
+    {
+        pCounts = pShard->pCounts + (size_t) slot * m_numRules;
+        readFields (pReadings, fields);
+        for (uint32_t x = 0; x < m_numRules; x++)
+        {
+            pRule = &(mp_rules[x]);
+            if ((presentBitmap & pRule->requiredBitmap) == pRule->requiredBitmap)
+            {
+                if (run (mp_code + pRule->codeOffset, fields) != 0)
+                {
+                    if (pCounts[x] < pRule->numInARow)
+                    {
+                        pCounts[x]++;
+                        if (pCounts[x] == pRule->numInARow)
+                        {
+                            if (mp_callback != NULL)
+                            {
+                                mp_callback (mp_callbackContext, deviceId, pRule->ruleId, true, pReadings);
+                            }
+                            pShard->numRaised++;
+                            numAlerts++;
+                        }
+                    }
+                }
+                else
+                {
+                    if (pCounts[x] >= pRule->numInARow)
+                    {
+                        if (mp_callback != NULL)
+                        {
+                            mp_callback (mp_callbackContext, deviceId, pRule->ruleId, false, pReadings);
+                        }
+                        pShard->numCleared++;
+                        numAlerts++;
+                    }
+                    pCounts[x] = 0;
+                }
+            }
+        }
+        pShard->numReadings++;
+    }
+
+    return numAlerts;
+}
+
+uint32_t AlertEngine::evaluateRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord)
+{
+    uint32_t numAlerts = 0;
+
+    if ((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+        (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG))
+    {
+        numAlerts = evaluate (shardIndex, pRecord->deviceId, &(pRecord->u.readings), pRecord->presentBitmap);
+    }
+
+    return numAlerts;
+}
+
+uint32_t AlertEngine::getNumRules (void)
+{
+    return m_numRules;
+}
+
+void AlertEngine::getStats (uint64_t * pNumReadings, uint64_t * pNumRaised, uint64_t * pNumCleared)
+{
+    uint64_t numReadings = 0;
+    uint64_t numRaised = 0;
+    uint64_t numCleared = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numReadings += mp_shards[x].numReadings;
+        numRaised += mp_shards[x].numRaised;
+        numCleared += mp_shards[x].numCleared;
+    }
+
+    if (pNumReadings != NULL)
+    {
+        *pNumReadings = numReadings;
+    }
+    if (pNumRaised != NULL)
+    {
+        *pNumRaised = numRaised;
+    }
+    if (pNumCleared != NULL)
+    {
+        *pNumCleared = numCleared;
+    }
+}
+
+// End Of File
@@ -0,0 +1,430 @@
+/* Teddy change-data-capture
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_cdc.cpp
+ * This file implements the change-data-capture encoder and the
+ * consumer side functions.
+ */
+
+#include <stdint.h>
+#include <stddef.h> // for offsetof()
+#include <stdlib.h> // for calloc(), posix_memalign() and free()
+#include <string.h> // for memset() and memcpy()
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_cdc.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The offsets of the parts of the fixed part of a change record
+#define RECORD_OFFSET_DEVICE_ID      0
+#define RECORD_OFFSET_TIME           8
+#define RECORD_OFFSET_SEQUENCE       12
+#define RECORD_OFFSET_FLAGS          13
+#define RECORD_OFFSET_PRESENT_BITMAP 14
+#define RECORD_OFFSET_FIELD_BITMAP   15
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Where a field lives in PipelineReadings_t.
+typedef struct FieldTag_t
+{
+    uint8_t offset;
+    uint8_t size;
+    uint8_t presentBit;              //!< The PIPELINE_PRESENT_x it belongs to.
+} Field_t;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The fields, in CDC_FIELD_x order.
+static const Field_t gFields[MAX_NUM_CDC_FIELDS] =
+{
+    {offsetof (PipelineReadings_t, gpsLatitude), 4, PIPELINE_PRESENT_GPS_POSITION},      // CDC_FIELD_GPS_LATITUDE
+    {offsetof (PipelineReadings_t, gpsLongitude), 4, PIPELINE_PRESENT_GPS_POSITION},     // CDC_FIELD_GPS_LONGITUDE
+    {offsetof (PipelineReadings_t, gpsElevation), 4, PIPELINE_PRESENT_GPS_POSITION},     // CDC_FIELD_GPS_ELEVATION
+    {offsetof (PipelineReadings_t, gpsSpeed), 4, PIPELINE_PRESENT_GPS_POSITION},         // CDC_FIELD_GPS_SPEED
+    {offsetof (PipelineReadings_t, energyUWH), 4, PIPELINE_PRESENT_POWER_STATE},         // CDC_FIELD_ENERGY_UWH
+    {offsetof (PipelineReadings_t, soundLevel), 2, PIPELINE_PRESENT_SOUND_LEVEL},        // CDC_FIELD_SOUND_LEVEL
+    {offsetof (PipelineReadings_t, luminosity), 2, PIPELINE_PRESENT_LUMINOSITY},         // CDC_FIELD_LUMINOSITY
+    {offsetof (PipelineReadings_t, batteryMV), 2, PIPELINE_PRESENT_POWER_STATE},         // CDC_FIELD_BATTERY_MV
+    {offsetof (PipelineReadings_t, orientation), 1, PIPELINE_PRESENT_LCL_POSITION},      // CDC_FIELD_ORIENTATION
+    {offsetof (PipelineReadings_t, hugsThisPeriod), 1, PIPELINE_PRESENT_LCL_POSITION},   // CDC_FIELD_HUGS
+    {offsetof (PipelineReadings_t, slapsThisPeriod), 1, PIPELINE_PRESENT_LCL_POSITION},  // CDC_FIELD_SLAPS
+    {offsetof (PipelineReadings_t, dropsThisPeriod), 1, PIPELINE_PRESENT_LCL_POSITION},  // CDC_FIELD_DROPS
+    {offsetof (PipelineReadings_t, nudgesThisPeriod), 1, PIPELINE_PRESENT_LCL_POSITION}, // CDC_FIELD_NUDGES
+    {offsetof (PipelineReadings_t, temperature), 1, PIPELINE_PRESENT_TEMPERATURE},       // CDC_FIELD_TEMPERATURE
+    {offsetof (PipelineReadings_t, rssi), 1, PIPELINE_PRESENT_RSSI},                     // CDC_FIELD_RSSI
+    {offsetof (PipelineReadings_t, chargeState), 1, PIPELINE_PRESENT_POWER_STATE}        // CDC_FIELD_CHARGE_STATE
+};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Get the value of a field as an unsigned integer of its width.
+static inline uint32_t getField (const PipelineReadings_t * pReadings, uint32_t field)
+{
+    const uint8_t * pValue = ((const uint8_t *) pReadings) + gFields[field].offset;
+    uint32_t value = 0;
+    uint16_t value16;
+
+    switch (gFields[field].size)
+    {
+        case 4:
+            memcpy (&value, pValue, sizeof (value));
+        break;
+        case 2:
+            memcpy (&value16, pValue, sizeof (value16));
+            value = value16;
+        break;
+        default:
+            value = *pValue;
+        break;
+    }
+
+    return value;
+}
+
+/// Set a field from an unsigned integer of its width.
+static inline void setField (PipelineReadings_t * pReadings, uint32_t field, uint32_t value)
+{
+    uint8_t * pValue = ((uint8_t *) pReadings) + gFields[field].offset;
+    uint16_t value16 = (uint16_t) value;
+
+    switch (gFields[field].size)
+    {
+        case 4:
+            memcpy (pValue, &value, sizeof (value));
+        break;
+        case 2:
+            memcpy (pValue, &value16, sizeof (value16));
+        break;
+        default:
+            *pValue = (uint8_t) value;
+        break;
+    }
+}
+
+/// Write an unsigned integer in network byte order.
+static inline void putUint (char * pBuffer, uint64_t value, uint32_t size)
+{
+    for (uint32_t x = size; x > 0; x--)
+    {
+        pBuffer[x - 1] = (char) (value & 0xFF);
+        value >>= 8;
+    }
+}
+
+/// Read an unsigned integer in network byte order.
+static inline uint64_t getUint (const char * pBuffer, uint32_t size)
+{
+    uint64_t value = 0;
+
+    for (uint32_t x = 0; x < size; x++)
+    {
+        value = (value << 8) | (uint8_t) pBuffer[x];
+    }
+
+    return value;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t cdcRecordInfo (const char * pRecord, uint32_t size, DeviceId_t * pDeviceId)
+{
+    uint32_t recordSize = 0;
+    uint32_t fieldBitmap;
+
+    if (size >= CDC_RECORD_HEADER_SIZE)
+    {
+        fieldBitmap = (uint32_t) getUint (pRecord + RECORD_OFFSET_FIELD_BITMAP, 2);
+        recordSize = CDC_RECORD_HEADER_SIZE;
+        for (uint32_t x = 0; x < MAX_NUM_CDC_FIELDS; x++)
+        {
+            if (fieldBitmap & (1 << x))
+            {
+                recordSize += gFields[x].size;
+            }
+        }
+        if (recordSize > size)
+        {
+            recordSize = 0;
+        }
+        else if (pDeviceId != NULL)
+        {
+            *pDeviceId = getUint (pRecord + RECORD_OFFSET_DEVICE_ID, 8);
+        }
+    }
+
+    return recordSize;
+}
+
+bool cdcApply (const char * pRecord, uint32_t size, CdcState_t * pState)
+{
+    bool applied = false;
+    DeviceId_t deviceId;
+    uint32_t fieldBitmap;
+    uint8_t sequence;
+    const char * pValue;
+
+    if (cdcRecordInfo (pRecord, size, &deviceId) > 0)
+    {
+        sequence = (uint8_t) pRecord[RECORD_OFFSET_SEQUENCE];
+        if (pRecord[RECORD_OFFSET_FLAGS] & CDC_RECORD_FLAG_KEY)
+        {
+            // Start again from nothing
+            memset (pState, 0, sizeof (*pState));
+            pState->deviceId = deviceId;
+            pState->synced = true;
+        }
+        else if ((deviceId == pState->deviceId) && (sequence != (uint8_t) (pState->sequence + 1)))
+        {
+            // A record has been lost: carry on but don't vouch for
+            // the state until the next key record
+            pState->synced = false;
+        }
+
+        if (deviceId == pState->deviceId)
+        {
+            pState->sequence = sequence;
+            pState->readings.time = (uint32_t) getUint (pRecord + RECORD_OFFSET_TIME, 4);
+            pState->presentBitmap = (uint8_t) pRecord[RECORD_OFFSET_PRESENT_BITMAP];
+            fieldBitmap = (uint32_t) getUint (pRecord + RECORD_OFFSET_FIELD_BITMAP, 2);
+            pValue = pRecord + CDC_RECORD_HEADER_SIZE;
+            for (uint32_t x = 0; x < MAX_NUM_CDC_FIELDS; x++)
+            {
+                if (fieldBitmap & (1 << x))
+                {
+                    setField (&(pState->readings), x, (uint32_t) getUint (pValue, gFields[x].size));
+                    pValue += gFields[x].size;
+                }
+            }
+            applied = pState->synced;
+        }
+    }
+
+    return applied;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t CdcEncoder::getSlot (Shard_t * pShard, DeviceId_t deviceId, bool * pIsNew)
+{
+    int64_t slot = -1;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    *pIsNew = false;
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (pShard->numEntries < pShard->maxEntries)
+    {
+        pShard->pDeviceIds[x] = deviceId;
+        memset (&(pShard->pDevices[x]), 0, sizeof (pShard->pDevices[x]));
+        pShard->numEntries++;
+        *pIsNew = true;
+        slot = x;
+    }
+
+    return slot;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+CdcEncoder::CdcEncoder (void)
+{
+    m_keyInterval = 0;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+CdcEncoder::~CdcEncoder (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        free (mp_shards[x].pDeviceIds);
+        free (mp_shards[x].pDevices);
+    }
+    free (mp_shards);
+}
+
+bool CdcEncoder::init (uint32_t numShards, uint32_t maxDevices, uint32_t keyInterval)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if (keyInterval == 0)
+    {
+        keyInterval = CDC_DEFAULT_KEY_INTERVAL;
+    }
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= CDC_MAX_SHARDS) &&
+        (maxDevices > 0) && (keyInterval <= UINT16_MAX) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        m_keyInterval = keyInterval;
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+            pShard->pDevices = (Device_t *) calloc (capacity, sizeof (Device_t));
+            if ((pShard->pDeviceIds == NULL) || (pShard->pDevices == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t CdcEncoder::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+uint32_t CdcEncoder::encode (uint32_t shardIndex, DeviceId_t deviceId,
+                             const PipelineReadings_t * pReadings, uint8_t presentBitmap,
+                             char * pBuffer)
+{
+    uint32_t size = 0;
+    Shard_t * pShard = NULL;
+    Device_t * pDevice;
+    uint32_t fieldBitmap = 0;
+    uint32_t value;
+    uint8_t flags = 0;
+    bool isNew = false;
+    int64_t slot = -1;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = getSlot (pShard, deviceId, &isNew);
+    }
+
+    if (slot >= 0)
+    {
+        pDevice = &(pShard->pDevices[slot]);
+        if (isNew || (pDevice->numSinceKey >= m_keyInterval))
+        {
+            flags |= CDC_RECORD_FLAG_KEY;
+            pDevice->numSinceKey = 0;
+        }
+        pDevice->numSinceKey++;
+
+        size = CDC_RECORD_HEADER_SIZE;
+        for (uint32_t x = 0; x < MAX_NUM_CDC_FIELDS; x++)
+        {
+            if (presentBitmap & gFields[x].presentBit)
+            {
+                value = getField (pReadings, x);
+                if ((flags & CDC_RECORD_FLAG_KEY) ||
+                    !(pDevice->presentBitmap & gFields[x].presentBit) ||
+                    (value != getField (&(pDevice->readings), x)))
+                {
+                    fieldBitmap |= 1 << x;
+                    putUint (pBuffer + size, value, gFields[x].size);
+                    size += gFields[x].size;
+                }
+            }
+        }
+
+        putUint (pBuffer + RECORD_OFFSET_DEVICE_ID, deviceId, 8);
+        putUint (pBuffer + RECORD_OFFSET_TIME, pReadings->time, 4);
+        pBuffer[RECORD_OFFSET_SEQUENCE] = (char) pDevice->sequence;
+        pBuffer[RECORD_OFFSET_FLAGS] = (char) flags;
+        pBuffer[RECORD_OFFSET_PRESENT_BITMAP] = (char) presentBitmap;
+        putUint (pBuffer + RECORD_OFFSET_FIELD_BITMAP, fieldBitmap, 2);
+
+        pDevice->readings = *pReadings;
+        pDevice->presentBitmap = presentBitmap;
+        pDevice->sequence++;
+        pShard->numRecords++;
+        pShard->numBytes += size;
+    }
+
+    return size;
+}
+
+uint32_t CdcEncoder::encodeRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord,
+                                   char * pBuffer)
+{
+    uint32_t size = 0;
+
+    if ((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+        (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG))
+    {
+        size = encode (shardIndex, pRecord->deviceId, &(pRecord->u.readings),
+                       pRecord->presentBitmap, pBuffer);
+    }
+
+    return size;
+}
+
+void CdcEncoder::getStats (uint64_t * pNumRecords, uint64_t * pNumBytes, uint64_t * pNumFullBytes)
+{
+    uint64_t numRecords = 0;
+    uint64_t numBytes = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numRecords += mp_shards[x].numRecords;
+        numBytes += mp_shards[x].numBytes;
+    }
+
+    if (pNumRecords != NULL)
+    {
+        *pNumRecords = numRecords;
+    }
+    if (pNumBytes != NULL)
+    {
+        *pNumBytes = numBytes;
+    }
+    if (pNumFullBytes != NULL)
+    {
+        *pNumFullBytes = numRecords * sizeof (SensorReadings_t);
+    }
+}
+
+// End Of File
@@ -0,0 +1,546 @@
+/* Teddy column codecs
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_column_codec.cpp
+ * This file implements the column codecs.  Values are bit-packed
+ * least significant bit first and, like the rest of a segment file,
+ * in host byte order.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <teddy_column_codec.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The widest a bit-packed number can be: a delta-of-delta of
+// 32-bit values fits in 34 bits, plus one for the zig-zag.  Anything
+// up to 56 bits can be unpacked with a single 8 byte load.
+#define MAX_PACKED_WIDTH 35
+
+/// The longest a varint can be
+#define MAX_VARINT_LEN 10
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// Somewhere to encode into.
+typedef struct OutTag_t
+{
+    uint8_t * pPos;
+    uint8_t * pEnd;
+    bool overflow;
+} Out_t;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Zig-zag encode.
+static inline uint64_t zigZag (int64_t value)
+{
+    return (((uint64_t) value) << 1) ^ (uint64_t) (value >> 63);
+}
+
+/// Zig-zag decode.
+static inline int64_t unZigZag (uint64_t value)
+{
+    return (int64_t) ((value >> 1) ^ (0 - (value & 1)));
+}
+
+/// Get value index of a column, widened.
+static inline int64_t loadValue (const void * pValues, uint32_t index,
+                                 uint32_t elementSize, bool isSigned)
+{
+    int64_t value = 0;
+
+    switch (elementSize)
+    {
+        case 1:
+            value = isSigned ? (int64_t) ((const int8_t *) pValues)[index] :
+                               (int64_t) ((const uint8_t *) pValues)[index];
+        break;
+        case 2:
+            value = isSigned ? (int64_t) ((const int16_t *) pValues)[index] :
+                               (int64_t) ((const uint16_t *) pValues)[index];
+        break;
+        default:
+            value = isSigned ? (int64_t) ((const int32_t *) pValues)[index] :
+                               (int64_t) ((const uint32_t *) pValues)[index];
+        break;
+    }
+
+    return value;
+}
+
+/// Put a byte.
+static inline void putByte (Out_t * pOut, uint8_t byte)
+{
+    if (pOut->pPos < pOut->pEnd)
+    {
+        *pOut->pPos = byte;
+        pOut->pPos++;
+    }
+    else
+    {
+        pOut->overflow = true;
+    }
+}
+
+/// Put a varint.
+static void putVarint (Out_t * pOut, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        putByte (pOut, (uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    putByte (pOut, (uint8_t) value);
+}
+
+/// Get a varint, returning the number of bytes used, zero if it is
+// malformed.
+static uint32_t getVarint (const uint8_t * pIn, const uint8_t * pEnd, uint64_t * pValue)
+{
+    uint64_t value = 0;
+    uint32_t length = 0;
+    uint32_t shift = 0;
+    bool done = false;
+
+    while (!done && (pIn + length < pEnd) && (length < MAX_VARINT_LEN))
+    {
+        value |= ((uint64_t) (pIn[length] & 0x7F)) << shift;
+        done = (pIn[length] & 0x80) == 0;
+        shift += 7;
+        length++;
+    }
+
+    if (!done)
+    {
+        length = 0;
+    }
+    *pValue = value;
+
+    return length;
+}
+
+/// Bit-pack a block of numbers.
+static void putBlock (Out_t * pOut, const uint64_t * pNumbers, uint32_t numNumbers)
+{
+    uint64_t all = 0;
+    uint32_t width = 0;
+    uint64_t accumulator = 0;
+    uint32_t numBits = 0;
+
+    for (uint32_t x = 0; x < numNumbers; x++)
+    {
+        all |= pNumbers[x];
+    }
+    while ((width < 64) && ((all >> width) != 0))
+    {
+        width++;
+    }
+
+    putByte (pOut, (uint8_t) width);
+    if (width > 0)
+    {
+        for (uint32_t x = 0; x < numNumbers; x++)
+        {
+            accumulator |= pNumbers[x] << numBits;
+            numBits += width;
+            while (numBits >= 8)
+            {
+                putByte (pOut, (uint8_t) accumulator);
+                accumulator >>= 8;
+                numBits -= 8;
+            }
+        }
+        if (numBits > 0)
+        {
+            putByte (pOut, (uint8_t) accumulator);
+        }
+    }
+}
+
+/// Find a bit-packed block of numbers, returning the number of
+// bytes it takes, zero if it is malformed.  Each number is picked out
+// of an 8 byte load so, near the end of the input, the packed bits
+// are copied to pSlack, which must be big enough for a block plus
+// COLUMN_CODEC_READ_SLACK.
+static uint32_t getBlock (const uint8_t * pIn, const uint8_t * pEnd, uint32_t numNumbers,
+                          uint8_t * pSlack, const uint8_t ** ppPacked, uint32_t * pWidth)
+{
+    uint32_t numBytes;
+
+    if ((pIn >= pEnd) || (*pIn > MAX_PACKED_WIDTH))
+    {
+        return 0;
+    }
+
+    *pWidth = *pIn;
+    *ppPacked = pIn + 1;
+    numBytes = (numNumbers * *pWidth + 7) / 8;
+    if (*ppPacked + numBytes > pEnd)
+    {
+        return 0;
+    }
+    if (*ppPacked + numBytes + COLUMN_CODEC_READ_SLACK > pEnd)
+    {
+        memset (pSlack, 0, numBytes + COLUMN_CODEC_READ_SLACK);
+        memcpy (pSlack, *ppPacked, numBytes);
+        *ppPacked = pSlack;
+    }
+
+    return numBytes + 1;
+}
+
+/// Get number index of a bit-packed block.
+static inline uint64_t unpack (const uint8_t * pPacked, uint32_t width,
+                               uint64_t mask, uint32_t index)
+{
+    uint32_t bit = index * width;
+    uint64_t word;
+
+    memcpy (&word, pPacked + (bit >> 3), sizeof (word));
+
+    return (word >> (bit & 7)) & mask;
+}
+
+/// Encode with COLUMN_CODEC_DELTA or COLUMN_CODEC_DELTA_OF_DELTA.
+static void encodeDelta (Out_t * pOut, bool ofDelta,
+                         const void * pValues, uint32_t numValues,
+                         uint32_t elementSize, bool isSigned)
+{
+    uint64_t numbers[COLUMN_CODEC_BLOCK_SIZE];
+    uint32_t numNumbers = 0;
+    int64_t previous;
+    int64_t previousDelta = 0;
+    int64_t value;
+    int64_t delta;
+    uint32_t x = 1;
+
+    previous = loadValue (pValues, 0, elementSize, isSigned);
+    putVarint (pOut, zigZag (previous));
+    if (ofDelta && (numValues > 1))
+    {
+        value = loadValue (pValues, 1, elementSize, isSigned);
+        previousDelta = value - previous;
+        previous = value;
+        putVarint (pOut, zigZag (previousDelta));
+        x++;
+    }
+
+    for (; x < numValues; x++)
+    {
+        value = loadValue (pValues, x, elementSize, isSigned);
+        delta = value - previous;
+        if (ofDelta)
+        {
+            numbers[numNumbers] = zigZag (delta - previousDelta);
+            previousDelta = delta;
+        }
+        else
+        {
+            numbers[numNumbers] = zigZag (delta);
+        }
+        previous = value;
+        numNumbers++;
+        if (numNumbers == COLUMN_CODEC_BLOCK_SIZE)
+        {
+            putBlock (pOut, numbers, numNumbers);
+            numNumbers = 0;
+        }
+    }
+    if (numNumbers > 0)
+    {
+        putBlock (pOut, numbers, numNumbers);
+    }
+}
+
+/// Decode COLUMN_CODEC_DELTA or COLUMN_CODEC_DELTA_OF_DELTA into
+// values of type T.
+template <typename T>
+static bool decodeDelta (bool ofDelta, const uint8_t * pIn, const uint8_t * pEnd,
+                         uint32_t numValues, T * pValues)
+{
+    uint8_t slack[(MAX_PACKED_WIDTH * COLUMN_CODEC_BLOCK_SIZE) / 8 + COLUMN_CODEC_READ_SLACK];
+    const uint8_t * pPacked;
+    uint32_t width;
+    uint64_t mask;
+    uint64_t number;
+    uint32_t numNumbers;
+    uint32_t length;
+    int64_t previous;
+    int64_t delta = 0;
+    uint32_t x = 1;
+
+    length = getVarint (pIn, pEnd, &number);
+    if (length == 0)
+    {
+        return false;
+    }
+    pIn += length;
+    previous = unZigZag (number);
+    pValues[0] = (T) previous;
+    if (ofDelta && (numValues > 1))
+    {
+        length = getVarint (pIn, pEnd, &number);
+        if (length == 0)
+        {
+            return false;
+        }
+        pIn += length;
+        delta = unZigZag (number);
+        previous += delta;
+        pValues[1] = (T) previous;
+        x++;
+    }
+
+    while (x < numValues)
+    {
+        numNumbers = numValues - x;
+        if (numNumbers > COLUMN_CODEC_BLOCK_SIZE)
+        {
+            numNumbers = COLUMN_CODEC_BLOCK_SIZE;
+        }
+        length = getBlock (pIn, pEnd, numNumbers, slack, &pPacked, &width);
+        if (length == 0)
+        {
+            return false;
+        }
+        pIn += length;
+        mask = (((uint64_t) 1) << width) - 1;
+        // Unpacking and summing in the one loop, rather than unpacking
+        // the block first, roughly doubles the speed
+        if (ofDelta && (width > 0))
+        {
+            for (uint32_t y = 0; y < numNumbers; y++)
+            {
+                delta += unZigZag (unpack (pPacked, width, mask, y));
+                previous += delta;
+                pValues[x + y] = (T) previous;
+            }
+        }
+        else if (ofDelta)
+        {
+            for (uint32_t y = 0; y < numNumbers; y++)
+            {
+                previous += delta;
+                pValues[x + y] = (T) previous;
+            }
+        }
+        else if (width > 0)
+        {
+            for (uint32_t y = 0; y < numNumbers; y++)
+            {
+                previous += unZigZag (unpack (pPacked, width, mask, y));
+                pValues[x + y] = (T) previous;
+            }
+        }
+        else
+        {
+            for (uint32_t y = 0; y < numNumbers; y++)
+            {
+                pValues[x + y] = (T) previous;
+            }
+        }
+        x += numNumbers;
+    }
+
+    return true;
+}
+
+/// Encode with COLUMN_CODEC_RLE.
+static void encodeRle (Out_t * pOut, const uint8_t * pValues, uint32_t numValues)
+{
+    uint32_t run;
+
+    for (uint32_t x = 0; x < numValues; x += run)
+    {
+        run = 1;
+        while ((x + run < numValues) && (pValues[x + run] == pValues[x]))
+        {
+            run++;
+        }
+        putByte (pOut, pValues[x]);
+        putVarint (pOut, run);
+    }
+}
+
+/// Decode COLUMN_CODEC_RLE.
+static bool decodeRle (const uint8_t * pIn, const uint8_t * pEnd,
+                       uint32_t numValues, uint8_t * pValues)
+{
+    uint64_t run;
+    uint32_t length;
+    uint8_t value;
+    uint32_t x = 0;
+
+    while (x < numValues)
+    {
+        if (pIn >= pEnd)
+        {
+            return false;
+        }
+        value = *pIn;
+        pIn++;
+        length = getVarint (pIn, pEnd, &run);
+        if ((length == 0) || (run == 0) || (run > numValues - x))
+        {
+            return false;
+        }
+        pIn += length;
+        memset (pValues + x, value, (size_t) run);
+        x += (uint32_t) run;
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t columnCodecMaxEncodedSize (uint32_t numValues, uint32_t elementSize)
+{
+    uint32_t numBlocks = (numValues + COLUMN_CODEC_BLOCK_SIZE - 1) / COLUMN_CODEC_BLOCK_SIZE;
+    uint32_t size = numValues * elementSize;
+    uint32_t deltaSize = (MAX_VARINT_LEN * 2) +
+                         numBlocks * (1 + (MAX_PACKED_WIDTH * COLUMN_CODEC_BLOCK_SIZE) / 8);
+
+    if (deltaSize > size)
+    {
+        size = deltaSize;
+    }
+    // RLE only applies to single bytes and a run of one is two bytes
+    if (numValues * 2 > size)
+    {
+        size = numValues * 2;
+    }
+
+    return size;
+}
+
+uint32_t columnEncode (ColumnCodec_t codec,
+                       const void * pValues, uint32_t numValues,
+                       uint32_t elementSize, bool isSigned,
+                       uint8_t * pOut, uint32_t outSize)
+{
+    Out_t out;
+
+    out.pPos = pOut;
+    out.pEnd = pOut + outSize;
+    out.overflow = false;
+
+    if ((numValues == 0) || ((elementSize != 1) && (elementSize != 2) && (elementSize != 4)))
+    {
+        return 0;
+    }
+
+    switch (codec)
+    {
+        case COLUMN_CODEC_RAW:
+            if (numValues * elementSize <= outSize)
+            {
+                memcpy (pOut, pValues, numValues * elementSize);
+                out.pPos += numValues * elementSize;
+            }
+            else
+            {
+                out.overflow = true;
+            }
+        break;
+        case COLUMN_CODEC_DELTA_OF_DELTA:
+            encodeDelta (&out, true, pValues, numValues, elementSize, isSigned);
+        break;
+        case COLUMN_CODEC_DELTA:
+            encodeDelta (&out, false, pValues, numValues, elementSize, isSigned);
+        break;
+        case COLUMN_CODEC_RLE:
+            if (elementSize == 1)
+            {
+                encodeRle (&out, (const uint8_t *) pValues, numValues);
+            }
+            else
+            {
+                out.overflow = true;
+            }
+        break;
+        default:
+            out.overflow = true;
+        break;
+    }
+
+    return out.overflow ? 0 : (uint32_t) (out.pPos - pOut);
+}
+
+bool columnDecode (ColumnCodec_t codec,
+                   const uint8_t * pIn, uint32_t inSize,
+                   uint32_t numValues, uint32_t elementSize, bool isSigned,
+                   void * pValues)
+{
+    const uint8_t * pEnd = pIn + inSize;
+    bool ofDelta = (codec == COLUMN_CODEC_DELTA_OF_DELTA);
+    bool success = false;
+
+    if (numValues == 0)
+    {
+        return true;
+    }
+
+    switch (codec)
+    {
+        case COLUMN_CODEC_RAW:
+            if (numValues * elementSize <= inSize)
+            {
+                memcpy (pValues, pIn, numValues * elementSize);
+                success = true;
+            }
+        break;
+        case COLUMN_CODEC_DELTA_OF_DELTA:
+        case COLUMN_CODEC_DELTA:
+            // Truncation to the element type does the right thing for
+            // signed and unsigned alike, so only the width matters here
+            (void) isSigned;
+            switch (elementSize)
+            {
+                case 1:
+                    success = decodeDelta (ofDelta, pIn, pEnd, numValues, (uint8_t *) pValues);
+                break;
+                case 2:
+                    success = decodeDelta (ofDelta, pIn, pEnd, numValues, (uint16_t *) pValues);
+                break;
+                case 4:
+                    success = decodeDelta (ofDelta, pIn, pEnd, numValues, (uint32_t *) pValues);
+                break;
+                default:
+                break;
+            }
+        break;
+        case COLUMN_CODEC_RLE:
+            if (elementSize == 1)
+            {
+                success = decodeRle (pIn, pEnd, numValues, (uint8_t *) pValues);
+            }
+        break;
+        default:
+        break;
+    }
+
+    return success;
+}
+
+// End Of File
@@ -0,0 +1,296 @@
+/* Teddy DebugInd template table
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_debug_template.cpp
+ * This file implements the DebugInd template table.
+ */
+
+#include <stdint.h>
+#include <stdio.h>  // for snprintf()
+#include <stdlib.h> // for posix_memalign() and free()
+#include <string.h> // for memset(), memcpy() and memcmp()
+#include <sched.h>  // for sched_yield()
+#include <new>      // for placement new
+#include <atomic>
+#include <teddy_msgs.hpp>
+#include <teddy_server.hpp>
+#include <teddy_debug_template.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The FNV-1a offset basis and prime
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME        0x100000001B3ULL
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Add a character to an FNV-1a hash.
+static inline uint64_t hashChar (uint64_t hash, char c)
+{
+    return (hash ^ (uint8_t) c) * FNV_PRIME;
+}
+
+static inline bool isDigit (char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+DebugTemplateTable::DebugTemplateTable (void)
+{
+    m_capacity = 0;
+    m_maxTemplates = 0;
+    m_numTemplates = 0;
+    m_numNotInterned = 0;
+    mp_slots = NULL;
+}
+
+DebugTemplateTable::~DebugTemplateTable (void)
+{
+    free (mp_slots);
+}
+
+bool DebugTemplateTable::init (uint32_t maxTemplates)
+{
+    bool success = false;
+    void * pMemory;
+
+    if (maxTemplates == 0)
+    {
+        maxTemplates = DEBUG_TEMPLATE_DEFAULT_MAX_TEMPLATES;
+    }
+
+    if (mp_slots == NULL)
+    {
+        // Kept no more than 80% full, though threads inserting at once
+        // may each take one more than maxTemplates
+        m_capacity = (uint32_t) (((uint64_t) maxTemplates * 100) / 80) + 1;
+        if (posix_memalign (&pMemory, SERVER_CACHE_LINE_SIZE, sizeof (Slot_t) * m_capacity) == 0)
+        {
+            memset (pMemory, 0, sizeof (Slot_t) * m_capacity);
+            mp_slots = (Slot_t *) pMemory;
+            for (uint32_t x = 0; x < m_capacity; x++)
+            {
+                new (&(mp_slots[x].state)) std::atomic<uint32_t> (SLOT_EMPTY);
+            }
+            m_maxTemplates = maxTemplates;
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+uint32_t DebugTemplateTable::intern (const char * pString, uint32_t size,
+                                     uint32_t * pParams, uint32_t * pNumParams)
+{
+    uint32_t templateId = DEBUG_TEMPLATE_ID_NONE;
+    char text[MAX_DEBUG_STRING_SIZE];
+    uint32_t textSize = 0;
+    uint32_t params[DEBUG_TEMPLATE_MAX_PARAMS];
+    uint32_t numParams = 0;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    bool ok = (mp_slots != NULL) && (size <= MAX_DEBUG_STRING_SIZE);
+    uint32_t x = 0;
+    uint32_t y;
+    uint32_t slot;
+    uint32_t state;
+    Slot_t * pSlot;
+
+    // Split the string into the template and the parameters
+    while (ok && (x < size))
+    {
+        if (pString[x] == DEBUG_TEMPLATE_PARAM_CHAR)
+        {
+            ok = false;
+        }
+        else if (isDigit (pString[x]) && (numParams < DEBUG_TEMPLATE_MAX_PARAMS))
+        {
+            for (y = x; (y < size) && isDigit (pString[y]); y++)
+            {
+            }
+            if ((y - x <= DEBUG_TEMPLATE_MAX_PARAM_DIGITS) && ((y - x == 1) || (pString[x] != '0')))
+            {
+                params[numParams] = 0;
+                for (; x < y; x++)
+                {
+                    params[numParams] = (params[numParams] * 10) + (pString[x] - '0');
+                }
+                numParams++;
+                text[textSize] = DEBUG_TEMPLATE_PARAM_CHAR;
+                hash = hashChar (hash, text[textSize]);
+                textSize++;
+            }
+            else
+            {
+                // Not a parameter: keep all of the digits, not just
+                // those that would make a parameter
+                for (; x < y; x++)
+                {
+                    text[textSize] = pString[x];
+                    hash = hashChar (hash, text[textSize]);
+                    textSize++;
+                }
+            }
+        }
+        else
+        {
+            text[textSize] = pString[x];
+            hash = hashChar (hash, text[textSize]);
+            textSize++;
+            x++;
+        }
+    }
+
+    // Find the template, or add it
+    slot = (uint32_t) ((((hash ^ (hash >> 32)) & 0xFFFFFFFF) * m_capacity) >> 32);
+    for (uint32_t probes = 0; ok && (probes < m_capacity); probes++)
+    {
+        pSlot = &(mp_slots[slot]);
+        state = pSlot->state.load (std::memory_order_acquire);
+        if (state == SLOT_EMPTY)
+        {
+            if (m_numTemplates.load (std::memory_order_relaxed) >= m_maxTemplates)
+            {
+                break;
+            }
+            if (pSlot->state.compare_exchange_strong (state, SLOT_FILLING, std::memory_order_acquire))
+            {
+                pSlot->hash = (uint32_t) hash;
+                pSlot->size = (uint8_t) textSize;
+                pSlot->numParams = (uint8_t) numParams;
+                memcpy (pSlot->text, text, textSize);
+                m_numTemplates.fetch_add (1, std::memory_order_relaxed);
+                pSlot->state.store (SLOT_READY, std::memory_order_release);
+                templateId = slot + 1;
+                break;
+            }
+            // Another thread got there first: state is now its state
+        }
+        while (state == SLOT_FILLING)
+        {
+            sched_yield ();
+            state = pSlot->state.load (std::memory_order_acquire);
+        }
+        if ((pSlot->hash == (uint32_t) hash) && (pSlot->size == textSize) &&
+            (memcmp (pSlot->text, text, textSize) == 0))
+        {
+            templateId = slot + 1;
+            break;
+        }
+        slot++;
+        if (slot >= m_capacity)
+        {
+            slot = 0;
+        }
+    }
+
+    if (templateId != DEBUG_TEMPLATE_ID_NONE)
+    {
+        memcpy (pParams, params, sizeof (params[0]) * numParams);
+        *pNumParams = numParams;
+    }
+    else
+    {
+        m_numNotInterned.fetch_add (1, std::memory_order_relaxed);
+    }
+
+    return templateId;
+}
+
+const char * DebugTemplateTable::getTemplate (uint32_t templateId, uint32_t * pSize)
+{
+    const char * pText = NULL;
+    Slot_t * pSlot;
+
+    if ((templateId != DEBUG_TEMPLATE_ID_NONE) && (templateId <= m_capacity))
+    {
+        pSlot = &(mp_slots[templateId - 1]);
+        if (pSlot->state.load (std::memory_order_acquire) == SLOT_READY)
+        {
+            pText = pSlot->text;
+            *pSize = pSlot->size;
+        }
+    }
+
+    return pText;
+}
+
+int32_t DebugTemplateTable::format (uint32_t templateId, const uint32_t * pParams, uint32_t numParams,
+                                    char * pBuffer, uint32_t size)
+{
+    int32_t length = -1;
+    const char * pText;
+    uint32_t textSize = 0;
+    uint32_t param = 0;
+    uint32_t used = 0;
+    int32_t written;
+
+    pText = getTemplate (templateId, &textSize);
+    if ((pText != NULL) && (mp_slots[templateId - 1].numParams == numParams) && (size > 0))
+    {
+        length = 0;
+        for (uint32_t x = 0; (length >= 0) && (x < textSize); x++)
+        {
+            if (pText[x] == DEBUG_TEMPLATE_PARAM_CHAR)
+            {
+                written = snprintf (pBuffer + used, size - used, "%u", pParams[param]);
+                param++;
+            }
+            else
+            {
+                written = 1;
+                if (used + 1 < size)
+                {
+                    pBuffer[used] = pText[x];
+                }
+            }
+            if (used + written < size)
+            {
+                used += written;
+            }
+            else
+            {
+                length = -1;
+            }
+        }
+        if (length >= 0)
+        {
+            pBuffer[used] = 0;
+            length = (int32_t) used;
+        }
+    }
+
+    return length;
+}
+
+void DebugTemplateTable::getStats (uint32_t * pNumTemplates, uint64_t * pNumNotInterned)
+{
+    if (pNumTemplates != NULL)
+    {
+        *pNumTemplates = m_numTemplates.load (std::memory_order_relaxed);
+    }
+    if (pNumNotInterned != NULL)
+    {
+        *pNumNotInterned = m_numNotInterned.load (std::memory_order_relaxed);
+    }
+}
+
+// End Of File
@@ -0,0 +1,344 @@
+/* Teddy duplicate datagram filter
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_dedup.cpp
+ * This file implements the duplicate datagram filter.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for posix_memalign() and free()
+#include <string.h> // for memset() and memcpy()
+#include <teddy_server.hpp>
+#include <teddy_dedup.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of 64-bit words in a cache line, which is both a Bloom
+// filter block and a set of the exact table
+#define WORDS_PER_LINE (SERVER_CACHE_LINE_SIZE / sizeof (uint64_t))
+
+/// The share of the memory of a generation, as a divisor, given to
+// the Bloom filter
+#define BLOOM_SHARE_DIVISOR 8
+
+/// Multipliers for mixing
+#define MIX_1 0x9E3779B97F4A7C15ULL
+#define MIX_2 0xFF51AFD7ED558CCDULL
+#define MIX_3 0xC4CEB9FE1A85EC53ULL
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// The final mix of MurmurHash3, so that every input bit affects
+// every output bit.
+static inline uint64_t mix (uint64_t value)
+{
+    value ^= value >> 33;
+    value *= MIX_2;
+    value ^= value >> 33;
+    value *= MIX_3;
+    value ^= value >> 33;
+
+    return value;
+}
+
+/// Choose a line out of a number of lines with 32 bits of a key.
+static inline uint32_t chooseLine (uint64_t bits32, uint32_t numLines)
+{
+    return (uint32_t) (((bits32 & 0xFFFFFFFF) * numLines) >> 32);
+}
+
+/// Form the mask of the Bloom filter bit for one word of a block.
+static inline uint64_t bloomBit (uint64_t key, uint32_t word)
+{
+    // Six bits per word from the top 48 bits of a remix of the key,
+    // the top 32 bits of the key itself having chosen the block
+    return 1ULL << (((key * MIX_1) >> (16 + (word * 6))) & 0x3F);
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+uint64_t DedupFilter::fingerprint (DeviceId_t deviceId, const char * pDatagram, uint32_t size)
+{
+    uint64_t hash = mix (deviceId ^ ((uint64_t) size << 48));
+    uint64_t word;
+
+    for (; size >= sizeof (word); size -= sizeof (word))
+    {
+        memcpy (&word, pDatagram, sizeof (word));
+        pDatagram += sizeof (word);
+        hash = (hash ^ (word * MIX_1)) * MIX_2;
+        hash ^= hash >> 29;
+    }
+    if (size > 0)
+    {
+        word = 0;
+        memcpy (&word, pDatagram, size);
+        hash = (hash ^ (word * MIX_1)) * MIX_2;
+    }
+    hash = mix (hash);
+
+    // Zero marks an empty place in the exact table
+    if (hash == 0)
+    {
+        hash = 1;
+    }
+
+    return hash;
+}
+
+bool DedupFilter::bloomTest (const uint64_t * pBlocks, uint64_t key)
+{
+    const uint64_t * pBlock = pBlocks + ((size_t) chooseLine (key >> 32, m_numBlocks) * WORDS_PER_LINE);
+    uint64_t missing = 0;
+
+    for (uint32_t x = 0; x < WORDS_PER_LINE; x++)
+    {
+        uint64_t bit = bloomBit (key, x);
+        missing |= (pBlock[x] & bit) ^ bit;
+    }
+
+    return missing == 0;
+}
+
+void DedupFilter::bloomAdd (uint64_t * pBlocks, uint64_t key)
+{
+    uint64_t * pBlock = pBlocks + ((size_t) chooseLine (key >> 32, m_numBlocks) * WORDS_PER_LINE);
+
+    for (uint32_t x = 0; x < WORDS_PER_LINE; x++)
+    {
+        pBlock[x] |= bloomBit (key, x);
+    }
+}
+
+bool DedupFilter::exactFind (const uint64_t * pSets, uint64_t key)
+{
+    const uint64_t * pSet = pSets + ((size_t) chooseLine (key, m_numSets) * WORDS_PER_LINE);
+    bool found = false;
+
+    for (uint32_t x = 0; x < WORDS_PER_LINE; x++)
+    {
+        found |= (pSet[x] == key);
+    }
+
+    return found;
+}
+
+void DedupFilter::exactAdd (uint64_t * pSets, uint64_t key)
+{
+    uint64_t * pSet = pSets + ((size_t) chooseLine (key, m_numSets) * WORDS_PER_LINE);
+    uint32_t place = WORDS_PER_LINE;
+
+    for (uint32_t x = 0; (x < WORDS_PER_LINE) && (place == WORDS_PER_LINE); x++)
+    {
+        if (pSet[x] == 0)
+        {
+            place = x;
+        }
+    }
+    if (place == WORDS_PER_LINE)
+    {
+        // Set full: forget one, at random, which can only ever let a
+        // duplicate through
+        place = (uint32_t) (key >> 13) & (WORDS_PER_LINE - 1);
+    }
+    pSet[place] = key;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+DedupFilter::DedupFilter (void)
+{
+    m_numBlocks = 0;
+    m_numSets = 0;
+    m_windowUs = 0;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+DedupFilter::~DedupFilter (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        free (mp_shards[x].pBlocks[0]);
+    }
+    free (mp_shards);
+}
+
+bool DedupFilter::init (uint32_t numShards, uint32_t memoryBytes, uint32_t windowSeconds)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t linesPerGeneration;
+    uint64_t * pLines;
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= DEDUP_MAX_SHARDS) &&
+        (windowSeconds > 0) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        linesPerGeneration = memoryBytes / numShards / 2 / SERVER_CACHE_LINE_SIZE;
+        m_numBlocks = linesPerGeneration / BLOOM_SHARE_DIVISOR;
+        if (m_numBlocks == 0)
+        {
+            m_numBlocks = 1;
+        }
+        m_numSets = linesPerGeneration - m_numBlocks;
+        if (m_numSets == 0)
+        {
+            m_numSets = 1;
+        }
+        m_windowUs = (uint64_t) windowSeconds * 1000000;
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+            size_t size = (size_t) (m_numBlocks + m_numSets) * 2 * SERVER_CACHE_LINE_SIZE;
+
+            pMem = NULL;
+            if (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, size) == 0)
+            {
+                memset (pMem, 0, size);
+                pLines = (uint64_t *) pMem;
+                for (uint32_t x = 0; x < 2; x++)
+                {
+                    pShard->pBlocks[x] = pLines;
+                    pLines += (size_t) m_numBlocks * WORDS_PER_LINE;
+                    pShard->pSets[x] = pLines;
+                    pLines += (size_t) m_numSets * WORDS_PER_LINE;
+                }
+            }
+            else
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t DedupFilter::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool DedupFilter::check (uint32_t shardIndex, DeviceId_t deviceId,
+                         const char * pDatagram, uint32_t size, uint64_t nowUs)
+{
+    bool duplicate = false;
+    bool bloomHit = false;
+    Shard_t * pShard;
+    uint64_t key;
+    uint32_t generation;
+
+    if ((shardIndex < m_numShards) && (mp_shards[shardIndex].pBlocks[0] != NULL))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        if (!pShard->started)
+        {
+            pShard->generationStartUs = nowUs;
+            pShard->started = true;
+        }
+        else if (nowUs - pShard->generationStartUs >= m_windowUs)
+        {
+            // Clear the older generation and make it the current one,
+            // clearing the newer one too if it has also had its time
+            for (uint32_t x = 0; x < 2; x++)
+            {
+                if ((x == 0) || (nowUs - pShard->generationStartUs >= m_windowUs * 2))
+                {
+                    generation = pShard->current ^ 1;
+                    memset (pShard->pBlocks[generation], 0, (size_t) m_numBlocks * SERVER_CACHE_LINE_SIZE);
+                    memset (pShard->pSets[generation], 0, (size_t) m_numSets * SERVER_CACHE_LINE_SIZE);
+                    pShard->current = generation;
+                }
+            }
+            pShard->generationStartUs = nowUs;
+        }
+
+        pShard->numChecked++;
+        key = fingerprint (deviceId, pDatagram, size);
+        for (uint32_t x = 0; (x < 2) && !duplicate; x++)
+        {
+            generation = pShard->current ^ x;
+            if (bloomTest (pShard->pBlocks[generation], key))
+            {
+                bloomHit = true;
+                duplicate = exactFind (pShard->pSets[generation], key);
+            }
+        }
+
+        if (duplicate)
+        {
+            pShard->numDuplicates++;
+        }
+        else
+        {
+            if (bloomHit)
+            {
+                pShard->numFalsePositives++;
+            }
+            bloomAdd (pShard->pBlocks[pShard->current], key);
+            exactAdd (pShard->pSets[pShard->current], key);
+        }
+    }
+
+    return duplicate;
+}
+
+void DedupFilter::getStats (uint64_t * pNumChecked, uint64_t * pNumDuplicates,
+                            uint64_t * pNumFalsePositives)
+{
+    uint64_t numChecked = 0;
+    uint64_t numDuplicates = 0;
+    uint64_t numFalsePositives = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numChecked += mp_shards[x].numChecked;
+        numDuplicates += mp_shards[x].numDuplicates;
+        numFalsePositives += mp_shards[x].numFalsePositives;
+    }
+
+    if (pNumChecked != NULL)
+    {
+        *pNumChecked = numChecked;
+    }
+    if (pNumDuplicates != NULL)
+    {
+        *pNumDuplicates = numDuplicates;
+    }
+    if (pNumFalsePositives != NULL)
+    {
+        *pNumFalsePositives = numFalsePositives;
+    }
+}
+
+// End Of File
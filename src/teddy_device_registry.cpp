@@ -0,0 +1,821 @@
+/* Teddy device registry
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_device_registry.cpp
+ * This file implements the device registry.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for posix_memalign() and free()
+#include <string.h> // for memset()
+#include <new>      // for placement new
+#include <atomic>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_device_registry.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Pack a wake-up code and revision level into one 16-bit entry,
+// saturating the revision level.
+static uint16_t packWakeUpRevision (uint8_t wakeUpCode, uint16_t revisionLevel)
+{
+    if (revisionLevel > DEVICE_REVISION_LEVEL_MAX)
+    {
+        revisionLevel = DEVICE_REVISION_LEVEL_MAX;
+    }
+
+    return (uint16_t) (((wakeUpCode & 0x0F) << DEVICE_REVISION_LEVEL_BITS) | revisionLevel);
+}
+
+/// The later of two times.
+static uint32_t laterTime (uint32_t a, uint32_t b)
+{
+    return (a > b) ? a : b;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+void DeviceRegistry::lockShard (Shard_t * pShard)
+{
+    while (pShard->lock.test_and_set (std::memory_order_acquire))
+    {
+        // Spin; only contended if threads share a shard
+    }
+}
+
+void DeviceRegistry::unlockShard (Shard_t * pShard)
+{
+    pShard->lock.clear (std::memory_order_release);
+}
+
+int64_t DeviceRegistry::findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add)
+{
+    int64_t slot = -1;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (add && (pShard->numEntries < pShard->maxEntries))
+    {
+        pShard->pDeviceIds[x] = deviceId;
+        pShard->pFlags[x] = 0;
+        pShard->pWakeUpRevisions[x] = 0;
+        pShard->pHeartbeatSeconds[x] = 0;
+        pShard->pReportingIntervalMinutes[x] = 0;
+        pShard->pLastInitIndTimes[x] = 0;
+        pShard->pLastPollIndTimes[x] = 0;
+        pShard->pLastSensorsReportTimes[x] = 0;
+        if (pShard->pServerCounts != NULL)
+        {
+            memset (&(pShard->pTraffic[x]), 0, sizeof (pShard->pTraffic[x]));
+            memset (&(pShard->pServerCounts[x]), 0, sizeof (pShard->pServerCounts[x]));
+            memset (&(pShard->pTrafficTotals[x]), 0, sizeof (pShard->pTrafficTotals[x]));
+            pShard->pLastTrafficTimes[x] = 0;
+        }
+        if (pShard->pHandles != NULL)
+        {
+            // There are as many handles as entries so one is free
+            pShard->numFreeHandles--;
+            pShard->pHandles[x] = pShard->pFreeHandles[pShard->numFreeHandles];
+            pShard->pHandleDeviceIds[pShard->pHandles[x]] = deviceId;
+        }
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+void DeviceRegistry::updateSlot (Shard_t * pShard, uint32_t slot,
+                                 MessageCodec::DecodeResult_t result,
+                                 uint32_t reportingIntervalMinutes,
+                                 uint32_t heartbeatSeconds,
+                                 uint8_t wakeUpCode,
+                                 uint16_t revisionLevel,
+                                 const TrafficReportIndUlMsg_t * pTraffic,
+                                 uint32_t now)
+{
+    switch (result)
+    {
+        case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+        {
+            // The device has restarted: what it was told before is
+            // gone and its traffic counters start again
+            pShard->pWakeUpRevisions[slot] = packWakeUpRevision (wakeUpCode, revisionLevel);
+            pShard->pLastInitIndTimes[slot] = now;
+            if (pShard->pFlags[slot] & DEVICE_STATE_TRAFFIC_SEEN)
+            {
+                pShard->pFlags[slot] |= DEVICE_STATE_RESTARTED_SINCE_TRAFFIC;
+            }
+            pShard->pFlags[slot] = (pShard->pFlags[slot] | DEVICE_STATE_INIT_IND_SEEN) &
+                                   ~(DEVICE_STATE_INTERVALS_KNOWN | DEVICE_STATE_TRAFFIC_SEEN);
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+        {
+            pShard->pReportingIntervalMinutes[slot] = reportingIntervalMinutes;
+            pShard->pHeartbeatSeconds[slot] = heartbeatSeconds;
+            pShard->pFlags[slot] |= DEVICE_STATE_INTERVALS_KNOWN;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+        {
+            pShard->pReportingIntervalMinutes[slot] = reportingIntervalMinutes;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+        {
+            pShard->pHeartbeatSeconds[slot] = heartbeatSeconds;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG:
+        {
+            pShard->pLastPollIndTimes[slot] = now;
+            pShard->pFlags[slot] = (pShard->pFlags[slot] | DEVICE_STATE_POLL_IND_SEEN) & ~DEVICE_STATE_POLL_IND_OVERDUE;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+        {
+            pShard->pLastSensorsReportTimes[slot] = now;
+            pShard->pFlags[slot] = (pShard->pFlags[slot] | DEVICE_STATE_SENSORS_REPORT_SEEN) & ~DEVICE_STATE_SENSORS_REPORT_OVERDUE;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG:
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG:
+        {
+            if (pShard->pServerCounts != NULL)
+            {
+                accountTraffic (pShard, slot, pTraffic, now);
+                pShard->pTraffic[slot] = *pTraffic;
+            }
+            pShard->pFlags[slot] = (pShard->pFlags[slot] | DEVICE_STATE_TRAFFIC_SEEN) &
+                                   ~DEVICE_STATE_RESTARTED_SINCE_TRAFFIC;
+        }
+        break;
+        default:
+        {
+            // Nothing else is session state
+        }
+        break;
+    }
+
+    if (pShard->pHandles != NULL)
+    {
+        armLiveness (pShard, slot, result, now);
+    }
+}
+
+uint32_t DeviceRegistry::livenessSeconds (Shard_t * pShard, uint32_t slot, bool sensorsNotPoll)
+{
+    uint32_t reportingSeconds = pShard->pReportingIntervalMinutes[slot] * 60;
+    uint32_t heartbeatSeconds = pShard->pHeartbeatSeconds[slot];
+    uint32_t periodSeconds = reportingSeconds;
+
+    if (sensorsNotPoll)
+    {
+        periodSeconds = heartbeatSeconds;
+        if ((heartbeatSeconds > 0) && (reportingSeconds > periodSeconds))
+        {
+            periodSeconds = ((reportingSeconds + heartbeatSeconds - 1) / heartbeatSeconds) * heartbeatSeconds;
+        }
+    }
+
+    return (uint32_t) ((uint64_t) periodSeconds * DEVICE_LIVENESS_GRACE_PERCENT / 100);
+}
+
+void DeviceRegistry::armLiveness (Shard_t * pShard, uint32_t slot,
+                                  MessageCodec::DecodeResult_t result,
+                                  uint32_t now)
+{
+    uint32_t timerIndex = pShard->pHandles[slot] * 2;
+    uint32_t graceSeconds;
+    uint32_t baseTime;
+    bool rearmPoll = false;
+    bool rearmSensors = false;
+
+    // Only the messages that move the last time or the interval
+    // move a deadline; everything else costs nothing here
+    switch (result)
+    {
+        case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+        case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+        case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+            rearmPoll = true;
+            rearmSensors = true;
+        break;
+        case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+            rearmSensors = true;
+        break;
+        case MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG:
+            rearmPoll = true;
+        break;
+        default:
+        break;
+    }
+
+    // The deadline runs from the last of the message concerned or,
+    // after a restart or if there hasn't been one, from now
+    if (rearmPoll)
+    {
+        graceSeconds = livenessSeconds (pShard, slot, false);
+        if (graceSeconds > 0)
+        {
+            baseTime = now;
+            if ((result != MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG) &&
+                (pShard->pFlags[slot] & DEVICE_STATE_POLL_IND_SEEN))
+            {
+                baseTime = pShard->pLastPollIndTimes[slot];
+            }
+            pShard->wheel.arm (timerIndex, baseTime + graceSeconds);
+        }
+        else
+        {
+            pShard->wheel.cancel (timerIndex);
+        }
+    }
+
+    if (rearmSensors)
+    {
+        graceSeconds = livenessSeconds (pShard, slot, true);
+        if (graceSeconds > 0)
+        {
+            baseTime = now;
+            if ((result != MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG) &&
+                (pShard->pFlags[slot] & DEVICE_STATE_SENSORS_REPORT_SEEN))
+            {
+                baseTime = pShard->pLastSensorsReportTimes[slot];
+            }
+            pShard->wheel.arm (timerIndex + 1, baseTime + graceSeconds);
+        }
+        else
+        {
+            pShard->wheel.cancel (timerIndex + 1);
+        }
+    }
+}
+
+void DeviceRegistry::timerCallback (void * pContext, uint32_t timerIndex, uint32_t expiryTick)
+{
+    TimerContext_t * pTimerContext = (TimerContext_t *) pContext;
+    DeviceRegistry * pRegistry = pTimerContext->pRegistry;
+    Shard_t * pShard = pTimerContext->pShard;
+    DeviceId_t deviceId = pShard->pHandleDeviceIds[timerIndex / 2];
+    int64_t slot = pRegistry->findSlot (pShard, deviceId, false);
+    DeviceLiveness_t what = DEVICE_LIVENESS_POLL_IND_MISSED;
+    uint32_t lastTime;
+
+    if (slot >= 0)
+    {
+        if (timerIndex & 1)
+        {
+            what = DEVICE_LIVENESS_SENSORS_REPORT_MISSED;
+            pShard->pFlags[slot] |= DEVICE_STATE_SENSORS_REPORT_OVERDUE;
+            lastTime = pShard->pLastSensorsReportTimes[slot];
+        }
+        else
+        {
+            pShard->pFlags[slot] |= DEVICE_STATE_POLL_IND_OVERDUE;
+            lastTime = pShard->pLastPollIndTimes[slot];
+        }
+        if (lastTime == 0)
+        {
+            // Never received, so the timer was armed when the
+            // interval became known
+            lastTime = expiryTick - livenessSeconds (pShard, slot, (timerIndex & 1) != 0);
+        }
+        pTimerContext->numFired++;
+        if (pRegistry->m_livenessCallback != NULL)
+        {
+            pRegistry->m_livenessCallback (pRegistry->mp_livenessContext, deviceId, what, lastTime, expiryTick);
+        }
+    }
+}
+
+void DeviceRegistry::accountTraffic (Shard_t * pShard, uint32_t slot,
+                                     const TrafficReportIndUlMsg_t * pTraffic,
+                                     uint32_t now)
+{
+    TrafficDelta_t delta;
+    const TrafficReportIndUlMsg_t * pPrevious = NULL;
+
+    delta.intervalSeconds = 0;
+    if (pShard->pFlags[slot] & DEVICE_STATE_TRAFFIC_SEEN)
+    {
+        pPrevious = &(pShard->pTraffic[slot]);
+        delta.intervalSeconds = now - pShard->pLastTrafficTimes[slot];
+    }
+    delta.flags = trafficReportDelta (pPrevious, pTraffic, &(delta.device));
+    delta.server = pShard->pServerCounts[slot];
+    memset (&(pShard->pServerCounts[slot]), 0, sizeof (pShard->pServerCounts[slot]));
+    pShard->pLastTrafficTimes[slot] = now;
+
+    if (pShard->pFlags[slot] & DEVICE_STATE_RESTARTED_SINCE_TRAFFIC)
+    {
+        delta.flags |= TRAFFIC_DELTA_RESTART;
+    }
+    else
+    {
+        trafficAddDelta (&(pShard->pTrafficTotals[slot]), &delta);
+    }
+
+    if (m_trafficCallback != NULL)
+    {
+        m_trafficCallback (mp_trafficContext, pShard->pDeviceIds[slot], &delta, &(pShard->pTrafficTotals[slot]));
+    }
+}
+
+void DeviceRegistry::moveSlot (Shard_t * pShard, uint32_t to, uint32_t from)
+{
+    pShard->pDeviceIds[to] = pShard->pDeviceIds[from];
+    pShard->pFlags[to] = pShard->pFlags[from];
+    pShard->pWakeUpRevisions[to] = pShard->pWakeUpRevisions[from];
+    pShard->pHeartbeatSeconds[to] = pShard->pHeartbeatSeconds[from];
+    pShard->pReportingIntervalMinutes[to] = pShard->pReportingIntervalMinutes[from];
+    pShard->pLastInitIndTimes[to] = pShard->pLastInitIndTimes[from];
+    pShard->pLastPollIndTimes[to] = pShard->pLastPollIndTimes[from];
+    pShard->pLastSensorsReportTimes[to] = pShard->pLastSensorsReportTimes[from];
+    if (pShard->pHandles != NULL)
+    {
+        pShard->pHandles[to] = pShard->pHandles[from];
+    }
+    if (pShard->pServerCounts != NULL)
+    {
+        pShard->pTraffic[to] = pShard->pTraffic[from];
+        pShard->pServerCounts[to] = pShard->pServerCounts[from];
+        pShard->pTrafficTotals[to] = pShard->pTrafficTotals[from];
+        pShard->pLastTrafficTimes[to] = pShard->pLastTrafficTimes[from];
+    }
+}
+
+void DeviceRegistry::freeShard (Shard_t * pShard)
+{
+    ::free (pShard->pDeviceIds);
+    ::free (pShard->pFlags);
+    ::free (pShard->pWakeUpRevisions);
+    ::free (pShard->pHeartbeatSeconds);
+    ::free (pShard->pReportingIntervalMinutes);
+    ::free (pShard->pLastInitIndTimes);
+    ::free (pShard->pLastPollIndTimes);
+    ::free (pShard->pLastSensorsReportTimes);
+    ::free (pShard->pHandles);
+    ::free (pShard->pHandleDeviceIds);
+    ::free (pShard->pFreeHandles);
+    ::free (pShard->pTraffic);
+    ::free (pShard->pServerCounts);
+    ::free (pShard->pTrafficTotals);
+    ::free (pShard->pLastTrafficTimes);
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+DeviceRegistry::DeviceRegistry (void)
+{
+    m_numShards = 0;
+    m_memoryUsed = 0;
+    m_livenessCallback = NULL;
+    mp_livenessContext = NULL;
+    m_trafficCallback = NULL;
+    mp_trafficContext = NULL;
+    mp_shards = NULL;
+}
+
+DeviceRegistry::~DeviceRegistry (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        freeShard (&(mp_shards[x]));
+        mp_shards[x].~Shard_t ();
+    }
+    ::free (mp_shards);
+}
+
+bool DeviceRegistry::init (uint32_t maxDevices, uint32_t numShards)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if ((mp_shards == NULL) && (maxDevices > 0) && (numShards > 0) && (numShards <= DEVICE_REGISTRY_MAX_SHARDS) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        mp_shards = (Shard_t *) pMem;
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = new (&(mp_shards[m_numShards])) Shard_t;
+
+            pShard->lock.clear ();
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->numEntries = 0;
+            pShard->pDeviceIds = (DeviceId_t *) shardAllocColumn (capacity, sizeof (DeviceId_t), &m_memoryUsed);
+            pShard->pFlags = (uint8_t *) shardAllocColumn (capacity, sizeof (uint8_t), &m_memoryUsed);
+            pShard->pWakeUpRevisions = (uint16_t *) shardAllocColumn (capacity, sizeof (uint16_t), &m_memoryUsed);
+            pShard->pHeartbeatSeconds = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t), &m_memoryUsed);
+            pShard->pReportingIntervalMinutes = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t), &m_memoryUsed);
+            pShard->pLastInitIndTimes = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t), &m_memoryUsed);
+            pShard->pLastPollIndTimes = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t), &m_memoryUsed);
+            pShard->pLastSensorsReportTimes = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t), &m_memoryUsed);
+            pShard->pHandles = NULL;
+            pShard->pHandleDeviceIds = NULL;
+            pShard->pFreeHandles = NULL;
+            pShard->numFreeHandles = 0;
+            pShard->pTraffic = NULL;
+            pShard->pServerCounts = NULL;
+            pShard->pTrafficTotals = NULL;
+            pShard->pLastTrafficTimes = NULL;
+
+            if ((pShard->pDeviceIds == NULL) || (pShard->pFlags == NULL) || (pShard->pWakeUpRevisions == NULL) ||
+                (pShard->pHeartbeatSeconds == NULL) || (pShard->pReportingIntervalMinutes == NULL) ||
+                (pShard->pLastInitIndTimes == NULL) || (pShard->pLastPollIndTimes == NULL) ||
+                (pShard->pLastSensorsReportTimes == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+bool DeviceRegistry::initLiveness (DeviceLivenessCallback_t callback, void * pContext, uint32_t now)
+{
+    bool success = (m_numShards > 0) && (mp_shards[0].pHandles == NULL) && (getNumDevices () == 0);
+
+    for (uint32_t x = 0; (x < m_numShards) && success; x++)
+    {
+        Shard_t * pShard = &(mp_shards[x]);
+
+        pShard->pHandles = (uint32_t *) shardAllocColumn (pShard->capacity, sizeof (uint32_t), &m_memoryUsed);
+        pShard->pHandleDeviceIds = (DeviceId_t *) shardAllocColumn (pShard->maxEntries, sizeof (DeviceId_t), &m_memoryUsed);
+        pShard->pFreeHandles = (uint32_t *) shardAllocColumn (pShard->maxEntries, sizeof (uint32_t), &m_memoryUsed);
+        if ((pShard->pHandles != NULL) && (pShard->pHandleDeviceIds != NULL) && (pShard->pFreeHandles != NULL) &&
+            pShard->wheel.init (pShard->maxEntries * 2, now))
+        {
+            m_memoryUsed += pShard->wheel.getMemoryUsed ();
+            // Hand out the low handles first
+            for (uint32_t y = 0; y < pShard->maxEntries; y++)
+            {
+                pShard->pFreeHandles[y] = pShard->maxEntries - 1 - y;
+            }
+            pShard->numFreeHandles = pShard->maxEntries;
+        }
+        else
+        {
+            ::free (pShard->pHandles);
+            pShard->pHandles = NULL;
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        m_livenessCallback = callback;
+        mp_livenessContext = pContext;
+    }
+
+    return success;
+}
+
+uint32_t DeviceRegistry::checkLiveness (uint32_t now)
+{
+    TimerContext_t context;
+
+    context.pRegistry = this;
+    context.numFired = 0;
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        context.pShard = &(mp_shards[x]);
+        if (context.pShard->pHandles != NULL)
+        {
+            lockShard (context.pShard);
+            context.pShard->wheel.advance (now, timerCallback, &context);
+            unlockShard (context.pShard);
+        }
+    }
+
+    return context.numFired;
+}
+
+bool DeviceRegistry::initTrafficAccounting (TrafficDeltaCallback_t callback, void * pContext)
+{
+    bool success = (m_numShards > 0) && (mp_shards[0].pServerCounts == NULL) && (getNumDevices () == 0);
+
+    for (uint32_t x = 0; (x < m_numShards) && success; x++)
+    {
+        Shard_t * pShard = &(mp_shards[x]);
+
+        pShard->pTraffic = (TrafficReportIndUlMsg_t *) shardAllocColumn (pShard->capacity, sizeof (TrafficReportIndUlMsg_t), &m_memoryUsed);
+        pShard->pServerCounts = (TrafficServerCounts_t *) shardAllocColumn (pShard->capacity, sizeof (TrafficServerCounts_t), &m_memoryUsed);
+        pShard->pTrafficTotals = (TrafficTotals_t *) shardAllocColumn (pShard->capacity, sizeof (TrafficTotals_t), &m_memoryUsed);
+        pShard->pLastTrafficTimes = (uint32_t *) shardAllocColumn (pShard->capacity, sizeof (uint32_t), &m_memoryUsed);
+        if ((pShard->pTraffic == NULL) || (pShard->pServerCounts == NULL) ||
+            (pShard->pTrafficTotals == NULL) || (pShard->pLastTrafficTimes == NULL))
+        {
+            ::free (pShard->pServerCounts);
+            pShard->pServerCounts = NULL;
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        m_trafficCallback = callback;
+        mp_trafficContext = pContext;
+    }
+
+    return success;
+}
+
+bool DeviceRegistry::countServerTraffic (DeviceId_t deviceId,
+                                         uint32_t numUlDatagrams, uint32_t numUlBytes,
+                                         uint32_t numDlDatagrams, uint32_t numDlBytes)
+{
+    bool success = false;
+    Shard_t * pShard;
+    int64_t slot;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        if (pShard->pServerCounts != NULL)
+        {
+            lockShard (pShard);
+            slot = findSlot (pShard, deviceId, true);
+            if (slot >= 0)
+            {
+                pShard->pServerCounts[slot].numUlDatagrams += numUlDatagrams;
+                pShard->pServerCounts[slot].numUlBytes += numUlBytes;
+                pShard->pServerCounts[slot].numDlDatagrams += numDlDatagrams;
+                pShard->pServerCounts[slot].numDlBytes += numDlBytes;
+                success = true;
+            }
+            unlockShard (pShard);
+        }
+    }
+
+    return success;
+}
+
+bool DeviceRegistry::getTrafficTotals (DeviceId_t deviceId, TrafficTotals_t * pTotals)
+{
+    bool found = false;
+    Shard_t * pShard;
+    int64_t slot;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        if (pShard->pServerCounts != NULL)
+        {
+            lockShard (pShard);
+            slot = findSlot (pShard, deviceId, false);
+            if (slot >= 0)
+            {
+                *pTotals = pShard->pTrafficTotals[slot];
+                found = true;
+            }
+            unlockShard (pShard);
+        }
+    }
+
+    return found;
+}
+
+bool DeviceRegistry::update (DeviceId_t deviceId,
+                             MessageCodec::DecodeResult_t result,
+                             const UlMsgUnion_t * pMsg,
+                             uint32_t now)
+{
+    bool success = false;
+    Shard_t * pShard;
+    int64_t slot;
+    uint32_t reportingIntervalMinutes = 0;
+    uint32_t heartbeatSeconds = 0;
+    uint8_t wakeUpCode = 0;
+    uint16_t revisionLevel = 0;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        switch (result)
+        {
+            case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+                wakeUpCode = (uint8_t) pMsg->initIndUlMsg.wakeUpCode;
+                revisionLevel = pMsg->initIndUlMsg.revisionLevel;
+            break;
+            case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+                reportingIntervalMinutes = pMsg->intervalsGetCnfUlMsg.reportingIntervalMinutes;
+                heartbeatSeconds = pMsg->intervalsGetCnfUlMsg.heartbeatSeconds;
+            break;
+            case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+                reportingIntervalMinutes = pMsg->reportingIntervalSetCnfUlMsg.reportingIntervalMinutes;
+            break;
+            case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+                heartbeatSeconds = pMsg->heartbeatSetCnfUlMsg.heartbeatSeconds;
+            break;
+            default:
+            break;
+        }
+
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, deviceId, true);
+        if (slot >= 0)
+        {
+            // The two traffic messages carry the same structure
+            updateSlot (pShard, (uint32_t) slot, result, reportingIntervalMinutes, heartbeatSeconds,
+                        wakeUpCode, revisionLevel, &(pMsg->trafficReportIndUlMsg), now);
+            success = true;
+        }
+        unlockShard (pShard);
+    }
+
+    return success;
+}
+
+bool DeviceRegistry::updateFromRecord (const PipelineRecord_t * pRecord, uint32_t now)
+{
+    bool success = false;
+    Shard_t * pShard;
+    int64_t slot;
+    MessageCodec::DecodeResult_t result = (MessageCodec::DecodeResult_t) pRecord->msgType;
+    uint32_t reportingIntervalMinutes = 0;
+    uint32_t heartbeatSeconds = 0;
+    uint8_t wakeUpCode = 0;
+    uint16_t revisionLevel = 0;
+
+    if ((m_numShards > 0) && (pRecord->deviceId != DEVICE_ID_INVALID))
+    {
+        switch (result)
+        {
+            case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+                wakeUpCode = pRecord->u.initInd.wakeUpCode;
+                revisionLevel = pRecord->u.initInd.revisionLevel;
+            break;
+            case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+            case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+            case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+                reportingIntervalMinutes = pRecord->u.intervals.reportingIntervalMinutes;
+                heartbeatSeconds = pRecord->u.intervals.heartbeatSeconds;
+            break;
+            default:
+            break;
+        }
+
+        pShard = &(mp_shards[deviceIdShard (pRecord->deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, pRecord->deviceId, true);
+        if (slot >= 0)
+        {
+            updateSlot (pShard, (uint32_t) slot, result, reportingIntervalMinutes, heartbeatSeconds,
+                        wakeUpCode, revisionLevel, &(pRecord->u.traffic), now);
+            success = true;
+        }
+        unlockShard (pShard);
+    }
+
+    return success;
+}
+
+bool DeviceRegistry::get (DeviceId_t deviceId, DeviceState_t * pState)
+{
+    bool found = false;
+    Shard_t * pShard;
+    int64_t slot;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, deviceId, false);
+        if (slot >= 0)
+        {
+            pState->deviceId = deviceId;
+            pState->flags = pShard->pFlags[slot];
+            pState->wakeUpCode = (uint8_t) (pShard->pWakeUpRevisions[slot] >> DEVICE_REVISION_LEVEL_BITS);
+            pState->revisionLevel = pShard->pWakeUpRevisions[slot] & DEVICE_REVISION_LEVEL_MAX;
+            pState->heartbeatSeconds = pShard->pHeartbeatSeconds[slot];
+            pState->reportingIntervalMinutes = pShard->pReportingIntervalMinutes[slot];
+            pState->lastInitIndTime = pShard->pLastInitIndTimes[slot];
+            pState->lastPollIndTime = pShard->pLastPollIndTimes[slot];
+            pState->lastSensorsReportTime = pShard->pLastSensorsReportTimes[slot];
+            pState->lastSeenTime = laterTime (laterTime (pState->lastInitIndTime, pState->lastPollIndTime),
+                                              pState->lastSensorsReportTime);
+            memset (&(pState->traffic), 0, sizeof (pState->traffic));
+            if (pShard->pTraffic != NULL)
+            {
+                pState->traffic = pShard->pTraffic[slot];
+            }
+            found = true;
+        }
+        unlockShard (pShard);
+    }
+
+    return found;
+}
+
+bool DeviceRegistry::remove (DeviceId_t deviceId)
+{
+    bool found = false;
+    Shard_t * pShard;
+    int64_t slot;
+    uint32_t hole;
+    uint32_t x;
+    uint32_t home;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, deviceId, false);
+        if (slot >= 0)
+        {
+            // Backward-shift deletion: move later entries of the same
+            // run into the hole if that doesn't put them before their
+            // home slot, so that no tombstones are needed
+            hole = (uint32_t) slot;
+            if (pShard->pHandles != NULL)
+            {
+                pShard->wheel.cancel (pShard->pHandles[hole] * 2);
+                pShard->wheel.cancel (pShard->pHandles[hole] * 2 + 1);
+                pShard->pFreeHandles[pShard->numFreeHandles] = pShard->pHandles[hole];
+                pShard->numFreeHandles++;
+            }
+            x = hole;
+            for (;;)
+            {
+                x++;
+                if (x >= pShard->capacity)
+                {
+                    x = 0;
+                }
+                if (pShard->pDeviceIds[x] == DEVICE_ID_INVALID)
+                {
+                    break;
+                }
+                home = shardHomeSlot (pShard->pDeviceIds[x], pShard->capacity);
+                if ((hole <= x) ? ((home <= hole) || (home > x)) : ((home <= hole) && (home > x)))
+                {
+                    moveSlot (pShard, hole, x);
+                    hole = x;
+                }
+            }
+            pShard->pDeviceIds[hole] = DEVICE_ID_INVALID;
+            pShard->numEntries--;
+            found = true;
+        }
+        unlockShard (pShard);
+    }
+
+    return found;
+}
+
+uint32_t DeviceRegistry::getNumDevices (void)
+{
+    uint32_t numDevices = 0;
+
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        lockShard (&(mp_shards[x]));
+        numDevices += mp_shards[x].numEntries;
+        unlockShard (&(mp_shards[x]));
+    }
+
+    return numDevices;
+}
+
+uint32_t DeviceRegistry::getNumShards (void)
+{
+    return m_numShards;
+}
+
+uint64_t DeviceRegistry::getMemoryUsed (void)
+{
+    return m_memoryUsed;
+}
+
+// End Of File
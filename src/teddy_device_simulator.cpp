@@ -0,0 +1,501 @@
+/* Teddy device simulator
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_device_simulator.cpp
+ * A simulator for a fleet of teddies, for driving the ingest
+ * server over loopback.  Each simulated device has its own UDP
+ * socket (and hence its own source port, which is what the server
+ * uses as the device ID).  Each device sends an InitInd and then,
+ * round after round, a datagram packed with SensorsReportInds
+ * followed by a PollInd, with a TrafficReportInd and a DebugInd
+ * every so often.
+ * Downlink datagrams are decoded and the Reqs in them answered
+ * with the matching Cnfs, as a real device would.
+ *
+ * Usage: teddy_device_simulator [-a address] [-p port] [-n devices]
+ * [-t threads] [-d duration seconds] [-r rounds per second, 0 for
+ * flat out]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> // for atoi() and calloc()
+#include <string.h> // for memset() and memcpy()
+#include <errno.h>
+#include <unistd.h> // for close() and usleep()
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ingest_server.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The default number of simulated devices
+#define SIMULATOR_DEFAULT_NUM_DEVICES 100
+
+/// The default duration of a run
+#define SIMULATOR_DEFAULT_DURATION_SECONDS 10
+
+/// The maximum number of simulator threads
+#define SIMULATOR_MAX_THREADS 64
+
+/// How many rounds between TrafficReportInds
+#define SIMULATOR_TRAFFIC_REPORT_ROUNDS 10
+
+/// The number of SensorsReportInds in each uplink datagram
+#define SIMULATOR_READINGS_PER_DATAGRAM 3
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A simulated device
+typedef struct SimulatedDeviceTag_t
+{
+    int socket;
+    uint32_t round;
+    uint32_t time;
+    uint32_t heartbeatSeconds;
+    uint32_t reportingIntervalMinutes;
+    GpsPosition_t gpsPosition;
+    TrafficReportIndUlMsg_t traffic;
+} SimulatedDevice_t;
+
+/// A simulator thread, looking after a range of devices
+typedef struct SimulatorThreadTag_t
+{
+    pthread_t thread;
+    uint32_t firstDevice;
+    uint32_t numDevices;
+    uint64_t numDatagramsSent;
+    uint64_t numDatagramsReceived;
+    uint64_t numDlMsgsDecoded;
+    uint64_t numDlDecodeFailures;
+} SimulatorThread_t;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static SimulatedDevice_t * gpDevices = NULL;
+static struct sockaddr_in gServerAddress;
+static uint32_t gDurationSeconds = SIMULATOR_DEFAULT_DURATION_SECONDS;
+static uint32_t gRoundsPerSecond = 0;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Fill in a plausible set of sensor readings, walking the GPS
+// position about a little.
+static void makeSensorReadings (SimulatedDevice_t * pDevice, uint32_t seed, SensorReadings_t * pReadings)
+{
+    memset (pReadings, 0, sizeof (*pReadings));
+
+    pDevice->time += pDevice->heartbeatSeconds;
+    pDevice->gpsPosition.latitude += (int32_t) (seed % 7) - 3;
+    pDevice->gpsPosition.longitude += (int32_t) (seed % 5) - 2;
+
+    pReadings->time = pDevice->time;
+    pReadings->gpsPositionPresent = ((seed & 0x03) == 0);
+    pReadings->gpsPosition = pDevice->gpsPosition;
+    pReadings->lclPositionPresent = true;
+    pReadings->lclPosition.orientation = (Orientation_t) (seed % MAX_NUM_ORIENTATION);
+    pReadings->lclPosition.hugsThisPeriod = seed & 0x01;
+    pReadings->lclPosition.nudgesThisPeriod = seed & 0x07;
+    pReadings->soundLevelPresent = true;
+    pReadings->soundLevel = (SoundLevel_t) (seed & 0xFFF);
+    pReadings->luminosityPresent = true;
+    pReadings->luminosity = (Luminosity_t) (400 + (seed & 0x3F));
+    pReadings->temperaturePresent = true;
+    pReadings->temperature = (Temperature_t) (18 + (seed & 0x03));
+    pReadings->rssiPresent = true;
+    pReadings->rssi = (Rssi_t) (20 + (seed % 10));
+    pReadings->powerStatePresent = ((seed & 0x07) == 0);
+    pReadings->powerState.chargeState = CHARGING_OFF;
+    pReadings->powerState.batteryMV = 3700;
+    pReadings->powerState.energyUWH = seed & 0xFFFF;
+}
+
+/// Send a datagram from a device.
+static bool sendDatagram (SimulatedDevice_t * pDevice, const char * pBuffer, uint32_t size)
+{
+    bool success = false;
+
+    if (sendto (pDevice->socket, pBuffer, size, 0, (struct sockaddr *) &gServerAddress,
+                sizeof (gServerAddress)) == (ssize_t) size)
+    {
+        pDevice->traffic.numDatagramsSent++;
+        pDevice->traffic.numBytesSent += size;
+        success = true;
+    }
+
+    return success;
+}
+
+/// Build and send the next uplink datagram for a device.
+static bool sendNextDatagram (MessageCodec * pCodec, SimulatedDevice_t * pDevice, uint32_t seed)
+{
+    char buffer[MAX_DATAGRAM_SIZE_RAW];
+    uint32_t size = 0;
+    SensorsReportIndUlMsg_t sensorsReportInd;
+
+    if (pDevice->round == 0)
+    {
+        InitIndUlMsg_t initInd;
+
+        initInd.wakeUpCode = WAKE_UP_CODE_OK;
+        initInd.revisionLevel = REVISION_LEVEL;
+        size += pCodec->encodeInitIndUlMsg (&(buffer[size]), &initInd);
+    }
+
+    for (uint32_t x = 0; (x < SIMULATOR_READINGS_PER_DATAGRAM) &&
+                         (size + MAX_MESSAGE_SIZE * 2 <= sizeof (buffer)); x++)
+    {
+        makeSensorReadings (pDevice, seed + x, &(sensorsReportInd.sensorReadings));
+        size += pCodec->encodeSensorsReportIndUlMsg (&(buffer[size]), &sensorsReportInd);
+    }
+
+    if ((pDevice->round % SIMULATOR_TRAFFIC_REPORT_ROUNDS) == SIMULATOR_TRAFFIC_REPORT_ROUNDS - 1)
+    {
+        size += pCodec->encodeTrafficReportIndUlMsg (&(buffer[size]), &(pDevice->traffic));
+    }
+    if ((pDevice->round % SIMULATOR_TRAFFIC_REPORT_ROUNDS) == SIMULATOR_TRAFFIC_REPORT_ROUNDS / 2)
+    {
+        DebugIndUlMsg_t debugInd;
+        char debugBuffer[MAX_MESSAGE_SIZE];
+        uint32_t debugSize;
+
+        // The sort of thing a device logs, the same text with
+        // different numbers each time; it goes in if there is room
+        // for it and the PollInd
+        debugInd.sizeOfString = snprintf (debugInd.string, sizeof (debugInd.string), "round %u, %u dl",
+                                          pDevice->round, pDevice->traffic.numDatagramsReceived);
+        if (debugInd.sizeOfString > sizeof (debugInd.string) - 1)
+        {
+            debugInd.sizeOfString = sizeof (debugInd.string) - 1;
+        }
+        debugSize = pCodec->encodeDebugIndUlMsg (debugBuffer, &debugInd);
+        if (size + debugSize < sizeof (buffer))
+        {
+            memcpy (&(buffer[size]), debugBuffer, debugSize);
+            size += debugSize;
+        }
+    }
+    size += pCodec->encodePollIndUlMsg (&(buffer[size]));
+
+    pDevice->round++;
+
+    return sendDatagram (pDevice, buffer, size);
+}
+
+/// Receive and answer any downlink datagrams waiting for a device.
+static void handleDownlink (MessageCodec * pCodec, SimulatedDevice_t * pDevice, SimulatorThread_t * pThread)
+{
+    char rxBuffer[MAX_DATAGRAM_SIZE_RAW + MAX_MESSAGE_SIZE];
+    char txBuffer[MAX_DATAGRAM_SIZE_RAW];
+    ssize_t numReceived;
+
+    while ((numReceived = recv (pDevice->socket, rxBuffer, MAX_DATAGRAM_SIZE_RAW, MSG_DONTWAIT)) > 0)
+    {
+        const char * pIn = rxBuffer;
+        const char * pEnd = rxBuffer + numReceived;
+        uint32_t txSize = 0;
+        MessageCodec::DecodeResult_t decodeResult;
+        DlMsgUnion_t msg;
+
+        pThread->numDatagramsReceived++;
+        pDevice->traffic.numDatagramsReceived++;
+        pDevice->traffic.numBytesReceived += numReceived;
+
+        while (pIn < pEnd)
+        {
+            decodeResult = pCodec->decodeDlMsg (&pIn, pEnd - pIn, &msg);
+            if ((decodeResult < MessageCodec::DECODE_RESULT_DL_MSG_BASE) ||
+                (decodeResult > MessageCodec::MAX_DL_REQ_MSG) || (pIn > pEnd) ||
+                (txSize + MAX_MESSAGE_SIZE > sizeof (txBuffer)))
+            {
+                pThread->numDlDecodeFailures++;
+                break;
+            }
+
+            pThread->numDlMsgsDecoded++;
+            switch (decodeResult)
+            {
+                case MessageCodec::DECODE_RESULT_INTERVALS_GET_REQ_DL_MSG:
+                {
+                    IntervalsGetCnfUlMsg_t cnf;
+                    cnf.reportingIntervalMinutes = pDevice->reportingIntervalMinutes;
+                    cnf.heartbeatSeconds = pDevice->heartbeatSeconds;
+                    txSize += pCodec->encodeIntervalsGetCnfUlMsg (&(txBuffer[txSize]), &cnf);
+                }
+                break;
+                case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_REQ_DL_MSG:
+                {
+                    ReportingIntervalSetCnfUlMsg_t cnf;
+                    pDevice->reportingIntervalMinutes = msg.reportingIntervalSetReqDlMsg.reportingIntervalMinutes;
+                    cnf.reportingIntervalMinutes = pDevice->reportingIntervalMinutes;
+                    txSize += pCodec->encodeReportingIntervalSetCnfUlMsg (&(txBuffer[txSize]), &cnf);
+                }
+                break;
+                case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_REQ_DL_MSG:
+                {
+                    HeartbeatSetCnfUlMsg_t cnf;
+                    pDevice->heartbeatSeconds = msg.heartbeatSetReqDlMsg.heartbeatSeconds;
+                    cnf.heartbeatSeconds = pDevice->heartbeatSeconds;
+                    txSize += pCodec->encodeHeartbeatSetCnfUlMsg (&(txBuffer[txSize]), &cnf);
+                }
+                break;
+                case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_REQ_DL_MSG:
+                {
+                    SensorsReportGetCnfUlMsg_t cnf;
+                    makeSensorReadings (pDevice, pDevice->round, &(cnf.sensorReadings));
+                    txSize += pCodec->encodeSensorsReportGetCnfUlMsg (&(txBuffer[txSize]), &cnf);
+                }
+                break;
+                case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_REQ_DL_MSG:
+                {
+                    TrafficReportGetCnfUlMsg_t cnf;
+                    cnf.numDatagramsSent = pDevice->traffic.numDatagramsSent;
+                    cnf.numBytesSent = pDevice->traffic.numBytesSent;
+                    cnf.numDatagramsReceived = pDevice->traffic.numDatagramsReceived;
+                    cnf.numBytesReceived = pDevice->traffic.numBytesReceived;
+                    txSize += pCodec->encodeTrafficReportGetCnfUlMsg (&(txBuffer[txSize]), &cnf);
+                }
+                break;
+                default:
+                // Nothing to say in response to a reboot, we're simulated
+                break;
+            }
+        }
+
+        if (txSize > 0)
+        {
+            if (sendDatagram (pDevice, txBuffer, txSize))
+            {
+                pThread->numDatagramsSent++;
+            }
+        }
+    }
+}
+
+/// A simulator thread.
+static void * simulatorThread (void * pParam)
+{
+    SimulatorThread_t * pThread = (SimulatorThread_t *) pParam;
+    MessageCodec codec;
+    uint64_t startTimeUs = serverTimeUs ();
+    uint64_t roundPeriodUs = 0;
+    uint64_t nextRoundTimeUs = startTimeUs;
+    uint32_t seed = pThread->firstDevice * 2654435761u;
+
+    if (gRoundsPerSecond > 0)
+    {
+        roundPeriodUs = 1000000 / gRoundsPerSecond;
+    }
+
+    while (serverTimeUs () - startTimeUs < (uint64_t) gDurationSeconds * 1000000)
+    {
+        for (uint32_t x = pThread->firstDevice; x < pThread->firstDevice + pThread->numDevices; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            if (sendNextDatagram (&codec, &(gpDevices[x]), seed >> 8))
+            {
+                pThread->numDatagramsSent++;
+            }
+            handleDownlink (&codec, &(gpDevices[x]), pThread);
+        }
+
+        if (roundPeriodUs > 0)
+        {
+            uint64_t nowUs;
+
+            nextRoundTimeUs += roundPeriodUs;
+            nowUs = serverTimeUs ();
+            if (nextRoundTimeUs > nowUs)
+            {
+                usleep ((useconds_t) (nextRoundTimeUs - nowUs));
+            }
+        }
+    }
+
+    // Give the last responses a moment to arrive
+    usleep (100000);
+    for (uint32_t x = pThread->firstDevice; x < pThread->firstDevice + pThread->numDevices; x++)
+    {
+        handleDownlink (&codec, &(gpDevices[x]), pThread);
+    }
+
+    return NULL;
+}
+
+static void printUsage (const char * pName)
+{
+    printf ("Usage: %s [-a address] [-p port] [-n devices] [-t threads] [-d duration seconds]"
+            " [-r rounds per second]\n", pName);
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main (int argc, char * argv[])
+{
+    int exitCode = 0;
+    const char * pAddress = "127.0.0.1";
+    uint16_t port = INGEST_DEFAULT_PORT;
+    uint32_t numDevices = SIMULATOR_DEFAULT_NUM_DEVICES;
+    uint32_t numThreads = 1;
+    uint64_t startTimeUs;
+    uint64_t durationUs;
+    SimulatorThread_t threads[SIMULATOR_MAX_THREADS];
+    SimulatorThread_t totals;
+
+    for (int x = 1; (x < argc) && (exitCode == 0); x++)
+    {
+        if ((strcmp (argv[x], "-a") == 0) && (x + 1 < argc))
+        {
+            pAddress = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-p") == 0) && (x + 1 < argc))
+        {
+            port = (uint16_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-n") == 0) && (x + 1 < argc))
+        {
+            numDevices = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-t") == 0) && (x + 1 < argc))
+        {
+            numThreads = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-d") == 0) && (x + 1 < argc))
+        {
+            gDurationSeconds = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-r") == 0) && (x + 1 < argc))
+        {
+            gRoundsPerSecond = (uint32_t) atoi (argv[++x]);
+        }
+        else
+        {
+            printUsage (argv[0]);
+            exitCode = 1;
+        }
+    }
+
+    if ((numThreads == 0) || (numThreads > SIMULATOR_MAX_THREADS) || (numDevices < numThreads))
+    {
+        printUsage (argv[0]);
+        exitCode = 1;
+    }
+
+    memset (&gServerAddress, 0, sizeof (gServerAddress));
+    gServerAddress.sin_family = AF_INET;
+    gServerAddress.sin_port = htons (port);
+    if ((exitCode == 0) && (inet_pton (AF_INET, pAddress, &(gServerAddress.sin_addr)) != 1))
+    {
+        printf ("Simulator: \"%s\" is not an IPv4 address.\n", pAddress);
+        exitCode = 1;
+    }
+
+    if (exitCode == 0)
+    {
+        gpDevices = (SimulatedDevice_t *) calloc (numDevices, sizeof (SimulatedDevice_t));
+        if (gpDevices == NULL)
+        {
+            exitCode = 2;
+        }
+    }
+
+    // Open a socket for each device, letting the system pick the port
+    for (uint32_t x = 0; (exitCode == 0) && (x < numDevices); x++)
+    {
+        gpDevices[x].socket = socket (AF_INET, SOCK_DGRAM, 0);
+        gpDevices[x].heartbeatSeconds = DEFAULT_HEARTBEAT_SECONDS;
+        gpDevices[x].reportingIntervalMinutes = DEFAULT_REPORTING_INTERVAL_MINUTES;
+        gpDevices[x].time = serverTimeUtcSeconds ();
+        gpDevices[x].gpsPosition.latitude = 3133200 + (int32_t) x;   // Around Cambridge, UK
+        gpDevices[x].gpsPosition.longitude = 6000 + (int32_t) x;
+        gpDevices[x].gpsPosition.elevation = 20;
+        if (gpDevices[x].socket < 0)
+        {
+            printf ("Simulator: unable to open socket for device %d (%s).\n", x, strerror (errno));
+            exitCode = 2;
+        }
+    }
+
+    if (exitCode == 0)
+    {
+        printf ("Simulator: %d device(s) on %d thread(s) sending to %s:%d for %d second(s).\n",
+                numDevices, numThreads, pAddress, port, gDurationSeconds);
+
+        memset (threads, 0, sizeof (threads));
+        startTimeUs = serverTimeUs ();
+        for (uint32_t x = 0; x < numThreads; x++)
+        {
+            threads[x].firstDevice = x * (numDevices / numThreads);
+            threads[x].numDevices = numDevices / numThreads;
+            if (x == numThreads - 1)
+            {
+                threads[x].numDevices = numDevices - threads[x].firstDevice;
+            }
+            pthread_create (&(threads[x].thread), NULL, simulatorThread, &(threads[x]));
+        }
+
+        memset (&totals, 0, sizeof (totals));
+        for (uint32_t x = 0; x < numThreads; x++)
+        {
+            pthread_join (threads[x].thread, NULL);
+            totals.numDatagramsSent += threads[x].numDatagramsSent;
+            totals.numDatagramsReceived += threads[x].numDatagramsReceived;
+            totals.numDlMsgsDecoded += threads[x].numDlMsgsDecoded;
+            totals.numDlDecodeFailures += threads[x].numDlDecodeFailures;
+        }
+        durationUs = serverTimeUs () - startTimeUs;
+
+        printf ("Simulator: sent %llu datagram(s) (%llu/s), received %llu datagram(s) containing"
+                " %llu downlink message(s), %llu bad.\n",
+                (unsigned long long) totals.numDatagramsSent,
+                (unsigned long long) (totals.numDatagramsSent * 1000000 / durationUs),
+                (unsigned long long) totals.numDatagramsReceived,
+                (unsigned long long) totals.numDlMsgsDecoded,
+                (unsigned long long) totals.numDlDecodeFailures);
+
+        if ((totals.numDatagramsReceived == 0) || (totals.numDlDecodeFailures > 0))
+        {
+            exitCode = 3;
+        }
+    }
+
+    if (gpDevices != NULL)
+    {
+        for (uint32_t x = 0; x < numDevices; x++)
+        {
+            if (gpDevices[x].socket > 0)
+            {
+                close (gpDevices[x].socket);
+            }
+        }
+        free (gpDevices);
+    }
+
+    return exitCode;
+}
+
+// End Of File
@@ -50,6 +50,71 @@ extern "C" {
     // PRIVATE FUNCTIONS
     // ----------------------------------------------------------------
 
+    // A compile-time check that CsSensorReadings_t is the size that
+    // C# expects
+    typedef char CsSensorReadingsSizeCheck_t[(sizeof (CsSensorReadings_t) == CS_SENSOR_READINGS_SIZE) ? 1 : -1];
+
+    // Flatten decoded sensor readings for C#
+    static void fillCsSensorReadings (CsSensorReadings_t * pOut,
+                                      uint32_t msgType,
+                                      const SensorReadings_t * pSensorReadings)
+    {
+        memset (pOut, 0, sizeof (*pOut));
+        pOut->msgType = msgType;
+        pOut->time = (uint32_t) pSensorReadings->time;
+
+        if (pSensorReadings->gpsPositionPresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_GPS_POSITION;
+            pOut->gpsPositionLatitude = (int32_t) pSensorReadings->gpsPosition.latitude;
+            pOut->gpsPositionLongitude = (int32_t) pSensorReadings->gpsPosition.longitude;
+            pOut->gpsPositionElevation = (int32_t) pSensorReadings->gpsPosition.elevation;
+            pOut->gpsPositionSpeed = (int32_t) pSensorReadings->gpsPosition.speed;
+        }
+
+        if (pSensorReadings->lclPositionPresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_LCL_POSITION;
+            pOut->lclPositionOrientation = (uint32_t) pSensorReadings->lclPosition.orientation;
+            pOut->lclPositionHugsThisPeriod = (uint32_t) pSensorReadings->lclPosition.hugsThisPeriod;
+            pOut->lclPositionSlapsThisPeriod = (uint32_t) pSensorReadings->lclPosition.slapsThisPeriod;
+            pOut->lclPositionDropsThisPeriod = (uint32_t) pSensorReadings->lclPosition.dropsThisPeriod;
+            pOut->lclPositionNudgesThisPeriod = (uint32_t) pSensorReadings->lclPosition.nudgesThisPeriod;
+        }
+
+        if (pSensorReadings->soundLevelPresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_SOUND_LEVEL;
+            pOut->soundLevel = (uint32_t) pSensorReadings->soundLevel;
+        }
+
+        if (pSensorReadings->luminosityPresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_LUMINOSITY;
+            pOut->luminosity = (uint32_t) pSensorReadings->luminosity;
+        }
+
+        if (pSensorReadings->temperaturePresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_TEMPERATURE;
+            pOut->temperature = (int32_t) pSensorReadings->temperature;
+        }
+
+        if (pSensorReadings->rssiPresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_RSSI;
+            pOut->rssi = (uint32_t) pSensorReadings->rssi;
+        }
+
+        if (pSensorReadings->powerStatePresent)
+        {
+            pOut->presentBitmap |= 1 << SENSOR_POWER_STATE;
+            pOut->powerStateChargeState = (uint32_t) pSensorReadings->powerState.chargeState;
+            pOut->powerStateBatteryMV = (uint32_t) pSensorReadings->powerState.batteryMV;
+            pOut->powerStateEnergyUWH = pSensorReadings->powerState.energyUWH;
+        }
+    }
+
     // ----------------------------------------------------------------
     // MESSAGE ENCODE WRAPPER FUNCTIONS
     // ----------------------------------------------------------------
@@ -334,6 +399,108 @@ extern "C" {
         return success;
     }
 
+    // Wrap decodeUlMsg for SensorsReportInd and SensorsReportGetCnf,
+    // filling in one flat structure rather than many out-parameters;
+    // pReadings is only filled in if the result is one of those two
+    uint32_t __cdecl decodeUlMsgSensorsReport (const char ** ppInBuffer,
+                                               uint32_t sizeInBuffer,
+                                               CsSensorReadings_t * pReadings)
+    {
+        MessageCodec::DecodeResult_t decodeResult;
+        UlMsgUnion_t outBuffer;
+
+        decodeResult = gMessageCodec.decodeUlMsg (ppInBuffer,
+                                                  sizeInBuffer,
+                                                  &outBuffer);
+
+        if ((decodeResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG) ||
+            (decodeResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG))
+        {
+            // The two messages carry the same structure
+            fillCsSensorReadings (pReadings, (uint32_t) decodeResult,
+                                  &(outBuffer.sensorsReportIndUlMsg.sensorReadings));
+        }
+
+        return (uint32_t) decodeResult;
+    }
+
+    // Decode all of the sensor readings in a batch of datagrams in
+    // one call, see teddy_dll_wrapper.hpp for the contract
+    uint32_t __cdecl decodeSensorsReportBatch (const char * pDatagrams,
+                                               const uint32_t * pDatagramSizes,
+                                               uint32_t numDatagrams,
+                                               CsSensorReadings_t * pReadings,
+                                               uint32_t * pDatagramIndexes,
+                                               uint32_t maxReadings,
+                                               uint32_t * pNumDatagramsDecoded)
+    {
+        MessageCodec::DecodeResult_t decodeResult;
+        UlMsgUnion_t outBuffer;
+        const char * pIn;
+        const char * pEnd = pDatagrams;
+        uint32_t numReadings = 0;
+        uint32_t numReadingsAtStart;
+        uint32_t x;
+        bool full = false;
+
+        for (x = 0; (x < numDatagrams) && !full; x++)
+        {
+            pIn = pEnd;
+            pEnd += pDatagramSizes[x];
+            numReadingsAtStart = numReadings;
+            while (pIn < pEnd)
+            {
+                decodeResult = gMessageCodec.decodeUlMsg (&pIn, (uint32_t) (pEnd - pIn), &outBuffer);
+                if ((decodeResult < MessageCodec::DECODE_RESULT_UL_MSG_BASE) ||
+                    (decodeResult > MessageCodec::MAX_UL_REQ_MSG) || (pIn > pEnd))
+                {
+                    // Can't trust anything after a bad message
+                    break;
+                }
+                if ((decodeResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG) ||
+                    (decodeResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG))
+                {
+                    if (numReadings >= maxReadings)
+                    {
+                        numReadings = numReadingsAtStart;
+                        if ((numReadings > 0) || (maxReadings == 0))
+                        {
+                            // Leave this datagram for the next call
+                            full = true;
+                        }
+                        else
+                        {
+                            // This datagram would never fit, so fail it
+                            // rather than leave the caller stuck on it
+                            memset (&(pReadings[numReadings]), 0, sizeof (pReadings[numReadings]));
+                            pReadings[numReadings].msgType = (uint32_t) MessageCodec::DECODE_RESULT_OUTPUT_TOO_SHORT;
+                            if (pDatagramIndexes != NULL)
+                            {
+                                pDatagramIndexes[numReadings] = x;
+                            }
+                            numReadings++;
+                        }
+                        break;
+                    }
+                    fillCsSensorReadings (&(pReadings[numReadings]), (uint32_t) decodeResult,
+                                          &(outBuffer.sensorsReportIndUlMsg.sensorReadings));
+                    if (pDatagramIndexes != NULL)
+                    {
+                        pDatagramIndexes[numReadings] = x;
+                    }
+                    numReadings++;
+                }
+            }
+        }
+
+        if (pNumDatagramsDecoded != NULL)
+        {
+            *pNumDatagramsDecoded = full ? x - 1 : x;
+        }
+
+        return numReadings;
+    }
+
     // Wrap decodeUlMsg for TrafficReportGetCnf 
     bool __cdecl decodeUlMsgTrafficReportGetCnf (const char ** ppInBuffer,
                                                  uint32_t sizeInBuffer,
@@ -405,7 +572,7 @@ extern "C" {
         if (decodeResult == MessageCodec::DECODE_RESULT_DEBUG_IND_UL_MSG)
         {
             *pSizeOfString = (uint32_t) outBuffer.debugIndUlMsg.sizeOfString;
-            memcpy (pString, &(outBuffer.debugIndUlMsg.string[0]), *pSizeOfString);
+            memcpy (pString, outBuffer.debugIndUlMsg.pString, *pSizeOfString);
             success = true;
         }
         
@@ -421,6 +588,47 @@ extern "C" {
         gMessageCodec.initDll (printToConsole);
     } 
 
+    // The whole API as a table, in the order of CodecApi_t
+    static const CodecApi_t gCodecApi =
+    {
+        CODEC_API_VERSION,
+        sizeof (CodecApi_t),
+        maxDatagramSizeRaw,
+        maxDebugStringSize,
+        revisionLevel,
+        encodeRebootReqDlMsg,
+        encodeIntervalsGetReqDlMsg,
+        encodeReportingIntervalSetReqDlMsg,
+        encodeHeartbeatSetReqDlMsg,
+        encodeSensorsReportGetReqDlMsg,
+        encodeTrafficReportGetReqDlMsg,
+        decodeUlMsgType,
+        decodeUlMsgInitInd,
+        decodeUlMsgIntervalsGetCnf,
+        decodeUlMsgReportingIntervalSetCnf,
+        decodeUlMsgHeartbeatSetCnf,
+        decodeUlMsgPollInd,
+        decodeUlMsgSensorsReportxxx,
+        decodeUlMsgSensorsReport,
+        decodeSensorsReportBatch,
+        decodeUlMsgTrafficReportGetCnf,
+        decodeUlMsgTrafficReportInd,
+        decodeUlMsgDebugInd,
+        initDll
+    };
+
+    const CodecApi_t * __cdecl getCodecApi (uint32_t version)
+    {
+        const CodecApi_t * pApi = NULL;
+
+        if ((version > 0) && (version <= CODEC_API_VERSION))
+        {
+            pApi = &gCodecApi;
+        }
+
+        return pApi;
+    }
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
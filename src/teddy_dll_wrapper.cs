@@ -62,6 +62,117 @@ namespace MessageCodec
                                              //! decode results.
         };
 
+        /// Sensor readings, flattened so that they are blittable: the
+        // native code fills them in place, one or an array of them,
+        // with no marshalling.
+        // !!! THE LAYOUT MUST align with the C typedef CsSensorReadings_t.
+        [StructLayout (LayoutKind.Explicit, Size = 76)]
+        public struct CSSensorReadings
+        {
+            /// Bits of presentBitmap, (1 << SENSOR_x) in C
+            public const UInt32 GPS_POSITION_PRESENT = 0x01;
+            public const UInt32 LCL_POSITION_PRESENT = 0x02;
+            public const UInt32 SOUND_LEVEL_PRESENT = 0x04;
+            public const UInt32 LUMINOSITY_PRESENT = 0x08;
+            public const UInt32 TEMPERATURE_PRESENT = 0x10;
+            public const UInt32 RSSI_PRESENT = 0x20;
+            public const UInt32 POWER_STATE_PRESENT = 0x40;
+
+            [FieldOffset (0)] public CSDecodeResult msgType;
+            [FieldOffset (4)] public UInt32 presentBitmap;
+            [FieldOffset (8)] public UInt32 time;
+            [FieldOffset (12)] public Int32 gpsPositionLatitude;
+            [FieldOffset (16)] public Int32 gpsPositionLongitude;
+            [FieldOffset (20)] public Int32 gpsPositionElevation;
+            [FieldOffset (24)] public Int32 gpsPositionSpeed;
+            [FieldOffset (28)] public UInt32 lclPositionOrientation;
+            [FieldOffset (32)] public UInt32 lclPositionHugsThisPeriod;
+            [FieldOffset (36)] public UInt32 lclPositionSlapsThisPeriod;
+            [FieldOffset (40)] public UInt32 lclPositionDropsThisPeriod;
+            [FieldOffset (44)] public UInt32 lclPositionNudgesThisPeriod;
+            [FieldOffset (48)] public UInt32 soundLevel;
+            [FieldOffset (52)] public UInt32 luminosity;
+            [FieldOffset (56)] public Int32 temperature;
+            [FieldOffset (60)] public UInt32 rssi;
+            [FieldOffset (64)] public UInt32 powerStateChargeState;
+            [FieldOffset (68)] public UInt32 powerStateBatteryMV;
+            [FieldOffset (72)] public UInt32 powerStateEnergyUWH;
+        };
+
+        /// The version of the C API table that this wrapper is built
+        // against, CODEC_API_VERSION in C.
+        public const UInt32 CODEC_API_VERSION = 1;
+
+        /// The C API as a table of function pointers, from getCodecApi().
+        // !!! THE LAYOUT MUST align with the C typedef CodecApi_t; new
+        // entries are only ever added at the end.
+        [StructLayout (LayoutKind.Sequential)]
+        public struct CSCodecApi
+        {
+            public UInt32 version;
+            public UInt32 size;
+            public IntPtr maxDatagramSizeRaw;
+            public IntPtr maxDebugStringSize;
+            public IntPtr revisionLevel;
+            public IntPtr encodeRebootReqDlMsg;
+            public IntPtr encodeIntervalsGetReqDlMsg;
+            public IntPtr encodeReportingIntervalSetReqDlMsg;
+            public IntPtr encodeHeartbeatSetReqDlMsg;
+            public IntPtr encodeSensorsReportGetReqDlMsg;
+            public IntPtr encodeTrafficReportGetReqDlMsg;
+            public IntPtr decodeUlMsgType;
+            public IntPtr decodeUlMsgInitInd;
+            public IntPtr decodeUlMsgIntervalsGetCnf;
+            public IntPtr decodeUlMsgReportingIntervalSetCnf;
+            public IntPtr decodeUlMsgHeartbeatSetCnf;
+            public IntPtr decodeUlMsgPollInd;
+            public IntPtr decodeUlMsgSensorsReportxxx;
+            public IntPtr decodeUlMsgSensorsReport;
+            public IntPtr decodeSensorsReportBatch;
+            public IntPtr decodeUlMsgTrafficReportGetCnf;
+            public IntPtr decodeUlMsgTrafficReportInd;
+            public IntPtr decodeUlMsgDebugInd;
+            public IntPtr initDll;
+        };
+
+        /// The same table as CSCodecApi but typed, so that the functions
+        // can be called straight through it with no delegate to bind;
+        // a C bool is a byte here.
+        // !!! THE LAYOUT MUST align with the C typedef CodecApi_t.
+        [StructLayout (LayoutKind.Sequential)]
+        public unsafe struct CSCodecApiFunctions
+        {
+            public UInt32 version;
+            public UInt32 size;
+            public delegate* unmanaged[Cdecl]<UInt32> maxDatagramSizeRaw;
+            public delegate* unmanaged[Cdecl]<UInt32> maxDebugStringSize;
+            public delegate* unmanaged[Cdecl]<UInt32> revisionLevel;
+            public delegate* unmanaged[Cdecl]<byte*, byte, UInt32> encodeRebootReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32> encodeIntervalsGetReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32, UInt32> encodeReportingIntervalSetReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32, UInt32> encodeHeartbeatSetReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32> encodeSensorsReportGetReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32> encodeTrafficReportGetReqDlMsg;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32, CSDecodeResult> decodeUlMsgType;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, UInt32*, byte> decodeUlMsgInitInd;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, UInt32*, byte> decodeUlMsgIntervalsGetCnf;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, byte> decodeUlMsgReportingIntervalSetCnf;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, byte> decodeUlMsgHeartbeatSetCnf;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, byte> decodeUlMsgPollInd;
+            public IntPtr decodeUlMsgSensorsReportxxx;   //!< Superseded by decodeUlMsgSensorsReport.
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, CSSensorReadings*, CSDecodeResult> decodeUlMsgSensorsReport;
+            public delegate* unmanaged[Cdecl]<byte*, UInt32*, UInt32, CSSensorReadings*, UInt32*, UInt32, UInt32*, UInt32> decodeSensorsReportBatch;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, UInt32*, UInt32*, UInt32*, byte> decodeUlMsgTrafficReportGetCnf;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, UInt32*, UInt32*, UInt32*, byte> decodeUlMsgTrafficReportInd;
+            public delegate* unmanaged[Cdecl]<byte**, UInt32, UInt32*, byte*, byte> decodeUlMsgDebugInd;
+            public delegate* unmanaged[Cdecl]<IntPtr, void> initDll;
+        };
+
+        /// The C API table, set by bindDll(); calls made through it need
+        // no binding at all.  Null for an older dll without getCodecApi(),
+        // in which case only the delegates below are bound.
+        public unsafe CSCodecApiFunctions* api;
+
         // uint32_t __cdecl maxDatagramSizeRaw (void);
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
         public unsafe delegate UInt32 _maxDatagramSizeRaw ();
@@ -222,6 +333,32 @@ namespace MessageCodec
                                                                            UInt32* pPowerStateEnergyUWH);
         public _decodeUlMsgSensorsReportxxx decodeUlMsgSensorsReportxxx;
 
+        // uint32_t __cdecl decodeUlMsgSensorsReport (const char ** ppInBuffer,
+        //                                            uint32_t sizeInBuffer,
+        //                                            CsSensorReadings_t * pReadings)
+        [UnmanagedFunctionPointer (CallingConvention.Cdecl)]
+        public unsafe delegate CSDecodeResult _decodeUlMsgSensorsReport(byte** ppInBuffer,
+                                                                        UInt32 sizeInBuffer,
+                                                                        CSSensorReadings* pReadings);
+        public _decodeUlMsgSensorsReport decodeUlMsgSensorsReport;
+
+        // uint32_t __cdecl decodeSensorsReportBatch (const char * pDatagrams,
+        //                                            const uint32_t * pDatagramSizes,
+        //                                            uint32_t numDatagrams,
+        //                                            CsSensorReadings_t * pReadings,
+        //                                            uint32_t * pDatagramIndexes,
+        //                                            uint32_t maxReadings,
+        //                                            uint32_t * pNumDatagramsDecoded)
+        [UnmanagedFunctionPointer (CallingConvention.Cdecl)]
+        public unsafe delegate UInt32 _decodeSensorsReportBatch(byte* pDatagrams,
+                                                                UInt32* pDatagramSizes,
+                                                                UInt32 numDatagrams,
+                                                                CSSensorReadings* pReadings,
+                                                                UInt32* pDatagramIndexes,
+                                                                UInt32 maxReadings,
+                                                                UInt32* pNumDatagramsDecoded);
+        public _decodeSensorsReportBatch decodeSensorsReportBatch;
+
         // bool __cdecl decodeUlMsgTrafficReportGetCnf (const char ** ppInBuffer,
         //                                              uint32_t sizeInBuffer,
         //                                              uint32_t * pNumDatagramsSent,
@@ -262,9 +399,16 @@ namespace MessageCodec
                                                                    byte *pString);
         public _decodeUlMsgDebugInd decodeUlMsgDebugInd;
 
+        // const CodecApi_t * __cdecl getCodecApi (uint32_t version);
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate IntPtr _getCodecApi(UInt32 version);
+
         [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
         public delegate void guiPrintToConsoleCallback(StringBuilder data);
 
+        // Held so that the callback given to initDll() is not collected
+        guiPrintToConsoleCallback printToConsoleCallback;
+
         [UnmanagedFunctionPointer (CallingConvention.Cdecl)]
         public delegate void _initDll([MarshalAs (UnmanagedType.FunctionPtr)] guiPrintToConsoleCallback callbackPointer);
         public _initDll initDll;
@@ -278,36 +422,256 @@ namespace MessageCodec
         }
 
         /// <summary>
-        /// Load the dll and do the bindings
+        /// Load the dll and bind to it through api, or through the
+        /// delegates if it is an older dll without getCodecApi()
         /// </summary>
         /// <param name="dllLocation">location of dll</param>
         public void bindDll(string dllLocation)
+        {
+            bindDll (dllLocation, false);
+        }
+
+        /// <summary>
+        /// Load the dll and do the bindings: api is set from the single table
+        /// given by getCodecApi() if the dll has it, otherwise the delegates
+        /// are bound function by function
+        /// </summary>
+        /// <param name="dllLocation">location of dll</param>
+        /// <param name="bindDelegates">whether to also bind the delegates when
+        /// the dll has the table, for callers that still use them</param>
+        public unsafe void bindDll(string dllLocation, bool bindDelegates)
         {
             IntPtr ptrDll = LoadLibrary (dllLocation);
+            IntPtr ptrApi = IntPtr.Zero;
+            IntPtr procaddr;
+            CSCodecApi table;
 
             if (ptrDll == IntPtr.Zero) throw new Exception (String.Format ("Cannot find {0}", dllLocation));
 
-            maxDatagramSizeRaw = (_maxDatagramSizeRaw)bindItem(ptrDll, "maxDatagramSizeRaw", typeof(_maxDatagramSizeRaw));
-            maxDebugStringSize = (_maxDebugStringSize)bindItem(ptrDll, "maxDebugStringSize", typeof(_maxDebugStringSize));
-            revisionLevel = (_revisionLevel)bindItem(ptrDll, "revisionLevel", typeof(_revisionLevel));
-            encodeRebootReqDlMsg = (_encodeRebootReqDlMsg)bindItem(ptrDll, "encodeRebootReqDlMsg", typeof(_encodeRebootReqDlMsg));
-            encodeIntervalsGetReqDlMsg = (_encodeIntervalsGetReqDlMsg)bindItem(ptrDll, "encodeIntervalsGetReqDlMsg", typeof(_encodeIntervalsGetReqDlMsg));
-            encodeReportingIntervalSetReqDlMsg = (_encodeReportingIntervalSetReqDlMsg)bindItem(ptrDll, "encodeReportingIntervalSetReqDlMsg", typeof(_encodeReportingIntervalSetReqDlMsg));
-            encodeHeartbeatSetReqDlMsg = (_encodeHeartbeatSetReqDlMsg)bindItem(ptrDll, "encodeHeartbeatSetReqDlMsg", typeof(_encodeHeartbeatSetReqDlMsg));
-            encodeSensorsReportGetReqDlMsg = (_encodeSensorsReportGetReqDlMsg)bindItem(ptrDll, "encodeSensorsReportGetReqDlMsg", typeof(_encodeSensorsReportGetReqDlMsg));
-            encodeTrafficReportGetReqDlMsg = (_encodeTrafficReportGetReqDlMsg)bindItem(ptrDll, "encodeTrafficReportGetReqDlMsg", typeof(_encodeTrafficReportGetReqDlMsg));
-            decodeUlMsgType = (_decodeUlMsgType)bindItem(ptrDll, "decodeUlMsgType", typeof(_decodeUlMsgType));
-            decodeUlMsgInitInd = (_decodeUlMsgInitInd)bindItem(ptrDll, "decodeUlMsgInitInd", typeof(_decodeUlMsgInitInd));
-            decodeUlMsgIntervalsGetCnf = (_decodeUlMsgIntervalsGetCnf)bindItem(ptrDll, "decodeUlMsgIntervalsGetCnf", typeof(_decodeUlMsgIntervalsGetCnf));
-            decodeUlMsgReportingIntervalSetCnf = (_decodeUlMsgReportingIntervalSetCnf)bindItem(ptrDll, "decodeUlMsgReportingIntervalSetCnf", typeof(_decodeUlMsgReportingIntervalSetCnf));
-            decodeUlMsgHeartbeatSetCnf = (_decodeUlMsgHeartbeatSetCnf)bindItem(ptrDll, "decodeUlMsgHeartbeatSetCnf", typeof(_decodeUlMsgHeartbeatSetCnf));
-            decodeUlMsgPollInd = (_decodeUlMsgPollInd)bindItem(ptrDll, "decodeUlMsgPollInd", typeof(_decodeUlMsgPollInd));
-            decodeUlMsgSensorsReportxxx = (_decodeUlMsgSensorsReportxxx)bindItem(ptrDll, "decodeUlMsgSensorsReportxxx", typeof(_decodeUlMsgSensorsReportxxx));
-            decodeUlMsgTrafficReportGetCnf = (_decodeUlMsgTrafficReportGetCnf)bindItem(ptrDll, "decodeUlMsgTrafficReportGetCnf", typeof(_decodeUlMsgTrafficReportGetCnf));
-            decodeUlMsgTrafficReportInd = (_decodeUlMsgTrafficReportInd)bindItem(ptrDll, "decodeUlMsgTrafficReportInd", typeof(_decodeUlMsgTrafficReportInd));
-            decodeUlMsgDebugInd = (_decodeUlMsgDebugInd)bindItem(ptrDll, "decodeUlMsgDebugInd", typeof(_decodeUlMsgDebugInd));
-            initDll = (_initDll)bindItem(ptrDll, "initDll", typeof(_initDll));
-            initDll (guiPrintToConsole);
+            procaddr = GetProcAddress (ptrDll, "getCodecApi");
+            if (procaddr != IntPtr.Zero)
+            {
+                _getCodecApi getCodecApi = (_getCodecApi) Marshal.GetDelegateForFunctionPointer (procaddr, typeof (_getCodecApi));
+                ptrApi = getCodecApi (CODEC_API_VERSION);
+                if (ptrApi == IntPtr.Zero) throw new Exception (String.Format ("{0} does not support codec API version {1}", dllLocation, CODEC_API_VERSION));
+            }
+            printToConsoleCallback = new guiPrintToConsoleCallback (guiPrintToConsole);
+            api = (CSCodecApiFunctions*) ptrApi;
+
+            if ((api != null) && bindDelegates)
+            {
+                table = (CSCodecApi) Marshal.PtrToStructure (ptrApi, typeof (CSCodecApi));
+                maxDatagramSizeRaw = (_maxDatagramSizeRaw)bindPointer(table.maxDatagramSizeRaw, "maxDatagramSizeRaw", typeof(_maxDatagramSizeRaw));
+                maxDebugStringSize = (_maxDebugStringSize)bindPointer(table.maxDebugStringSize, "maxDebugStringSize", typeof(_maxDebugStringSize));
+                revisionLevel = (_revisionLevel)bindPointer(table.revisionLevel, "revisionLevel", typeof(_revisionLevel));
+                encodeRebootReqDlMsg = (_encodeRebootReqDlMsg)bindPointer(table.encodeRebootReqDlMsg, "encodeRebootReqDlMsg", typeof(_encodeRebootReqDlMsg));
+                encodeIntervalsGetReqDlMsg = (_encodeIntervalsGetReqDlMsg)bindPointer(table.encodeIntervalsGetReqDlMsg, "encodeIntervalsGetReqDlMsg", typeof(_encodeIntervalsGetReqDlMsg));
+                encodeReportingIntervalSetReqDlMsg = (_encodeReportingIntervalSetReqDlMsg)bindPointer(table.encodeReportingIntervalSetReqDlMsg, "encodeReportingIntervalSetReqDlMsg", typeof(_encodeReportingIntervalSetReqDlMsg));
+                encodeHeartbeatSetReqDlMsg = (_encodeHeartbeatSetReqDlMsg)bindPointer(table.encodeHeartbeatSetReqDlMsg, "encodeHeartbeatSetReqDlMsg", typeof(_encodeHeartbeatSetReqDlMsg));
+                encodeSensorsReportGetReqDlMsg = (_encodeSensorsReportGetReqDlMsg)bindPointer(table.encodeSensorsReportGetReqDlMsg, "encodeSensorsReportGetReqDlMsg", typeof(_encodeSensorsReportGetReqDlMsg));
+                encodeTrafficReportGetReqDlMsg = (_encodeTrafficReportGetReqDlMsg)bindPointer(table.encodeTrafficReportGetReqDlMsg, "encodeTrafficReportGetReqDlMsg", typeof(_encodeTrafficReportGetReqDlMsg));
+                decodeUlMsgType = (_decodeUlMsgType)bindPointer(table.decodeUlMsgType, "decodeUlMsgType", typeof(_decodeUlMsgType));
+                decodeUlMsgInitInd = (_decodeUlMsgInitInd)bindPointer(table.decodeUlMsgInitInd, "decodeUlMsgInitInd", typeof(_decodeUlMsgInitInd));
+                decodeUlMsgIntervalsGetCnf = (_decodeUlMsgIntervalsGetCnf)bindPointer(table.decodeUlMsgIntervalsGetCnf, "decodeUlMsgIntervalsGetCnf", typeof(_decodeUlMsgIntervalsGetCnf));
+                decodeUlMsgReportingIntervalSetCnf = (_decodeUlMsgReportingIntervalSetCnf)bindPointer(table.decodeUlMsgReportingIntervalSetCnf, "decodeUlMsgReportingIntervalSetCnf", typeof(_decodeUlMsgReportingIntervalSetCnf));
+                decodeUlMsgHeartbeatSetCnf = (_decodeUlMsgHeartbeatSetCnf)bindPointer(table.decodeUlMsgHeartbeatSetCnf, "decodeUlMsgHeartbeatSetCnf", typeof(_decodeUlMsgHeartbeatSetCnf));
+                decodeUlMsgPollInd = (_decodeUlMsgPollInd)bindPointer(table.decodeUlMsgPollInd, "decodeUlMsgPollInd", typeof(_decodeUlMsgPollInd));
+                decodeUlMsgSensorsReportxxx = (_decodeUlMsgSensorsReportxxx)bindPointer(table.decodeUlMsgSensorsReportxxx, "decodeUlMsgSensorsReportxxx", typeof(_decodeUlMsgSensorsReportxxx));
+                decodeUlMsgSensorsReport = (_decodeUlMsgSensorsReport)bindPointer(table.decodeUlMsgSensorsReport, "decodeUlMsgSensorsReport", typeof(_decodeUlMsgSensorsReport));
+                decodeSensorsReportBatch = (_decodeSensorsReportBatch)bindPointer(table.decodeSensorsReportBatch, "decodeSensorsReportBatch", typeof(_decodeSensorsReportBatch));
+                decodeUlMsgTrafficReportGetCnf = (_decodeUlMsgTrafficReportGetCnf)bindPointer(table.decodeUlMsgTrafficReportGetCnf, "decodeUlMsgTrafficReportGetCnf", typeof(_decodeUlMsgTrafficReportGetCnf));
+                decodeUlMsgTrafficReportInd = (_decodeUlMsgTrafficReportInd)bindPointer(table.decodeUlMsgTrafficReportInd, "decodeUlMsgTrafficReportInd", typeof(_decodeUlMsgTrafficReportInd));
+                decodeUlMsgDebugInd = (_decodeUlMsgDebugInd)bindPointer(table.decodeUlMsgDebugInd, "decodeUlMsgDebugInd", typeof(_decodeUlMsgDebugInd));
+                initDll = (_initDll)bindPointer(table.initDll, "initDll", typeof(_initDll));
+            }
+            else if (api == null)
+            {
+                // An older dll, without the table
+                maxDatagramSizeRaw = (_maxDatagramSizeRaw)bindItem(ptrDll, "maxDatagramSizeRaw", typeof(_maxDatagramSizeRaw));
+                maxDebugStringSize = (_maxDebugStringSize)bindItem(ptrDll, "maxDebugStringSize", typeof(_maxDebugStringSize));
+                revisionLevel = (_revisionLevel)bindItem(ptrDll, "revisionLevel", typeof(_revisionLevel));
+                encodeRebootReqDlMsg = (_encodeRebootReqDlMsg)bindItem(ptrDll, "encodeRebootReqDlMsg", typeof(_encodeRebootReqDlMsg));
+                encodeIntervalsGetReqDlMsg = (_encodeIntervalsGetReqDlMsg)bindItem(ptrDll, "encodeIntervalsGetReqDlMsg", typeof(_encodeIntervalsGetReqDlMsg));
+                encodeReportingIntervalSetReqDlMsg = (_encodeReportingIntervalSetReqDlMsg)bindItem(ptrDll, "encodeReportingIntervalSetReqDlMsg", typeof(_encodeReportingIntervalSetReqDlMsg));
+                encodeHeartbeatSetReqDlMsg = (_encodeHeartbeatSetReqDlMsg)bindItem(ptrDll, "encodeHeartbeatSetReqDlMsg", typeof(_encodeHeartbeatSetReqDlMsg));
+                encodeSensorsReportGetReqDlMsg = (_encodeSensorsReportGetReqDlMsg)bindItem(ptrDll, "encodeSensorsReportGetReqDlMsg", typeof(_encodeSensorsReportGetReqDlMsg));
+                encodeTrafficReportGetReqDlMsg = (_encodeTrafficReportGetReqDlMsg)bindItem(ptrDll, "encodeTrafficReportGetReqDlMsg", typeof(_encodeTrafficReportGetReqDlMsg));
+                decodeUlMsgType = (_decodeUlMsgType)bindItem(ptrDll, "decodeUlMsgType", typeof(_decodeUlMsgType));
+                decodeUlMsgInitInd = (_decodeUlMsgInitInd)bindItem(ptrDll, "decodeUlMsgInitInd", typeof(_decodeUlMsgInitInd));
+                decodeUlMsgIntervalsGetCnf = (_decodeUlMsgIntervalsGetCnf)bindItem(ptrDll, "decodeUlMsgIntervalsGetCnf", typeof(_decodeUlMsgIntervalsGetCnf));
+                decodeUlMsgReportingIntervalSetCnf = (_decodeUlMsgReportingIntervalSetCnf)bindItem(ptrDll, "decodeUlMsgReportingIntervalSetCnf", typeof(_decodeUlMsgReportingIntervalSetCnf));
+                decodeUlMsgHeartbeatSetCnf = (_decodeUlMsgHeartbeatSetCnf)bindItem(ptrDll, "decodeUlMsgHeartbeatSetCnf", typeof(_decodeUlMsgHeartbeatSetCnf));
+                decodeUlMsgPollInd = (_decodeUlMsgPollInd)bindItem(ptrDll, "decodeUlMsgPollInd", typeof(_decodeUlMsgPollInd));
+                decodeUlMsgSensorsReportxxx = (_decodeUlMsgSensorsReportxxx)bindItem(ptrDll, "decodeUlMsgSensorsReportxxx", typeof(_decodeUlMsgSensorsReportxxx));
+                decodeUlMsgSensorsReport = (_decodeUlMsgSensorsReport)bindItem(ptrDll, "decodeUlMsgSensorsReport", typeof(_decodeUlMsgSensorsReport));
+                decodeSensorsReportBatch = (_decodeSensorsReportBatch)bindItem(ptrDll, "decodeSensorsReportBatch", typeof(_decodeSensorsReportBatch));
+                decodeUlMsgTrafficReportGetCnf = (_decodeUlMsgTrafficReportGetCnf)bindItem(ptrDll, "decodeUlMsgTrafficReportGetCnf", typeof(_decodeUlMsgTrafficReportGetCnf));
+                decodeUlMsgTrafficReportInd = (_decodeUlMsgTrafficReportInd)bindItem(ptrDll, "decodeUlMsgTrafficReportInd", typeof(_decodeUlMsgTrafficReportInd));
+                decodeUlMsgDebugInd = (_decodeUlMsgDebugInd)bindItem(ptrDll, "decodeUlMsgDebugInd", typeof(_decodeUlMsgDebugInd));
+                initDll = (_initDll)bindItem(ptrDll, "initDll", typeof(_initDll));
+            }
+
+            if (api != null)
+            {
+                api->initDll (Marshal.GetFunctionPointerForDelegate (printToConsoleCallback));
+            }
+            else
+            {
+                initDll (printToConsoleCallback);
+            }
+        }
+
+        /// <summary>
+        /// Decode the message at offset in buffer; readings is only filled
+        /// in if it is a SensorsReportInd or SensorsReportGetCnf
+        /// </summary>
+        /// <param name="buffer">the datagram(s)</param>
+        /// <param name="offset">where to decode from, moved on past the message</param>
+        /// <param name="end">the offset of the end of the datagram</param>
+        /// <param name="readings">the readings</param>
+        /// <returns>the decode result</returns>
+        public unsafe CSDecodeResult decodeUlMsgSensorsReportAt(byte[] buffer, ref int offset, int end, out CSSensorReadings readings)
+        {
+            CSDecodeResult result;
+            CSSensorReadings local = new CSSensorReadings ();
+
+            fixed (byte* pBuffer = buffer)
+            {
+                byte* pIn = pBuffer + offset;
+                if (api != null)
+                {
+                    result = api->decodeUlMsgSensorsReport (&pIn, (UInt32) (end - offset), &local);
+                }
+                else
+                {
+                    result = decodeUlMsgSensorsReport (&pIn, (UInt32) (end - offset), &local);
+                }
+                offset = (int) (pIn - pBuffer);
+            }
+            readings = local;
+
+            return result;
+        }
+
+        /// <summary>
+        /// Decode all of the sensor readings in a batch of datagrams with one
+        /// native call, see decodeSensorsReportBatch() in teddy_dll_wrapper.hpp;
+        /// a datagram with more readings than fit in readings is consumed
+        /// and given one entry with msgType DECODE_RESULT_OUTPUT_TOO_SHORT
+        /// </summary>
+        /// <param name="datagrams">the datagrams, end to end</param>
+        /// <param name="datagramSizes">the size of each datagram</param>
+        /// <param name="readings">where to put the readings</param>
+        /// <param name="datagramIndexes">where to put the datagram index of each reading, may be null</param>
+        /// <param name="numDatagramsDecoded">the number of datagrams consumed, all unless readings filled up;
+        /// the next call should start from there</param>
+        /// <returns>the number of readings</returns>
+        public unsafe int decodeSensorsReportBatchOf(byte[] datagrams, UInt32[] datagramSizes,
+                                                    CSSensorReadings[] readings, UInt32[] datagramIndexes,
+                                                    out int numDatagramsDecoded)
+        {
+            UInt32 numReadings;
+            UInt32 numDone = 0;
+
+            if (readings.Length == 0)
+            {
+                throw new ArgumentException ("readings is empty");
+            }
+            if ((datagramIndexes != null) && (datagramIndexes.Length < readings.Length))
+            {
+                throw new ArgumentException ("datagramIndexes is shorter than readings");
+            }
+            fixed (byte* pDatagrams = datagrams)
+            fixed (UInt32* pDatagramSizes = datagramSizes)
+            fixed (CSSensorReadings* pReadings = readings)
+            fixed (UInt32* pDatagramIndexes = datagramIndexes)
+            {
+                if (api != null)
+                {
+                    numReadings = api->decodeSensorsReportBatch (pDatagrams, pDatagramSizes, (UInt32) datagramSizes.Length,
+                                                                 pReadings, pDatagramIndexes, (UInt32) readings.Length,
+                                                                 &numDone);
+                }
+                else
+                {
+                    numReadings = decodeSensorsReportBatch (pDatagrams, pDatagramSizes, (UInt32) datagramSizes.Length,
+                                                            pReadings, pDatagramIndexes, (UInt32) readings.Length,
+                                                            &numDone);
+                }
+            }
+            numDatagramsDecoded = (int) numDone;
+
+            return (int) numReadings;
+        }
+
+        /// <summary>
+        /// As decodeUlMsgSensorsReportAt() but for a span holding the rest of
+        /// the datagram, which is moved on past the message
+        /// </summary>
+        public unsafe CSDecodeResult decodeUlMsgSensorsReportAt(ref ReadOnlySpan<byte> datagram, out CSSensorReadings readings)
+        {
+            CSDecodeResult result;
+            CSSensorReadings local = new CSSensorReadings ();
+            int used;
+
+            fixed (byte* pBuffer = datagram)
+            {
+                byte* pIn = pBuffer;
+                if (api != null)
+                {
+                    result = api->decodeUlMsgSensorsReport (&pIn, (UInt32) datagram.Length, &local);
+                }
+                else
+                {
+                    result = decodeUlMsgSensorsReport (&pIn, (UInt32) datagram.Length, &local);
+                }
+                used = (int) (pIn - pBuffer);
+            }
+            datagram = datagram.Slice (Math.Min (used, datagram.Length));
+            readings = local;
+
+            return result;
+        }
+
+        /// <summary>
+        /// As decodeSensorsReportBatchOf() but for spans
+        /// </summary>
+        public unsafe int decodeSensorsReportBatchOf(ReadOnlySpan<byte> datagrams, ReadOnlySpan<UInt32> datagramSizes,
+                                                    Span<CSSensorReadings> readings, Span<UInt32> datagramIndexes,
+                                                    out int numDatagramsDecoded)
+        {
+            UInt32 numReadings;
+            UInt32 numDone = 0;
+
+            if (readings.IsEmpty)
+            {
+                throw new ArgumentException ("readings is empty");
+            }
+            if (!datagramIndexes.IsEmpty && (datagramIndexes.Length < readings.Length))
+            {
+                throw new ArgumentException ("datagramIndexes is shorter than readings");
+            }
+            fixed (byte* pDatagrams = datagrams)
+            fixed (UInt32* pDatagramSizes = datagramSizes)
+            fixed (CSSensorReadings* pReadings = readings)
+            fixed (UInt32* pDatagramIndexes = datagramIndexes)
+            {
+                if (api != null)
+                {
+                    numReadings = api->decodeSensorsReportBatch (pDatagrams, pDatagramSizes, (UInt32) datagramSizes.Length,
+                                                                 pReadings, pDatagramIndexes, (UInt32) readings.Length,
+                                                                 &numDone);
+                }
+                else
+                {
+                    numReadings = decodeSensorsReportBatch (pDatagrams, pDatagramSizes, (UInt32) datagramSizes.Length,
+                                                            pReadings, pDatagramIndexes, (UInt32) readings.Length,
+                                                            &numDone);
+                }
+            }
+            numDatagramsDecoded = (int) numDone;
+
+            return (int) numReadings;
         }
 
         public object bindItem(IntPtr ptrDll, string dllFuncName, Type type)
@@ -323,6 +687,17 @@ namespace MessageCodec
             return result;
         }
 
+        public object bindPointer(IntPtr procaddr, string dllFuncName, Type type)
+        {
+            if (procaddr == IntPtr.Zero) throw new Exception (String.Format ("No {0} in the codec API table", dllFuncName));
+
+            // Bind it to the function
+            Object result = Marshal.GetDelegateForFunctionPointer (procaddr, type);
+            if (result == null) throw new Exception (String.Format ("Cannot bind to {0}", dllFuncName));
+
+            return result;
+        }
+
         public delegate void ConsoleTrace(string data);
         public event ConsoleTrace onConsoleTrace;
     }
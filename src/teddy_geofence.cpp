@@ -0,0 +1,795 @@
+/* Teddy geofence engine
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_geofence.cpp
+ * This file implements the geofence engine.
+ */
+
+#include <stdint.h>
+#include <stdio.h>  // for fopen() and getline()
+#include <stdlib.h> // for malloc(), realloc(), free() and strtol()
+#include <string.h> // for memset() and strtok_r()
+#include <math.h>   // for cos(), only when adding a circle
+#include <teddy_geofence.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The metres in a minute of arc of latitude (a nautical mile), times
+// 1000 since the units are thousandths of a minute
+#define MILLIMETRES_PER_UNIT 1852
+
+/// The smallest longitude scale used for a circle, so that circles
+// near the poles don't have an unbounded extent, 1.0 = 65536
+#define MIN_COS_Q16 1024
+
+/// The bit of a cell entry set if the fence covers the whole cell
+#define ENTRY_COVERS_ALL 0x80000000
+
+/// The number of positions checkBatch() finds the cells of at a time
+#define BATCH_BLOCK_SIZE 256
+
+/// The initial sizes of the growable arrays
+#define INITIAL_MAX_FENCES 64
+#define INITIAL_MAX_VERTICES 1024
+#define INITIAL_MAX_ENTRIES 1024
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// The side of the line from A to B that P is on: positive for the
+// left, negative for the right and zero for on it.
+static inline int64_t orient (int64_t ax, int64_t ay, int64_t bx, int64_t by,
+                              int64_t px, int64_t py)
+{
+    return ((bx - ax) * (py - ay)) - ((by - ay) * (px - ax));
+}
+
+/// Test whether the segment from A to B touches a closed rectangle,
+// x being longitude and y latitude: it does if their bounding boxes
+// overlap and the line through the segment doesn't have all four
+// corners strictly on one side of it.
+static bool segmentTouchesRect (int64_t ax, int64_t ay, int64_t bx, int64_t by,
+                                int64_t x0, int64_t y0, int64_t x1, int64_t y1)
+{
+    bool touches = false;
+    int64_t o;
+    uint32_t numLeft = 0;
+    uint32_t numRight = 0;
+
+    if ((((ax < bx) ? ax : bx) <= x1) && (((ax > bx) ? ax : bx) >= x0) &&
+        (((ay < by) ? ay : by) <= y1) && (((ay > by) ? ay : by) >= y0))
+    {
+        o = orient (ax, ay, bx, by, x0, y0);
+        numLeft += (o > 0);
+        numRight += (o < 0);
+        o = orient (ax, ay, bx, by, x1, y0);
+        numLeft += (o > 0);
+        numRight += (o < 0);
+        o = orient (ax, ay, bx, by, x0, y1);
+        numLeft += (o > 0);
+        numRight += (o < 0);
+        o = orient (ax, ay, bx, by, x1, y1);
+        numLeft += (o > 0);
+        numRight += (o < 0);
+        touches = (numLeft < 4) && (numRight < 4);
+    }
+
+    return touches;
+}
+
+/// Test whether a polygon contains a point by counting the edges that
+// a ray heading east from the point crosses.
+static bool polygonContains (const int32_t * pLatitudes, const int32_t * pLongitudes,
+                             uint32_t numVertices, int32_t latitude, int32_t longitude)
+{
+    bool inside = false;
+    int64_t yi;
+    int64_t yj;
+    int64_t lhs;
+    int64_t rhs;
+
+    for (uint32_t i = 0, j = numVertices - 1; i < numVertices; j = i++)
+    {
+        yi = pLatitudes[i];
+        yj = pLatitudes[j];
+        if ((yi > latitude) != (yj > latitude))
+        {
+            // The crossing is east of the point if
+            // longitude < xi + (xj - xi) * (latitude - yi) / (yj - yi),
+            // multiplied out to stay in integers
+            lhs = ((int64_t) longitude - pLongitudes[i]) * (yj - yi);
+            rhs = ((int64_t) pLongitudes[j] - pLongitudes[i]) * (latitude - yi);
+            if ((yj > yi) ? (lhs < rhs) : (lhs > rhs))
+            {
+                inside = !inside;
+            }
+        }
+    }
+
+    return inside;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+bool GeofenceEngine::addFence (const Fence_t * pFence)
+{
+    bool success = true;
+    Fence_t * pFences;
+    uint32_t maxFences;
+
+    if (m_numFences >= m_maxFences)
+    {
+        maxFences = (m_maxFences == 0) ? INITIAL_MAX_FENCES : m_maxFences * 2;
+        pFences = (Fence_t *) realloc (mp_fences, sizeof (Fence_t) * maxFences);
+        if (pFences != NULL)
+        {
+            mp_fences = pFences;
+            m_maxFences = maxFences;
+        }
+        else
+        {
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        mp_fences[m_numFences] = *pFence;
+        m_numFences++;
+        m_built = false;
+    }
+
+    return success;
+}
+
+bool GeofenceEngine::contains (const Fence_t * pFence, int32_t latitude, int32_t longitude)
+{
+    bool inside;
+    int64_t dLatitude;
+    int64_t dLongitude;
+
+    if (pFence->isCircle)
+    {
+        dLatitude = (int64_t) latitude - pFence->latitude;
+        dLongitude = (((int64_t) longitude - pFence->longitude) * pFence->cosQ16) >> 16;
+        inside = (uint64_t) ((dLatitude * dLatitude) + (dLongitude * dLongitude)) <= pFence->radiusSquared;
+    }
+    else
+    {
+        inside = polygonContains (mp_vertexLatitudes + pFence->firstVertex,
+                                  mp_vertexLongitudes + pFence->firstVertex,
+                                  pFence->numVertices, latitude, longitude);
+    }
+
+    return inside;
+}
+
+GeofenceEngine::Cover_t GeofenceEngine::cover (const Fence_t * pFence,
+                                               int32_t minLatitude, int32_t minLongitude,
+                                               int32_t maxLatitude, int32_t maxLongitude)
+{
+    Cover_t cover = COVER_NONE;
+    int32_t nearLatitude;
+    int32_t nearLongitude;
+    const int32_t * pLatitudes;
+    const int32_t * pLongitudes;
+    uint32_t j;
+
+    if (pFence->isCircle)
+    {
+        // The nearest point of the cell to the centre decides whether
+        // the circle reaches the cell; a circle is convex so it covers
+        // the cell if it contains all four corners
+        nearLatitude = (pFence->latitude < minLatitude) ? minLatitude :
+                       (pFence->latitude > maxLatitude) ? maxLatitude : pFence->latitude;
+        nearLongitude = (pFence->longitude < minLongitude) ? minLongitude :
+                        (pFence->longitude > maxLongitude) ? maxLongitude : pFence->longitude;
+        if (contains (pFence, nearLatitude, nearLongitude))
+        {
+            cover = COVER_PART;
+            if (contains (pFence, minLatitude, minLongitude) &&
+                contains (pFence, minLatitude, maxLongitude) &&
+                contains (pFence, maxLatitude, minLongitude) &&
+                contains (pFence, maxLatitude, maxLongitude))
+            {
+                cover = COVER_ALL;
+            }
+        }
+    }
+    else
+    {
+        // If no edge touches the cell then the cell is either all
+        // inside or all outside, and its centre says which
+        pLatitudes = mp_vertexLatitudes + pFence->firstVertex;
+        pLongitudes = mp_vertexLongitudes + pFence->firstVertex;
+        j = pFence->numVertices - 1;
+        for (uint32_t i = 0; (i < pFence->numVertices) && (cover == COVER_NONE); j = i++)
+        {
+            if (segmentTouchesRect (pLongitudes[j], pLatitudes[j], pLongitudes[i], pLatitudes[i],
+                                    minLongitude, minLatitude, maxLongitude, maxLatitude))
+            {
+                cover = COVER_PART;
+            }
+        }
+        if ((cover == COVER_NONE) &&
+            contains (pFence, (int32_t) (((int64_t) minLatitude + maxLatitude) / 2),
+                      (int32_t) (((int64_t) minLongitude + maxLongitude) / 2)))
+        {
+            cover = COVER_ALL;
+        }
+    }
+
+    return cover;
+}
+
+inline int64_t GeofenceEngine::getCell (int32_t latitude, int32_t longitude)
+{
+    int64_t cell = -1;
+    // A position south or west of the grid wraps to a large number
+    uint32_t row = ((uint32_t) latitude - (uint32_t) m_gridLatitude) >> m_cellShift;
+    uint32_t column = ((uint32_t) longitude - (uint32_t) m_gridLongitude) >> m_cellShift;
+
+    if ((row < m_numRows) && (column < m_numColumns))
+    {
+        cell = ((int64_t) row * m_numColumns) + column;
+    }
+
+    return cell;
+}
+
+void GeofenceEngine::freeGrid (void)
+{
+    free (mp_cellStarts);
+    mp_cellStarts = NULL;
+    free (mp_entries);
+    mp_entries = NULL;
+    m_numEntries = 0;
+    m_numRows = 0;
+    m_numColumns = 0;
+    m_built = false;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+GeofenceEngine::GeofenceEngine (void)
+{
+    mp_fences = NULL;
+    m_numFences = 0;
+    m_maxFences = 0;
+    mp_vertexLatitudes = NULL;
+    mp_vertexLongitudes = NULL;
+    m_numVertices = 0;
+    m_maxVertices = 0;
+    m_built = false;
+    m_gridLatitude = 0;
+    m_gridLongitude = 0;
+    m_cellShift = 0;
+    m_numRows = 0;
+    m_numColumns = 0;
+    mp_cellStarts = NULL;
+    mp_entries = NULL;
+    m_numEntries = 0;
+}
+
+GeofenceEngine::~GeofenceEngine (void)
+{
+    freeGrid ();
+    free (mp_fences);
+    free (mp_vertexLatitudes);
+    free (mp_vertexLongitudes);
+}
+
+bool GeofenceEngine::addCircle (uint32_t fenceId, int32_t latitude, int32_t longitude,
+                                uint32_t radiusMetres)
+{
+    bool success = false;
+    Fence_t fence;
+    int64_t radius = ((int64_t) radiusMetres * 1000) / MILLIMETRES_PER_UNIT;
+    int64_t longitudeExtent;
+    double cosLatitude;
+
+    if ((latitude >= -90 * GEOFENCE_UNITS_PER_DEGREE) && (latitude <= 90 * GEOFENCE_UNITS_PER_DEGREE) &&
+        (longitude >= -180 * GEOFENCE_UNITS_PER_DEGREE) && (longitude <= 180 * GEOFENCE_UNITS_PER_DEGREE) &&
+        (radius <= 90 * GEOFENCE_UNITS_PER_DEGREE))
+    {
+        memset (&fence, 0, sizeof (fence));
+        fence.fenceId = fenceId;
+        fence.isCircle = true;
+        fence.latitude = latitude;
+        fence.longitude = longitude;
+        cosLatitude = cos ((double) latitude / GEOFENCE_UNITS_PER_DEGREE * M_PI / 180);
+        fence.cosQ16 = (uint32_t) (cosLatitude * 65536);
+        if (fence.cosQ16 < MIN_COS_Q16)
+        {
+            fence.cosQ16 = MIN_COS_Q16;
+        }
+        fence.radiusSquared = (uint64_t) (radius * radius);
+        // One unit of slack all round for rounding in contains()
+        longitudeExtent = ((radius + 1) << 16) / fence.cosQ16 + 1;
+        fence.minLatitude = (int32_t) (latitude - radius - 1);
+        fence.maxLatitude = (int32_t) (latitude + radius + 1);
+        fence.minLongitude = (int32_t) (longitude - longitudeExtent);
+        fence.maxLongitude = (int32_t) (longitude + longitudeExtent);
+        success = addFence (&fence);
+    }
+
+    return success;
+}
+
+bool GeofenceEngine::addPolygon (uint32_t fenceId, const int32_t * pLatitudes,
+                                 const int32_t * pLongitudes, uint32_t numVertices)
+{
+    bool success = false;
+    Fence_t fence;
+    int32_t * pVertexLatitudes;
+    int32_t * pVertexLongitudes;
+    uint32_t maxVertices;
+
+    if ((numVertices >= 3) && (numVertices <= GEOFENCE_MAX_VERTICES))
+    {
+        success = true;
+        if (m_numVertices + numVertices > m_maxVertices)
+        {
+            maxVertices = (m_maxVertices == 0) ? INITIAL_MAX_VERTICES : m_maxVertices;
+            while (maxVertices < m_numVertices + numVertices)
+            {
+                maxVertices *= 2;
+            }
+            pVertexLatitudes = (int32_t *) realloc (mp_vertexLatitudes, sizeof (int32_t) * maxVertices);
+            if (pVertexLatitudes != NULL)
+            {
+                mp_vertexLatitudes = pVertexLatitudes;
+            }
+            pVertexLongitudes = (int32_t *) realloc (mp_vertexLongitudes, sizeof (int32_t) * maxVertices);
+            if (pVertexLongitudes != NULL)
+            {
+                mp_vertexLongitudes = pVertexLongitudes;
+            }
+            if ((pVertexLatitudes != NULL) && (pVertexLongitudes != NULL))
+            {
+                m_maxVertices = maxVertices;
+            }
+            else
+            {
+                success = false;
+            }
+        }
+
+        if (success)
+        {
+            memset (&fence, 0, sizeof (fence));
+            fence.fenceId = fenceId;
+            fence.firstVertex = m_numVertices;
+            fence.numVertices = numVertices;
+            fence.minLatitude = INT32_MAX;
+            fence.maxLatitude = INT32_MIN;
+            fence.minLongitude = INT32_MAX;
+            fence.maxLongitude = INT32_MIN;
+            for (uint32_t x = 0; x < numVertices; x++)
+            {
+                mp_vertexLatitudes[m_numVertices + x] = pLatitudes[x];
+                mp_vertexLongitudes[m_numVertices + x] = pLongitudes[x];
+                if (pLatitudes[x] < fence.minLatitude)
+                {
+                    fence.minLatitude = pLatitudes[x];
+                }
+                if (pLatitudes[x] > fence.maxLatitude)
+                {
+                    fence.maxLatitude = pLatitudes[x];
+                }
+                if (pLongitudes[x] < fence.minLongitude)
+                {
+                    fence.minLongitude = pLongitudes[x];
+                }
+                if (pLongitudes[x] > fence.maxLongitude)
+                {
+                    fence.maxLongitude = pLongitudes[x];
+                }
+            }
+            success = addFence (&fence);
+            if (success)
+            {
+                m_numVertices += numVertices;
+            }
+        }
+    }
+
+    return success;
+}
+
+bool GeofenceEngine::addFile (const char * pFileName)
+{
+    bool success = false;
+    FILE * pFile = fopen (pFileName, "r");
+    char * pLine = NULL;
+    size_t lineSize = 0;
+    char * pSave;
+    char * pWord;
+    long values[4];
+    int32_t * pLatitudes = NULL;
+    int32_t * pLongitudes = NULL;
+    uint32_t numVertices;
+
+    if (pFile != NULL)
+    {
+        pLatitudes = (int32_t *) malloc (sizeof (int32_t) * GEOFENCE_MAX_VERTICES);
+        pLongitudes = (int32_t *) malloc (sizeof (int32_t) * GEOFENCE_MAX_VERTICES);
+        success = (pLatitudes != NULL) && (pLongitudes != NULL);
+        while (success && (getline (&pLine, &lineSize, pFile) >= 0))
+        {
+            pWord = strtok_r (pLine, " \t\r\n", &pSave);
+            if ((pWord == NULL) || (pWord[0] == '#'))
+            {
+                // Blank or a comment
+            }
+            else if (strcmp (pWord, "circle") == 0)
+            {
+                success = true;
+                for (uint32_t x = 0; success && (x < 4); x++)
+                {
+                    pWord = strtok_r (NULL, " \t\r\n", &pSave);
+                    success = (pWord != NULL);
+                    if (success)
+                    {
+                        values[x] = strtol (pWord, NULL, 10);
+                    }
+                }
+                success = success && (values[3] >= 0) &&
+                          addCircle ((uint32_t) values[0], (int32_t) values[1], (int32_t) values[2],
+                                     (uint32_t) values[3]);
+            }
+            else if (strcmp (pWord, "polygon") == 0)
+            {
+                pWord = strtok_r (NULL, " \t\r\n", &pSave);
+                success = (pWord != NULL);
+                if (success)
+                {
+                    values[0] = strtol (pWord, NULL, 10);
+                    numVertices = 0;
+                    pWord = strtok_r (NULL, " \t\r\n", &pSave);
+                    while (success && (pWord != NULL))
+                    {
+                        pLatitudes[numVertices] = (int32_t) strtol (pWord, NULL, 10);
+                        pWord = strtok_r (NULL, " \t\r\n", &pSave);
+                        success = (pWord != NULL) && (numVertices < GEOFENCE_MAX_VERTICES);
+                        if (success)
+                        {
+                            pLongitudes[numVertices] = (int32_t) strtol (pWord, NULL, 10);
+                            numVertices++;
+                            pWord = strtok_r (NULL, " \t\r\n", &pSave);
+                        }
+                    }
+                    success = success && addPolygon ((uint32_t) values[0], pLatitudes, pLongitudes, numVertices);
+                }
+            }
+            else
+            {
+                success = false;
+            }
+        }
+        free (pLine);
+        free (pLatitudes);
+        free (pLongitudes);
+        fclose (pFile);
+    }
+
+    return success;
+}
+
+bool GeofenceEngine::build (void)
+{
+    bool success = true;
+    int32_t minLatitude = INT32_MAX;
+    int32_t maxLatitude = INT32_MIN;
+    int32_t minLongitude = INT32_MAX;
+    int32_t maxLongitude = INT32_MIN;
+    uint64_t targetCells;
+    uint32_t numCells;
+    uint32_t * pCells = NULL;
+    uint32_t * pValues = NULL;
+    uint32_t * pNewCells;
+    uint32_t * pNewValues;
+    uint32_t numPairs = 0;
+    uint32_t maxPairs = 0;
+    uint32_t row0;
+    uint32_t row1;
+    uint32_t column0;
+    uint32_t column1;
+    int64_t cellMinLatitude;
+    int64_t cellMinLongitude;
+    int64_t cellSize;
+    Cover_t cellCover;
+    const Fence_t * pFence;
+
+    freeGrid ();
+
+    if (m_numFences > 0)
+    {
+        for (uint32_t x = 0; x < m_numFences; x++)
+        {
+            pFence = &(mp_fences[x]);
+            if (pFence->minLatitude < minLatitude)
+            {
+                minLatitude = pFence->minLatitude;
+            }
+            if (pFence->maxLatitude > maxLatitude)
+            {
+                maxLatitude = pFence->maxLatitude;
+            }
+            if (pFence->minLongitude < minLongitude)
+            {
+                minLongitude = pFence->minLongitude;
+            }
+            if (pFence->maxLongitude > maxLongitude)
+            {
+                maxLongitude = pFence->maxLongitude;
+            }
+        }
+
+        // The smallest power-of-two cell that keeps to the target
+        targetCells = (uint64_t) m_numFences * GEOFENCE_CELLS_PER_FENCE;
+        if (targetCells > GEOFENCE_MAX_CELLS)
+        {
+            targetCells = GEOFENCE_MAX_CELLS;
+        }
+        m_gridLatitude = minLatitude;
+        m_gridLongitude = minLongitude;
+        for (m_cellShift = 0; ; m_cellShift++)
+        {
+            m_numRows = (uint32_t) (((int64_t) maxLatitude - minLatitude) >> m_cellShift) + 1;
+            m_numColumns = (uint32_t) (((int64_t) maxLongitude - minLongitude) >> m_cellShift) + 1;
+            if ((uint64_t) m_numRows * m_numColumns <= targetCells)
+            {
+                break;
+            }
+        }
+        numCells = m_numRows * m_numColumns;
+        cellSize = (int64_t) 1 << m_cellShift;
+
+        // Work out the (cell, entry) pairs fence by fence
+        for (uint32_t x = 0; success && (x < m_numFences); x++)
+        {
+            pFence = &(mp_fences[x]);
+            row0 = (uint32_t) (((int64_t) pFence->minLatitude - m_gridLatitude) >> m_cellShift);
+            row1 = (uint32_t) (((int64_t) pFence->maxLatitude - m_gridLatitude) >> m_cellShift);
+            column0 = (uint32_t) (((int64_t) pFence->minLongitude - m_gridLongitude) >> m_cellShift);
+            column1 = (uint32_t) (((int64_t) pFence->maxLongitude - m_gridLongitude) >> m_cellShift);
+            for (uint32_t row = row0; success && (row <= row1); row++)
+            {
+                cellMinLatitude = m_gridLatitude + ((int64_t) row << m_cellShift);
+                for (uint32_t column = column0; success && (column <= column1); column++)
+                {
+                    cellMinLongitude = m_gridLongitude + ((int64_t) column << m_cellShift);
+                    cellCover = cover (pFence, (int32_t) cellMinLatitude, (int32_t) cellMinLongitude,
+                                       (int32_t) (cellMinLatitude + cellSize - 1),
+                                       (int32_t) (cellMinLongitude + cellSize - 1));
+                    if (cellCover != COVER_NONE)
+                    {
+                        if (numPairs >= maxPairs)
+                        {
+                            maxPairs = (maxPairs == 0) ? INITIAL_MAX_ENTRIES : maxPairs * 2;
+                            pNewCells = (uint32_t *) realloc (pCells, sizeof (uint32_t) * maxPairs);
+                            if (pNewCells != NULL)
+                            {
+                                pCells = pNewCells;
+                            }
+                            pNewValues = (uint32_t *) realloc (pValues, sizeof (uint32_t) * maxPairs);
+                            if (pNewValues != NULL)
+                            {
+                                pValues = pNewValues;
+                            }
+                            success = (pNewCells != NULL) && (pNewValues != NULL);
+                        }
+                        if (success)
+                        {
+                            pCells[numPairs] = (row * m_numColumns) + column;
+                            pValues[numPairs] = x | ((cellCover == COVER_ALL) ? ENTRY_COVERS_ALL : 0);
+                            numPairs++;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Counting sort of the pairs into the entries of each cell,
+        // keeping them in fence order
+        if (success)
+        {
+            mp_cellStarts = (uint32_t *) calloc (numCells + 1, sizeof (uint32_t));
+            mp_entries = (uint32_t *) malloc (sizeof (uint32_t) * (numPairs + 1));
+            success = (mp_cellStarts != NULL) && (mp_entries != NULL);
+        }
+        if (success)
+        {
+            for (uint32_t x = 0; x < numPairs; x++)
+            {
+                mp_cellStarts[pCells[x] + 1]++;
+            }
+            for (uint32_t x = 0; x < numCells; x++)
+            {
+                mp_cellStarts[x + 1] += mp_cellStarts[x];
+            }
+            for (uint32_t x = 0; x < numPairs; x++)
+            {
+                // Use the start of the next cell as a cursor, then put
+                // it back
+                mp_entries[mp_cellStarts[pCells[x]]] = pValues[x];
+                mp_cellStarts[pCells[x]]++;
+            }
+            for (uint32_t x = numCells; x > 0; x--)
+            {
+                mp_cellStarts[x] = mp_cellStarts[x - 1];
+            }
+            mp_cellStarts[0] = 0;
+            m_numEntries = numPairs;
+        }
+        free (pCells);
+        free (pValues);
+    }
+
+    if (success)
+    {
+        m_built = true;
+    }
+    else
+    {
+        freeGrid ();
+    }
+
+    return success;
+}
+
+uint32_t GeofenceEngine::check (int32_t latitude, int32_t longitude,
+                                uint32_t * pFenceIds, uint32_t maxFenceIds)
+{
+    uint32_t numFences = 0;
+    uint32_t entry;
+    const Fence_t * pFence;
+    int64_t cell = -1;
+
+    if (m_built && (m_numEntries > 0))
+    {
+        cell = getCell (latitude, longitude);
+    }
+
+    if (cell >= 0)
+    {
+        for (uint32_t x = mp_cellStarts[cell]; x < mp_cellStarts[cell + 1]; x++)
+        {
+            entry = mp_entries[x];
+            pFence = &(mp_fences[entry & ~ENTRY_COVERS_ALL]);
+            if ((entry & ENTRY_COVERS_ALL) || contains (pFence, latitude, longitude))
+            {
+                if (numFences < maxFenceIds)
+                {
+                    pFenceIds[numFences] = pFence->fenceId;
+                }
+                numFences++;
+            }
+        }
+    }
+
+    return numFences;
+}
+
+uint32_t GeofenceEngine::checkBatch (const int32_t * pLatitudes, const int32_t * pLongitudes,
+                                     uint32_t numPoints, GeofenceHit_t * pHits, uint32_t maxHits,
+                                     uint32_t * pNumPointsChecked)
+{
+    uint32_t numHits = 0;
+    uint32_t numPointHits;
+    uint32_t point = 0;
+    uint32_t blockSize;
+    uint32_t rows[BATCH_BLOCK_SIZE];
+    uint32_t columns[BATCH_BLOCK_SIZE];
+    uint32_t entry;
+    uint32_t cell;
+    const Fence_t * pFence;
+    bool full = false;
+
+    if (m_built && (m_numEntries > 0))
+    {
+        while ((point < numPoints) && !full)
+        {
+            blockSize = numPoints - point;
+            if (blockSize > BATCH_BLOCK_SIZE)
+            {
+                blockSize = BATCH_BLOCK_SIZE;
+            }
+
+            // Cells first, in a loop with no branches to vectorise
+            for (uint32_t x = 0; x < blockSize; x++)
+            {
+                rows[x] = ((uint32_t) pLatitudes[point + x] - (uint32_t) m_gridLatitude) >> m_cellShift;
+                columns[x] = ((uint32_t) pLongitudes[point + x] - (uint32_t) m_gridLongitude) >> m_cellShift;
+            }
+
+            // Then the fences of each cell
+            for (uint32_t x = 0; (x < blockSize) && !full; x++)
+            {
+                if ((rows[x] < m_numRows) && (columns[x] < m_numColumns))
+                {
+                    cell = (rows[x] * m_numColumns) + columns[x];
+                    numPointHits = 0;
+                    for (uint32_t y = mp_cellStarts[cell]; (y < mp_cellStarts[cell + 1]) && !full; y++)
+                    {
+                        entry = mp_entries[y];
+                        pFence = &(mp_fences[entry & ~ENTRY_COVERS_ALL]);
+                        if ((entry & ENTRY_COVERS_ALL) ||
+                            contains (pFence, pLatitudes[point + x], pLongitudes[point + x]))
+                        {
+                            if (numHits + numPointHits < maxHits)
+                            {
+                                pHits[numHits + numPointHits].pointIndex = point + x;
+                                pHits[numHits + numPointHits].fenceId = pFence->fenceId;
+                                numPointHits++;
+                            }
+                            else
+                            {
+                                // Leave this position for next time
+                                full = true;
+                                blockSize = x;
+                            }
+                        }
+                    }
+                    if (!full)
+                    {
+                        numHits += numPointHits;
+                    }
+                }
+            }
+            point += blockSize;
+        }
+    }
+    else
+    {
+        point = numPoints;
+    }
+
+    if (pNumPointsChecked != NULL)
+    {
+        *pNumPointsChecked = point;
+    }
+
+    return numHits;
+}
+
+uint32_t GeofenceEngine::getNumFences (void)
+{
+    return m_numFences;
+}
+
+void GeofenceEngine::getGridInfo (uint32_t * pNumCells, uint32_t * pNumEntries, uint32_t * pCellSize)
+{
+    if (pNumCells != NULL)
+    {
+        *pNumCells = m_numRows * m_numColumns;
+    }
+    if (pNumEntries != NULL)
+    {
+        *pNumEntries = m_numEntries;
+    }
+    if (pCellSize != NULL)
+    {
+        *pCellSize = (uint32_t) 1 << m_cellShift;
+    }
+}
+
+// End Of File
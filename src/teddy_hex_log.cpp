@@ -0,0 +1,668 @@
+/* Teddy hex log reader
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_hex_log.cpp
+ * This file implements the hex log reader.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for malloc() and free()
+#include <string.h> // for memchr(), memmove(), memset() and strcmp()
+#include <errno.h>
+#include <fcntl.h>  // for open() and posix_fadvise()
+#include <unistd.h> // for read() and close()
+#if defined (__x86_64__) || defined (__i386__)
+# define HEX_LOG_X86
+# include <immintrin.h>
+#endif
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_hex_log.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// What hexValue() gives for a character that is not hex
+#define HEX_VALUE_INVALID 0x10
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The names of the HexLogPath_t values.
+static const char * gPathNames[] = {"scalar", "SSE4.1", "AVX2"};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS: SCALAR
+// ----------------------------------------------------------------
+
+static inline bool isSeparator (char c)
+{
+    return (c == ' ') || (c == '\t') || (c == ',') || (c == '"') || (c == '\r');
+}
+
+static inline bool isDigit (char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+/// Get the value of a hex character.
+// \return  0 to 15, or HEX_VALUE_INVALID.
+static inline uint32_t hexValue (char c)
+{
+    uint32_t value = (uint32_t) (uint8_t) c - '0';
+
+    if (value > 9)
+    {
+        // Both cases of letter at once
+        value = (uint32_t) ((uint8_t) c | 0x20) - 'a';
+        value = (value < 6) ? value + 10 : HEX_VALUE_INVALID;
+    }
+
+    return value;
+}
+
+static inline bool hexToBinaryScalar (const char * pHex, uint32_t size, char * pBinary)
+{
+    uint32_t invalid = 0;
+    uint32_t high;
+    uint32_t low;
+
+    for (uint32_t x = 0; x + 1 < size; x += 2)
+    {
+        high = hexValue (pHex[x]);
+        low = hexValue (pHex[x + 1]);
+        invalid |= high | low;
+        *pBinary = (char) ((high << 4) | low);
+        pBinary++;
+    }
+
+    return (invalid & HEX_VALUE_INVALID) == 0;
+}
+
+static inline const char * findLastSeparatorScalar (const char * pStart, const char * pEnd)
+{
+    const char * pSeparator = NULL;
+
+    while ((pSeparator == NULL) && (pEnd > pStart))
+    {
+        pEnd--;
+        if (isSeparator (*pEnd))
+        {
+            pSeparator = pEnd;
+        }
+    }
+
+    return pSeparator;
+}
+
+#ifdef HEX_LOG_X86
+
+// The SIMD functions are built up from inline steps, rather than
+// one calling another for its remainder, so that the AVX2 functions
+// contain only VEX-encoded instructions: a call from AVX2 code into
+// legacy SSE code can leave the upper halves of the registers dirty,
+// which costs more than the remainder itself.
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS: SSE4.1
+// ----------------------------------------------------------------
+
+/// Convert 16 hex characters to 8 bytes: each character is turned
+// into its value both as a digit and as a letter of either case, an
+// unsigned minimum telling which (if either) is in range, then each
+// pair of values is multiplied and added into (high * 16) + low and
+// packed down to a byte.
+// \return  A mask of the characters that are hex.
+__attribute__ ((target ("sse4.1")))
+static inline __m128i hexToBinary16 (const char * pHex, char * pBinary)
+{
+    __m128i chars = _mm_loadu_si128 ((const __m128i *) pHex);
+    __m128i digits = _mm_sub_epi8 (chars, _mm_set1_epi8 ('0'));
+    __m128i letters = _mm_sub_epi8 (_mm_or_si128 (chars, _mm_set1_epi8 (0x20)), _mm_set1_epi8 ('a'));
+    __m128i isDigit = _mm_cmpeq_epi8 (_mm_min_epu8 (digits, _mm_set1_epi8 (9)), digits);
+    __m128i isLetter = _mm_cmpeq_epi8 (_mm_min_epu8 (letters, _mm_set1_epi8 (5)), letters);
+    __m128i values = _mm_blendv_epi8 (_mm_add_epi8 (letters, _mm_set1_epi8 (10)), digits, isDigit);
+
+    values = _mm_maddubs_epi16 (values, _mm_set1_epi16 (0x0110));
+    _mm_storel_epi64 ((__m128i *) pBinary, _mm_packus_epi16 (values, values));
+
+    return _mm_or_si128 (isDigit, isLetter);
+}
+
+/// Get a mask of the separators among 16 characters.
+__attribute__ ((target ("sse4.1")))
+static inline uint32_t separators16 (const char * pText)
+{
+    __m128i chars = _mm_loadu_si128 ((const __m128i *) pText);
+    __m128i separators = _mm_cmpeq_epi8 (chars, _mm_set1_epi8 (' '));
+
+    separators = _mm_or_si128 (separators, _mm_cmpeq_epi8 (chars, _mm_set1_epi8 ('\t')));
+    separators = _mm_or_si128 (separators, _mm_cmpeq_epi8 (chars, _mm_set1_epi8 (',')));
+    separators = _mm_or_si128 (separators, _mm_cmpeq_epi8 (chars, _mm_set1_epi8 ('"')));
+    separators = _mm_or_si128 (separators, _mm_cmpeq_epi8 (chars, _mm_set1_epi8 ('\r')));
+
+    return (uint32_t) _mm_movemask_epi8 (separators);
+}
+
+__attribute__ ((target ("sse4.1")))
+static bool hexToBinarySse4 (const char * pHex, uint32_t size, char * pBinary)
+{
+    __m128i valid = _mm_set1_epi8 (-1);
+    uint32_t x = 0;
+
+    for (; x + 16 <= size; x += 16)
+    {
+        valid = _mm_and_si128 (valid, hexToBinary16 (pHex + x, pBinary + (x >> 1)));
+    }
+
+    return (_mm_movemask_epi8 (valid) == 0xFFFF) &&
+           hexToBinaryScalar (pHex + x, size - x, pBinary + (x >> 1));
+}
+
+__attribute__ ((target ("sse4.1")))
+static const char * findLastSeparatorSse4 (const char * pStart, const char * pEnd)
+{
+    const char * pSeparator = NULL;
+    uint32_t mask;
+
+    while ((pSeparator == NULL) && (pEnd - pStart >= 16))
+    {
+        pEnd -= 16;
+        mask = separators16 (pEnd);
+        if (mask != 0)
+        {
+            pSeparator = pEnd + 31 - __builtin_clz (mask);
+        }
+    }
+    if (pSeparator == NULL)
+    {
+        pSeparator = findLastSeparatorScalar (pStart, pEnd);
+    }
+
+    return pSeparator;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS: AVX2
+// ----------------------------------------------------------------
+
+/// As hexToBinary16() but 32 hex characters to 16 bytes.
+__attribute__ ((target ("avx2")))
+static inline __m256i hexToBinary32 (const char * pHex, char * pBinary)
+{
+    __m256i chars = _mm256_loadu_si256 ((const __m256i *) pHex);
+    __m256i digits = _mm256_sub_epi8 (chars, _mm256_set1_epi8 ('0'));
+    __m256i letters = _mm256_sub_epi8 (_mm256_or_si256 (chars, _mm256_set1_epi8 (0x20)), _mm256_set1_epi8 ('a'));
+    __m256i isDigit = _mm256_cmpeq_epi8 (_mm256_min_epu8 (digits, _mm256_set1_epi8 (9)), digits);
+    __m256i isLetter = _mm256_cmpeq_epi8 (_mm256_min_epu8 (letters, _mm256_set1_epi8 (5)), letters);
+    __m256i values = _mm256_blendv_epi8 (_mm256_add_epi8 (letters, _mm256_set1_epi8 (10)), digits, isDigit);
+
+    values = _mm256_maddubs_epi16 (values, _mm256_set1_epi16 (0x0110));
+    // Packing is done within each 128-bit lane, so bring the
+    // 8 bytes of the upper lane down next to those of the lower
+    values = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (values, values), 0x08);
+    _mm_storeu_si128 ((__m128i *) pBinary, _mm256_castsi256_si128 (values));
+
+    return _mm256_or_si256 (isDigit, isLetter);
+}
+
+/// As separators16() but for 32 characters.
+__attribute__ ((target ("avx2")))
+static inline uint32_t separators32 (const char * pText)
+{
+    __m256i chars = _mm256_loadu_si256 ((const __m256i *) pText);
+    __m256i separators = _mm256_cmpeq_epi8 (chars, _mm256_set1_epi8 (' '));
+
+    separators = _mm256_or_si256 (separators, _mm256_cmpeq_epi8 (chars, _mm256_set1_epi8 ('\t')));
+    separators = _mm256_or_si256 (separators, _mm256_cmpeq_epi8 (chars, _mm256_set1_epi8 (',')));
+    separators = _mm256_or_si256 (separators, _mm256_cmpeq_epi8 (chars, _mm256_set1_epi8 ('"')));
+    separators = _mm256_or_si256 (separators, _mm256_cmpeq_epi8 (chars, _mm256_set1_epi8 ('\r')));
+
+    return (uint32_t) _mm256_movemask_epi8 (separators);
+}
+
+__attribute__ ((target ("avx2")))
+static bool hexToBinaryAvx2 (const char * pHex, uint32_t size, char * pBinary)
+{
+    __m256i valid = _mm256_set1_epi8 (-1);
+    __m128i valid16 = _mm_set1_epi8 (-1);
+    uint32_t x = 0;
+
+    for (; x + 32 <= size; x += 32)
+    {
+        valid = _mm256_and_si256 (valid, hexToBinary32 (pHex + x, pBinary + (x >> 1)));
+    }
+    if (x + 16 <= size)
+    {
+        valid16 = hexToBinary16 (pHex + x, pBinary + (x >> 1));
+        x += 16;
+    }
+
+    return ((uint32_t) _mm256_movemask_epi8 (valid) == 0xFFFFFFFF) &&
+           (_mm_movemask_epi8 (valid16) == 0xFFFF) &&
+           hexToBinaryScalar (pHex + x, size - x, pBinary + (x >> 1));
+}
+
+__attribute__ ((target ("avx2")))
+static const char * findLastSeparatorAvx2 (const char * pStart, const char * pEnd)
+{
+    const char * pSeparator = NULL;
+    uint32_t mask;
+
+    while ((pSeparator == NULL) && (pEnd - pStart >= 32))
+    {
+        pEnd -= 32;
+        mask = separators32 (pEnd);
+        if (mask != 0)
+        {
+            pSeparator = pEnd + 31 - __builtin_clz (mask);
+        }
+    }
+    if ((pSeparator == NULL) && (pEnd - pStart >= 16))
+    {
+        pEnd -= 16;
+        mask = separators16 (pEnd);
+        if (mask != 0)
+        {
+            pSeparator = pEnd + 31 - __builtin_clz (mask);
+        }
+    }
+    if (pSeparator == NULL)
+    {
+        pSeparator = findLastSeparatorScalar (pStart, pEnd);
+    }
+
+    return pSeparator;
+}
+
+#endif
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+const char * HexLogReader::findLastSeparator (const char * pStart, const char * pEnd,
+                                              HexLogPath_t path)
+{
+    const char * pSeparator;
+
+    switch (path)
+    {
+#ifdef HEX_LOG_X86
+        case HEX_LOG_PATH_AVX2:
+            pSeparator = findLastSeparatorAvx2 (pStart, pEnd);
+        break;
+        case HEX_LOG_PATH_SSE4:
+            pSeparator = findLastSeparatorSse4 (pStart, pEnd);
+        break;
+#endif
+        default:
+            pSeparator = findLastSeparatorScalar (pStart, pEnd);
+        break;
+    }
+
+    return pSeparator;
+}
+
+DeviceId_t HexLogReader::parseDevice (const char * pStart, const char * pEnd)
+{
+    DeviceId_t deviceId = DEVICE_ID_INVALID;
+    uint32_t ipAddress = 0;
+    uint32_t value = 0;
+    uint32_t numDigits;
+    bool ok = true;
+
+    // Four octets, each followed by a '.' except the last, which is
+    // followed by a ':' and then the port
+    for (uint32_t x = 0; ok && (x < 5); x++)
+    {
+        value = 0;
+        for (numDigits = 0; (pStart < pEnd) && isDigit (*pStart) && (numDigits < 5); numDigits++)
+        {
+            value = (value * 10) + (*pStart - '0');
+            pStart++;
+        }
+        ok = (numDigits > 0) && (value <= ((x < 4) ? 0xFF : 0xFFFF));
+        if (x < 4)
+        {
+            ipAddress = (ipAddress << 8) | value;
+            ok = ok && (pStart < pEnd) && (*pStart == ((x < 3) ? '.' : ':'));
+            pStart++;
+        }
+    }
+    if (ok && (pStart == pEnd))
+    {
+        deviceId = deviceIdFromAddress (ipAddress, (uint16_t) value);
+    }
+
+    return deviceId;
+}
+
+void HexLogReader::processLine (const char * pLine, const char * pEnd)
+{
+    const char * pSeparator;
+    const char * pField;
+    const char * pFieldEnd;
+    DeviceId_t deviceId = DEVICE_ID_INVALID;
+    int32_t size = -1;
+
+    // Lose any CR, closing quote or trailing space
+    while ((pEnd > pLine) && isSeparator (*(pEnd - 1)))
+    {
+        pEnd--;
+    }
+
+    m_stats.numLines++;
+    if ((pEnd == pLine) || (*pLine == '#'))
+    {
+        m_stats.numLinesSkipped++;
+    }
+    else
+    {
+        pSeparator = findLastSeparator (pLine, pEnd, m_path);
+        if ((pSeparator != NULL) && (pEnd - (pSeparator + 1) <= MAX_DATAGRAM_SIZE_RAW * 2))
+        {
+            // The device is the field before the hex
+            pFieldEnd = pSeparator;
+            while ((pFieldEnd > pLine) && isSeparator (*(pFieldEnd - 1)))
+            {
+                pFieldEnd--;
+            }
+            pField = pFieldEnd;
+            while ((pField > pLine) && !isSeparator (*(pField - 1)))
+            {
+                pField--;
+            }
+            deviceId = parseDevice (pField, pFieldEnd);
+            if (deviceId != DEVICE_ID_INVALID)
+            {
+                size = hexToBinary (pSeparator + 1, pEnd - (pSeparator + 1), m_slots[m_batchSize], m_path);
+            }
+        }
+
+        if (size > 0)
+        {
+            m_deviceIds[m_batchSize] = deviceId;
+            m_sizes[m_batchSize] = (uint32_t) size;
+            m_batchSize++;
+            m_stats.numDatagrams++;
+            m_stats.numBytes += size;
+            if (m_batchSize >= HEX_LOG_BATCH_SIZE)
+            {
+                decodeBatch ();
+            }
+        }
+        else
+        {
+            m_stats.numBadLines++;
+        }
+    }
+}
+
+void HexLogReader::decodeBatch (void)
+{
+    MessageCodec::DecodeResult_t decodeResult;
+    UlMsgUnion_t msg;
+    uint64_t startTimeUs;
+    const char * pIn;
+    const char * pEnd;
+    bool decode;
+
+    if (m_batchSize > 0)
+    {
+        startTimeUs = serverTimeUs ();
+        for (uint32_t x = 0; x < m_batchSize; x++)
+        {
+            decode = true;
+            if (m_datagramCallback != NULL)
+            {
+                decode = m_datagramCallback (mp_context, m_index, m_deviceIds[x], m_slots[x], m_sizes[x]);
+            }
+
+            // As for the IngestServer, decode straight out of the slot
+            pIn = m_slots[x];
+            pEnd = pIn + m_sizes[x];
+            while (decode && (pIn < pEnd))
+            {
+                decodeResult = m_codec.decodeUlMsg (&pIn, pEnd - pIn, &msg);
+                if ((decodeResult < MessageCodec::DECODE_RESULT_UL_MSG_BASE) ||
+                    (decodeResult > MessageCodec::MAX_UL_REQ_MSG) || (pIn > pEnd))
+                {
+                    // Can't trust anything after a bad message
+                    m_stats.numDecodeFailures++;
+                    break;
+                }
+
+                m_stats.numMsgsDecoded++;
+                if (m_msgCallback != NULL)
+                {
+                    m_msgCallback (mp_context, m_index, m_deviceIds[x], decodeResult,
+                                   &msg, NULL, 0, &m_codec);
+                }
+            }
+        }
+        m_batchSize = 0;
+        m_stats.decodeTimeUs += serverTimeUs () - startTimeUs;
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+HexLogReader::HexLogReader (void)
+{
+    m_msgCallback = NULL;
+    m_datagramCallback = NULL;
+    mp_context = NULL;
+    m_index = 0;
+    m_path = HEX_LOG_PATH_SCALAR;
+    m_skipLine = false;
+    m_batchSize = 0;
+    memset (&m_stats, 0, sizeof (m_stats));
+}
+
+HexLogReader::~HexLogReader (void)
+{
+}
+
+bool HexLogReader::init (IngestMsgCallback_t msgCallback,
+                         IngestDatagramCallback_t datagramCallback,
+                         void * pContext,
+                         uint32_t index)
+{
+    m_msgCallback = msgCallback;
+    m_datagramCallback = datagramCallback;
+    mp_context = pContext;
+    m_index = index;
+    m_path = getBestPath ();
+    m_skipLine = false;
+    m_batchSize = 0;
+    memset (&m_stats, 0, sizeof (m_stats));
+
+    return true;
+}
+
+bool HexLogReader::setPath (HexLogPath_t path)
+{
+    bool success = false;
+
+    // A CPU with AVX2 has SSE4.1 too
+    if (path <= getBestPath ())
+    {
+        m_path = path;
+        success = true;
+    }
+
+    return success;
+}
+
+HexLogPath_t HexLogReader::getPath (void)
+{
+    return m_path;
+}
+
+HexLogPath_t HexLogReader::getBestPath (void)
+{
+    HexLogPath_t path = HEX_LOG_PATH_SCALAR;
+
+#ifdef HEX_LOG_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+    {
+        path = HEX_LOG_PATH_AVX2;
+    }
+    else if (__builtin_cpu_supports ("sse4.1"))
+    {
+        path = HEX_LOG_PATH_SSE4;
+    }
+#endif
+
+    return path;
+}
+
+const char * HexLogReader::getPathName (HexLogPath_t path)
+{
+    const char * pName = "unknown";
+
+    if (path < MAX_NUM_HEX_LOG_PATHS)
+    {
+        pName = gPathNames[path];
+    }
+
+    return pName;
+}
+
+int32_t HexLogReader::hexToBinary (const char * pHex, uint32_t size, char * pBinary,
+                                   HexLogPath_t path)
+{
+    bool valid = false;
+
+    if ((size & 1) == 0)
+    {
+        switch (path)
+        {
+#ifdef HEX_LOG_X86
+            case HEX_LOG_PATH_AVX2:
+                valid = hexToBinaryAvx2 (pHex, size, pBinary);
+            break;
+            case HEX_LOG_PATH_SSE4:
+                valid = hexToBinarySse4 (pHex, size, pBinary);
+            break;
+#endif
+            default:
+                valid = hexToBinaryScalar (pHex, size, pBinary);
+            break;
+        }
+    }
+
+    return valid ? (int32_t) (size >> 1) : -1;
+}
+
+uint32_t HexLogReader::ingest (const char * pText, uint32_t size, bool final)
+{
+    const char * pLine = pText;
+    const char * pEnd = pText + size;
+    const char * pNewline;
+    const char * pLineEnd;
+    uint64_t startTimeUs = serverTimeUs ();
+    uint64_t decodeTimeUs = m_stats.decodeTimeUs;
+
+    while (pLine < pEnd)
+    {
+        pNewline = (const char *) memchr (pLine, '\n', pEnd - pLine);
+        if ((pNewline == NULL) && !final && !m_skipLine && (pEnd - pLine < HEX_LOG_MAX_LINE_SIZE))
+        {
+            // A partial line, to be passed again
+            break;
+        }
+        pLineEnd = (pNewline != NULL) ? pNewline : pEnd;
+        if (!m_skipLine)
+        {
+            if (pLineEnd - pLine < HEX_LOG_MAX_LINE_SIZE)
+            {
+                processLine (pLine, pLineEnd);
+            }
+            else
+            {
+                m_stats.numLines++;
+                m_stats.numBadLines++;
+            }
+        }
+        // If there is no end of line then this is the start of a long
+        // line, the rest of which must be thrown away too
+        m_skipLine = (pNewline == NULL) && !final;
+        pLine = (pNewline != NULL) ? pNewline + 1 : pEnd;
+    }
+    decodeBatch ();
+
+    m_stats.numChars += pLine - pText;
+    m_stats.hexTimeUs += (serverTimeUs () - startTimeUs) - (m_stats.decodeTimeUs - decodeTimeUs);
+
+    return pLine - pText;
+}
+
+bool HexLogReader::ingestFile (const char * pFileName)
+{
+    bool success = false;
+    int fd = 0;
+    char * pBuffer = (char *) malloc (HEX_LOG_READ_SIZE);
+    uint32_t size = 0;
+    uint32_t used;
+    ssize_t numRead;
+
+    if (strcmp (pFileName, "-") != 0)
+    {
+        fd = open (pFileName, O_RDONLY);
+    }
+    if ((pBuffer != NULL) && (fd >= 0))
+    {
+        posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        // ingest() always leaves less than a line, so there is always
+        // room to read more
+        do
+        {
+            numRead = read (fd, pBuffer + size, HEX_LOG_READ_SIZE - size);
+            if (numRead >= 0)
+            {
+                size += numRead;
+                used = ingest (pBuffer, size, numRead == 0);
+                size -= used;
+                memmove (pBuffer, pBuffer + used, size);
+            }
+        }
+        while ((numRead > 0) || ((numRead < 0) && (errno == EINTR)));
+        success = (numRead == 0);
+    }
+    if (fd > 0)
+    {
+        close (fd);
+    }
+    free (pBuffer);
+
+    return success;
+}
+
+void HexLogReader::getStats (HexLogStats_t * pStats)
+{
+    *pStats = m_stats;
+}
+
+MessageCodec * HexLogReader::getCodec (void)
+{
+    return &m_codec;
+}
+
+// End Of File
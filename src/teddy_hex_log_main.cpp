@@ -0,0 +1,288 @@
+/* Teddy hex log ingest application
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_hex_log_main.cpp
+ * The main() of the hex log ingester: decodes the uplink datagrams
+ * in logs of them written as hex text, see HexLogReader, and prints
+ * what was found and how fast.
+ *
+ * Usage: teddy_hex_log [-t threads] [-h scalar|sse4|avx2] file
+ * [file ...]
+ *
+ * A file of "-" is stdin, e.g. zcat old.log.gz | teddy_hex_log -.
+ * With -t the files are shared out among that many threads, each
+ * with its own HexLogReader, one file at a time (default one
+ * thread).  With -h the hex is converted that way rather than the
+ * fastest way that the CPU supports, e.g. to compare them.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> // for atoi()
+#include <string.h> // for strcmp() and memset()
+#include <new>      // for std::nothrow
+#include <atomic>
+#include <pthread.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_hex_log.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The maximum number of threads
+#define MAX_NUM_THREADS 64
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A thread and what it has found.
+typedef struct ThreadTag_t
+{
+    pthread_t thread;
+    bool threadRunning;
+    HexLogReader reader;
+    uint64_t numMsgs[MessageCodec::MAX_NUM_DECODE_RESULTS];
+    uint32_t numFiles;
+    uint32_t numFilesFailed;
+} Thread_t;
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The files and the next one to be taken by a thread.
+static char ** gpFileNames = NULL;
+static int gNumFiles = 0;
+static std::atomic<int> gNextFile (0);
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void printUsage (const char * pName)
+{
+    printf ("Usage: %s [-t threads] [-h scalar|sse4|avx2] file [file ...]\n", pName);
+}
+
+/// Count the messages decoded by type.
+static uint32_t msgCallback (void * pContext,
+                             uint32_t threadIndex,
+                             DeviceId_t deviceId,
+                             MessageCodec::DecodeResult_t result,
+                             const UlMsgUnion_t * pMsg,
+                             char * pDlBuffer,
+                             uint32_t dlSpace,
+                             MessageCodec * pCodec)
+{
+    ((Thread_t *) pContext)->numMsgs[result]++;
+
+    return 0;
+}
+
+/// A thread: takes files until there are none left.
+static void * fileThread (void * pParam)
+{
+    Thread_t * pThread = (Thread_t *) pParam;
+    int file;
+
+    while ((file = gNextFile.fetch_add (1)) < gNumFiles)
+    {
+        pThread->numFiles++;
+        if (!pThread->reader.ingestFile (gpFileNames[file]))
+        {
+            printf ("HexLog: unable to read %s.\n", gpFileNames[file]);
+            pThread->numFilesFailed++;
+        }
+    }
+
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main (int argc, char * argv[])
+{
+    int exitCode = 0;
+    uint32_t numThreads = 1;
+    HexLogPath_t path = HexLogReader::getBestPath ();
+    Thread_t * pThreads[MAX_NUM_THREADS];
+    HexLogStats_t stats;
+    HexLogStats_t totals;
+    uint64_t numMsgs[MessageCodec::MAX_NUM_DECODE_RESULTS];
+    uint32_t numFilesFailed = 0;
+    uint64_t startTimeUs;
+    uint64_t elapsedUs;
+    int x;
+
+    memset (pThreads, 0, sizeof (pThreads));
+    for (x = 1; (x < argc) && (exitCode == 0) && (gpFileNames == NULL); x++)
+    {
+        if ((strcmp (argv[x], "-t") == 0) && (x + 1 < argc))
+        {
+            numThreads = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-h") == 0) && (x + 1 < argc))
+        {
+            x++;
+            if (strcmp (argv[x], "scalar") == 0)
+            {
+                path = HEX_LOG_PATH_SCALAR;
+            }
+            else if (strcmp (argv[x], "sse4") == 0)
+            {
+                path = HEX_LOG_PATH_SSE4;
+            }
+            else if (strcmp (argv[x], "avx2") == 0)
+            {
+                path = HEX_LOG_PATH_AVX2;
+            }
+            else
+            {
+                printUsage (argv[0]);
+                exitCode = 1;
+            }
+        }
+        else if ((argv[x][0] != '-') || (argv[x][1] == 0))
+        {
+            // The rest are files
+            gpFileNames = &(argv[x]);
+            gNumFiles = argc - x;
+        }
+        else
+        {
+            printUsage (argv[0]);
+            exitCode = 1;
+        }
+    }
+    if ((exitCode == 0) && ((gNumFiles == 0) || (numThreads == 0) || (numThreads > MAX_NUM_THREADS)))
+    {
+        printUsage (argv[0]);
+        exitCode = 1;
+    }
+
+    if (exitCode == 0)
+    {
+        if (numThreads > (uint32_t) gNumFiles)
+        {
+            numThreads = gNumFiles;
+        }
+        for (uint32_t y = 0; (exitCode == 0) && (y < numThreads); y++)
+        {
+            pThreads[y] = new (std::nothrow) Thread_t ();
+            if ((pThreads[y] == NULL) || !pThreads[y]->reader.init (msgCallback, NULL, pThreads[y], y))
+            {
+                printf ("HexLog: out of memory.\n");
+                exitCode = 2;
+            }
+            else if (!pThreads[y]->reader.setPath (path))
+            {
+                printf ("HexLog: this CPU can't convert hex with %s.\n", HexLogReader::getPathName (path));
+                exitCode = 1;
+            }
+        }
+    }
+
+    if (exitCode == 0)
+    {
+        printf ("HexLog: %d file(s) with %d thread(s), converting hex with %s.\n",
+                gNumFiles, numThreads, HexLogReader::getPathName (path));
+        startTimeUs = serverTimeUs ();
+        for (uint32_t y = 0; y < numThreads; y++)
+        {
+            pThreads[y]->threadRunning = (pthread_create (&(pThreads[y]->thread), NULL,
+                                                          fileThread, pThreads[y]) == 0);
+        }
+        // Do the work of any thread that could not be started here
+        for (uint32_t y = 0; y < numThreads; y++)
+        {
+            if (!pThreads[y]->threadRunning)
+            {
+                fileThread (pThreads[y]);
+            }
+        }
+        for (uint32_t y = 0; y < numThreads; y++)
+        {
+            if (pThreads[y]->threadRunning)
+            {
+                pthread_join (pThreads[y]->thread, NULL);
+            }
+        }
+        elapsedUs = serverTimeUs () - startTimeUs;
+
+        memset (&totals, 0, sizeof (totals));
+        memset (numMsgs, 0, sizeof (numMsgs));
+        for (uint32_t y = 0; y < numThreads; y++)
+        {
+            pThreads[y]->reader.getStats (&stats);
+            totals.numChars += stats.numChars;
+            totals.numLines += stats.numLines;
+            totals.numLinesSkipped += stats.numLinesSkipped;
+            totals.numBadLines += stats.numBadLines;
+            totals.numDatagrams += stats.numDatagrams;
+            totals.numBytes += stats.numBytes;
+            totals.numMsgsDecoded += stats.numMsgsDecoded;
+            totals.numDecodeFailures += stats.numDecodeFailures;
+            totals.hexTimeUs += stats.hexTimeUs;
+            totals.decodeTimeUs += stats.decodeTimeUs;
+            for (uint32_t z = 0; z < MessageCodec::MAX_NUM_DECODE_RESULTS; z++)
+            {
+                numMsgs[z] += pThreads[y]->numMsgs[z];
+            }
+            numFilesFailed += pThreads[y]->numFilesFailed;
+        }
+
+        printf ("HexLog: %llu line(s), %llu skipped, %llu bad, holding %llu datagram(s) of %llu byte(s).\n",
+                (unsigned long long) totals.numLines, (unsigned long long) totals.numLinesSkipped,
+                (unsigned long long) totals.numBadLines, (unsigned long long) totals.numDatagrams,
+                (unsigned long long) totals.numBytes);
+        printf ("HexLog: decoded %llu InitInd(s), %llu SensorsReportInd(s), %llu PollInd(s),"
+                " %llu TrafficReportInd(s), %llu DebugInd(s), %llu other message(s);"
+                " %llu datagram(s) failed to decode.\n",
+                (unsigned long long) numMsgs[MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG],
+                (unsigned long long) numMsgs[MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG],
+                (unsigned long long) numMsgs[MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG],
+                (unsigned long long) numMsgs[MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG],
+                (unsigned long long) numMsgs[MessageCodec::DECODE_RESULT_DEBUG_IND_UL_MSG],
+                (unsigned long long) (totals.numMsgsDecoded -
+                                      numMsgs[MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG] -
+                                      numMsgs[MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG] -
+                                      numMsgs[MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG] -
+                                      numMsgs[MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG] -
+                                      numMsgs[MessageCodec::DECODE_RESULT_DEBUG_IND_UL_MSG]),
+                (unsigned long long) totals.numDecodeFailures);
+        // Per thread, so that the rates are per core
+        printf ("HexLog: %.3f second(s), lines and hex at %.1f Mbyte(s)/s of log per thread,"
+                " decode at %.1f Mbyte(s)/s of datagrams per thread.\n",
+                (double) elapsedUs / 1000000,
+                totals.hexTimeUs > 0 ? (double) totals.numChars / totals.hexTimeUs : 0.0,
+                totals.decodeTimeUs > 0 ? (double) totals.numBytes / totals.decodeTimeUs : 0.0);
+        if (numFilesFailed > 0)
+        {
+            exitCode = 3;
+        }
+    }
+
+    for (uint32_t y = 0; y < MAX_NUM_THREADS; y++)
+    {
+        delete pThreads[y];
+    }
+
+    return exitCode;
+}
+
+// End Of File
@@ -0,0 +1,486 @@
+/* Teddy UDP ingest server
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_ingest_server.cpp
+ * This file implements a reference Linux UDP ingest server for
+ * the teddy uplink.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for recvmmsg(), sendmmsg() and CPU affinity
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> // for posix_memalign()
+#include <errno.h>
+#include <string.h> // for memset()
+#include <new>      // for placement new
+#include <unistd.h> // for close() and sysconf()
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ingest_server.hpp>
+
+// ----------------------------------------------------------------
+// CONSTRUCTION/DESTRUCTION
+// ----------------------------------------------------------------
+
+IngestServer::IngestServer (void)
+{
+    m_port = 0;
+    m_numThreads = 0;
+    m_stop = false;
+    m_msgCallback = NULL;
+    m_datagramCallback = NULL;
+    mp_context = NULL;
+    memset (mp_threads, 0, sizeof (mp_threads));
+}
+
+IngestServer::~IngestServer (void)
+{
+    stop ();
+
+    for (uint32_t x = 0; x < m_numThreads; x++)
+    {
+        if (mp_threads[x] != NULL)
+        {
+            if (mp_threads[x]->socket >= 0)
+            {
+                close (mp_threads[x]->socket);
+            }
+            free (mp_threads[x]);
+            mp_threads[x] = NULL;
+        }
+    }
+}
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+int IngestServer::openSocket (void)
+{
+    int fd;
+    int on = 1;
+    struct sockaddr_in address;
+    struct timeval timeout;
+
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    if (fd >= 0)
+    {
+        memset (&address, 0, sizeof (address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl (INADDR_ANY);
+        address.sin_port = htons (m_port);
+
+        // A receive timeout so that the thread can notice when
+        // it's been asked to stop
+        timeout.tv_sec = INGEST_RECEIVE_TIMEOUT_MS / 1000;
+        timeout.tv_usec = (INGEST_RECEIVE_TIMEOUT_MS % 1000) * 1000;
+
+        if ((setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof (on)) != 0) ||
+            (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout)) != 0) ||
+            (bind (fd, (struct sockaddr *) &address, sizeof (address)) != 0))
+        {
+            close (fd);
+            fd = -1;
+        }
+    }
+
+    return fd;
+}
+
+uint32_t IngestServer::decodeDatagram (Thread_t * pThread,
+                                       DeviceId_t deviceId,
+                                       const char * pDatagram,
+                                       uint32_t size,
+                                       char * pDlBuffer)
+{
+    MessageCodec::DecodeResult_t decodeResult;
+    UlMsgUnion_t msg;
+    const char * pIn = pDatagram;
+    const char * pEnd = pDatagram + size;
+    uint32_t dlSize = 0;
+
+    // Work through the messages in the datagram, decoding straight
+    // out of the receive slot
+    while (pIn < pEnd)
+    {
+        decodeResult = pThread->codec.decodeUlMsg (&pIn, pEnd - pIn, &msg);
+        if ((decodeResult < MessageCodec::DECODE_RESULT_UL_MSG_BASE) ||
+            (decodeResult > MessageCodec::MAX_UL_REQ_MSG) || (pIn > pEnd))
+        {
+            // Can't trust anything after a bad message
+            pThread->stats.numDecodeFailures++;
+            break;
+        }
+
+        pThread->stats.numMsgsDecoded++;
+        if (m_msgCallback != NULL)
+        {
+            uint32_t dlSpace = 0;
+
+            if (dlSize + MAX_MESSAGE_SIZE <= MAX_DATAGRAM_SIZE_RAW)
+            {
+                dlSpace = MAX_DATAGRAM_SIZE_RAW - dlSize;
+            }
+            dlSize += m_msgCallback (mp_context, pThread->index, deviceId, decodeResult,
+                                     &msg, pDlBuffer + dlSize, dlSpace, &(pThread->codec));
+        }
+    }
+
+    return dlSize;
+}
+
+bool IngestServer::processBatch (Thread_t * pThread)
+{
+    bool socketOk = true;
+    int numReceived;
+    uint32_t numToSend = 0;
+    uint64_t startTimeUs;
+    struct mmsghdr rxMsgs[INGEST_BATCH_SIZE];
+    struct iovec rxIovecs[INGEST_BATCH_SIZE];
+    struct sockaddr_in rxAddresses[INGEST_BATCH_SIZE];
+    struct mmsghdr txMsgs[INGEST_BATCH_SIZE];
+    struct iovec txIovecs[INGEST_BATCH_SIZE];
+
+    memset (rxMsgs, 0, sizeof (rxMsgs));
+    for (uint32_t x = 0; x < INGEST_BATCH_SIZE; x++)
+    {
+        rxIovecs[x].iov_base = pThread->rxSlots[x];
+        rxIovecs[x].iov_len = MAX_DATAGRAM_SIZE_RAW;
+        rxMsgs[x].msg_hdr.msg_iov = &(rxIovecs[x]);
+        rxMsgs[x].msg_hdr.msg_iovlen = 1;
+        rxMsgs[x].msg_hdr.msg_name = &(rxAddresses[x]);
+        rxMsgs[x].msg_hdr.msg_namelen = sizeof (rxAddresses[x]);
+    }
+
+    // Block for the first datagram (or the timeout) and then
+    // take whatever else is already queued, up to a batch
+    numReceived = recvmmsg (pThread->socket, rxMsgs, INGEST_BATCH_SIZE, MSG_WAITFORONE, NULL);
+    if (numReceived > 0)
+    {
+        pThread->stats.numBatches++;
+        startTimeUs = serverTimeUs ();
+        memset (txMsgs, 0, sizeof (txMsgs));
+
+        for (int x = 0; x < numReceived; x++)
+        {
+            uint32_t size = rxMsgs[x].msg_len;
+            DeviceId_t deviceId = deviceIdFromAddress (ntohl (rxAddresses[x].sin_addr.s_addr),
+                                                       ntohs (rxAddresses[x].sin_port));
+            bool decode = true;
+
+            pThread->stats.numDatagramsReceived++;
+            pThread->stats.numBytesReceived += size;
+
+            if (rxMsgs[x].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                // Too long for any teddy, and what is left of the last
+                // message would decode as garbage
+                pThread->stats.numTruncated++;
+                decode = false;
+            }
+            else if (m_datagramCallback != NULL)
+            {
+                decode = m_datagramCallback (mp_context, pThread->index, deviceId,
+                                             pThread->rxSlots[x], size);
+            }
+
+            if (decode)
+            {
+                uint32_t dlSize = decodeDatagram (pThread, deviceId, pThread->rxSlots[x],
+                                                  size, pThread->txSlots[numToSend]);
+                if (dlSize > 0)
+                {
+                    // Reply to the address the datagram came from, which
+                    // is still sitting in rxAddresses[x]
+                    txIovecs[numToSend].iov_base = pThread->txSlots[numToSend];
+                    txIovecs[numToSend].iov_len = dlSize;
+                    txMsgs[numToSend].msg_hdr.msg_iov = &(txIovecs[numToSend]);
+                    txMsgs[numToSend].msg_hdr.msg_iovlen = 1;
+                    txMsgs[numToSend].msg_hdr.msg_name = &(rxAddresses[x]);
+                    txMsgs[numToSend].msg_hdr.msg_namelen = sizeof (rxAddresses[x]);
+                    numToSend++;
+                }
+            }
+        }
+
+        pThread->stats.decodeTimeUs += serverTimeUs () - startTimeUs;
+
+        // Send all the responses in as few system calls as possible
+        for (uint32_t sent = 0; sent < numToSend;)
+        {
+            int numSent = sendmmsg (pThread->socket, &(txMsgs[sent]), numToSend - sent, 0);
+            if (numSent <= 0)
+            {
+                pThread->stats.numSendFailures += numToSend - sent;
+                break;
+            }
+            sent += numSent;
+            pThread->stats.numDatagramsSent += numSent;
+        }
+    }
+    else
+    {
+        if ((numReceived < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+            socketOk = false;
+        }
+    }
+
+    return socketOk;
+}
+
+void * IngestServer::receiveThread (void * pParam)
+{
+    Thread_t * pThread = (Thread_t *) pParam;
+    IngestServer * pServer = pThread->pServer;
+
+    while (!pServer->m_stop && pServer->processBatch (pThread))
+    {
+    }
+
+    return NULL;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+bool IngestServer::init (uint16_t port,
+                         uint32_t numThreads,
+                         IngestMsgCallback_t msgCallback,
+                         IngestDatagramCallback_t datagramCallback,
+                         void * pContext)
+{
+    bool success = true;
+
+    m_port = port;
+    m_msgCallback = msgCallback;
+    if (m_msgCallback == NULL)
+    {
+        m_msgCallback = defaultMsgCallback;
+    }
+    m_datagramCallback = datagramCallback;
+    mp_context = pContext;
+
+    if (numThreads == 0)
+    {
+        numThreads = (uint32_t) sysconf (_SC_NPROCESSORS_ONLN);
+    }
+    if (numThreads > INGEST_MAX_THREADS)
+    {
+        numThreads = INGEST_MAX_THREADS;
+    }
+
+    for (m_numThreads = 0; success && (m_numThreads < numThreads); m_numThreads++)
+    {
+        void * pMemory = NULL;
+
+        if (posix_memalign (&pMemory, SERVER_CACHE_LINE_SIZE, sizeof (Thread_t)) == 0)
+        {
+            // Zeroed, and the codec constructed
+            Thread_t * pThread = new (pMemory) Thread_t ();
+
+            pThread->pServer = this;
+            pThread->index = m_numThreads;
+            pThread->socket = openSocket ();
+            mp_threads[m_numThreads] = pThread;
+            if (pThread->socket < 0)
+            {
+                printf ("IngestServer: unable to open socket on port %d.\n", m_port);
+                success = false;
+            }
+        }
+        else
+        {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+bool IngestServer::start (void)
+{
+    bool success = true;
+    uint32_t numCores = (uint32_t) sysconf (_SC_NPROCESSORS_ONLN);
+
+    m_stop = false;
+    for (uint32_t x = 0; success && (x < m_numThreads); x++)
+    {
+        Thread_t * pThread = mp_threads[x];
+
+        if (pthread_create (&(pThread->thread), NULL, receiveThread, pThread) == 0)
+        {
+            cpu_set_t cpuSet;
+
+            pThread->threadRunning = true;
+            // Pin each thread to its own core, it doesn't matter if this fails
+            CPU_ZERO (&cpuSet);
+            CPU_SET (x % numCores, &cpuSet);
+            pthread_setaffinity_np (pThread->thread, sizeof (cpuSet), &cpuSet);
+        }
+        else
+        {
+            success = false;
+        }
+    }
+
+    if (!success)
+    {
+        stop ();
+    }
+
+    return success;
+}
+
+void IngestServer::stop (void)
+{
+    m_stop = true;
+
+    for (uint32_t x = 0; x < m_numThreads; x++)
+    {
+        if ((mp_threads[x] != NULL) && mp_threads[x]->threadRunning)
+        {
+            pthread_join (mp_threads[x]->thread, NULL);
+            mp_threads[x]->threadRunning = false;
+        }
+    }
+}
+
+uint32_t IngestServer::getNumThreads (void)
+{
+    return m_numThreads;
+}
+
+void IngestServer::getStats (uint32_t threadIndex, IngestThreadStats_t * pStats)
+{
+    memset (pStats, 0, sizeof (*pStats));
+    if ((threadIndex < m_numThreads) && (mp_threads[threadIndex] != NULL))
+    {
+        *pStats = mp_threads[threadIndex]->stats;
+    }
+}
+
+#ifdef MESSAGE_CODEC_METRICS
+void IngestServer::getCodecMetrics (MessageCodec::Metrics_t * pMetrics)
+{
+    MessageCodec::Metrics_t threadMetrics;
+
+    memset (pMetrics, 0, sizeof (*pMetrics));
+    for (uint32_t x = 0; x < m_numThreads; x++)
+    {
+        if (mp_threads[x] != NULL)
+        {
+            mp_threads[x]->codec.getMetrics (&threadMetrics);
+            MessageCodec::mergeMetrics (pMetrics, &threadMetrics);
+        }
+    }
+}
+#endif
+
+void IngestServer::printThroughput (uint64_t intervalUs)
+{
+    IngestThreadStats_t now;
+    IngestThreadStats_t * pLast;
+    uint64_t totalDatagrams = 0;
+    uint64_t totalMsgs = 0;
+
+    if (intervalUs == 0)
+    {
+        intervalUs = 1;
+    }
+
+    for (uint32_t x = 0; x < m_numThreads; x++)
+    {
+        uint64_t datagrams;
+        uint64_t msgs;
+        uint64_t batches;
+        uint64_t decodeTimeUs;
+
+        getStats (x, &now);
+        pLast = &(mp_threads[x]->lastPrintedStats);
+        datagrams = now.numDatagramsReceived - pLast->numDatagramsReceived;
+        msgs = now.numMsgsDecoded - pLast->numMsgsDecoded;
+        batches = now.numBatches - pLast->numBatches;
+        decodeTimeUs = now.decodeTimeUs - pLast->decodeTimeUs;
+
+        printf ("IngestServer: core %2d: %9llu datagrams/s, %9llu msgs/s, %6.1f datagrams/batch,"
+                " %5.1f%% decoding, %llu bad, %llu truncated, %llu sent, %llu send failures.\n",
+                x,
+                (unsigned long long) (datagrams * 1000000 / intervalUs),
+                (unsigned long long) (msgs * 1000000 / intervalUs),
+                batches > 0 ? (double) datagrams / batches : 0.0,
+                (double) decodeTimeUs * 100 / intervalUs,
+                (unsigned long long) (now.numDecodeFailures - pLast->numDecodeFailures),
+                (unsigned long long) (now.numTruncated - pLast->numTruncated),
+                (unsigned long long) (now.numDatagramsSent - pLast->numDatagramsSent),
+                (unsigned long long) (now.numSendFailures - pLast->numSendFailures));
+
+        totalDatagrams += datagrams;
+        totalMsgs += msgs;
+        *pLast = now;
+    }
+
+    printf ("IngestServer: total:   %9llu datagrams/s, %9llu msgs/s.\n",
+            (unsigned long long) (totalDatagrams * 1000000 / intervalUs),
+            (unsigned long long) (totalMsgs * 1000000 / intervalUs));
+}
+
+uint32_t IngestServer::defaultMsgCallback (void * pContext,
+                                           uint32_t threadIndex,
+                                           DeviceId_t deviceId,
+                                           MessageCodec::DecodeResult_t result,
+                                           const UlMsgUnion_t * pMsg,
+                                           char * pDlBuffer,
+                                           uint32_t dlSpace,
+                                           MessageCodec * pCodec)
+{
+    uint32_t numBytesEncoded = 0;
+
+    (void) pContext;
+    (void) threadIndex;
+    (void) deviceId;
+    (void) pMsg;
+
+    if (dlSpace >= MAX_MESSAGE_SIZE)
+    {
+        switch (result)
+        {
+            case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+            {
+                numBytesEncoded = pCodec->encodeIntervalsGetReqDlMsg (pDlBuffer);
+            }
+            break;
+            case MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG:
+            {
+                numBytesEncoded = pCodec->encodeTrafficReportGetReqDlMsg (pDlBuffer);
+            }
+            break;
+            default:
+            // No response to anything else
+            break;
+        }
+    }
+
+    return numBytesEncoded;
+}
+
+// End Of File
@@ -0,0 +1,925 @@
+/* Teddy UDP ingest server application
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_ingest_server_main.cpp
+ * The main() of the reference ingest server: listens for teddy
+ * uplink datagrams and prints the per-core throughput periodically.
+ *
+ * Usage: teddy_ingest_server [-p port] [-t threads] [-w decode
+ * workers] [-m max devices] [-s store directory] [-a rollup
+ * directory] [-c change record file] [-u dedup window seconds]
+ * [-g geofence file] [-e GPS error metres] [-r alert rule file]
+ * [-k heavy hitters] [-l max DebugInd templates] [-v] [-b] [-x
+ * codec metrics file] [-o Req timeout milliseconds] [-i report
+ * interval seconds] [-d duration seconds]
+ *
+ * A duration of zero (the default) means run until killed.  The
+ * decoded messages keep a DeviceRegistry of up to -m devices up to
+ * date.  Each of the other options switches on one feature, see the
+ * header named for how it works; those marked "-w" need -w and those
+ * marked "not -w" can't be used with it, as no Reqs are sent then:
+ *
+ * -w  decode in an IngestPipeline with that many workers, keeping a
+ *     LastStateCache too, teddy_pipeline.hpp, teddy_last_state.hpp
+ * -v  count devices that miss a PollInd or SensorsReportInd, teddy_timer_wheel.hpp
+ * -b  estimate uplink and downlink loss, not -w, teddy_traffic_accounting.hpp
+ * -s  store sensor readings in the directory, -w, teddy_sensor_store.hpp
+ * -e  leave out GPS positions within the error, with -s, teddy_trajectory.hpp
+ * -a  roll sensor readings up into the directory, -w, teddy_rollup.hpp
+ * -c  append change records to the file, -w, teddy_cdc.hpp
+ * -u  drop datagrams repeated within the window, -w, teddy_dedup.hpp
+ * -g  check GPS positions against the fences in the file, -w, teddy_geofence.hpp
+ * -r  evaluate the alert rules in the file, -w, teddy_alert.hpp
+ * -k  print fleet statistics at exit, 0 for default heavy hitters, teddy_sketch.hpp
+ * -l  intern DebugInd templates, 0 for the default maximum, -w, teddy_debug_template.hpp
+ * -x  write codec metrics at exit to the file, "-" for stdout, teddy_api.hpp
+ * -o  time Reqs to their Cnfs, with that timeout, not -w, teddy_rtt_tracker.hpp
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> // for atoi()
+#include <string.h> // for strcmp()
+#include <new>      // for std::nothrow
+#include <signal.h>
+#include <atomic>
+#include <unistd.h> // for usleep()
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ingest_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_device_registry.hpp>
+#include <teddy_sensor_store.hpp>
+#include <teddy_rollup.hpp>
+#include <teddy_reorder.hpp>
+#include <teddy_last_state.hpp>
+#include <teddy_cdc.hpp>
+#include <teddy_geofence.hpp>
+#include <teddy_trajectory.hpp>
+#include <teddy_sketch.hpp>
+#include <teddy_alert.hpp>
+#include <teddy_rtt_tracker.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The default interval at which throughput is printed
+#define DEFAULT_REPORT_INTERVAL_SECONDS 5
+
+/// The default maximum number of devices in the registry
+#define DEFAULT_MAX_DEVICES 1000000
+
+/// How long a device must be quiet before the readings held for it
+// by the reorder stage in front of the store are released
+#define REORDER_IDLE_SECONDS 30
+
+/// How often the sensor store sink flushes partly-filled segments
+// and the rollup sink writes out closed windows
+#define STORE_FLUSH_INTERVAL_SECONDS 5
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+static volatile bool gStop = false;
+
+/// The number of records of each message type seen by the
+// counting sink of the pipeline.
+static uint64_t gNumRecords[MessageCodec::MAX_NUM_DECODE_RESULTS];
+
+/// The session state of the devices we've heard from.
+static DeviceRegistry gRegistry;
+
+/// Whether devices that fall silent are looked for and the number
+// of times devices have missed a PollInd and a SensorsReportInd.
+static bool gLivenessEnabled = false;
+static uint64_t gNumPollIndMissed = 0;
+static uint64_t gNumSensorsReportMissed = 0;
+
+/// Whether traffic accounting is on and the fleet-wide traffic
+// totals, summed from the per-device deltas.
+static bool gTrafficEnabled = false;
+static std::atomic<uint64_t> gNumUlDatagramsSent (0);
+static std::atomic<uint64_t> gNumUlDatagramsReceived (0);
+static std::atomic<uint64_t> gNumDlDatagramsSent (0);
+static std::atomic<uint64_t> gNumDlDatagramsReceived (0);
+
+/// The last known state of each device, for point reads.
+static LastStateCache gLastState;
+
+/// Turns the sensor readings into change records.
+static CdcEncoder gCdc;
+
+/// Where the change records go, if anywhere.
+static FILE * gpCdcFile = NULL;
+
+/// The fences that GPS positions are checked against, if any.
+static GeofenceEngine gGeofence;
+
+/// The number of GPS positions checked against the fences, the
+// number inside at least one fence and the number of fences they
+// were inside in total.
+static uint64_t gNumGeofenceChecks = 0;
+static uint64_t gNumGeofenceInside = 0;
+static uint64_t gNumGeofenceHits = 0;
+
+/// The alert rules that the sensor readings are evaluated against, if
+// any; alerts are only counted.
+static AlertEngine gAlert;
+
+/// The fleet statistics, if kept: one per receive thread when
+// decoding on those, merged at exit, otherwise just the first, fed
+// by a pipeline sink.
+static bool gSketchEnabled = false;
+static FleetSketch gSketches[INGEST_MAX_THREADS];
+
+/// Where the sensor readings are stored, if anywhere.
+static SensorStore gStore;
+
+/// Puts the sensor readings in time order, per device, on their way
+// to the store.
+static ReorderBuffer gReorder;
+
+/// Simplifies the GPS positions on their way to the store, if enabled.
+static TrajectorySimplifier gTrajectory;
+static bool gTrajectoryEnabled = false;
+
+/// When the store sink last flushed.
+static uint64_t gLastStoreFlushTimeUs = 0;
+
+/// Where the sensor readings are rolled up, if anywhere.
+static RollupEngine gRollup;
+
+/// When the rollup sink last flushed.
+static uint64_t gLastRollupFlushTimeUs = 0;
+
+/// The round-trip times of the downlink Reqs, if tracked.
+static RttTracker gRtt;
+static bool gRttEnabled = false;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+static void signalHandler (int signal)
+{
+    (void) signal;
+    gStop = true;
+}
+
+static void printUsage (const char * pName)
+{
+    printf ("Usage: %s [-p port] [-t threads] [-w decode workers] [-m max devices]"
+            " [-s store directory] [-a rollup directory] [-c change record file]"
+            " [-u dedup window seconds] [-g geofence file] [-e GPS error metres]"
+            " [-r alert rule file] [-k heavy hitters] [-l max DebugInd templates] [-v] [-b]"
+            " [-x codec metrics file] [-o Req timeout milliseconds] [-i report interval seconds]"
+            " [-d duration seconds]\n", pName);
+}
+
+/// A pipeline sink that just counts records by type.
+static void countingSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    (void) pContext;
+    gNumRecords[pRecord->msgType]++;
+}
+
+/// A pipeline sink that keeps the device registry up to date.
+static void registrySink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    (void) pContext;
+    gRegistry.updateFromRecord (pRecord, serverTimeUtcSeconds ());
+}
+
+/// A pipeline sink that keeps the last-known-state cache up to date;
+// the cache has a single shard, owned by this sink's thread.
+static void lastStateSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    (void) pContext;
+    gLastState.updateFromRecord (0, pRecord, serverTimeUtcSeconds ());
+}
+
+/// A pipeline sink that appends a change record for each sensor
+// reading to the change record file; the encoder has a single shard,
+// owned by this sink's thread.
+static void cdcSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    char buffer[CDC_MAX_RECORD_SIZE];
+    uint32_t size;
+
+    (void) pContext;
+    size = gCdc.encodeRecord (0, pRecord, buffer);
+    if (size > 0)
+    {
+        fwrite (buffer, 1, size, gpCdcFile);
+    }
+}
+
+/// A pipeline sink that checks the GPS position of each sensor
+// reading against the fences; the engine is only read once built so
+// this could equally be done on any other thread.
+static void geofenceSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    uint32_t numFences;
+
+    (void) pContext;
+    if (((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+         (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG)) &&
+        (pRecord->presentBitmap & PIPELINE_PRESENT_GPS_POSITION))
+    {
+        numFences = gGeofence.check (pRecord->u.readings.gpsLatitude, pRecord->u.readings.gpsLongitude, NULL, 0);
+        gNumGeofenceChecks++;
+        if (numFences > 0)
+        {
+            gNumGeofenceInside++;
+            gNumGeofenceHits += numFences;
+        }
+    }
+}
+
+/// A pipeline sink that evaluates the alert rules against each sensor
+// reading; the engine has a single shard, owned by this sink's thread.
+static void alertSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    (void) pContext;
+    gAlert.evaluateRecord (0, pRecord);
+}
+
+/// A pipeline sink that adds each record to the fleet statistics.
+static void sketchSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    (void) pContext;
+    gSketches[0].addRecord (pRecord);
+}
+
+/// Set up a FleetSketch for each receive thread.
+static bool initSketches (uint32_t numThreads, uint32_t numHeavyHitters)
+{
+    bool success = true;
+
+    for (uint32_t x = 0; success && (x < numThreads); x++)
+    {
+        success = gSketches[x].init (numHeavyHitters);
+    }
+
+    return success;
+}
+
+/// Print the heavy hitters of a SpaceSaving.
+static void printHeavyHitters (const char * pWhat, SpaceSaving * pSketch)
+{
+    uint64_t deviceIds[5];
+    uint64_t counts[5];
+    uint64_t errors[5];
+    uint32_t numDevices;
+    uint32_t ipAddress;
+    uint16_t port;
+
+    numDevices = pSketch->getTop (deviceIds, counts, errors, sizeof (deviceIds) / sizeof (deviceIds[0]));
+    printf ("IngestServer: %llu %s(s)", (unsigned long long) pSketch->getTotal (), pWhat);
+    for (uint32_t x = 0; x < numDevices; x++)
+    {
+        deviceIdToAddress (deviceIds[x], &ipAddress, &port);
+        printf ("%s %d.%d.%d.%d:%d %llu (+0/-%llu)", x == 0 ? ", most from" : ",",
+                (int) (ipAddress >> 24), (int) ((ipAddress >> 16) & 0xFF), (int) ((ipAddress >> 8) & 0xFF),
+                (int) (ipAddress & 0xFF), port, (unsigned long long) counts[x], (unsigned long long) errors[x]);
+    }
+    printf (".\n");
+}
+
+/// Print the fleet statistics.
+static void printSketch (FleetSketch * pSketch)
+{
+    ValueHistogram * pRssi = pSketch->getRssi ();
+    ValueHistogram * pBatteryMV = pSketch->getBatteryMV ();
+    ValueHistogram * pTemperature = pSketch->getTemperature ();
+
+    printf ("IngestServer: about %llu distinct device(s), %llu SensorsReportInd(s), %llu InitInd(s)"
+            " (%llu watchdog).\n", (unsigned long long) pSketch->getDevices ()->estimate (),
+            (unsigned long long) pSketch->getNumMsgs (MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG),
+            (unsigned long long) pSketch->getNumMsgs (MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG),
+            (unsigned long long) pSketch->getNumWakeUps (WAKE_UP_CODE_WATCHDOG));
+    printf ("IngestServer: p5/p50/p95 of %llu RSSI %d/%d/%d, of %llu battery %d/%d/%d mV,"
+            " of %llu temperature %d/%d/%d C.\n",
+            (unsigned long long) pRssi->getCount (), pRssi->quantile (0.05), pRssi->quantile (0.5),
+            pRssi->quantile (0.95), (unsigned long long) pBatteryMV->getCount (), pBatteryMV->quantile (0.05),
+            pBatteryMV->quantile (0.5), pBatteryMV->quantile (0.95), (unsigned long long) pTemperature->getCount (),
+            pTemperature->quantile (0.05), pTemperature->quantile (0.5), pTemperature->quantile (0.95));
+    printHeavyHitters ("watchdog wake-up", pSketch->getWatchdogDevices ());
+    printHeavyHitters ("DebugInd", pSketch->getDebugIndDevices ());
+}
+
+/// Print the round-trip times of each type of Req that was sent.
+static void printRtts (RttTracker * pTracker)
+{
+    RttStats_t stats;
+
+    for (uint32_t x = 0; x < MAX_NUM_RTT_REQS; x++)
+    {
+        pTracker->getStats ((RttReq_t) x, &stats);
+        if (stats.numSent > 0)
+        {
+            printf ("IngestServer: %llu %sReq(s), %llu confirmed (RTT p50/p99/max %u/%u/%u us),"
+                    " %llu timed out, %llu overlapping, %llu unmatched Cnf(s).\n",
+                    (unsigned long long) stats.numSent, RttTracker::getReqName ((RttReq_t) x),
+                    (unsigned long long) stats.numConfirmed, RttTracker::getQuantileUs (&stats, 500),
+                    RttTracker::getQuantileUs (&stats, 990), stats.maxUs,
+                    (unsigned long long) stats.numTimedOut, (unsigned long long) stats.numOverlapped,
+                    (unsigned long long) stats.numUnmatched);
+        }
+    }
+}
+
+/// Called by the reorder stage with readings, in time order per
+// device, to write to the store, simplifying the GPS track first
+// if enabled.
+static void reorderCallback (void * pContext, DeviceId_t deviceId,
+                             const PipelineReadings_t * pReadings,
+                             uint8_t presentBitmap)
+{
+    PipelineReadings_t readings;
+
+    (void) pContext;
+    if (gTrajectoryEnabled)
+    {
+        readings = *pReadings;
+        gTrajectory.simplify (0, deviceId, &readings, &presentBitmap);
+        pReadings = &readings;
+    }
+    gStore.append (0, deviceId, pReadings, presentBitmap);
+}
+
+/// A pipeline sink that writes sensor readings to the store, through
+// the reorder stage, flushing every so often; the reorder stage and
+// the store have a single shard each, owned by this sink's thread.
+static void storeSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    uint64_t nowUs;
+
+    (void) pContext;
+    gReorder.addRecord (0, pRecord);
+    nowUs = serverTimeUs ();
+    if (nowUs - gLastStoreFlushTimeUs > (uint64_t) STORE_FLUSH_INTERVAL_SECONDS * 1000000)
+    {
+        gReorder.releaseIdle (0, nowUs, (uint64_t) REORDER_IDLE_SECONDS * 1000000);
+        gStore.flush (0);
+        gLastStoreFlushTimeUs = nowUs;
+    }
+}
+
+/// A pipeline sink that rolls up sensor readings, writing out
+// closed windows every so often; the engine has a single shard,
+// owned by this sink's thread.
+static void rollupSink (void * pContext, const PipelineRecord_t * pRecord)
+{
+    uint64_t nowUs;
+
+    (void) pContext;
+    gRollup.addRecord (0, pRecord);
+    nowUs = serverTimeUs ();
+    if (nowUs - gLastRollupFlushTimeUs > (uint64_t) STORE_FLUSH_INTERVAL_SECONDS * 1000000)
+    {
+        gRollup.flush (0, false);
+        gLastRollupFlushTimeUs = nowUs;
+    }
+}
+
+/// The datagram callback when decoding on the receive threads: counts
+// the uplink traffic of the device.
+static bool registryDatagramCallback (void * pContext,
+                                      uint32_t threadIndex,
+                                      DeviceId_t deviceId,
+                                      const char * pDatagram,
+                                      uint32_t size)
+{
+    gRegistry.countServerTraffic (deviceId, 1, size, 0, 0);
+
+    return true;
+}
+
+/// The message callback when decoding on the receive threads: keeps
+// the device registry up to date then responds as the default does,
+// counting the downlink traffic and, if enabled, timing the Reqs
+// sent until their Cnfs come back.
+static uint32_t registryMsgCallback (void * pContext,
+                                     uint32_t threadIndex,
+                                     DeviceId_t deviceId,
+                                     MessageCodec::DecodeResult_t result,
+                                     const UlMsgUnion_t * pMsg,
+                                     char * pDlBuffer,
+                                     uint32_t dlSpace,
+                                     MessageCodec * pCodec)
+{
+    uint32_t numBytesEncoded;
+    uint64_t nowUs = 0;
+
+    gRegistry.update (deviceId, result, pMsg, serverTimeUtcSeconds ());
+    if (gRttEnabled)
+    {
+        nowUs = serverTimeUs ();
+        gRtt.ulMsgReceived (deviceId, result, nowUs);
+    }
+    if (gSketchEnabled)
+    {
+        gSketches[threadIndex].addMsg (deviceId, result, pMsg);
+    }
+
+    numBytesEncoded = IngestServer::defaultMsgCallback (pContext, threadIndex, deviceId, result, pMsg,
+                                                        pDlBuffer, dlSpace, pCodec);
+    if (numBytesEncoded > 0)
+    {
+        // The downlink datagram for this uplink datagram starts with
+        // the first message encoded, when the space is untouched
+        gRegistry.countServerTraffic (deviceId, 0, 0, (dlSpace == MAX_DATAGRAM_SIZE_RAW) ? 1 : 0,
+                                      numBytesEncoded);
+        if (gRttEnabled)
+        {
+            gRtt.dlMsgsSent (deviceId, pDlBuffer, numBytesEncoded, pCodec, nowUs);
+        }
+    }
+
+    return numBytesEncoded;
+}
+
+/// Sum the per-device traffic deltas.
+static void trafficCallback (void * pContext, DeviceId_t deviceId,
+                             const TrafficDelta_t * pDelta, const TrafficTotals_t * pTotals)
+{
+    (void) pContext;
+    if (!(pDelta->flags & TRAFFIC_DELTA_RESTART))
+    {
+        gNumUlDatagramsSent += pDelta->device.numDatagramsSent;
+        gNumUlDatagramsReceived += pDelta->server.numUlDatagrams;
+        gNumDlDatagramsSent += pDelta->server.numDlDatagrams;
+        gNumDlDatagramsReceived += pDelta->device.numDatagramsReceived;
+    }
+}
+
+/// Count devices falling silent.
+static void livenessCallback (void * pContext, DeviceId_t deviceId, DeviceLiveness_t what,
+                              uint32_t lastTime, uint32_t dueTime)
+{
+    (void) pContext;
+    if (what == DEVICE_LIVENESS_POLL_IND_MISSED)
+    {
+        gNumPollIndMissed++;
+    }
+    else
+    {
+        gNumSensorsReportMissed++;
+    }
+}
+
+/// Report backpressure from the pipeline.
+static void backpressureCallback (void * pContext, uint32_t workerIndex, bool on)
+{
+    (void) pContext;
+    printf ("IngestServer: backpressure %s on decode worker %d.\n", on ? "ON" : "off", workerIndex);
+}
+
+/// Write the codec metrics of the server or the pipeline, whichever
+// did the decoding, to a file in the Prometheus text format and print
+// a summary.
+static void writeCodecMetrics (IngestServer * pServer, IngestPipeline * pPipeline,
+                               const char * pFileName)
+{
+#ifdef MESSAGE_CODEC_METRICS
+    MessageCodec::Metrics_t * pMetrics = new (std::nothrow) MessageCodec::Metrics_t;
+    char * pText = new (std::nothrow) char[MESSAGE_CODEC_METRICS_MAX_TEXT_SIZE];
+    FILE * pFile = NULL;
+    int32_t length = -1;
+    uint64_t numFailures = 0;
+
+    if ((pMetrics != NULL) && (pText != NULL))
+    {
+        if (pPipeline != NULL)
+        {
+            pPipeline->getCodecMetrics (pMetrics);
+        }
+        else
+        {
+            pServer->getCodecMetrics (pMetrics);
+        }
+        for (uint32_t x = 0; x <= MessageCodec::DECODE_RESULT_BAD_MSG_FORMAT; x++)
+        {
+            numFailures += pMetrics->numDecodes[x];
+        }
+        printf ("IngestServer: codec decoded %llu message(s), %llu failed, latency p50 %llu ns, p99 %llu ns,"
+                " max %llu ns.\n", (unsigned long long) pMetrics->decodeLatency.count,
+                (unsigned long long) numFailures,
+                (unsigned long long) MessageCodec::getLatencyQuantile (&(pMetrics->decodeLatency), 500),
+                (unsigned long long) MessageCodec::getLatencyQuantile (&(pMetrics->decodeLatency), 990),
+                (unsigned long long) pMetrics->decodeLatency.maxTicks);
+        length = MessageCodec::printMetrics (pMetrics, pText, MESSAGE_CODEC_METRICS_MAX_TEXT_SIZE);
+        if (length >= 0)
+        {
+            pFile = (strcmp (pFileName, "-") == 0) ? stdout : fopen (pFileName, "w");
+        }
+        if ((pFile == NULL) || (fwrite (pText, 1, length, pFile) != (size_t) length))
+        {
+            printf ("IngestServer: unable to write codec metrics to %s.\n", pFileName);
+        }
+        if ((pFile != NULL) && (pFile != stdout))
+        {
+            fclose (pFile);
+        }
+    }
+    delete[] pText;
+    delete pMetrics;
+#else
+    (void) pServer;
+    (void) pPipeline;
+    printf ("IngestServer: codec metrics not written to %s, MESSAGE_CODEC_METRICS is not defined.\n", pFileName);
+#endif
+}
+
+// ----------------------------------------------------------------
+// MAIN
+// ----------------------------------------------------------------
+
+int main (int argc, char * argv[])
+{
+    int exitCode = 0;
+    uint16_t port = INGEST_DEFAULT_PORT;
+    uint32_t numThreads = 0;
+    uint32_t numWorkers = 0;
+    uint32_t maxDevices = DEFAULT_MAX_DEVICES;
+    const char * pStoreDirectory = NULL;
+    const char * pRollupDirectory = NULL;
+    const char * pCdcFileName = NULL;
+    uint32_t dedupWindowSeconds = 0;
+    const char * pGeofenceFileName = NULL;
+    uint32_t gpsErrorMetres = 0;
+    const char * pAlertFileName = NULL;
+    uint32_t numHeavyHitters = 0;
+    bool debugTemplatesEnabled = false;
+    uint32_t maxDebugTemplates = 0;
+    const char * pMetricsFileName = NULL;
+    uint32_t rttTimeoutMs = 0;
+    uint32_t reportIntervalSeconds = DEFAULT_REPORT_INTERVAL_SECONDS;
+    uint32_t durationSeconds = 0;
+    uint64_t startTimeUs;
+    uint64_t lastReportTimeUs;
+    IngestServer ownServer;
+    IngestServer * pServer = &ownServer;
+    IngestPipeline pipeline;
+    bool started;
+
+    for (int x = 1; (x < argc) && (exitCode == 0); x++)
+    {
+        if ((strcmp (argv[x], "-p") == 0) && (x + 1 < argc))
+        {
+            port = (uint16_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-t") == 0) && (x + 1 < argc))
+        {
+            numThreads = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-w") == 0) && (x + 1 < argc))
+        {
+            numWorkers = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-m") == 0) && (x + 1 < argc))
+        {
+            maxDevices = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-s") == 0) && (x + 1 < argc))
+        {
+            pStoreDirectory = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-a") == 0) && (x + 1 < argc))
+        {
+            pRollupDirectory = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-c") == 0) && (x + 1 < argc))
+        {
+            pCdcFileName = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-u") == 0) && (x + 1 < argc))
+        {
+            dedupWindowSeconds = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-g") == 0) && (x + 1 < argc))
+        {
+            pGeofenceFileName = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-e") == 0) && (x + 1 < argc))
+        {
+            gpsErrorMetres = (uint32_t) atoi (argv[++x]);
+            gTrajectoryEnabled = true;
+        }
+        else if ((strcmp (argv[x], "-r") == 0) && (x + 1 < argc))
+        {
+            pAlertFileName = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-k") == 0) && (x + 1 < argc))
+        {
+            numHeavyHitters = (uint32_t) atoi (argv[++x]);
+            gSketchEnabled = true;
+        }
+        else if ((strcmp (argv[x], "-l") == 0) && (x + 1 < argc))
+        {
+            maxDebugTemplates = (uint32_t) atoi (argv[++x]);
+            debugTemplatesEnabled = true;
+        }
+        else if ((strcmp (argv[x], "-x") == 0) && (x + 1 < argc))
+        {
+            pMetricsFileName = argv[++x];
+        }
+        else if ((strcmp (argv[x], "-o") == 0) && (x + 1 < argc))
+        {
+            rttTimeoutMs = (uint32_t) atoi (argv[++x]);
+            gRttEnabled = true;
+        }
+        else if (strcmp (argv[x], "-v") == 0)
+        {
+            gLivenessEnabled = true;
+        }
+        else if (strcmp (argv[x], "-b") == 0)
+        {
+            gTrafficEnabled = true;
+        }
+        else if ((strcmp (argv[x], "-i") == 0) && (x + 1 < argc))
+        {
+            reportIntervalSeconds = (uint32_t) atoi (argv[++x]);
+        }
+        else if ((strcmp (argv[x], "-d") == 0) && (x + 1 < argc))
+        {
+            durationSeconds = (uint32_t) atoi (argv[++x]);
+        }
+        else
+        {
+            printUsage (argv[0]);
+            exitCode = 1;
+        }
+    }
+
+    if ((exitCode == 0) && (numWorkers > 0) && gTrafficEnabled)
+    {
+        // The server only counts its own traffic on the receive threads
+        printf ("IngestServer: -b can't be used with -w.\n");
+        exitCode = 1;
+    }
+
+    if ((exitCode == 0) && (numWorkers > 0) && gRttEnabled)
+    {
+        // No downlink Reqs are sent with -w, so there is nothing to time
+        printf ("IngestServer: -o can't be used with -w.\n");
+        exitCode = 1;
+    }
+
+    if (exitCode == 0)
+    {
+        signal (SIGINT, signalHandler);
+        signal (SIGTERM, signalHandler);
+#ifdef MESSAGE_CODEC_METRICS
+        if (pMetricsFileName != NULL)
+        {
+            MessageCodec::setMetricsClock (serverTimeNs);
+        }
+#endif
+
+        if (numWorkers > 0)
+        {
+            pServer = pipeline.getIngestServer ();
+            // One registry shard per decode worker, the same sharding
+            started = gRegistry.init (maxDevices, numWorkers) &&
+                      (!gLivenessEnabled ||
+                       gRegistry.initLiveness (livenessCallback, NULL, serverTimeUtcSeconds ())) &&
+                      pipeline.init (port, numThreads, numWorkers, backpressureCallback, NULL) &&
+                      ((dedupWindowSeconds == 0) || pipeline.enableDedup (0, dedupWindowSeconds)) &&
+                      (!debugTemplatesEnabled || pipeline.enableDebugTemplates (maxDebugTemplates)) &&
+                      (pipeline.addSink ("count", countingSink, NULL, 0) >= 0) &&
+                      (pipeline.addSink ("registry", registrySink, NULL, 0) >= 0) &&
+                      gLastState.init (1, maxDevices) &&
+                      (pipeline.addSink ("state", lastStateSink, NULL, 0) >= 0) &&
+                      ((pStoreDirectory == NULL) ||
+                       (gStore.init (pStoreDirectory, 1, maxDevices, 0, true) &&
+                        gReorder.init (1, maxDevices, 0, REORDER_DEFAULT_DELAY_SECONDS, reorderCallback, NULL) &&
+                        (!gTrajectoryEnabled || gTrajectory.init (1, maxDevices, gpsErrorMetres)) &&
+                        (pipeline.addSink ("store", storeSink, NULL, 0) >= 0))) &&
+                      ((pRollupDirectory == NULL) ||
+                       (gRollup.init (pRollupDirectory, 1, maxDevices, ROLLUP_DEFAULT_LATENESS_SECONDS) &&
+                        (pipeline.addSink ("rollup", rollupSink, NULL, 0) >= 0))) &&
+                      ((pCdcFileName == NULL) ||
+                       (((gpCdcFile = fopen (pCdcFileName, "ab")) != NULL) &&
+                        gCdc.init (1, maxDevices, 0) &&
+                        (pipeline.addSink ("cdc", cdcSink, NULL, 0) >= 0))) &&
+                      ((pGeofenceFileName == NULL) ||
+                       (gGeofence.addFile (pGeofenceFileName) && gGeofence.build () &&
+                        (pipeline.addSink ("geofence", geofenceSink, NULL, 0) >= 0))) &&
+                      ((pAlertFileName == NULL) ||
+                       (gAlert.addFile (pAlertFileName) && gAlert.init (1, maxDevices, NULL, NULL) &&
+                        (pipeline.addSink ("alert", alertSink, NULL, 0) >= 0))) &&
+                      (!gSketchEnabled ||
+                       (gSketches[0].init (numHeavyHitters) &&
+                        (pipeline.addSink ("sketch", sketchSink, NULL, 0) >= 0))) &&
+                      pipeline.start ();
+        }
+        else
+        {
+            started = ownServer.init (port, numThreads, registryMsgCallback, registryDatagramCallback, NULL) &&
+                      gRegistry.init (maxDevices, ownServer.getNumThreads ()) &&
+                      (!gLivenessEnabled ||
+                       gRegistry.initLiveness (livenessCallback, NULL, serverTimeUtcSeconds ())) &&
+                      (!gTrafficEnabled || gRegistry.initTrafficAccounting (trafficCallback, NULL)) &&
+                      (!gSketchEnabled || initSketches (ownServer.getNumThreads (), numHeavyHitters)) &&
+                      (!gRttEnabled ||
+                       gRtt.init (ownServer.getNumThreads (), maxDevices, rttTimeoutMs, serverTimeUs ())) &&
+                      ownServer.start ();
+        }
+
+        if (started)
+        {
+            printf ("IngestServer: listening on port %d with %d thread(s).\n", port, pServer->getNumThreads ());
+            startTimeUs = serverTimeUs ();
+            lastReportTimeUs = startTimeUs;
+
+            while (!gStop &&
+                   ((durationSeconds == 0) || (serverTimeUs () - startTimeUs < (uint64_t) durationSeconds * 1000000)))
+            {
+                usleep (100000);
+                if (gLivenessEnabled)
+                {
+                    gRegistry.checkLiveness (serverTimeUtcSeconds ());
+                }
+                if (gRttEnabled)
+                {
+                    gRtt.checkTimeouts (serverTimeUs ());
+                }
+                if (serverTimeUs () - lastReportTimeUs >= (uint64_t) reportIntervalSeconds * 1000000)
+                {
+                    uint64_t nowUs = serverTimeUs ();
+                    pServer->printThroughput (nowUs - lastReportTimeUs);
+                    if (numWorkers > 0)
+                    {
+                        pipeline.printStats ();
+                    }
+                    lastReportTimeUs = nowUs;
+                }
+            }
+
+            if (numWorkers > 0)
+            {
+                uint32_t numLastStates;
+
+                pipeline.stop ();
+                pServer->printThroughput (serverTimeUs () - lastReportTimeUs);
+                pipeline.printStats ();
+                printf ("IngestServer: pipeline delivered %llu SensorsReportInd(s), %llu PollInd(s).\n",
+                        (unsigned long long) gNumRecords[MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG],
+                        (unsigned long long) gNumRecords[MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG]);
+                gLastState.getStats (&numLastStates, NULL);
+                printf ("IngestServer: last known state of %u device(s) cached.\n", numLastStates);
+                if (pStoreDirectory != NULL)
+                {
+                    uint64_t numRows;
+                    uint64_t numSegmentWrites;
+                    uint64_t numSegmentsSealed;
+                    uint64_t numBytesSealed;
+                    uint64_t numLate;
+
+                    // The sinks have stopped so this thread may flush
+                    gReorder.releaseIdle (0, serverTimeUs (), 0);
+                    gStore.flush (0);
+                    gStore.getStats (&numRows, &numSegmentWrites, &numSegmentsSealed, &numBytesSealed);
+                    gReorder.getStats (NULL, &numLate, NULL);
+                    printf ("IngestServer: stored %llu row(s) of sensor readings in %s with %llu segment write(s),"
+                            " %llu dropped as too far out of order.\n",
+                            (unsigned long long) numRows, pStoreDirectory, (unsigned long long) numSegmentWrites,
+                            (unsigned long long) numLate);
+                    if (numBytesSealed > 0)
+                    {
+                        printf ("IngestServer: %llu full segment(s) compressed to %llu byte(s), %.1f times smaller.\n",
+                                (unsigned long long) numSegmentsSealed, (unsigned long long) numBytesSealed,
+                                (double) numSegmentsSealed * sensorSegmentFileSize (SENSOR_STORE_DEFAULT_ROWS_PER_SEGMENT) /
+                                numBytesSealed);
+                    }
+                    if (gTrajectoryEnabled)
+                    {
+                        uint64_t numKept;
+                        uint64_t numDropped;
+
+                        gTrajectory.getStats (&numKept, &numDropped);
+                        printf ("IngestServer: kept %llu GPS position(s), left out %llu as within %u metre(s)"
+                                " of the track.\n", (unsigned long long) numKept, (unsigned long long) numDropped,
+                                gpsErrorMetres > 0 ? gpsErrorMetres : TRAJECTORY_DEFAULT_ERROR_METRES);
+                    }
+                }
+                if (pRollupDirectory != NULL)
+                {
+                    uint64_t numReadings;
+                    uint64_t numLate;
+                    uint64_t numRowsWritten;
+
+                    // As for the store, and close the open windows too
+                    gRollup.flush (0, true);
+                    gRollup.getStats (&numReadings, &numLate, &numRowsWritten);
+                    printf ("IngestServer: rolled up %llu reading(s) (%llu too late) into %llu row(s) in %s.\n",
+                            (unsigned long long) numReadings, (unsigned long long) numLate,
+                            (unsigned long long) numRowsWritten, pRollupDirectory);
+                }
+                if (gpCdcFile != NULL)
+                {
+                    uint64_t numRecords;
+                    uint64_t numBytes;
+                    uint64_t numFullBytes;
+
+                    gCdc.getStats (&numRecords, &numBytes, &numFullBytes);
+                    printf ("IngestServer: %llu change record(s), %llu byte(s), in %s, %.1f times smaller"
+                            " than full readings.\n",
+                            (unsigned long long) numRecords, (unsigned long long) numBytes, pCdcFileName,
+                            numBytes > 0 ? (double) numFullBytes / numBytes : 0.0);
+                }
+                if (pGeofenceFileName != NULL)
+                {
+                    uint32_t numCells;
+
+                    gGeofence.getGridInfo (&numCells, NULL, NULL);
+                    printf ("IngestServer: %llu GPS position(s) checked against %u fence(s) in %u cell(s),"
+                            " %llu inside, %llu fence hit(s).\n",
+                            (unsigned long long) gNumGeofenceChecks, gGeofence.getNumFences (), numCells,
+                            (unsigned long long) gNumGeofenceInside, (unsigned long long) gNumGeofenceHits);
+                }
+                if (pAlertFileName != NULL)
+                {
+                    uint64_t numReadings;
+                    uint64_t numRaised;
+                    uint64_t numCleared;
+
+                    gAlert.getStats (&numReadings, &numRaised, &numCleared);
+                    printf ("IngestServer: %llu reading(s) evaluated against %u alert rule(s), %llu alert(s) raised,"
+                            " %llu cleared.\n", (unsigned long long) numReadings, gAlert.getNumRules (),
+                            (unsigned long long) numRaised, (unsigned long long) numCleared);
+                }
+            }
+            else
+            {
+                ownServer.stop ();
+                pServer->printThroughput (serverTimeUs () - lastReportTimeUs);
+                if (gTrafficEnabled)
+                {
+                    printf ("IngestServer: by traffic reports, uplink %llu datagram(s) sent, %llu received (%.2f%% loss),"
+                            " downlink %llu sent, %llu received (%.2f%% loss).\n",
+                            (unsigned long long) gNumUlDatagramsSent, (unsigned long long) gNumUlDatagramsReceived,
+                            trafficLossPercent (gNumUlDatagramsSent, gNumUlDatagramsReceived),
+                            (unsigned long long) gNumDlDatagramsSent, (unsigned long long) gNumDlDatagramsReceived,
+                            trafficLossPercent (gNumDlDatagramsSent, gNumDlDatagramsReceived));
+                }
+                // The receive threads have stopped so their sketches
+                // may be merged
+                for (uint32_t x = 1; gSketchEnabled && (x < ownServer.getNumThreads ()); x++)
+                {
+                    gSketches[0].merge (&gSketches[x]);
+                }
+                if (gRttEnabled)
+                {
+                    gRtt.checkTimeouts (serverTimeUs ());
+                    printRtts (&gRtt);
+                }
+            }
+            if (gSketchEnabled)
+            {
+                printSketch (&gSketches[0]);
+            }
+            if (pMetricsFileName != NULL)
+            {
+                writeCodecMetrics (numWorkers > 0 ? NULL : &ownServer, numWorkers > 0 ? &pipeline : NULL,
+                                   pMetricsFileName);
+            }
+            printf ("IngestServer: %d device(s) in the registry (%llu Mbyte(s) allocated).\n",
+                    gRegistry.getNumDevices (),
+                    (unsigned long long) (gRegistry.getMemoryUsed () / (1024 * 1024)));
+            if (gLivenessEnabled)
+            {
+                printf ("IngestServer: devices missed %llu PollInd(s) and %llu SensorsReportInd(s).\n",
+                        (unsigned long long) gNumPollIndMissed, (unsigned long long) gNumSensorsReportMissed);
+            }
+        }
+        else
+        {
+            printf ("IngestServer: failed to start.\n");
+            exitCode = 2;
+        }
+
+        if (gpCdcFile != NULL)
+        {
+            fclose (gpCdcFile);
+        }
+    }
+
+    return exitCode;
+}
+
+// End Of File
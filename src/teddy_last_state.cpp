@@ -0,0 +1,297 @@
+/* Teddy last-known-state cache
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_last_state.cpp
+ * This file implements the last-known-state cache.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for calloc(), posix_memalign() and free()
+#include <string.h> // for memset() and memcpy()
+#include <atomic>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_last_state.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t LastStateCache::findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add)
+{
+    int64_t slot = -1;
+    // The key column is atomic so the probe loads it with acquire,
+    // pairing with the release in which the writer publishes a new
+    // device, so that its entry is seen filled in
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (shardDeviceIdAt (pShard->pDeviceIds, x) == deviceId)
+    {
+        slot = x;
+    }
+    else if (add && (pShard->numEntries < pShard->maxEntries))
+    {
+        pShard->pEntries[x].sequence.store (0, std::memory_order_relaxed);
+        memset (&(pShard->pEntries[x].state), 0, sizeof (pShard->pEntries[x].state));
+        pShard->pEntries[x].state.deviceId = deviceId;
+        pShard->pDeviceIds[x].store (deviceId, std::memory_order_release);
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+void LastStateCache::copySensor (PipelineReadings_t * pTo, const PipelineReadings_t * pFrom,
+                                 uint32_t sensor)
+{
+    switch (sensor)
+    {
+        case SENSOR_GPS_POSITION:
+            pTo->gpsLatitude = pFrom->gpsLatitude;
+            pTo->gpsLongitude = pFrom->gpsLongitude;
+            pTo->gpsElevation = pFrom->gpsElevation;
+            pTo->gpsSpeed = pFrom->gpsSpeed;
+        break;
+        case SENSOR_LCL_POSITION:
+            pTo->orientation = pFrom->orientation;
+            pTo->hugsThisPeriod = pFrom->hugsThisPeriod;
+            pTo->slapsThisPeriod = pFrom->slapsThisPeriod;
+            pTo->dropsThisPeriod = pFrom->dropsThisPeriod;
+            pTo->nudgesThisPeriod = pFrom->nudgesThisPeriod;
+        break;
+        case SENSOR_SOUND_LEVEL:
+            pTo->soundLevel = pFrom->soundLevel;
+        break;
+        case SENSOR_LUMINOSITY:
+            pTo->luminosity = pFrom->luminosity;
+        break;
+        case SENSOR_TEMPERATURE:
+            pTo->temperature = pFrom->temperature;
+        break;
+        case SENSOR_RSSI:
+            pTo->rssi = pFrom->rssi;
+        break;
+        case SENSOR_POWER_STATE:
+            pTo->chargeState = pFrom->chargeState;
+            pTo->batteryMV = pFrom->batteryMV;
+            pTo->energyUWH = pFrom->energyUWH;
+        break;
+        default:
+        break;
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+LastStateCache::LastStateCache (void)
+{
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+LastStateCache::~LastStateCache (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        free (mp_shards[x].pDeviceIds);
+        free (mp_shards[x].pEntries);
+    }
+    free (mp_shards);
+}
+
+bool LastStateCache::init (uint32_t numShards, uint32_t maxDevices)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= LAST_STATE_MAX_SHARDS) &&
+        (maxDevices > 0) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            // All zero is DEVICE_ID_INVALID and an even sequence number
+            pShard->pDeviceIds = (std::atomic<DeviceId_t> *) calloc (capacity, sizeof (std::atomic<DeviceId_t>));
+            pShard->pEntries = (Entry_t *) calloc (capacity, sizeof (Entry_t));
+            if ((pShard->pDeviceIds == NULL) || (pShard->pEntries == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t LastStateCache::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool LastStateCache::updateFromRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord,
+                                       uint32_t now)
+{
+    bool success = false;
+    Shard_t * pShard = NULL;
+    Entry_t * pEntry;
+    LastState_t * pState;
+    const PipelineReadings_t * pReadings = &(pRecord->u.readings);
+    uint32_t sequence;
+    int64_t slot = -1;
+
+    if ((shardIndex < m_numShards) && (pRecord->deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = findSlot (pShard, pRecord->deviceId, true);
+    }
+
+    if (slot >= 0)
+    {
+        pEntry = &(pShard->pEntries[slot]);
+        pState = &(pEntry->state);
+
+        // Make the sequence number odd for the duration; the release
+        // fence stops the writes below being seen before it
+        sequence = pEntry->sequence.load (std::memory_order_relaxed);
+        pEntry->sequence.store (sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_release);
+
+        pState->lastSeenTime = now;
+        switch (pRecord->msgType)
+        {
+            case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+                pState->wakeUpCode = pRecord->u.initInd.wakeUpCode;
+                pState->revisionLevel = pRecord->u.initInd.revisionLevel;
+                pState->initIndTime = now;
+                pState->flags |= LAST_STATE_INIT_IND_SEEN;
+            break;
+            case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+            case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+            case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+                // Zero where the Cnf doesn't carry it
+                if (pRecord->u.intervals.reportingIntervalMinutes > 0)
+                {
+                    pState->reportingIntervalMinutes = pRecord->u.intervals.reportingIntervalMinutes;
+                    pState->flags |= LAST_STATE_REPORTING_INTERVAL_SEEN;
+                }
+                if (pRecord->u.intervals.heartbeatSeconds > 0)
+                {
+                    pState->heartbeatSeconds = pRecord->u.intervals.heartbeatSeconds;
+                    pState->flags |= LAST_STATE_HEARTBEAT_SEEN;
+                }
+                pState->intervalsTime = now;
+            break;
+            case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+            case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+                // Keep the latest of each sensor, as read
+                for (uint32_t x = 0; x < MAX_NUM_SENSORS; x++)
+                {
+                    if ((pRecord->presentBitmap & (1 << x)) &&
+                        (!(pState->presentBitmap & (1 << x)) || (pReadings->time >= pState->sensorTimes[x])))
+                    {
+                        copySensor (&(pState->readings), pReadings, x);
+                        pState->sensorTimes[x] = pReadings->time;
+                        pState->presentBitmap |= (uint8_t) (1 << x);
+                        if (pReadings->time > pState->readings.time)
+                        {
+                            pState->readings.time = pReadings->time;
+                        }
+                    }
+                }
+            break;
+            default:
+            break;
+        }
+
+        pEntry->sequence.store (sequence + 2, std::memory_order_release);
+        pShard->numUpdates++;
+        success = true;
+    }
+
+    return success;
+}
+
+bool LastStateCache::get (DeviceId_t deviceId, LastState_t * pState)
+{
+    bool found = false;
+    Entry_t * pEntry;
+    uint32_t before;
+    uint32_t after;
+    int64_t slot = -1;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        slot = findSlot (&(mp_shards[deviceIdShard (deviceId, m_numShards)]), deviceId, false);
+    }
+
+    if (slot >= 0)
+    {
+        pEntry = &(mp_shards[deviceIdShard (deviceId, m_numShards)].pEntries[slot]);
+        do
+        {
+            before = pEntry->sequence.load (std::memory_order_acquire);
+            memcpy (pState, &(pEntry->state), sizeof (*pState));
+            // The acquire fence stops the copy being seen after the
+            // second read of the sequence number
+            std::atomic_thread_fence (std::memory_order_acquire);
+            after = pEntry->sequence.load (std::memory_order_relaxed);
+        } while ((before & 1) || (before != after));
+        found = true;
+    }
+
+    return found;
+}
+
+void LastStateCache::getStats (uint32_t * pNumDevices, uint64_t * pNumUpdates)
+{
+    uint32_t numDevices = 0;
+    uint64_t numUpdates = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numDevices += mp_shards[x].numEntries;
+        numUpdates += mp_shards[x].numUpdates;
+    }
+
+    if (pNumDevices != NULL)
+    {
+        *pNumDevices = numDevices;
+    }
+    if (pNumUpdates != NULL)
+    {
+        *pNumUpdates = numUpdates;
+    }
+}
+
+// End Of File
@@ -17,11 +17,16 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stddef.h> // for offsetof()
 #include <stdarg.h> // for va_...
-#include <string.h> // for memcpy()
+#include <string.h> // for strlen() and memcpy()
 #include <teddy_api.hpp>
 
+// Logging can be compiled out for builds where the codec is driven
+// at high rate (e.g. the Linux ingest server in bld_linux)
+#ifndef MESSAGE_CODEC_NO_LOGGING
 #define DEBUG
+#endif
 
 #ifdef DEBUG
 #define MESSAGE_CODEC_LOGMSG(...)    MessageCodec::logMsg(__VA_ARGS__)
@@ -29,6 +34,27 @@
 #define MESSAGE_CODEC_LOGMSG(...)
 #endif
 
+// Metrics are only compiled in if MESSAGE_CODEC_METRICS is defined
+#ifdef MESSAGE_CODEC_METRICS
+#define MESSAGE_CODEC_METRICS_START_ENCODE()                uint64_t metricsStartTicks = metricsTicks ()
+#define MESSAGE_CODEC_METRICS_ENCODE(msgType, numBytes)     addEncodeMetrics (msgType, numBytes, metricsStartTicks)
+#define MESSAGE_CODEC_METRICS_START_DECODE(ppIn)            uint64_t metricsStartTicks = metricsTicks (); \
+                                                            const char * pMetricsMsgStart = *(ppIn)
+// A decode with no output buffer only peeks at the message ID, so
+// isn't counted
+#define MESSAGE_CODEC_METRICS_DECODE(direction, ppIn, sizeIn, pOut, result) \
+                                                            if ((pOut) != NULL) \
+                                                            { \
+                                                                addDecodeMetrics (direction, pMetricsMsgStart, *(ppIn), \
+                                                                                  sizeIn, result, metricsStartTicks); \
+                                                            }
+#else
+#define MESSAGE_CODEC_METRICS_START_ENCODE()
+#define MESSAGE_CODEC_METRICS_ENCODE(msgType, numBytes)
+#define MESSAGE_CODEC_METRICS_START_DECODE(ppIn)
+#define MESSAGE_CODEC_METRICS_DECODE(direction, ppIn, sizeIn, pOut, result)
+#endif
+
 // ----------------------------------------------------------------
 // GENERAL COMPILE-TIME CONSTANTS
 // ----------------------------------------------------------------
@@ -45,6 +71,10 @@
 
 void (*MessageCodec::mp_guiPrintToConsole) (const char*) = NULL;
 
+#ifdef MESSAGE_CODEC_METRICS
+uint64_t (*MessageCodec::mp_metricsClock) (void) = NULL;
+#endif
+
 // ----------------------------------------------------------------
 // ON-AIR MESSAGE IDs
 // ----------------------------------------------------------------
@@ -86,15 +116,124 @@ typedef enum MsgIdUlTag_t
   MAX_NUM_UL_MSGS                    //!< The maximum number of uplink messages.
 } MsgIdUl_t;
 
+// ----------------------------------------------------------------
+// MESSAGE FORMATS
+// ----------------------------------------------------------------
+
+/// How one field of a message structure goes on the air.
+typedef struct MsgFieldTag_t
+{
+    uint8_t offset;                  //!< offsetof() the field in the structure.
+    uint8_t size;                    //!< sizeof() the field in the structure.
+    uint8_t onAirSize;               //!< Bytes on the air, big-endian.
+} MsgField_t;
+
+/// How a message made of fixed-size fields is encoded.
+typedef struct MsgFormatTag_t
+{
+#ifdef DEBUG
+    const char * pName;              //!< The name of the message, for logging.
+#endif
+    uint8_t msgId;                   //!< The on-air message ID.
+    uint8_t msgType;                 //!< The DecodeResult_t of the message.
+    uint8_t numFields;
+    MsgField_t fields[4];
+} MsgFormat_t;
+
+/// The name of a message at the start of a MsgFormat_t, only
+// compiled in with logging.
+#ifdef DEBUG
+#define MSG_NAME(name) name,
+#else
+#define MSG_NAME(name)
+#endif
+
+/// A MsgField_t for a field of a message structure.
+#define MSG_FIELD(msgStruct, field, onAirSize) {(uint8_t) offsetof (msgStruct, field), \
+                                                (uint8_t) sizeof (((msgStruct *) 0)->field), \
+                                                onAirSize}
+
+/// The formats of the messages made of fixed-size fields, which are
+// all encoded by encodeMsg(), each format being compiled out with
+// its encode function.
+static const MsgFormat_t gInitIndUlMsgFormat =
+    {MSG_NAME ("InitIndUlMsg") INIT_IND_UL_MSG, MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG, 2,
+     {MSG_FIELD (InitIndUlMsg_t, wakeUpCode, 1),
+      MSG_FIELD (InitIndUlMsg_t, revisionLevel, 2)}};
+static const MsgFormat_t gIntervalsGetCnfUlMsgFormat =
+    {MSG_NAME ("IntervalsGetCnfUlMsg") INTERVALS_GET_CNF_UL_MSG, MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG, 2,
+     {MSG_FIELD (IntervalsGetCnfUlMsg_t, reportingIntervalMinutes, 4),
+      MSG_FIELD (IntervalsGetCnfUlMsg_t, heartbeatSeconds, 4)}};
+static const MsgFormat_t gReportingIntervalSetCnfUlMsgFormat =
+    {MSG_NAME ("ReportingIntervalSetCnfUlMsg") REPORTING_INTERVAL_SET_CNF_UL_MSG, MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG, 1,
+     {MSG_FIELD (ReportingIntervalSetCnfUlMsg_t, reportingIntervalMinutes, 4)}};
+static const MsgFormat_t gHeartbeatSetCnfUlMsgFormat =
+    {MSG_NAME ("HeartbeatSetCnfUlMsg") HEARTBEAT_SET_CNF_UL_MSG, MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG, 1,
+     {MSG_FIELD (HeartbeatSetCnfUlMsg_t, heartbeatSeconds, 4)}};
+static const MsgFormat_t gPollIndUlMsgFormat =
+    {MSG_NAME ("PollIndUlMsg") POLL_IND_UL_MSG, MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG, 0, {}};
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
+static const MsgFormat_t gTrafficReportGetCnfUlMsgFormat =
+    {MSG_NAME ("TrafficReportGetCnfUlMsg") TRAFFIC_REPORT_GET_CNF_UL_MSG, MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG, 4,
+     {MSG_FIELD (TrafficReportGetCnfUlMsg_t, numDatagramsSent, 4),
+      MSG_FIELD (TrafficReportGetCnfUlMsg_t, numBytesSent, 4),
+      MSG_FIELD (TrafficReportGetCnfUlMsg_t, numDatagramsReceived, 4),
+      MSG_FIELD (TrafficReportGetCnfUlMsg_t, numBytesReceived, 4)}};
+static const MsgFormat_t gTrafficReportIndUlMsgFormat =
+    {MSG_NAME ("TrafficReportIndUlMsg") TRAFFIC_REPORT_IND_UL_MSG, MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG, 4,
+     {MSG_FIELD (TrafficReportIndUlMsg_t, numDatagramsSent, 4),
+      MSG_FIELD (TrafficReportIndUlMsg_t, numBytesSent, 4),
+      MSG_FIELD (TrafficReportIndUlMsg_t, numDatagramsReceived, 4),
+      MSG_FIELD (TrafficReportIndUlMsg_t, numBytesReceived, 4)}};
+#endif
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
+static const MsgFormat_t gRebootReqDlMsgFormat =
+    {MSG_NAME ("RebootReqDlMsg") REBOOT_REQ_DL_MSG, MessageCodec::DECODE_RESULT_REBOOT_REQ_DL_MSG, 1,
+     {MSG_FIELD (RebootReqDlMsg_t, devModeOnNotOff, 1)}};
+static const MsgFormat_t gIntervalsGetReqDlMsgFormat =
+    {MSG_NAME ("IntervalsGetReqDlMsg") INTERVALS_GET_REQ_DL_MSG, MessageCodec::DECODE_RESULT_INTERVALS_GET_REQ_DL_MSG, 0, {}};
+static const MsgFormat_t gReportingIntervalSetReqDlMsgFormat =
+    {MSG_NAME ("ReportingIntervalSetReqDlMsg") REPORTING_INTERVAL_SET_REQ_DL_MSG, MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_REQ_DL_MSG, 1,
+     {MSG_FIELD (ReportingIntervalSetReqDlMsg_t, reportingIntervalMinutes, 4)}};
+static const MsgFormat_t gHeartbeatSetReqDlMsgFormat =
+    {MSG_NAME ("HeartbeatSetReqDlMsg") HEARTBEAT_SET_REQ_DL_MSG, MessageCodec::DECODE_RESULT_HEARTBEAT_SET_REQ_DL_MSG, 1,
+     {MSG_FIELD (HeartbeatSetReqDlMsg_t, heartbeatSeconds, 4)}};
+static const MsgFormat_t gSensorsReportGetReqDlMsgFormat =
+    {MSG_NAME ("SensorsReportGetReqDlMsg") SENSORS_REPORT_GET_REQ_DL_MSG, MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_REQ_DL_MSG, 0, {}};
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
+static const MsgFormat_t gTrafficReportGetReqDlMsgFormat =
+    {MSG_NAME ("TrafficReportGetReqDlMsg") TRAFFIC_REPORT_GET_REQ_DL_MSG, MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_REQ_DL_MSG, 0, {}};
+#endif
+#endif
+
 // ----------------------------------------------------------------
 // GENERIC PRIVATE FUNCTIONS
 // ----------------------------------------------------------------
 
-/// Encode a boolean value.
-uint32_t MessageCodec::encodeBool (char * pBuffer, bool value)
+#ifdef MESSAGE_CODEC_ENCODE_HEX
+/// The number of characters each encoded byte takes in the output.
+#define ENCODE_CHARS_PER_BYTE 2
+
+/// The characters of hex output.
+static const char gHexDigits[] = "0123456789ABCDEF";
+#else
+/// The number of characters each encoded byte takes in the output.
+#define ENCODE_CHARS_PER_BYTE 1
+#endif
+
+/// Write one byte of encoded output.
+uint32_t MessageCodec::writeByte (char * pBuffer, uint8_t value)
 {
-    *pBuffer = value;
-    return 1;
+    uint32_t numCharsWritten = ENCODE_CHARS_PER_BYTE;
+
+#ifdef MESSAGE_CODEC_ENCODE_HEX
+    pBuffer[0] = gHexDigits[value >> 4];
+    pBuffer[1] = gHexDigits[value & 0x0F];
+#else
+    pBuffer[0] = value;
+#endif
+
+    return numCharsWritten;
 }
 
 /// Decode a boolean value.
@@ -115,12 +254,12 @@ bool MessageCodec::decodeBool (const char ** ppBuffer)
 /// Encode a uint32_t
 uint32_t MessageCodec::encodeUint32 (char * pBuffer, uint32_t value)
 {
-    uint32_t numBytesEncoded = 4;
+    uint32_t numBytesEncoded = 0;
 
-    pBuffer[0] = 0xff & (value >> 24);
-    pBuffer[1] = 0xff & (value >> 16);
-    pBuffer[2] = 0xff & (value >> 8);
-    pBuffer[3] = 0xff & value;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 24));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 16));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 8));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & value);
 
     return numBytesEncoded;
 }
@@ -145,15 +284,16 @@ uint32_t MessageCodec::decodeUint32 (const char ** ppBuffer)
 /// Encode a uint24_t
 uint32_t MessageCodec::encodeUint24 (char * pBuffer, uint32_t value)
 {
-    uint32_t numBytesEncoded = 3;
+    uint32_t numBytesEncoded = 0;
 
-    pBuffer[0] = 0xff & (value >> 16);
-    pBuffer[1] = 0xff & (value >> 8);
-    pBuffer[2] = 0xff & value;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 16));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 8));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & value);
 
     return numBytesEncoded;
 }
 
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
 /// Decode a uint24_t
 uint32_t MessageCodec::decodeUint24 (const char ** ppBuffer)
 {
@@ -168,18 +308,20 @@ uint32_t MessageCodec::decodeUint24 (const char ** ppBuffer)
 
     return value;
 }
+#endif
 
 /// Encode a uint16_t
 uint32_t MessageCodec::encodeUint16 (char * pBuffer, uint16_t value)
 {
-    uint32_t numBytesEncoded = 2;
+    uint32_t numBytesEncoded = 0;
 
-    pBuffer[0] = 0xff & (value >> 8);
-    pBuffer[1] = 0xff & value;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> 8));
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & value);
 
     return numBytesEncoded;
 }
 
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
 /// Decode a uint16_t
 uint32_t MessageCodec::decodeUint16 (const char ** ppBuffer)
 {
@@ -192,6 +334,7 @@ uint32_t MessageCodec::decodeUint16 (const char ** ppBuffer)
 
     return value;
 }
+#endif
 
 /// Encode a SensorReadings_t
 //The sensor readings message is coded as follows:
@@ -235,6 +378,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     char *pBufferAtStart;
     char *pBytesToFollow;
     uint8_t bitMap = 0;
+    uint32_t width = ENCODE_CHARS_PER_BYTE;
 
     pBufferAtStart = pBuffer;
 
@@ -243,7 +387,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
 
     // Set things up so that bytesToFollow can be filled in later
     pBytesToFollow = pBuffer;
-    pBuffer++;
+    pBuffer += width;
 
     // Now fill in the bit-map, determining which items are present
     // and filling in the bitmap according to the order of the items
@@ -279,7 +423,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     // That's 7 things coded up so write this bitmap value
     // but don't advance the pointer as it may be necessary
     // to set the extension bit
-    *pBuffer = bitMap;
+    writeByte (pBuffer, bitMap);
 
     // That's all we have but if we have more it would go as follows
     // if (pSensorReadings->blahPresent || pSensorReadings->blahBlahPresent)
@@ -287,8 +431,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     //     // Set the extension bit, re-write the last bitmap
     //     // value and start on the next one
     //     bitMap |= 0x80;
-    //     *pBuffer = bitMap;
-    //     pBuffer++;
+    //     pBuffer += writeByte (pBuffer, bitMap);
     //     bitMap = 0;
     //
     //     if (pSensorReadings->blahPresent)
@@ -302,11 +445,11 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     //
     //     // This is the end of the structure, so now write this
     //     // bitmap value
-    //     *pBuffer = bitMap;
+    //     writeByte (pBuffer, bitMap);
     // }
 
     // Advance the pointer
-    pBuffer++;
+    pBuffer += width;
 
     // Now fill in the actual values
     if (pSensorReadings->gpsPositionPresent)
@@ -326,8 +469,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
             pSensorReadings->lclPosition.hugsThisPeriod = MAX_HUGS_THIS_PERIOD;
         }
         x |= ((pSensorReadings->lclPosition.hugsThisPeriod << 4) & 0xF0);
-        *pBuffer = x;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, x);
         if (pSensorReadings->lclPosition.slapsThisPeriod > MAX_SLAPS_THIS_PERIOD)
         {
             pSensorReadings->lclPosition.slapsThisPeriod = MAX_SLAPS_THIS_PERIOD;
@@ -338,11 +480,9 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
             pSensorReadings->lclPosition.dropsThisPeriod = MAX_DROPS_THIS_PERIOD;
         }
         x |= ((pSensorReadings->lclPosition.dropsThisPeriod << 4) & 0xF0);
-        *pBuffer = x;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, x);
         x = pSensorReadings->lclPosition.nudgesThisPeriod;
-        *pBuffer = x;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, x);
     }
     if (pSensorReadings->soundLevelPresent)
     {
@@ -354,13 +494,11 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     }
     if (pSensorReadings->temperaturePresent)
     {
-        *pBuffer = (uint8_t) pSensorReadings->temperature;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, (uint8_t) pSensorReadings->temperature);
     }
     if (pSensorReadings->rssiPresent)
     {
-        *pBuffer = pSensorReadings->rssi;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, pSensorReadings->rssi);
     }
     if (pSensorReadings->powerStatePresent)
     {
@@ -373,8 +511,7 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
         }
         x |= (((uint32_t) pSensorReadings->powerState.batteryMV * 0x3F / 10000) & 0x3F);
         x |= ((pSensorReadings->powerState.chargeState << 6) & 0xC0);
-        *pBuffer = x;
-        pBuffer++;
+        pBuffer += writeByte (pBuffer, x);
         energyUWH = pSensorReadings->powerState.energyUWH;
         if (energyUWH > MAX_ENERGY_UWH)
         {
@@ -397,11 +534,12 @@ uint32_t MessageCodec::encodeSensorReadings (char * pBuffer, SensorReadings_t *
     // }
 
     /* Now fill in the value for bytesToFollow */
-    *pBytesToFollow = pBuffer - (pBufferAtStart + 5); // 5 for a UInt32 and bytesToFollow itself
+    writeByte (pBytesToFollow, (pBuffer - (pBufferAtStart + (5 * width))) / width); // 5 for a UInt32 and bytesToFollow itself
 
     return (pBuffer - pBufferAtStart);
 }
 
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
 // Decode a SensorReading_t
 bool MessageCodec::decodeSensorReadings (const char ** ppBuffer, SensorReadings_t * pSensorReadings)
 {
@@ -540,160 +678,142 @@ bool MessageCodec::decodeSensorReadings (const char ** ppBuffer, SensorReadings_
 
     return success;
 }
+#endif
 
 // ----------------------------------------------------------------
 // MESSAGE ENCODING FUNCTIONS
 // ----------------------------------------------------------------
 
-uint32_t MessageCodec::encodeInitIndUlMsg (char * pBuffer,
-                                           InitIndUlMsg_t * pMsg)
+uint32_t MessageCodec::encodeMsg (char * pBuffer,
+                                  const MsgFormat_t * pFormat,
+                                  const void * pMsg)
 {
     uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding InitIndUlMsg, ID 0x%.2x, ", INIT_IND_UL_MSG);
-    pBuffer[numBytesEncoded] = INIT_IND_UL_MSG;
-    numBytesEncoded++;
-    pBuffer[numBytesEncoded] = (uint8_t) pMsg->wakeUpCode;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint16 (&(pBuffer[numBytesEncoded]), REVISION_LEVEL);
+    const MsgField_t * pField;
+    const uint8_t * pValue;
+    uint32_t value;
+    uint16_t value16;
+    MESSAGE_CODEC_METRICS_START_ENCODE ();
+
+    MESSAGE_CODEC_LOGMSG ("Encoding %s, ID 0x%.2x, ", pFormat->pName, pFormat->msgId);
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), pFormat->msgId);
+    for (uint32_t x = 0; x < pFormat->numFields; x++)
+    {
+        pField = &(pFormat->fields[x]);
+        pValue = (const uint8_t *) pMsg + pField->offset;
+        // An enum may be one byte or four, depending on the compiler,
+        // so go by the size of the field in the structure
+        switch (pField->size)
+        {
+            case 1:
+            {
+                value = *pValue;
+            }
+            break;
+            case 2:
+            {
+                memcpy (&value16, pValue, sizeof (value16));
+                value = value16;
+            }
+            break;
+            default:
+            {
+                memcpy (&value, pValue, sizeof (value));
+            }
+            break;
+        }
+        for (uint32_t y = pField->onAirSize; y > 0; y--)
+        {
+            numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), 0xff & (value >> ((y - 1) * 8)));
+        }
+    }
     MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    MESSAGE_CODEC_METRICS_ENCODE ((DecodeResult_t) pFormat->msgType, numBytesEncoded);
 
     return numBytesEncoded;
 }
 
-uint32_t MessageCodec::encodeRebootReqDlMsg (char * pBuffer,
-											 RebootReqDlMsg_t *pMsg)
+uint32_t MessageCodec::encodeInitIndUlMsg (char * pBuffer,
+                                           InitIndUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
+    InitIndUlMsg_t msg = *pMsg;
 
-    pBuffer[numBytesEncoded] = REBOOT_REQ_DL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeBool (&(pBuffer[numBytesEncoded]), pMsg->devModeOnNotOff);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    // The revision level is always that of this codec
+    msg.revisionLevel = REVISION_LEVEL;
 
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gInitIndUlMsgFormat, &msg);
 }
 
-uint32_t MessageCodec::encodeIntervalsGetReqDlMsg (char * pBuffer)
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
+uint32_t MessageCodec::encodeRebootReqDlMsg (char * pBuffer,
+                                             RebootReqDlMsg_t *pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding IntervalsGetReqDlMsg, ID 0x%.2x, ", INTERVALS_GET_REQ_DL_MSG);
-    pBuffer[numBytesEncoded] = INTERVALS_GET_REQ_DL_MSG;
-    numBytesEncoded++;
-    // Empty body
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    return encodeMsg (pBuffer, &gRebootReqDlMsgFormat, pMsg);
+}
 
-    return numBytesEncoded;
+uint32_t MessageCodec::encodeIntervalsGetReqDlMsg (char * pBuffer)
+{
+    return encodeMsg (pBuffer, &gIntervalsGetReqDlMsgFormat, NULL);
 }
+#endif
 
 uint32_t MessageCodec::encodeIntervalsGetCnfUlMsg (char * pBuffer,
                                                    IntervalsGetCnfUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding IntervalsGetCnfUlMsg, ID 0x%.2x, ", INTERVALS_GET_CNF_UL_MSG);
-    pBuffer[numBytesEncoded] = INTERVALS_GET_CNF_UL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->reportingIntervalMinutes);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->heartbeatSeconds);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gIntervalsGetCnfUlMsgFormat, pMsg);
 }
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
 uint32_t MessageCodec::encodeReportingIntervalSetReqDlMsg (char * pBuffer,
                                                            ReportingIntervalSetReqDlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding ReportingIntervalSetReqDlMsg, ID 0x%.2x, ", REPORTING_INTERVAL_SET_REQ_DL_MSG);
-    pBuffer[numBytesEncoded] = REPORTING_INTERVAL_SET_REQ_DL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->reportingIntervalMinutes);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gReportingIntervalSetReqDlMsgFormat, pMsg);
 }
+#endif
 
 uint32_t MessageCodec::encodeReportingIntervalSetCnfUlMsg (char * pBuffer,
                                                            ReportingIntervalSetCnfUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding ReportingIntervalSetCnfUlMsg, ID 0x%.2x, ", REPORTING_INTERVAL_SET_CNF_UL_MSG);
-    pBuffer[numBytesEncoded] = REPORTING_INTERVAL_SET_CNF_UL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->reportingIntervalMinutes);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gReportingIntervalSetCnfUlMsgFormat, pMsg);
 }
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
 uint32_t MessageCodec::encodeHeartbeatSetReqDlMsg (char * pBuffer,
                                                          HeartbeatSetReqDlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding HeartbeatSetReqDlMsg, ID 0x%.2x, ", HEARTBEAT_SET_REQ_DL_MSG);
-    pBuffer[numBytesEncoded] = HEARTBEAT_SET_REQ_DL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->heartbeatSeconds);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gHeartbeatSetReqDlMsgFormat, pMsg);
 }
+#endif
 
 uint32_t MessageCodec::encodeHeartbeatSetCnfUlMsg (char * pBuffer,
                                                          HeartbeatSetCnfUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding HeartbeatSetCnfUlMsg, ID 0x%.2x, ", HEARTBEAT_SET_CNF_UL_MSG);
-    pBuffer[numBytesEncoded] = HEARTBEAT_SET_CNF_UL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->heartbeatSeconds);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gHeartbeatSetCnfUlMsgFormat, pMsg);
 }
 
 uint32_t MessageCodec::encodePollIndUlMsg (char * pBuffer)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding PollIndMsg, ID 0x%.2x, ", POLL_IND_UL_MSG);
-    pBuffer[numBytesEncoded] = POLL_IND_UL_MSG;
-    numBytesEncoded++;
-    // Empty body
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gPollIndUlMsgFormat, NULL);
 }
 
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
 uint32_t MessageCodec::encodeSensorsReportGetReqDlMsg (char * pBuffer)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding SensorsReportGetReqDlMsg, ID 0x%.2x, ", SENSORS_REPORT_GET_REQ_DL_MSG);
-    pBuffer[numBytesEncoded] = SENSORS_REPORT_GET_REQ_DL_MSG;
-    numBytesEncoded++;
-    // Empty body
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gSensorsReportGetReqDlMsgFormat, NULL);
 }
+#endif
 
 uint32_t MessageCodec::encodeSensorsReportGetCnfUlMsg (char * pBuffer,
                                                        SensorsReportGetCnfUlMsg_t * pMsg)
 {
     uint32_t numBytesEncoded = 0;
+    MESSAGE_CODEC_METRICS_START_ENCODE ();
 
     MESSAGE_CODEC_LOGMSG ("Encoding SensorsReportGetCnfUlMsg, ID 0x%.2x, ", SENSORS_REPORT_GET_CNF_UL_MSG);
-    pBuffer[numBytesEncoded] = SENSORS_REPORT_GET_CNF_UL_MSG;
-    numBytesEncoded++;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), SENSORS_REPORT_GET_CNF_UL_MSG);
     numBytesEncoded += encodeSensorReadings (&(pBuffer[numBytesEncoded]), &(pMsg->sensorReadings));
     MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    MESSAGE_CODEC_METRICS_ENCODE (DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG, numBytesEncoded);
 
     return numBytesEncoded;
 }
@@ -702,83 +822,63 @@ uint32_t MessageCodec::encodeSensorsReportIndUlMsg (char * pBuffer,
                                                     SensorsReportIndUlMsg_t * pMsg)
 {
     uint32_t numBytesEncoded = 0;
+    MESSAGE_CODEC_METRICS_START_ENCODE ();
 
     MESSAGE_CODEC_LOGMSG ("Encoding SensorsReportIndUlMsg, ID 0x%.2x, ", SENSORS_REPORT_IND_UL_MSG);
-    pBuffer[numBytesEncoded] = SENSORS_REPORT_IND_UL_MSG;
-    numBytesEncoded++;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), SENSORS_REPORT_IND_UL_MSG);
     numBytesEncoded += encodeSensorReadings (&(pBuffer[numBytesEncoded]), &(pMsg->sensorReadings));
     MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    MESSAGE_CODEC_METRICS_ENCODE (DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG, numBytesEncoded);
 
     return numBytesEncoded;
 }
 
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
+#ifndef MESSAGE_CODEC_NO_DL_ENCODE
 uint32_t MessageCodec::encodeTrafficReportGetReqDlMsg (char * pBuffer)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding TrafficReportGetReqDlMsg, ID 0x%.2x, ", TRAFFIC_REPORT_GET_REQ_DL_MSG);
-    pBuffer[numBytesEncoded] = TRAFFIC_REPORT_GET_REQ_DL_MSG;
-    numBytesEncoded++;
-    // Empty body
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gTrafficReportGetReqDlMsgFormat, NULL);
 }
+#endif
 
 uint32_t MessageCodec::encodeTrafficReportGetCnfUlMsg (char * pBuffer,
                                                        TrafficReportGetCnfUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding TrafficReportGetCnfUlMsg, ID 0x%.2x, ", TRAFFIC_REPORT_GET_CNF_UL_MSG);
-    pBuffer[numBytesEncoded] = TRAFFIC_REPORT_GET_CNF_UL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numDatagramsSent);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numBytesSent);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numDatagramsReceived);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numBytesReceived);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gTrafficReportGetCnfUlMsgFormat, pMsg);
 }
 
 uint32_t MessageCodec::encodeTrafficReportIndUlMsg (char * pBuffer,
                                                     TrafficReportIndUlMsg_t * pMsg)
 {
-    uint32_t numBytesEncoded = 0;
-
-    MESSAGE_CODEC_LOGMSG ("Encoding TrafficReportIndUlMsg, ID 0x%.2x, ", TRAFFIC_REPORT_IND_UL_MSG);
-    pBuffer[numBytesEncoded] = TRAFFIC_REPORT_IND_UL_MSG;
-    numBytesEncoded++;
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numDatagramsSent);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numBytesSent);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numDatagramsReceived);
-    numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), pMsg->numBytesReceived);
-    MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
-
-    return numBytesEncoded;
+    return encodeMsg (pBuffer, &gTrafficReportIndUlMsgFormat, pMsg);
 }
+#endif
 
+#ifndef MESSAGE_CODEC_NO_DEBUG_IND
 uint32_t MessageCodec::encodeDebugIndUlMsg (char * pBuffer,
                                             DebugIndUlMsg_t * pMsg)
 {
     uint32_t numBytesEncoded = 0;
     uint32_t sizeOfString = pMsg->sizeOfString;
+    MESSAGE_CODEC_METRICS_START_ENCODE ();
 
     MESSAGE_CODEC_LOGMSG ("Encoding DebugIndUlMsg, ID 0x%.2x, ", DEBUG_IND_UL_MSG);
     if (sizeOfString > MAX_DEBUG_STRING_SIZE)
     {
         sizeOfString = MAX_DEBUG_STRING_SIZE;
     }
-    pBuffer[numBytesEncoded] = DEBUG_IND_UL_MSG;
-    numBytesEncoded++;
+    numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), DEBUG_IND_UL_MSG);
     numBytesEncoded += encodeUint32 (&(pBuffer[numBytesEncoded]), (uint32_t) pMsg->sizeOfString);
-    memcpy (&(pBuffer[numBytesEncoded]), &(pMsg->string[0]), sizeOfString);
-    numBytesEncoded += sizeOfString;
+    for (uint32_t x = 0; x < sizeOfString; x++)
+    {
+        numBytesEncoded += writeByte (&(pBuffer[numBytesEncoded]), (uint8_t) pMsg->string[x]);
+    }
     MESSAGE_CODEC_LOGMSG ("%d bytes encoded.\n", numBytesEncoded);
+    MESSAGE_CODEC_METRICS_ENCODE (DECODE_RESULT_DEBUG_IND_UL_MSG, numBytesEncoded);
 
     return numBytesEncoded;
 }
+#endif
 
 // ----------------------------------------------------------------
 // MESSAGE DECODING FUNCTIONS
@@ -789,6 +889,7 @@ MessageCodec::DecodeResult_t MessageCodec::decodeDlMsg (const char ** ppInBuffer
 {
     MsgIdDl_t msgId;
     DecodeResult_t decodeResult = DECODE_RESULT_FAILURE;
+    MESSAGE_CODEC_METRICS_START_DECODE (ppInBuffer);
 
     if (sizeInBuffer <  MIN_MESSAGE_SIZE)
     {
@@ -843,28 +944,36 @@ MessageCodec::DecodeResult_t MessageCodec::decodeDlMsg (const char ** ppInBuffer
                     // Empty message
                 }
                 break;
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
                 case TRAFFIC_REPORT_GET_REQ_DL_MSG:
                 {
                     decodeResult = DECODE_RESULT_TRAFFIC_REPORT_GET_REQ_DL_MSG;
                     // Empty message
                 }
                 break;
+#endif
                 default:
                 // The decodeResult will be left as Unknown message
                 break;
             }
         }
     }
+    MESSAGE_CODEC_METRICS_DECODE (METRICS_DIRECTION_DL, ppInBuffer, sizeInBuffer, pOutBuffer, decodeResult);
 
     return decodeResult;
 }
 
+#ifndef MESSAGE_CODEC_NO_UL_DECODE
 MessageCodec::DecodeResult_t MessageCodec::decodeUlMsg (const char ** ppInBuffer,
                                                         uint32_t sizeInBuffer,
                                                         UlMsgUnion_t * pOutBuffer)
 {
     MsgIdUl_t msgId;
     DecodeResult_t decodeResult = DECODE_RESULT_FAILURE;
+#ifndef MESSAGE_CODEC_NO_DEBUG_IND
+    const char * pMsgStart = *ppInBuffer;
+#endif
+    MESSAGE_CODEC_METRICS_START_DECODE (ppInBuffer);
 
     if (sizeInBuffer < MIN_MESSAGE_SIZE)
     {
@@ -949,6 +1058,7 @@ MessageCodec::DecodeResult_t MessageCodec::decodeUlMsg (const char ** ppInBuffer
                     }
                 }
                 break;
+#ifndef MESSAGE_CODEC_NO_TRAFFIC_REPORT
                 case TRAFFIC_REPORT_GET_CNF_UL_MSG:
                 {
                     decodeResult = DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG;
@@ -973,35 +1083,96 @@ MessageCodec::DecodeResult_t MessageCodec::decodeUlMsg (const char ** ppInBuffer
                     }
                 }
                 break;
+#endif
+#ifndef MESSAGE_CODEC_NO_DEBUG_IND
                 case DEBUG_IND_UL_MSG:
                 {
                     decodeResult = DECODE_RESULT_DEBUG_IND_UL_MSG;
                     if (pOutBuffer != NULL)
                     {
-                        pOutBuffer->debugIndUlMsg.sizeOfString = (uint32_t) decodeUint32 (ppInBuffer);
-                        if (pOutBuffer->debugIndUlMsg.sizeOfString > MAX_DEBUG_STRING_SIZE)
+                        // The string is handed out where it lies, so it
+                        // must not run past the end of the input, nor
+                        // may the header, the ID and the uint32_t size
+                        if (sizeInBuffer < 1 + sizeof (uint32_t))
+                        {
+                            pOutBuffer->debugIndUlMsg.sizeOfString = 0;
+                            *(ppInBuffer) = pMsgStart + sizeInBuffer;
+                        }
+                        else
                         {
-                            pOutBuffer->debugIndUlMsg.sizeOfString = MAX_DEBUG_STRING_SIZE;
+                            pOutBuffer->debugIndUlMsg.sizeOfString = (uint32_t) decodeUint32 (ppInBuffer);
+                            if (pOutBuffer->debugIndUlMsg.sizeOfString > MAX_DEBUG_STRING_SIZE)
+                            {
+                                pOutBuffer->debugIndUlMsg.sizeOfString = MAX_DEBUG_STRING_SIZE;
+                            }
+                            if (pOutBuffer->debugIndUlMsg.sizeOfString > sizeInBuffer - (uint32_t) (*(ppInBuffer) - pMsgStart))
+                            {
+                                pOutBuffer->debugIndUlMsg.sizeOfString = sizeInBuffer - (uint32_t) (*(ppInBuffer) - pMsgStart);
+                            }
                         }
-                        memcpy (&(pOutBuffer->debugIndUlMsg.string[0]), *(ppInBuffer), pOutBuffer->debugIndUlMsg.sizeOfString);
+                        pOutBuffer->debugIndUlMsg.pString = *(ppInBuffer);
                         *(ppInBuffer) += pOutBuffer->debugIndUlMsg.sizeOfString;
                     }
                 }
                 break;
+#endif
                 default:
                 // The decodeResult will be left as Unknown message
                 break;
             }
         }
     }
+    MESSAGE_CODEC_METRICS_DECODE (METRICS_DIRECTION_UL, ppInBuffer, sizeInBuffer, pOutBuffer, decodeResult);
 
     return decodeResult;
 }
+#endif
 
 // ----------------------------------------------------------------
 // MISC FUNCTIONS
 // ----------------------------------------------------------------
 
+MessageCodec::MessageCodec (void)
+{
+#ifdef MESSAGE_CODEC_METRICS
+    resetMetrics ();
+#endif
+}
+
+#ifdef MESSAGE_CODEC_ENCODE_HEX
+char * MessageCodec::finishAtCommand (char * pBuffer, const char * pPrefix, uint32_t hexSize)
+{
+    char * pCommand = NULL;
+    char * pHeader = pBuffer + AT_COMMAND_HEADER_ROOM;
+    uint32_t prefixSize = strlen (pPrefix);
+    uint32_t length = hexSize / 2;
+
+    if ((hexSize <= MAX_DATAGRAM_SIZE_RAW * 2) && ((hexSize & 1) == 0))
+    {
+        pBuffer[AT_COMMAND_HEADER_ROOM + hexSize] = 0;
+        // Fill in backwards from the hex: the comma, the length, least
+        // significant digit first, and then the prefix
+        pHeader--;
+        *pHeader = ',';
+        do
+        {
+            pHeader--;
+            *pHeader = '0' + (length % 10);
+            length /= 10;
+        }
+        while (length > 0);
+        if ((uint32_t) (pHeader - pBuffer) >= prefixSize)
+        {
+            pHeader -= prefixSize;
+            memcpy (pHeader, pPrefix, prefixSize);
+            pCommand = pHeader;
+        }
+    }
+
+    return pCommand;
+}
+#endif
+
 // Log debug messages
 void MessageCodec::logMsg (const char * pFormat, ...)
 {
@@ -1037,4 +1208,376 @@ void  MessageCodec::initDll (void (*guiPrintToConsole) (const char *))
 #endif
 }
 
+#ifdef MESSAGE_CODEC_METRICS
+// ----------------------------------------------------------------
+// METRICS FUNCTIONS
+// ----------------------------------------------------------------
+
+// Read the metrics clock
+uint64_t MessageCodec::metricsTicks (void)
+{
+    uint64_t ticks = 0;
+
+    if (mp_metricsClock != NULL)
+    {
+        ticks = mp_metricsClock ();
+    }
+
+    return ticks;
+}
+
+// Add a latency to a histogram
+void MessageCodec::addLatency (MetricsHistogram_t * pHistogram, uint64_t ticks)
+{
+    uint32_t bucket = (uint32_t) ticks;
+    uint32_t shift = 0;
+
+    if (ticks >= (1 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS))
+    {
+        // Find the shift that leaves the top bit and the sub-bucket bits
+        while ((ticks >> shift) >= (2 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS))
+        {
+            shift++;
+        }
+        bucket = (shift << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS) + (uint32_t) (ticks >> shift);
+    }
+
+    pHistogram->count++;
+    pHistogram->totalTicks += ticks;
+    if (ticks > pHistogram->maxTicks)
+    {
+        pHistogram->maxTicks = ticks;
+    }
+    pHistogram->buckets[bucket]++;
+}
+
+// The upper bound of a latency histogram bucket
+static uint64_t latencyBucketMaxTicks (uint32_t bucket)
+{
+    uint64_t maxTicks = bucket;
+    uint32_t shift = bucket >> MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS;
+
+    if (shift > 0)
+    {
+        shift--;
+        maxTicks = ((uint64_t) ((bucket & ((1 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS) - 1)) +
+                                (1 << MESSAGE_CODEC_METRICS_SUB_BUCKET_BITS) + 1) << shift) - 1;
+    }
+
+    return maxTicks;
+}
+
+// Count a decode
+void MessageCodec::addDecodeMetrics (MetricsDirection_t direction, const char * pMsgStart, const char * pMsgEnd,
+                                     uint32_t sizeIn, DecodeResult_t result, uint64_t startTicks)
+{
+    uint32_t msgId = MESSAGE_CODEC_METRICS_MAX_MSG_IDS;
+
+    if ((uint32_t) result < MAX_NUM_DECODE_RESULTS)
+    {
+        m_metrics.numDecodes[result]++;
+    }
+    if (result <= DECODE_RESULT_BAD_MSG_FORMAT)
+    {
+        if ((sizeIn > 0) && ((uint8_t) *pMsgStart < MESSAGE_CODEC_METRICS_MAX_MSG_IDS))
+        {
+            msgId = (uint8_t) *pMsgStart;
+        }
+        m_metrics.numDecodeFailures[direction][msgId][result]++;
+    }
+    // A badly formatted message may have been read past its end
+    if ((uint32_t) (pMsgEnd - pMsgStart) < sizeIn)
+    {
+        sizeIn = (uint32_t) (pMsgEnd - pMsgStart);
+    }
+    m_metrics.numBytesDecoded += sizeIn;
+    if (mp_metricsClock != NULL)
+    {
+        addLatency (&(m_metrics.decodeLatency), mp_metricsClock () - startTicks);
+    }
+}
+
+// Count an encode
+void MessageCodec::addEncodeMetrics (DecodeResult_t msgType, uint32_t numBytes, uint64_t startTicks)
+{
+    m_metrics.numEncodes[msgType]++;
+    // Count the bytes on the air, not the characters
+    m_metrics.numBytesEncoded += numBytes / ENCODE_CHARS_PER_BYTE;
+    if (mp_metricsClock != NULL)
+    {
+        addLatency (&(m_metrics.encodeLatency), mp_metricsClock () - startTicks);
+    }
+}
+
+// Get the name of a DecodeResult_t
+const char * MessageCodec::getResultName (uint32_t result)
+{
+    const char * pName = NULL;
+
+    switch (result)
+    {
+        case DECODE_RESULT_FAILURE:
+            pName = "FAILURE";
+        break;
+        case DECODE_RESULT_INPUT_TOO_SHORT:
+            pName = "INPUT_TOO_SHORT";
+        break;
+        case DECODE_RESULT_OUTPUT_TOO_SHORT:
+            pName = "OUTPUT_TOO_SHORT";
+        break;
+        case DECODE_RESULT_UNKNOWN_MSG_ID:
+            pName = "UNKNOWN_MSG_ID";
+        break;
+        case DECODE_RESULT_BAD_MSG_FORMAT:
+            pName = "BAD_MSG_FORMAT";
+        break;
+        case DECODE_RESULT_REBOOT_REQ_DL_MSG:
+            pName = "REBOOT_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_INTERVALS_GET_REQ_DL_MSG:
+            pName = "INTERVALS_GET_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_REPORTING_INTERVAL_SET_REQ_DL_MSG:
+            pName = "REPORTING_INTERVAL_SET_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_HEARTBEAT_SET_REQ_DL_MSG:
+            pName = "HEARTBEAT_SET_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_SENSORS_REPORT_GET_REQ_DL_MSG:
+            pName = "SENSORS_REPORT_GET_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_TRAFFIC_REPORT_GET_REQ_DL_MSG:
+            pName = "TRAFFIC_REPORT_GET_REQ_DL_MSG";
+        break;
+        case DECODE_RESULT_INIT_IND_UL_MSG:
+            pName = "INIT_IND_UL_MSG";
+        break;
+        case DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+            pName = "INTERVALS_GET_CNF_UL_MSG";
+        break;
+        case DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+            pName = "REPORTING_INTERVAL_SET_CNF_UL_MSG";
+        break;
+        case DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+            pName = "HEARTBEAT_SET_CNF_UL_MSG";
+        break;
+        case DECODE_RESULT_POLL_IND_UL_MSG:
+            pName = "POLL_IND_UL_MSG";
+        break;
+        case DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+            pName = "SENSORS_REPORT_GET_CNF_UL_MSG";
+        break;
+        case DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+            pName = "SENSORS_REPORT_IND_UL_MSG";
+        break;
+        case DECODE_RESULT_DEBUG_IND_UL_MSG:
+            pName = "DEBUG_IND_UL_MSG";
+        break;
+        case DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG:
+            pName = "TRAFFIC_REPORT_GET_CNF_UL_MSG";
+        break;
+        case DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG:
+            pName = "TRAFFIC_REPORT_IND_UL_MSG";
+        break;
+        default:
+        break;
+    }
+
+    return pName;
+}
+
+void MessageCodec::getMetrics (Metrics_t * pSnapshot)
+{
+    memcpy (pSnapshot, &m_metrics, sizeof (*pSnapshot));
+}
+
+void MessageCodec::resetMetrics (void)
+{
+    memset (&m_metrics, 0, sizeof (m_metrics));
+}
+
+void MessageCodec::setMetricsClock (uint64_t (*pGetTicks) (void))
+{
+    mp_metricsClock = pGetTicks;
+}
+
+void MessageCodec::mergeMetrics (Metrics_t * pTotal, const Metrics_t * pMetrics)
+{
+    const MetricsHistogram_t * pFrom[] = {&(pMetrics->decodeLatency), &(pMetrics->encodeLatency)};
+    MetricsHistogram_t * pTo[] = {&(pTotal->decodeLatency), &(pTotal->encodeLatency)};
+
+    for (uint32_t x = 0; x < MAX_NUM_DECODE_RESULTS; x++)
+    {
+        pTotal->numDecodes[x] += pMetrics->numDecodes[x];
+        pTotal->numEncodes[x] += pMetrics->numEncodes[x];
+    }
+    for (uint32_t x = 0; x < METRICS_NUM_DIRECTIONS; x++)
+    {
+        for (uint32_t y = 0; y < MESSAGE_CODEC_METRICS_MAX_MSG_IDS + 1; y++)
+        {
+            for (uint32_t z = 0; z < DECODE_RESULT_BAD_MSG_FORMAT + 1; z++)
+            {
+                pTotal->numDecodeFailures[x][y][z] += pMetrics->numDecodeFailures[x][y][z];
+            }
+        }
+    }
+    pTotal->numBytesDecoded += pMetrics->numBytesDecoded;
+    pTotal->numBytesEncoded += pMetrics->numBytesEncoded;
+    for (uint32_t x = 0; x < sizeof (pTo) / sizeof (pTo[0]); x++)
+    {
+        pTo[x]->count += pFrom[x]->count;
+        pTo[x]->totalTicks += pFrom[x]->totalTicks;
+        if (pFrom[x]->maxTicks > pTo[x]->maxTicks)
+        {
+            pTo[x]->maxTicks = pFrom[x]->maxTicks;
+        }
+        for (uint32_t y = 0; y < MESSAGE_CODEC_METRICS_NUM_LATENCY_BUCKETS; y++)
+        {
+            pTo[x]->buckets[y] += pFrom[x]->buckets[y];
+        }
+    }
+}
+
+uint64_t MessageCodec::getLatencyQuantile (const MetricsHistogram_t * pHistogram, uint32_t permille)
+{
+    uint64_t ticks = 0;
+    uint64_t rank;
+    uint64_t count = 0;
+
+    if (pHistogram->count > 0)
+    {
+        // The rank of the quantile, counting from one
+        rank = ((pHistogram->count * permille) + 999) / 1000;
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        for (uint32_t x = 0; x < MESSAGE_CODEC_METRICS_NUM_LATENCY_BUCKETS; x++)
+        {
+            count += pHistogram->buckets[x];
+            if (count >= rank)
+            {
+                ticks = latencyBucketMaxTicks (x);
+                break;
+            }
+        }
+        if (ticks > pHistogram->maxTicks)
+        {
+            ticks = pHistogram->maxTicks;
+        }
+    }
+
+    return ticks;
+}
+
+// Add to a printMetrics() buffer, keeping track of how much is used
+static void printMetricsAppend (char * pBuffer, uint32_t size, int32_t * pUsed, const char * pFormat, ...)
+{
+    va_list args;
+    int32_t written;
+
+    if (*pUsed >= 0)
+    {
+        va_start (args, pFormat);
+        written = vsnprintf (pBuffer + *pUsed, size - *pUsed, pFormat, args);
+        va_end (args);
+        if ((written >= 0) && ((uint32_t) (*pUsed + written) < size))
+        {
+            *pUsed += written;
+        }
+        else
+        {
+            *pUsed = -1;
+        }
+    }
+}
+
+int32_t MessageCodec::printMetrics (const Metrics_t * pMetrics, char * pBuffer, uint32_t size)
+{
+    int32_t used = (size > 0) ? 0 : -1;
+    const char * pDirectionNames[] = {"dl", "ul"};
+    const char * pLatencyNames[] = {"codec_decode_latency_ticks", "codec_encode_latency_ticks"};
+    const MetricsHistogram_t * pHistograms[] = {&(pMetrics->decodeLatency), &(pMetrics->encodeLatency)};
+    uint64_t count;
+
+    printMetricsAppend (pBuffer, size, &used, "# TYPE codec_decodes_total counter\n");
+    for (uint32_t x = 0; x < MAX_NUM_DECODE_RESULTS; x++)
+    {
+        if ((pMetrics->numDecodes[x] > 0) && (getResultName (x) != NULL))
+        {
+            printMetricsAppend (pBuffer, size, &used, "codec_decodes_total{result=\"%s\"} %llu\n",
+                                getResultName (x), (unsigned long long) pMetrics->numDecodes[x]);
+        }
+    }
+    printMetricsAppend (pBuffer, size, &used, "# TYPE codec_decode_failures_total counter\n");
+    for (uint32_t x = 0; x < METRICS_NUM_DIRECTIONS; x++)
+    {
+        for (uint32_t y = 0; y < MESSAGE_CODEC_METRICS_MAX_MSG_IDS + 1; y++)
+        {
+            for (uint32_t z = 0; z < DECODE_RESULT_BAD_MSG_FORMAT + 1; z++)
+            {
+                if (pMetrics->numDecodeFailures[x][y][z] > 0)
+                {
+                    if (y < MESSAGE_CODEC_METRICS_MAX_MSG_IDS)
+                    {
+                        printMetricsAppend (pBuffer, size, &used,
+                                            "codec_decode_failures_total{direction=\"%s\",msg_id=\"%u\",result=\"%s\"} %llu\n",
+                                            pDirectionNames[x], y, getResultName (z),
+                                            (unsigned long long) pMetrics->numDecodeFailures[x][y][z]);
+                    }
+                    else
+                    {
+                        printMetricsAppend (pBuffer, size, &used,
+                                            "codec_decode_failures_total{direction=\"%s\",msg_id=\"other\",result=\"%s\"} %llu\n",
+                                            pDirectionNames[x], getResultName (z),
+                                            (unsigned long long) pMetrics->numDecodeFailures[x][y][z]);
+                    }
+                }
+            }
+        }
+    }
+    printMetricsAppend (pBuffer, size, &used, "# TYPE codec_encodes_total counter\n");
+    for (uint32_t x = 0; x < MAX_NUM_DECODE_RESULTS; x++)
+    {
+        if ((pMetrics->numEncodes[x] > 0) && (getResultName (x) != NULL))
+        {
+            printMetricsAppend (pBuffer, size, &used, "codec_encodes_total{msg=\"%s\"} %llu\n",
+                                getResultName (x), (unsigned long long) pMetrics->numEncodes[x]);
+        }
+    }
+    printMetricsAppend (pBuffer, size, &used, "# TYPE codec_bytes_total counter\n");
+    printMetricsAppend (pBuffer, size, &used, "codec_bytes_total{op=\"decode\"} %llu\n",
+                        (unsigned long long) pMetrics->numBytesDecoded);
+    printMetricsAppend (pBuffer, size, &used, "codec_bytes_total{op=\"encode\"} %llu\n",
+                        (unsigned long long) pMetrics->numBytesEncoded);
+    for (uint32_t x = 0; x < sizeof (pHistograms) / sizeof (pHistograms[0]); x++)
+    {
+        if (pHistograms[x]->count > 0)
+        {
+            // Buckets are cumulative; empty ones add nothing so are
+            // left out
+            printMetricsAppend (pBuffer, size, &used, "# TYPE %s histogram\n", pLatencyNames[x]);
+            count = 0;
+            for (uint32_t y = 0; y < MESSAGE_CODEC_METRICS_NUM_LATENCY_BUCKETS; y++)
+            {
+                if (pHistograms[x]->buckets[y] > 0)
+                {
+                    count += pHistograms[x]->buckets[y];
+                    printMetricsAppend (pBuffer, size, &used, "%s_bucket{le=\"%llu\"} %llu\n", pLatencyNames[x],
+                                        (unsigned long long) latencyBucketMaxTicks (y), (unsigned long long) count);
+                }
+            }
+            printMetricsAppend (pBuffer, size, &used, "%s_bucket{le=\"+Inf\"} %llu\n", pLatencyNames[x],
+                                (unsigned long long) pHistograms[x]->count);
+            printMetricsAppend (pBuffer, size, &used, "%s_sum %llu\n", pLatencyNames[x],
+                                (unsigned long long) pHistograms[x]->totalTicks);
+            printMetricsAppend (pBuffer, size, &used, "%s_count %llu\n", pLatencyNames[x],
+                                (unsigned long long) pHistograms[x]->count);
+        }
+    }
+
+    return used;
+}
+#endif
+
 // End Of File
@@ -0,0 +1,918 @@
+/* Teddy staged ingest pipeline
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_pipeline.cpp
+ * This file implements the staged ingest pipeline.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> // for posix_memalign() and free()
+#include <string.h> // for memset(), memcpy() and strncpy()
+#include <unistd.h> // for usleep()
+#include <sched.h>  // for sched_yield()
+#include <new>      // for std::nothrow
+#include <atomic>
+#include <pthread.h>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_ring.hpp>
+#include <teddy_ingest_server.hpp>
+#include <teddy_pipeline.hpp>
+
+// ----------------------------------------------------------------
+// CONSTRUCTION/DESTRUCTION
+// ----------------------------------------------------------------
+
+IngestPipeline::IngestPipeline (void)
+{
+    m_numWorkers = 0;
+    m_numSinks = 0;
+    m_dedupEnabled = false;
+    m_debugTemplatesEnabled = false;
+    m_stopWorkers = false;
+    m_stopSinks = false;
+    m_backpressureCallback = NULL;
+    mp_context = NULL;
+    mp_receiveStats = NULL;
+    memset (mp_workers, 0, sizeof (mp_workers));
+    memset (mp_sinks, 0, sizeof (mp_sinks));
+}
+
+IngestPipeline::~IngestPipeline (void)
+{
+    stop ();
+
+    for (uint32_t x = 0; x < m_numWorkers; x++)
+    {
+        for (uint32_t y = 0; y < m_numSinks; y++)
+        {
+            delete mp_workers[x]->pOutRings[y];
+        }
+        delete mp_workers[x];
+    }
+    for (uint32_t x = 0; x < m_numSinks; x++)
+    {
+        delete mp_sinks[x];
+    }
+    free (mp_receiveStats);
+}
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+void IngestPipeline::addLatency (PipelineStageStats_t * pStats, uint64_t latencyUs)
+{
+    uint32_t bucket = 0;
+
+    pStats->latencyTotalUs += latencyUs;
+    if (latencyUs > pStats->latencyMaxUs)
+    {
+        pStats->latencyMaxUs = latencyUs;
+    }
+
+    while ((latencyUs > 0) && (bucket < PIPELINE_NUM_LATENCY_BUCKETS - 1))
+    {
+        latencyUs >>= 1;
+        bucket++;
+    }
+    pStats->latencyBuckets[bucket]++;
+}
+
+void IngestPipeline::addStats (PipelineStageStats_t * pTotal, const PipelineStageStats_t * pStats)
+{
+    pTotal->numIn += pStats->numIn;
+    pTotal->numOut += pStats->numOut;
+    pTotal->numDropped += pStats->numDropped;
+    pTotal->numStalls += pStats->numStalls;
+    pTotal->numBackpressureOn += pStats->numBackpressureOn;
+    pTotal->queueDepth += pStats->queueDepth;
+    if (pStats->maxQueueDepth > pTotal->maxQueueDepth)
+    {
+        pTotal->maxQueueDepth = pStats->maxQueueDepth;
+    }
+    pTotal->latencyTotalUs += pStats->latencyTotalUs;
+    if (pStats->latencyMaxUs > pTotal->latencyMaxUs)
+    {
+        pTotal->latencyMaxUs = pStats->latencyMaxUs;
+    }
+    for (uint32_t x = 0; x < PIPELINE_NUM_LATENCY_BUCKETS; x++)
+    {
+        pTotal->latencyBuckets[x] += pStats->latencyBuckets[x];
+    }
+}
+
+bool IngestPipeline::receiveCallback (void * pContext,
+                                      uint32_t threadIndex,
+                                      DeviceId_t deviceId,
+                                      const char * pDatagram,
+                                      uint32_t size)
+{
+    IngestPipeline * pPipeline = (IngestPipeline *) pContext;
+    PipelineStageStats_t * pStats = &(pPipeline->mp_receiveStats[threadIndex]);
+    Worker_t * pWorker;
+    Datagram_t * pBlock;
+    uint32_t depth;
+    uint32_t capacity;
+
+    pStats->numIn++;
+
+    // Shard by device so that a device's messages stay in order
+    pWorker = pPipeline->mp_workers[deviceIdShard (deviceId, pPipeline->m_numWorkers)];
+    pBlock = (Datagram_t *) pPipeline->m_datagramPool.alloc ();
+    if (pBlock != NULL)
+    {
+        pBlock->deviceId = deviceId;
+        pBlock->receiveTimeUs = serverTimeUs ();
+        pBlock->size = size;
+        memcpy (pBlock->data, pDatagram, size);
+        if (pWorker->inRing.push (pBlock))
+        {
+            pStats->numOut++;
+        }
+        else
+        {
+            pPipeline->m_datagramPool.free (pBlock);
+            pStats->numDropped++;
+        }
+    }
+    else
+    {
+        pStats->numDropped++;
+    }
+
+    // Signal backpressure, with hysteresis
+    depth = pWorker->inRing.getDepth ();
+    capacity = pWorker->inRing.getCapacity ();
+    if (depth > pStats->maxQueueDepth)
+    {
+        pStats->maxQueueDepth = depth;
+    }
+    if (!pWorker->backpressure.load (std::memory_order_relaxed))
+    {
+        if (depth >= capacity / 8 * PIPELINE_BACKPRESSURE_ON_EIGHTHS)
+        {
+            bool expected = false;
+            if (pWorker->backpressure.compare_exchange_strong (expected, true))
+            {
+                pStats->numBackpressureOn++;
+                if (pPipeline->m_backpressureCallback != NULL)
+                {
+                    pPipeline->m_backpressureCallback (pPipeline->mp_context, pWorker->index, true);
+                }
+            }
+        }
+    }
+    else
+    {
+        if (depth <= capacity / 8 * PIPELINE_BACKPRESSURE_OFF_EIGHTHS)
+        {
+            bool expected = true;
+            if (pWorker->backpressure.compare_exchange_strong (expected, false) &&
+                (pPipeline->m_backpressureCallback != NULL))
+            {
+                pPipeline->m_backpressureCallback (pPipeline->mp_context, pWorker->index, false);
+            }
+        }
+    }
+
+    // The receive thread never decodes
+    return false;
+}
+
+bool IngestPipeline::fillRecord (PipelineRecord_t * pRecord,
+                                 MessageCodec::DecodeResult_t result,
+                                 const UlMsgUnion_t * pMsg)
+{
+    bool passOn = true;
+
+    pRecord->msgType = (uint8_t) result;
+    pRecord->presentBitmap = 0;
+
+    switch (result)
+    {
+        case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+        {
+            pRecord->u.initInd.wakeUpCode = (uint8_t) pMsg->initIndUlMsg.wakeUpCode;
+            pRecord->u.initInd.revisionLevel = pMsg->initIndUlMsg.revisionLevel;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+        {
+            pRecord->u.intervals.reportingIntervalMinutes = pMsg->intervalsGetCnfUlMsg.reportingIntervalMinutes;
+            pRecord->u.intervals.heartbeatSeconds = pMsg->intervalsGetCnfUlMsg.heartbeatSeconds;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+        {
+            pRecord->u.intervals.reportingIntervalMinutes = pMsg->reportingIntervalSetCnfUlMsg.reportingIntervalMinutes;
+            pRecord->u.intervals.heartbeatSeconds = 0;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+        {
+            pRecord->u.intervals.reportingIntervalMinutes = 0;
+            pRecord->u.intervals.heartbeatSeconds = pMsg->heartbeatSetCnfUlMsg.heartbeatSeconds;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_POLL_IND_UL_MSG:
+        {
+            // Empty message
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+        {
+            // The two messages carry the same structure
+            const SensorReadings_t * pReadings = &(pMsg->sensorsReportIndUlMsg.sensorReadings);
+            PipelineReadings_t * pOut = &(pRecord->u.readings);
+
+            memset (pOut, 0, sizeof (*pOut));
+            pOut->time = pReadings->time;
+            if (pReadings->gpsPositionPresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_GPS_POSITION;
+                pOut->gpsLatitude = pReadings->gpsPosition.latitude;
+                pOut->gpsLongitude = pReadings->gpsPosition.longitude;
+                pOut->gpsElevation = pReadings->gpsPosition.elevation;
+                pOut->gpsSpeed = pReadings->gpsPosition.speed;
+            }
+            if (pReadings->lclPositionPresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_LCL_POSITION;
+                pOut->orientation = (uint8_t) pReadings->lclPosition.orientation;
+                pOut->hugsThisPeriod = pReadings->lclPosition.hugsThisPeriod;
+                pOut->slapsThisPeriod = pReadings->lclPosition.slapsThisPeriod;
+                pOut->dropsThisPeriod = pReadings->lclPosition.dropsThisPeriod;
+                pOut->nudgesThisPeriod = pReadings->lclPosition.nudgesThisPeriod;
+            }
+            if (pReadings->soundLevelPresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_SOUND_LEVEL;
+                pOut->soundLevel = pReadings->soundLevel;
+            }
+            if (pReadings->luminosityPresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_LUMINOSITY;
+                pOut->luminosity = pReadings->luminosity;
+            }
+            if (pReadings->temperaturePresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_TEMPERATURE;
+                pOut->temperature = pReadings->temperature;
+            }
+            if (pReadings->rssiPresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_RSSI;
+                pOut->rssi = pReadings->rssi;
+            }
+            if (pReadings->powerStatePresent)
+            {
+                pRecord->presentBitmap |= PIPELINE_PRESENT_POWER_STATE;
+                pOut->chargeState = (uint8_t) pReadings->powerState.chargeState;
+                pOut->batteryMV = pReadings->powerState.batteryMV;
+                pOut->energyUWH = pReadings->powerState.energyUWH;
+            }
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG:
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG:
+        {
+            // The two messages carry the same structure
+            pRecord->u.traffic = pMsg->trafficReportIndUlMsg;
+        }
+        break;
+        case MessageCodec::DECODE_RESULT_DEBUG_IND_UL_MSG:
+        {
+            uint32_t numParams = 0;
+
+            pRecord->u.debugInd.templateId = DEBUG_TEMPLATE_ID_NONE;
+            pRecord->u.debugInd.numParams = 0;
+            pRecord->u.debugInd.sizeOfString = 0;
+            if (m_debugTemplatesEnabled)
+            {
+                pRecord->u.debugInd.templateId = m_debugTemplates.intern (pMsg->debugIndUlMsg.pString,
+                                                                          pMsg->debugIndUlMsg.sizeOfString,
+                                                                          pRecord->u.debugInd.params,
+                                                                          &numParams);
+                pRecord->u.debugInd.numParams = (uint8_t) numParams;
+            }
+            if (pRecord->u.debugInd.templateId == DEBUG_TEMPLATE_ID_NONE)
+            {
+                pRecord->u.debugInd.sizeOfString = (uint8_t) pMsg->debugIndUlMsg.sizeOfString;
+                memcpy (pRecord->u.debugInd.string, pMsg->debugIndUlMsg.pString, pMsg->debugIndUlMsg.sizeOfString);
+            }
+        }
+        break;
+        default:
+        {
+            passOn = false;
+        }
+        break;
+    }
+
+    return passOn;
+}
+
+void IngestPipeline::releaseRecord (PipelineRecord_t * pRecord)
+{
+    if (pRecord->refCount.fetch_sub (1, std::memory_order_acq_rel) == 1)
+    {
+        m_recordPool.free (pRecord);
+    }
+}
+
+void IngestPipeline::publishRecord (Worker_t * pWorker, PipelineRecord_t * pRecord)
+{
+    pRecord->refCount.store ((uint8_t) m_numSinks, std::memory_order_relaxed);
+
+    for (uint32_t x = 0; x < m_numSinks; x++)
+    {
+        SpscRing * pRing = pWorker->pOutRings[x];
+        bool stalled = false;
+
+        // Wait for the sink rather than drop: the pressure then
+        // backs up into this worker's input ring
+        while (!pRing->push (pRecord))
+        {
+            if (!stalled)
+            {
+                pWorker->stats.numStalls++;
+                stalled = true;
+            }
+            if (m_stopSinks)
+            {
+                // Sinks have gone, nobody will ever consume this
+                pWorker->stats.numDropped++;
+                releaseRecord (pRecord);
+                break;
+            }
+            sched_yield ();
+        }
+    }
+}
+
+bool IngestPipeline::isDuplicate (Worker_t * pWorker, const Datagram_t * pDatagram)
+{
+    bool duplicate = false;
+    const char * pIn = pDatagram->data;
+    MessageCodec::DecodeResult_t firstResult;
+
+    if (m_dedupEnabled)
+    {
+        // With no output buffer the codec only reads the message ID
+        firstResult = pWorker->codec.decodeUlMsg (&pIn, pDatagram->size, NULL);
+        if ((firstResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+            (firstResult == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG) ||
+            (firstResult == MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_IND_UL_MSG) ||
+            (firstResult == MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG))
+        {
+            // Devices are sharded across the workers and the filter alike
+            duplicate = m_dedup.check (pWorker->index, pDatagram->deviceId, pDatagram->data,
+                                       pDatagram->size, pDatagram->receiveTimeUs);
+        }
+    }
+
+    return duplicate;
+}
+
+void IngestPipeline::decodeDatagram (Worker_t * pWorker, Datagram_t * pDatagram)
+{
+    MessageCodec::DecodeResult_t decodeResult;
+    UlMsgUnion_t msg;
+    const char * pIn = pDatagram->data;
+    const char * pEnd = pDatagram->data + pDatagram->size;
+    PipelineRecord_t * pRecord;
+
+    while (pIn < pEnd)
+    {
+        decodeResult = pWorker->codec.decodeUlMsg (&pIn, pEnd - pIn, &msg);
+        if ((decodeResult < MessageCodec::DECODE_RESULT_UL_MSG_BASE) ||
+            (decodeResult > MessageCodec::MAX_UL_REQ_MSG) || (pIn > pEnd))
+        {
+            // Can't trust anything after a bad message
+            pWorker->stats.numDropped++;
+            break;
+        }
+
+        pRecord = (PipelineRecord_t *) m_recordPool.alloc ();
+        if (pRecord == NULL)
+        {
+            pWorker->stats.numDropped++;
+            break;
+        }
+
+        pRecord->deviceId = pDatagram->deviceId;
+        pRecord->receiveTimeUs = pDatagram->receiveTimeUs;
+        pRecord->workerIndex = (uint8_t) pWorker->index;
+        if (fillRecord (pRecord, decodeResult, &msg) && (m_numSinks > 0))
+        {
+            publishRecord (pWorker, pRecord);
+            pWorker->stats.numOut++;
+        }
+        else
+        {
+            m_recordPool.free (pRecord);
+        }
+    }
+}
+
+void * IngestPipeline::workerThread (void * pParam)
+{
+    Worker_t * pWorker = (Worker_t *) pParam;
+    IngestPipeline * pPipeline = pWorker->pPipeline;
+    Datagram_t * pDatagram;
+    uint32_t depth;
+
+    for (;;)
+    {
+        pDatagram = (Datagram_t *) pWorker->inRing.pop ();
+        if (pDatagram != NULL)
+        {
+            pWorker->stats.numIn++;
+            depth = pWorker->inRing.getDepth ();
+            pWorker->stats.queueDepth = depth;
+            if (depth > pWorker->stats.maxQueueDepth)
+            {
+                pWorker->stats.maxQueueDepth = depth;
+            }
+            if (!pPipeline->isDuplicate (pWorker, pDatagram))
+            {
+                pPipeline->decodeDatagram (pWorker, pDatagram);
+            }
+            addLatency (&(pWorker->stats), serverTimeUs () - pDatagram->receiveTimeUs);
+            pPipeline->m_datagramPool.free (pDatagram);
+        }
+        else
+        {
+            if (pPipeline->m_stopWorkers)
+            {
+                break;
+            }
+            usleep (PIPELINE_IDLE_SLEEP_US);
+        }
+    }
+
+    return NULL;
+}
+
+void * IngestPipeline::sinkThread (void * pParam)
+{
+    Sink_t * pSink = (Sink_t *) pParam;
+    IngestPipeline * pPipeline = pSink->pPipeline;
+    PipelineRecord_t * pRecord;
+    bool idle;
+    uint32_t depth;
+
+    for (;;)
+    {
+        idle = true;
+        depth = 0;
+        // Take a record from each worker's ring in turn
+        for (uint32_t x = 0; x < pPipeline->m_numWorkers; x++)
+        {
+            SpscRing * pRing = pPipeline->mp_workers[x]->pOutRings[pSink->index];
+
+            pRecord = (PipelineRecord_t *) pRing->pop ();
+            if (pRecord != NULL)
+            {
+                idle = false;
+                pSink->stats.numIn++;
+                pSink->callback (pSink->pContext, pRecord);
+                pSink->stats.numOut++;
+                addLatency (&(pSink->stats), serverTimeUs () - pRecord->receiveTimeUs);
+                pPipeline->releaseRecord (pRecord);
+                depth += pRing->getDepth ();
+            }
+        }
+
+        if (idle)
+        {
+            if (pPipeline->m_stopSinks)
+            {
+                break;
+            }
+            usleep (PIPELINE_IDLE_SLEEP_US);
+        }
+        else
+        {
+            pSink->stats.queueDepth = depth;
+            if (depth > pSink->stats.maxQueueDepth)
+            {
+                pSink->stats.maxQueueDepth = depth;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void IngestPipeline::printStageStats (const char * pName, const PipelineStageStats_t * pStats)
+{
+    uint64_t percentile99Us = 0;
+    uint64_t count = 0;
+    uint64_t total = 0;
+
+    for (uint32_t x = 0; x < PIPELINE_NUM_LATENCY_BUCKETS; x++)
+    {
+        total += pStats->latencyBuckets[x];
+    }
+    for (uint32_t x = 0; (x < PIPELINE_NUM_LATENCY_BUCKETS) && (total > 0); x++)
+    {
+        count += pStats->latencyBuckets[x];
+        if (count * 100 >= total * 99)
+        {
+            percentile99Us = (uint64_t) 1 << x;
+            break;
+        }
+    }
+
+    printf ("IngestPipeline: %-12s in %llu, out %llu, dropped %llu, stalls %llu, backpressure %llu,"
+            " depth %u (max %u), latency avg %llu us, 99%% < %llu us, max %llu us.\n",
+            pName,
+            (unsigned long long) pStats->numIn,
+            (unsigned long long) pStats->numOut,
+            (unsigned long long) pStats->numDropped,
+            (unsigned long long) pStats->numStalls,
+            (unsigned long long) pStats->numBackpressureOn,
+            pStats->queueDepth, pStats->maxQueueDepth,
+            (unsigned long long) (total > 0 ? pStats->latencyTotalUs / total : 0),
+            (unsigned long long) percentile99Us,
+            (unsigned long long) pStats->latencyMaxUs);
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+bool IngestPipeline::init (uint16_t port,
+                           uint32_t numReceiveThreads,
+                           uint32_t numWorkers,
+                           PipelineBackpressureCallback_t backpressureCallback,
+                           void * pContext)
+{
+    bool success = false;
+    void * pMemory = NULL;
+
+    m_backpressureCallback = backpressureCallback;
+    mp_context = pContext;
+
+    if (numWorkers == 0)
+    {
+        numWorkers = 1;
+    }
+    if (numWorkers > PIPELINE_MAX_WORKERS)
+    {
+        numWorkers = PIPELINE_MAX_WORKERS;
+    }
+
+    if (m_datagramPool.init (sizeof (Datagram_t), PIPELINE_DEFAULT_NUM_DATAGRAMS) &&
+        m_recordPool.init (sizeof (PipelineRecord_t), PIPELINE_DEFAULT_NUM_RECORDS) &&
+        (posix_memalign (&pMemory, SERVER_CACHE_LINE_SIZE, sizeof (PipelineStageStats_t) * INGEST_MAX_THREADS) == 0))
+    {
+        mp_receiveStats = (PipelineStageStats_t *) pMemory;
+        memset (mp_receiveStats, 0, sizeof (PipelineStageStats_t) * INGEST_MAX_THREADS);
+        success = true;
+        for (m_numWorkers = 0; success && (m_numWorkers < numWorkers); m_numWorkers++)
+        {
+            Worker_t * pWorker = new (std::nothrow) Worker_t;
+
+            success = false;
+            mp_workers[m_numWorkers] = pWorker;
+            if (pWorker != NULL)
+            {
+                pWorker->pPipeline = this;
+                pWorker->index = m_numWorkers;
+                pWorker->threadRunning = false;
+                memset (pWorker->pOutRings, 0, sizeof (pWorker->pOutRings));
+                pWorker->backpressure.store (false);
+                memset (&(pWorker->stats), 0, sizeof (pWorker->stats));
+                success = pWorker->inRing.init (PIPELINE_DEFAULT_WORKER_RING_SIZE);
+            }
+        }
+    }
+
+    if (success)
+    {
+        // The receive stage: an IngestServer that hands every datagram
+        // to us rather than decoding it
+        success = m_ingestServer.init (port, numReceiveThreads, NULL, receiveCallback, this);
+    }
+
+    return success;
+}
+
+int32_t IngestPipeline::addSink (const char * pName,
+                                 PipelineSinkCallback_t callback,
+                                 void * pContext,
+                                 uint32_t ringCapacity)
+{
+    int32_t sinkIndex = -1;
+    Sink_t * pSink;
+    bool success = true;
+
+    if ((m_numSinks < PIPELINE_MAX_SINKS) && (callback != NULL))
+    {
+        if (ringCapacity == 0)
+        {
+            ringCapacity = PIPELINE_DEFAULT_SINK_RING_SIZE;
+        }
+
+        pSink = new (std::nothrow) Sink_t;
+        if (pSink != NULL)
+        {
+            memset (pSink, 0, sizeof (*pSink));
+            pSink->pPipeline = this;
+            pSink->index = m_numSinks;
+            strncpy (pSink->name, pName, sizeof (pSink->name) - 1);
+            pSink->callback = callback;
+            pSink->pContext = pContext;
+
+            // One ring from each worker to this sink
+            for (uint32_t x = 0; success && (x < m_numWorkers); x++)
+            {
+                SpscRing * pRing = new (std::nothrow) SpscRing;
+                mp_workers[x]->pOutRings[m_numSinks] = pRing;
+                success = (pRing != NULL) && pRing->init (ringCapacity);
+            }
+
+            mp_sinks[m_numSinks] = pSink;
+            m_numSinks++;
+            if (success)
+            {
+                sinkIndex = pSink->index;
+            }
+        }
+    }
+
+    return sinkIndex;
+}
+
+bool IngestPipeline::enableDedup (uint32_t memoryBytes, uint32_t windowSeconds)
+{
+    if (memoryBytes == 0)
+    {
+        memoryBytes = DEDUP_DEFAULT_MEMORY_BYTES;
+    }
+    if (windowSeconds == 0)
+    {
+        windowSeconds = DEDUP_DEFAULT_WINDOW_SECONDS;
+    }
+
+    if (!m_dedupEnabled && (m_numWorkers > 0))
+    {
+        m_dedupEnabled = m_dedup.init (m_numWorkers, memoryBytes, windowSeconds);
+    }
+
+    return m_dedupEnabled;
+}
+
+bool IngestPipeline::enableDebugTemplates (uint32_t maxTemplates)
+{
+    if (!m_debugTemplatesEnabled)
+    {
+        m_debugTemplatesEnabled = m_debugTemplates.init (maxTemplates);
+    }
+
+    return m_debugTemplatesEnabled;
+}
+
+DebugTemplateTable * IngestPipeline::getDebugTemplates (void)
+{
+    return m_debugTemplatesEnabled ? &m_debugTemplates : NULL;
+}
+
+bool IngestPipeline::start (void)
+{
+    bool success = true;
+
+    m_stopWorkers = false;
+    m_stopSinks = false;
+
+    // Start from the back so that everything is ready to receive
+    for (uint32_t x = 0; success && (x < m_numSinks); x++)
+    {
+        success = (pthread_create (&(mp_sinks[x]->thread), NULL, sinkThread, mp_sinks[x]) == 0);
+        mp_sinks[x]->threadRunning = success;
+    }
+    for (uint32_t x = 0; success && (x < m_numWorkers); x++)
+    {
+        success = (pthread_create (&(mp_workers[x]->thread), NULL, workerThread, mp_workers[x]) == 0);
+        mp_workers[x]->threadRunning = success;
+    }
+    if (success)
+    {
+        success = m_ingestServer.start ();
+    }
+
+    if (!success)
+    {
+        stop ();
+    }
+
+    return success;
+}
+
+void IngestPipeline::stop (void)
+{
+    // Stop from the front, letting each stage drain before the next
+    m_ingestServer.stop ();
+
+    m_stopWorkers = true;
+    for (uint32_t x = 0; x < m_numWorkers; x++)
+    {
+        if (mp_workers[x]->threadRunning)
+        {
+            pthread_join (mp_workers[x]->thread, NULL);
+            mp_workers[x]->threadRunning = false;
+        }
+    }
+
+    m_stopSinks = true;
+    for (uint32_t x = 0; x < m_numSinks; x++)
+    {
+        if (mp_sinks[x]->threadRunning)
+        {
+            pthread_join (mp_sinks[x]->thread, NULL);
+            mp_sinks[x]->threadRunning = false;
+        }
+    }
+}
+
+bool IngestPipeline::isBackpressured (void)
+{
+    bool backpressured = false;
+
+    for (uint32_t x = 0; !backpressured && (x < m_numWorkers); x++)
+    {
+        backpressured = mp_workers[x]->backpressure.load (std::memory_order_relaxed);
+    }
+
+    return backpressured;
+}
+
+void IngestPipeline::getReceiveStats (PipelineStageStats_t * pStats)
+{
+    memset (pStats, 0, sizeof (*pStats));
+    for (uint32_t x = 0; (mp_receiveStats != NULL) && (x < m_ingestServer.getNumThreads ()); x++)
+    {
+        addStats (pStats, &(mp_receiveStats[x]));
+    }
+}
+
+void IngestPipeline::getDecodeStats (PipelineStageStats_t * pStats)
+{
+    memset (pStats, 0, sizeof (*pStats));
+    for (uint32_t x = 0; x < m_numWorkers; x++)
+    {
+        addStats (pStats, &(mp_workers[x]->stats));
+    }
+}
+
+void IngestPipeline::getSinkStats (uint32_t sinkIndex, PipelineStageStats_t * pStats)
+{
+    memset (pStats, 0, sizeof (*pStats));
+    if (sinkIndex < m_numSinks)
+    {
+        *pStats = mp_sinks[sinkIndex]->stats;
+    }
+}
+
+void IngestPipeline::getDedupStats (uint64_t * pNumChecked, uint64_t * pNumDuplicates)
+{
+    if (pNumChecked != NULL)
+    {
+        *pNumChecked = 0;
+    }
+    if (pNumDuplicates != NULL)
+    {
+        *pNumDuplicates = 0;
+    }
+    if (m_dedupEnabled)
+    {
+        m_dedup.getStats (pNumChecked, pNumDuplicates, NULL);
+    }
+}
+
+#ifdef MESSAGE_CODEC_METRICS
+void IngestPipeline::getCodecMetrics (MessageCodec::Metrics_t * pMetrics)
+{
+    MessageCodec::Metrics_t workerMetrics;
+
+    memset (pMetrics, 0, sizeof (*pMetrics));
+    for (uint32_t x = 0; x < m_numWorkers; x++)
+    {
+        mp_workers[x]->codec.getMetrics (&workerMetrics);
+        MessageCodec::mergeMetrics (pMetrics, &workerMetrics);
+    }
+}
+#endif
+
+void IngestPipeline::printStats (void)
+{
+    PipelineStageStats_t stats;
+
+    getReceiveStats (&stats);
+    printStageStats ("receive", &stats);
+    getDecodeStats (&stats);
+    printStageStats ("decode", &stats);
+    for (uint32_t x = 0; x < m_numSinks; x++)
+    {
+        getSinkStats (x, &stats);
+        printStageStats (mp_sinks[x]->name, &stats);
+    }
+    if (m_dedupEnabled)
+    {
+        uint64_t numChecked;
+        uint64_t numDuplicates;
+        uint64_t numFalsePositives;
+
+        m_dedup.getStats (&numChecked, &numDuplicates, &numFalsePositives);
+        printf ("IngestPipeline: dedup checked %llu datagram(s), dropped %llu duplicate(s),"
+                " %llu Bloom false positive(s).\n",
+                (unsigned long long) numChecked, (unsigned long long) numDuplicates,
+                (unsigned long long) numFalsePositives);
+    }
+    if (m_debugTemplatesEnabled)
+    {
+        uint32_t numTemplates;
+        uint64_t numNotInterned;
+
+        m_debugTemplates.getStats (&numTemplates, &numNotInterned);
+        printf ("IngestPipeline: %u DebugInd template(s), %llu string(s) not interned.\n",
+                numTemplates, (unsigned long long) numNotInterned);
+    }
+    printf ("IngestPipeline: %u datagram block(s) and %u record(s) free.\n",
+            m_datagramPool.getNumFree (), m_recordPool.getNumFree ());
+}
+
+IngestServer * IngestPipeline::getIngestServer (void)
+{
+    return &m_ingestServer;
+}
+
+void IngestPipeline::recordToSensorReadings (const PipelineRecord_t * pRecord,
+                                             SensorReadings_t * pReadings)
+{
+    const PipelineReadings_t * pIn = &(pRecord->u.readings);
+
+    memset (pReadings, 0, sizeof (*pReadings));
+    pReadings->time = pIn->time;
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_GPS_POSITION)
+    {
+        pReadings->gpsPositionPresent = true;
+        pReadings->gpsPosition.latitude = pIn->gpsLatitude;
+        pReadings->gpsPosition.longitude = pIn->gpsLongitude;
+        pReadings->gpsPosition.elevation = pIn->gpsElevation;
+        pReadings->gpsPosition.speed = pIn->gpsSpeed;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_LCL_POSITION)
+    {
+        pReadings->lclPositionPresent = true;
+        pReadings->lclPosition.orientation = (Orientation_t) pIn->orientation;
+        pReadings->lclPosition.hugsThisPeriod = pIn->hugsThisPeriod;
+        pReadings->lclPosition.slapsThisPeriod = pIn->slapsThisPeriod;
+        pReadings->lclPosition.dropsThisPeriod = pIn->dropsThisPeriod;
+        pReadings->lclPosition.nudgesThisPeriod = pIn->nudgesThisPeriod;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_SOUND_LEVEL)
+    {
+        pReadings->soundLevelPresent = true;
+        pReadings->soundLevel = pIn->soundLevel;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_LUMINOSITY)
+    {
+        pReadings->luminosityPresent = true;
+        pReadings->luminosity = pIn->luminosity;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_TEMPERATURE)
+    {
+        pReadings->temperaturePresent = true;
+        pReadings->temperature = pIn->temperature;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_RSSI)
+    {
+        pReadings->rssiPresent = true;
+        pReadings->rssi = pIn->rssi;
+    }
+    if (pRecord->presentBitmap & PIPELINE_PRESENT_POWER_STATE)
+    {
+        pReadings->powerStatePresent = true;
+        pReadings->powerState.chargeState = (ChargeState_t) pIn->chargeState;
+        pReadings->powerState.batteryMV = pIn->batteryMV;
+        pReadings->powerState.energyUWH = pIn->energyUWH;
+    }
+}
+
+// End Of File
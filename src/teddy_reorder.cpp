@@ -0,0 +1,328 @@
+/* Teddy per-device reorder buffer
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_reorder.cpp
+ * This file implements the per-device reorder stage.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for calloc(), posix_memalign() and free()
+#include <string.h> // for memset()
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_reorder.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t ReorderBuffer::getSlot (Shard_t * pShard, DeviceId_t deviceId)
+{
+    int64_t slot = -1;
+    Entry_t * pHeap;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (pShard->numEntries < pShard->maxEntries)
+    {
+        pHeap = (Entry_t *) calloc (m_depth, sizeof (Entry_t));
+        if (pHeap != NULL)
+        {
+            pShard->pDeviceIds[x] = deviceId;
+            memset (&(pShard->pDevices[x]), 0, sizeof (pShard->pDevices[x]));
+            pShard->pDevices[x].pHeap = pHeap;
+            pShard->numEntries++;
+            slot = x;
+        }
+    }
+
+    return slot;
+}
+
+void ReorderBuffer::releaseTop (DeviceId_t deviceId, Device_t * pDevice)
+{
+    Entry_t * pHeap = pDevice->pHeap;
+    Entry_t top = pHeap[0];
+    Entry_t moving;
+    uint32_t x = 0;
+    uint32_t child;
+
+    // Move the last entry to the top and sift it down
+    pDevice->numHeld--;
+    if (pDevice->numHeld > 0)
+    {
+        moving = pHeap[pDevice->numHeld];
+        for (child = 1; child < pDevice->numHeld; child = (x * 2) + 1)
+        {
+            if ((child + 1 < pDevice->numHeld) &&
+                (pHeap[child + 1].readings.time < pHeap[child].readings.time))
+            {
+                child++;
+            }
+            if (pHeap[child].readings.time >= moving.readings.time)
+            {
+                break;
+            }
+            pHeap[x] = pHeap[child];
+            x = child;
+        }
+        pHeap[x] = moving;
+    }
+
+    pDevice->releasedTime = top.readings.time;
+    pDevice->released = true;
+    m_callback (mp_callbackContext, deviceId, &(top.readings), top.presentBitmap);
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+ReorderBuffer::ReorderBuffer (void)
+{
+    m_depth = 0;
+    m_delaySeconds = 0;
+    m_callback = NULL;
+    mp_callbackContext = NULL;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+ReorderBuffer::~ReorderBuffer (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        Shard_t * pShard = &(mp_shards[x]);
+
+        if (pShard->pDevices != NULL)
+        {
+            for (uint32_t y = 0; y < pShard->capacity; y++)
+            {
+                free (pShard->pDevices[y].pHeap);
+            }
+        }
+        free (pShard->pDeviceIds);
+        free (pShard->pDevices);
+    }
+    free (mp_shards);
+}
+
+bool ReorderBuffer::init (uint32_t numShards, uint32_t maxDevices, uint32_t depth,
+                          uint32_t delaySeconds, ReorderCallback_t callback,
+                          void * pContext)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if (depth == 0)
+    {
+        depth = REORDER_DEFAULT_DEPTH;
+    }
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= REORDER_MAX_SHARDS) &&
+        (maxDevices > 0) && (depth <= REORDER_MAX_DEPTH) && (callback != NULL) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        m_depth = depth;
+        m_delaySeconds = delaySeconds;
+        m_callback = callback;
+        mp_callbackContext = pContext;
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+            pShard->pDevices = (Device_t *) calloc (capacity, sizeof (Device_t));
+            if ((pShard->pDeviceIds == NULL) || (pShard->pDevices == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t ReorderBuffer::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool ReorderBuffer::add (uint32_t shardIndex, DeviceId_t deviceId,
+                         const PipelineReadings_t * pReadings, uint8_t presentBitmap)
+{
+    bool taken = false;
+    Shard_t * pShard = NULL;
+    Device_t * pDevice;
+    Entry_t * pHeap;
+    uint32_t time = pReadings->time;
+    uint32_t x;
+    uint32_t parent;
+    int64_t slot = -1;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = getSlot (pShard, deviceId);
+    }
+
+    if (slot >= 0)
+    {
+        pDevice = &(pShard->pDevices[slot]);
+        pHeap = pDevice->pHeap;
+        if (pDevice->released && (time < pDevice->releasedTime))
+        {
+            // Too late to be put in order
+            pShard->numLate++;
+        }
+        else
+        {
+            pShard->numAdded++;
+            pDevice->lastAddTimeUs = serverTimeUs ();
+            if ((pDevice->numHeld >= m_depth) && (time <= pHeap[0].readings.time))
+            {
+                // Full, and this is the earliest anyway: straight out
+                pShard->numForced++;
+                pDevice->releasedTime = time;
+                pDevice->released = true;
+                m_callback (mp_callbackContext, deviceId, pReadings, presentBitmap);
+            }
+            else
+            {
+                if (pDevice->numHeld >= m_depth)
+                {
+                    // Full: make room by releasing the earliest early
+                    pShard->numForced++;
+                    releaseTop (deviceId, pDevice);
+                }
+                // Sift up from the bottom
+                x = pDevice->numHeld;
+                while (x > 0)
+                {
+                    parent = (x - 1) / 2;
+                    if (pHeap[parent].readings.time <= time)
+                    {
+                        break;
+                    }
+                    pHeap[x] = pHeap[parent];
+                    x = parent;
+                }
+                pHeap[x].readings = *pReadings;
+                pHeap[x].presentBitmap = presentBitmap;
+                pDevice->numHeld++;
+            }
+
+            // Release whatever is now at or below the watermark
+            if (time > pDevice->latestTime)
+            {
+                pDevice->latestTime = time;
+            }
+            while ((pDevice->numHeld > 0) &&
+                   ((uint64_t) pHeap[0].readings.time + m_delaySeconds <= pDevice->latestTime))
+            {
+                releaseTop (deviceId, pDevice);
+            }
+            taken = true;
+        }
+    }
+
+    return taken;
+}
+
+bool ReorderBuffer::addRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord)
+{
+    bool taken = false;
+
+    if ((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+        (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG))
+    {
+        taken = add (shardIndex, pRecord->deviceId, &(pRecord->u.readings), pRecord->presentBitmap);
+    }
+
+    return taken;
+}
+
+uint32_t ReorderBuffer::releaseIdle (uint32_t shardIndex, uint64_t nowUs, uint64_t idleUs)
+{
+    uint32_t numReleased = 0;
+    Shard_t * pShard;
+    Device_t * pDevice;
+
+    if (shardIndex < m_numShards)
+    {
+        pShard = &(mp_shards[shardIndex]);
+        for (uint32_t x = 0; x < pShard->capacity; x++)
+        {
+            pDevice = &(pShard->pDevices[x]);
+            if ((pShard->pDeviceIds[x] != DEVICE_ID_INVALID) && (pDevice->numHeld > 0) &&
+                ((idleUs == 0) || (nowUs - pDevice->lastAddTimeUs >= idleUs)))
+            {
+                while (pDevice->numHeld > 0)
+                {
+                    releaseTop (pShard->pDeviceIds[x], pDevice);
+                    numReleased++;
+                }
+            }
+        }
+    }
+
+    return numReleased;
+}
+
+void ReorderBuffer::getStats (uint64_t * pNumAdded, uint64_t * pNumLate, uint64_t * pNumForced)
+{
+    uint64_t numAdded = 0;
+    uint64_t numLate = 0;
+    uint64_t numForced = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numAdded += mp_shards[x].numAdded;
+        numLate += mp_shards[x].numLate;
+        numForced += mp_shards[x].numForced;
+    }
+
+    if (pNumAdded != NULL)
+    {
+        *pNumAdded = numAdded;
+    }
+    if (pNumLate != NULL)
+    {
+        *pNumLate = numLate;
+    }
+    if (pNumForced != NULL)
+    {
+        *pNumForced = numForced;
+    }
+}
+
+// End Of File
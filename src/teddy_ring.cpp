@@ -0,0 +1,314 @@
+/* Teddy server-side lock-free rings
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_ring.cpp
+ * This file implements the bounded lock-free rings and the block
+ * pool built on them.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for malloc(), posix_memalign() and free()
+#include <string.h> // for memset()
+#include <new>      // for placement new
+#include <atomic>
+#include <teddy_server.hpp>
+#include <teddy_ring.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Round a value up to a power of two, minimum 2.
+static uint32_t roundUpToPowerOfTwo (uint32_t value)
+{
+    uint32_t x = 2;
+
+    while ((x < value) && (x < 0x80000000))
+    {
+        x <<= 1;
+    }
+
+    return x;
+}
+
+// ----------------------------------------------------------------
+// SPSC RING
+// ----------------------------------------------------------------
+
+SpscRing::SpscRing (void)
+{
+    mp_slots = NULL;
+    m_mask = 0;
+    m_head.store (0, std::memory_order_relaxed);
+    m_cachedTail = 0;
+    m_tail.store (0, std::memory_order_relaxed);
+    m_cachedHead = 0;
+}
+
+SpscRing::~SpscRing (void)
+{
+    ::free (mp_slots);
+}
+
+bool SpscRing::init (uint32_t capacity)
+{
+    capacity = roundUpToPowerOfTwo (capacity);
+    ::free (mp_slots);
+    mp_slots = (void **) calloc (capacity, sizeof (void *));
+    m_mask = capacity - 1;
+
+    return mp_slots != NULL;
+}
+
+bool SpscRing::push (void * pItem)
+{
+    bool success = false;
+    uint32_t tail = m_tail.load (std::memory_order_relaxed);
+
+    if (tail - m_cachedHead > m_mask)
+    {
+        // Looks full, go and find out where the consumer really is
+        m_cachedHead = m_head.load (std::memory_order_acquire);
+    }
+
+    if (tail - m_cachedHead <= m_mask)
+    {
+        mp_slots[tail & m_mask] = pItem;
+        m_tail.store (tail + 1, std::memory_order_release);
+        success = true;
+    }
+
+    return success;
+}
+
+void * SpscRing::pop (void)
+{
+    void * pItem = NULL;
+    uint32_t head = m_head.load (std::memory_order_relaxed);
+
+    if (head == m_cachedTail)
+    {
+        // Looks empty, go and find out where the producer really is
+        m_cachedTail = m_tail.load (std::memory_order_acquire);
+    }
+
+    if (head != m_cachedTail)
+    {
+        pItem = mp_slots[head & m_mask];
+        m_head.store (head + 1, std::memory_order_release);
+    }
+
+    return pItem;
+}
+
+uint32_t SpscRing::getDepth (void)
+{
+    return m_tail.load (std::memory_order_acquire) - m_head.load (std::memory_order_acquire);
+}
+
+uint32_t SpscRing::getCapacity (void)
+{
+    return m_mask + 1;
+}
+
+// ----------------------------------------------------------------
+// MPMC RING
+// ----------------------------------------------------------------
+
+MpmcRing::MpmcRing (void)
+{
+    mp_slots = NULL;
+    m_mask = 0;
+    m_enqueuePos.store (0, std::memory_order_relaxed);
+    m_dequeuePos.store (0, std::memory_order_relaxed);
+}
+
+MpmcRing::~MpmcRing (void)
+{
+    ::free (mp_slots);
+}
+
+bool MpmcRing::init (uint32_t capacity)
+{
+    capacity = roundUpToPowerOfTwo (capacity);
+    ::free (mp_slots);
+    mp_slots = (Slot_t *) malloc (capacity * sizeof (Slot_t));
+    if (mp_slots != NULL)
+    {
+        for (uint32_t x = 0; x < capacity; x++)
+        {
+            new (&(mp_slots[x].sequence)) std::atomic<uint64_t> (x);
+            mp_slots[x].pItem = NULL;
+        }
+        m_mask = capacity - 1;
+        m_enqueuePos.store (0, std::memory_order_relaxed);
+        m_dequeuePos.store (0, std::memory_order_relaxed);
+    }
+
+    return mp_slots != NULL;
+}
+
+bool MpmcRing::push (void * pItem)
+{
+    bool success = false;
+    bool done = false;
+    Slot_t * pSlot;
+    uint64_t pos = m_enqueuePos.load (std::memory_order_relaxed);
+
+    while (!done)
+    {
+        uint64_t sequence;
+        int64_t difference;
+
+        pSlot = &(mp_slots[pos & m_mask]);
+        sequence = pSlot->sequence.load (std::memory_order_acquire);
+        difference = (int64_t) sequence - (int64_t) pos;
+        if (difference == 0)
+        {
+            // The slot is free, try to claim it
+            if (m_enqueuePos.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+            {
+                pSlot->pItem = pItem;
+                pSlot->sequence.store (pos + 1, std::memory_order_release);
+                success = true;
+                done = true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The consumer hasn't got this far round yet: full
+            done = true;
+        }
+        else
+        {
+            // Another producer got here first
+            pos = m_enqueuePos.load (std::memory_order_relaxed);
+        }
+    }
+
+    return success;
+}
+
+void * MpmcRing::pop (void)
+{
+    void * pItem = NULL;
+    bool done = false;
+    Slot_t * pSlot;
+    uint64_t pos = m_dequeuePos.load (std::memory_order_relaxed);
+
+    while (!done)
+    {
+        uint64_t sequence;
+        int64_t difference;
+
+        pSlot = &(mp_slots[pos & m_mask]);
+        sequence = pSlot->sequence.load (std::memory_order_acquire);
+        difference = (int64_t) sequence - (int64_t) (pos + 1);
+        if (difference == 0)
+        {
+            // The slot is filled, try to claim it
+            if (m_dequeuePos.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+            {
+                pItem = pSlot->pItem;
+                pSlot->sequence.store (pos + m_mask + 1, std::memory_order_release);
+                done = true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // No producer has filled this slot yet: empty
+            done = true;
+        }
+        else
+        {
+            // Another consumer got here first
+            pos = m_dequeuePos.load (std::memory_order_relaxed);
+        }
+    }
+
+    return pItem;
+}
+
+uint32_t MpmcRing::getDepth (void)
+{
+    uint64_t enqueuePos = m_enqueuePos.load (std::memory_order_acquire);
+    uint64_t dequeuePos = m_dequeuePos.load (std::memory_order_acquire);
+    uint32_t depth = 0;
+
+    if (enqueuePos > dequeuePos)
+    {
+        depth = (uint32_t) (enqueuePos - dequeuePos);
+    }
+
+    return depth;
+}
+
+uint32_t MpmcRing::getCapacity (void)
+{
+    return (uint32_t) m_mask + 1;
+}
+
+// ----------------------------------------------------------------
+// BLOCK POOL
+// ----------------------------------------------------------------
+
+BlockPool::BlockPool (void)
+{
+    mp_memory = NULL;
+}
+
+BlockPool::~BlockPool (void)
+{
+    ::free (mp_memory);
+}
+
+bool BlockPool::init (uint32_t blockSize, uint32_t numBlocks)
+{
+    bool success = false;
+    void * pMemory = NULL;
+
+    blockSize = (blockSize + SERVER_CACHE_LINE_SIZE - 1) & ~(SERVER_CACHE_LINE_SIZE - 1);
+    if ((numBlocks > 0) && m_freeList.init (numBlocks) &&
+        (posix_memalign (&pMemory, SERVER_CACHE_LINE_SIZE, (size_t) blockSize * numBlocks) == 0))
+    {
+        ::free (mp_memory);
+        mp_memory = (char *) pMemory;
+        for (uint32_t x = 0; x < numBlocks; x++)
+        {
+            m_freeList.push (mp_memory + ((size_t) x * blockSize));
+        }
+        success = true;
+    }
+
+    return success;
+}
+
+void * BlockPool::alloc (void)
+{
+    return m_freeList.pop ();
+}
+
+void BlockPool::free (void * pBlock)
+{
+    if (pBlock != NULL)
+    {
+        m_freeList.push (pBlock);
+    }
+}
+
+uint32_t BlockPool::getNumFree (void)
+{
+    return m_freeList.getDepth ();
+}
+
+// End Of File
@@ -0,0 +1,715 @@
+/* Teddy sensor readings rollup
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_rollup.cpp
+ * This file implements the rollup engine and the reading of its
+ * output.
+ */
+
+#include <stdint.h>
+#include <stdio.h>  // for snprintf()
+#include <stdlib.h> // for calloc(), realloc(), posix_memalign(), qsort() and free()
+#include <string.h> // for memset(), strcpy() and strlen()
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_sensor_store.hpp>
+#include <teddy_rollup.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of rows written to a rollup file at a time
+#define WRITE_CHUNK_ROWS 256
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The window length of each resolution, in RollupResolution_t order.
+static const uint32_t gResolutionSeconds[MAX_NUM_ROLLUP_RESOLUTIONS] =
+{
+    60,   // ROLLUP_RESOLUTION_MINUTE
+    3600, // ROLLUP_RESOLUTION_HOUR
+    86400 // ROLLUP_RESOLUTION_DAY
+};
+
+/// The directory name of each resolution, in RollupResolution_t order.
+static const char * gResolutionNames[MAX_NUM_ROLLUP_RESOLUTIONS] =
+{
+    "minute", // ROLLUP_RESOLUTION_MINUTE
+    "hour",   // ROLLUP_RESOLUTION_HOUR
+    "day"     // ROLLUP_RESOLUTION_DAY
+};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Set up an empty window.
+static void openWindow (RollupRow_t * pWindow, uint32_t windowStart)
+{
+    memset (pWindow, 0, sizeof (*pWindow));
+    pWindow->windowStart = windowStart;
+    pWindow->batteryMVMin = ROLLUP_NO_BATTERY_MV;
+    pWindow->temperatureMin = INT8_MAX;
+    pWindow->temperatureMax = INT8_MIN;
+}
+
+/// Add a reading to a window.
+static void accumulate (RollupRow_t * pWindow, const PipelineReadings_t * pReadings,
+                        uint8_t presentBitmap)
+{
+    pWindow->numReadings++;
+    pWindow->presenceUnion |= presentBitmap;
+    if (presentBitmap & PIPELINE_PRESENT_TEMPERATURE)
+    {
+        pWindow->temperatureSum += pReadings->temperature;
+        pWindow->numTemperatures++;
+        if (pReadings->temperature < pWindow->temperatureMin)
+        {
+            pWindow->temperatureMin = pReadings->temperature;
+        }
+        if (pReadings->temperature > pWindow->temperatureMax)
+        {
+            pWindow->temperatureMax = pReadings->temperature;
+        }
+    }
+    if ((presentBitmap & PIPELINE_PRESENT_SOUND_LEVEL) &&
+        (pReadings->soundLevel > pWindow->soundLevelMax))
+    {
+        pWindow->soundLevelMax = pReadings->soundLevel;
+    }
+    if (presentBitmap & PIPELINE_PRESENT_LCL_POSITION)
+    {
+        pWindow->hugs += pReadings->hugsThisPeriod;
+        pWindow->slaps += pReadings->slapsThisPeriod;
+        pWindow->drops += pReadings->dropsThisPeriod;
+        pWindow->nudges += pReadings->nudgesThisPeriod;
+    }
+    if (presentBitmap & PIPELINE_PRESENT_POWER_STATE)
+    {
+        if (pReadings->batteryMV < pWindow->batteryMVMin)
+        {
+            pWindow->batteryMVMin = pReadings->batteryMV;
+        }
+        pWindow->energyUWH += pReadings->energyUWH;
+    }
+}
+
+/// Order rows by window.
+static int compareRows (const void * pA, const void * pB)
+{
+    uint32_t a = ((const RollupRow_t *) pA)->windowStart;
+    uint32_t b = ((const RollupRow_t *) pB)->windowStart;
+
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+/// Append rows to a file.
+static bool appendRows (const char * pPath, const RollupRow_t * pRows, uint32_t numRows)
+{
+    bool success = false;
+    uint32_t size = numRows * sizeof (RollupRow_t);
+    uint32_t written = 0;
+    ssize_t result = 0;
+    int fd;
+
+    fd = open (pPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0)
+    {
+        while ((written < size) && (result >= 0))
+        {
+            result = write (fd, ((const uint8_t *) pRows) + written, size - written);
+            if (result > 0)
+            {
+                written += result;
+            }
+            else if ((result < 0) && (errno == EINTR))
+            {
+                result = 0;
+            }
+            else
+            {
+                result = -1;
+            }
+        }
+        close (fd);
+        success = (written == size);
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t rollupResolutionSeconds (RollupResolution_t resolution)
+{
+    uint32_t seconds = 0;
+
+    if ((uint32_t) resolution < MAX_NUM_ROLLUP_RESOLUTIONS)
+    {
+        seconds = gResolutionSeconds[resolution];
+    }
+
+    return seconds;
+}
+
+bool rollupPath (const char * pDirectory, RollupResolution_t resolution,
+                 DeviceId_t deviceId, char * pPath)
+{
+    int length = -1;
+
+    if ((uint32_t) resolution < MAX_NUM_ROLLUP_RESOLUTIONS)
+    {
+        length = snprintf (pPath, SENSOR_STORE_MAX_PATH_LEN, "%s/%s/%02x/%016llx.rol",
+                           pDirectory, gResolutionNames[resolution],
+                           (unsigned int) (deviceIdHash (deviceId) & 0xFF),
+                           (unsigned long long) deviceId);
+    }
+
+    return (length > 0) && (length < SENSOR_STORE_MAX_PATH_LEN);
+}
+
+void rollupMerge (RollupRow_t * pInto, const RollupRow_t * pFrom)
+{
+    pInto->numReadings += pFrom->numReadings;
+    pInto->temperatureSum += pFrom->temperatureSum;
+    pInto->numTemperatures += pFrom->numTemperatures;
+    pInto->energyUWH += pFrom->energyUWH;
+    pInto->hugs += pFrom->hugs;
+    pInto->slaps += pFrom->slaps;
+    pInto->drops += pFrom->drops;
+    pInto->nudges += pFrom->nudges;
+    if (pFrom->soundLevelMax > pInto->soundLevelMax)
+    {
+        pInto->soundLevelMax = pFrom->soundLevelMax;
+    }
+    if (pFrom->batteryMVMin < pInto->batteryMVMin)
+    {
+        pInto->batteryMVMin = pFrom->batteryMVMin;
+    }
+    // An empty minimum/maximum is INT8_MAX/INT8_MIN so this works
+    // whichever side has temperatures
+    if (pFrom->temperatureMin < pInto->temperatureMin)
+    {
+        pInto->temperatureMin = pFrom->temperatureMin;
+    }
+    if (pFrom->temperatureMax > pInto->temperatureMax)
+    {
+        pInto->temperatureMax = pFrom->temperatureMax;
+    }
+    pInto->presenceUnion |= pFrom->presenceUnion;
+}
+
+uint32_t rollupRead (const char * pDirectory, RollupResolution_t resolution,
+                     DeviceId_t deviceId, uint32_t startTime, uint32_t endTime,
+                     RollupRow_t ** ppRows)
+{
+    uint32_t numRows = 0;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    RollupRow_t * pRows = NULL;
+    struct stat status;
+    uint32_t size;
+    uint32_t got = 0;
+    uint32_t numKept = 0;
+    ssize_t result = 0;
+    int fd;
+
+    if (rollupPath (pDirectory, resolution, deviceId, path))
+    {
+        fd = open (path, O_RDONLY);
+        if (fd >= 0)
+        {
+            if ((fstat (fd, &status) == 0) && (status.st_size >= (off_t) sizeof (RollupRow_t)))
+            {
+                // A torn final row is ignored
+                size = (uint32_t) (status.st_size / sizeof (RollupRow_t)) * sizeof (RollupRow_t);
+                pRows = (RollupRow_t *) malloc (size);
+                while ((pRows != NULL) && (got < size) && (result >= 0))
+                {
+                    result = read (fd, ((uint8_t *) pRows) + got, size - got);
+                    if (result > 0)
+                    {
+                        got += result;
+                    }
+                    else if ((result < 0) && (errno == EINTR))
+                    {
+                        result = 0;
+                    }
+                    else
+                    {
+                        result = -1;
+                    }
+                }
+                got /= sizeof (RollupRow_t);
+            }
+            close (fd);
+        }
+    }
+
+    // Rows are nearly always in window order already but one that
+    // reopened after an early close may not be
+    for (uint32_t x = 0; x < got; x++)
+    {
+        if ((pRows[x].windowStart >= startTime) && (pRows[x].windowStart < endTime))
+        {
+            pRows[numKept] = pRows[x];
+            numKept++;
+        }
+    }
+    if (numKept > 1)
+    {
+        qsort (pRows, numKept, sizeof (RollupRow_t), compareRows);
+    }
+    for (uint32_t x = 0; x < numKept; x++)
+    {
+        if ((numRows > 0) && (pRows[numRows - 1].windowStart == pRows[x].windowStart))
+        {
+            rollupMerge (&(pRows[numRows - 1]), &(pRows[x]));
+        }
+        else
+        {
+            pRows[numRows] = pRows[x];
+            numRows++;
+        }
+    }
+
+    if (numRows == 0)
+    {
+        free (pRows);
+        pRows = NULL;
+    }
+    *ppRows = pRows;
+
+    return numRows;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+/// Order pending windows by device, then resolution, then the order
+// in which they closed, which is window order.
+int RollupEngine::comparePending (const void * pA, const void * pB)
+{
+    const Pending_t * pPendingA = (const Pending_t *) pA;
+    const Pending_t * pPendingB = (const Pending_t *) pB;
+    int result = 0;
+
+    if (pPendingA->deviceId != pPendingB->deviceId)
+    {
+        result = (pPendingA->deviceId < pPendingB->deviceId) ? -1 : 1;
+    }
+    else if (pPendingA->resolution != pPendingB->resolution)
+    {
+        result = (pPendingA->resolution < pPendingB->resolution) ? -1 : 1;
+    }
+    else if (pPendingA->sequence != pPendingB->sequence)
+    {
+        result = (pPendingA->sequence < pPendingB->sequence) ? -1 : 1;
+    }
+
+    return result;
+}
+
+int64_t RollupEngine::getSlot (Shard_t * pShard, DeviceId_t deviceId)
+{
+    int64_t slot = -1;
+    RollupRow_t * pWindows;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (pShard->numEntries < pShard->maxEntries)
+    {
+        // A window with no readings is empty
+        pWindows = (RollupRow_t *) calloc (m_windowsPerDevice, sizeof (RollupRow_t));
+        if (pWindows != NULL)
+        {
+            pShard->pDeviceIds[x] = deviceId;
+            pShard->pWatermarks[x] = 0;
+            pShard->ppWindows[x] = pWindows;
+            pShard->numEntries++;
+            slot = x;
+        }
+    }
+
+    return slot;
+}
+
+bool RollupEngine::closeWindow (Shard_t * pShard, DeviceId_t deviceId, uint32_t resolution,
+                                RollupRow_t * pWindow)
+{
+    bool success = true;
+    Pending_t * pPending;
+    uint32_t maxPending;
+
+    if (pShard->numPending >= pShard->maxPending)
+    {
+        maxPending = (pShard->maxPending == 0) ? 1024 : pShard->maxPending * 2;
+        pPending = (Pending_t *) realloc (pShard->pPending, maxPending * sizeof (Pending_t));
+        if (pPending != NULL)
+        {
+            pShard->pPending = pPending;
+            pShard->maxPending = maxPending;
+        }
+    }
+
+    if (pShard->numPending < pShard->maxPending)
+    {
+        pPending = &(pShard->pPending[pShard->numPending]);
+        pPending->deviceId = deviceId;
+        pPending->resolution = resolution;
+        pPending->sequence = pShard->numPending;
+        pPending->row = *pWindow;
+        pShard->numPending++;
+    }
+    else
+    {
+        success = false;
+    }
+    pWindow->numReadings = 0;
+
+    return success;
+}
+
+bool RollupEngine::writePending (Shard_t * pShard)
+{
+    bool success = true;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    RollupRow_t rows[WRITE_CHUNK_ROWS];
+    const Pending_t * pPending;
+    uint32_t numRows = 0;
+
+    // Group the windows by file, keeping them in order within a file,
+    // so that each file is appended to once
+    if (pShard->numPending > 1)
+    {
+        qsort (pShard->pPending, pShard->numPending, sizeof (Pending_t), comparePending);
+    }
+    for (uint32_t x = 0; x < pShard->numPending; x++)
+    {
+        pPending = &(pShard->pPending[x]);
+        rows[numRows] = pPending->row;
+        numRows++;
+        if ((numRows == WRITE_CHUNK_ROWS) || (x + 1 == pShard->numPending) ||
+            (pPending[1].deviceId != pPending->deviceId) ||
+            (pPending[1].resolution != pPending->resolution))
+        {
+            if (rollupPath (m_directory, (RollupResolution_t) pPending->resolution,
+                            pPending->deviceId, path) &&
+                appendRows (path, rows, numRows))
+            {
+                pShard->numRowsWritten += numRows;
+            }
+            else
+            {
+                success = false;
+            }
+            numRows = 0;
+        }
+    }
+    pShard->numPending = 0;
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+RollupEngine::RollupEngine (void)
+{
+    m_directory[0] = 0;
+    m_latenessSeconds = 0;
+    m_windowsPerDevice = 0;
+    for (uint32_t x = 0; x < MAX_NUM_ROLLUP_RESOLUTIONS; x++)
+    {
+        m_numWindows[x] = 0;
+        m_firstWindow[x] = 0;
+    }
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+RollupEngine::~RollupEngine (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        Shard_t * pShard = &(mp_shards[x]);
+
+        if (pShard->ppWindows != NULL)
+        {
+            for (uint32_t y = 0; y < pShard->capacity; y++)
+            {
+                free (pShard->ppWindows[y]);
+            }
+        }
+        free (pShard->pDeviceIds);
+        free (pShard->pWatermarks);
+        free (pShard->ppWindows);
+        free (pShard->pPending);
+    }
+    free (mp_shards);
+}
+
+bool RollupEngine::init (const char * pDirectory, uint32_t numShards,
+                         uint32_t maxDevices, uint32_t latenessSeconds)
+{
+    bool success = false;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if ((mp_shards == NULL) && (pDirectory != NULL) && (strlen (pDirectory) < sizeof (m_directory) - 48) &&
+        (numShards > 0) && (numShards <= ROLLUP_MAX_SHARDS) && (maxDevices > 0) &&
+        (latenessSeconds <= ROLLUP_MAX_LATENESS_SECONDS) &&
+        ((mkdir (pDirectory, 0755) == 0) || (errno == EEXIST)))
+    {
+        success = true;
+        for (uint32_t x = 0; (x < MAX_NUM_ROLLUP_RESOLUTIONS) && success; x++)
+        {
+            snprintf (path, sizeof (path), "%s/%s", pDirectory, gResolutionNames[x]);
+            success = (mkdir (path, 0755) == 0) || (errno == EEXIST);
+            for (uint32_t y = 0; (y < 256) && success; y++)
+            {
+                snprintf (path, sizeof (path), "%s/%s/%02x", pDirectory, gResolutionNames[x], y);
+                success = (mkdir (path, 0755) == 0) || (errno == EEXIST);
+            }
+        }
+
+        if (success)
+        {
+            success = false;
+            if (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0)
+            {
+                strcpy (m_directory, pDirectory);
+                m_latenessSeconds = latenessSeconds;
+                // The windows that can be open at once are those from
+                // the one holding the watermark back by the lateness,
+                // so a ring of this many never has to close a window
+                // early
+                m_windowsPerDevice = 0;
+                for (uint32_t x = 0; x < MAX_NUM_ROLLUP_RESOLUTIONS; x++)
+                {
+                    m_numWindows[x] = latenessSeconds / gResolutionSeconds[x] + 2;
+                    m_firstWindow[x] = m_windowsPerDevice;
+                    m_windowsPerDevice += m_numWindows[x];
+                }
+                mp_shards = (Shard_t *) pMem;
+                memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+                capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+                success = true;
+                for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+                {
+                    Shard_t * pShard = &(mp_shards[m_numShards]);
+
+                    pShard->capacity = capacity;
+                    pShard->maxEntries = maxEntries;
+                    pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+                    pShard->pWatermarks = (uint32_t *) calloc (capacity, sizeof (uint32_t));
+                    pShard->ppWindows = (RollupRow_t **) calloc (capacity, sizeof (RollupRow_t *));
+                    if ((pShard->pDeviceIds == NULL) || (pShard->pWatermarks == NULL) ||
+                        (pShard->ppWindows == NULL))
+                    {
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t RollupEngine::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool RollupEngine::add (uint32_t shardIndex, DeviceId_t deviceId,
+                        const PipelineReadings_t * pReadings, uint8_t presentBitmap)
+{
+    bool counted = false;
+    Shard_t * pShard;
+    RollupRow_t * pWindows;
+    RollupRow_t * pWindow;
+    uint32_t time = pReadings->time;
+    uint32_t watermark;
+    bool advanced = false;
+    uint32_t length;
+    uint32_t windowStart;
+    int64_t slot = -1;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = getSlot (pShard, deviceId);
+    }
+
+    if (slot >= 0)
+    {
+        watermark = pShard->pWatermarks[slot];
+        if (time > watermark)
+        {
+            watermark = time;
+            pShard->pWatermarks[slot] = watermark;
+            advanced = true;
+        }
+
+        for (uint32_t x = 0; x < MAX_NUM_ROLLUP_RESOLUTIONS; x++)
+        {
+            length = gResolutionSeconds[x];
+            pWindows = pShard->ppWindows[slot] + m_firstWindow[x];
+
+            // Close whatever the watermark has now passed, by the lateness
+            for (uint32_t y = 0; advanced && (y < m_numWindows[x]); y++)
+            {
+                if ((pWindows[y].numReadings > 0) &&
+                    ((uint64_t) pWindows[y].windowStart + length + m_latenessSeconds <= watermark))
+                {
+                    closeWindow (pShard, deviceId, x, &(pWindows[y]));
+                }
+            }
+
+            windowStart = time - (time % length);
+            if ((uint64_t) windowStart + length + m_latenessSeconds > watermark)
+            {
+                pWindow = &(pWindows[(windowStart / length) % m_numWindows[x]]);
+                if ((pWindow->numReadings > 0) && (pWindow->windowStart != windowStart))
+                {
+                    // Can't happen with the ring sized as it is, but
+                    // don't lose anything if it does
+                    closeWindow (pShard, deviceId, x, pWindow);
+                }
+                if (pWindow->numReadings == 0)
+                {
+                    openWindow (pWindow, windowStart);
+                }
+                accumulate (pWindow, pReadings, presentBitmap);
+                counted = true;
+            }
+        }
+
+        pShard->numReadings++;
+        if (!counted)
+        {
+            pShard->numLate++;
+        }
+    }
+
+    return counted;
+}
+
+bool RollupEngine::addRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord)
+{
+    bool counted = false;
+
+    if ((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+        (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG))
+    {
+        counted = add (shardIndex, pRecord->deviceId, &(pRecord->u.readings), pRecord->presentBitmap);
+    }
+
+    return counted;
+}
+
+bool RollupEngine::flush (uint32_t shardIndex, bool closeAll)
+{
+    bool success = false;
+    Shard_t * pShard;
+    RollupRow_t * pWindows;
+
+    if (shardIndex < m_numShards)
+    {
+        pShard = &(mp_shards[shardIndex]);
+        success = true;
+        for (uint32_t x = 0; closeAll && (x < pShard->capacity); x++)
+        {
+            if (pShard->pDeviceIds[x] != DEVICE_ID_INVALID)
+            {
+                for (uint32_t y = 0; y < MAX_NUM_ROLLUP_RESOLUTIONS; y++)
+                {
+                    pWindows = pShard->ppWindows[x] + m_firstWindow[y];
+                    for (uint32_t z = 0; z < m_numWindows[y]; z++)
+                    {
+                        if ((pWindows[z].numReadings > 0) &&
+                            !closeWindow (pShard, pShard->pDeviceIds[x], y, &(pWindows[z])))
+                        {
+                            success = false;
+                        }
+                    }
+                }
+            }
+        }
+        if (!writePending (pShard))
+        {
+            success = false;
+        }
+    }
+
+    return success;
+}
+
+const char * RollupEngine::getDirectory (void)
+{
+    return m_directory;
+}
+
+void RollupEngine::getStats (uint64_t * pNumReadings, uint64_t * pNumLate,
+                             uint64_t * pNumRowsWritten)
+{
+    uint64_t numReadings = 0;
+    uint64_t numLate = 0;
+    uint64_t numRowsWritten = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numReadings += mp_shards[x].numReadings;
+        numLate += mp_shards[x].numLate;
+        numRowsWritten += mp_shards[x].numRowsWritten;
+    }
+
+    if (pNumReadings != NULL)
+    {
+        *pNumReadings = numReadings;
+    }
+    if (pNumLate != NULL)
+    {
+        *pNumLate = numLate;
+    }
+    if (pNumRowsWritten != NULL)
+    {
+        *pNumRowsWritten = numRowsWritten;
+    }
+}
+
+// End Of File
@@ -0,0 +1,504 @@
+/* Teddy downlink request round-trip time tracker
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_rtt_tracker.cpp
+ * This file implements the downlink request round-trip time tracker.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for posix_memalign() and free()
+#include <string.h> // for memset()
+#include <new>      // for placement new
+#include <atomic>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_timer_wheel.hpp>
+#include <teddy_rtt_tracker.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// A time from serverTimeUs() as the millisecond ticks of a shard's
+// TimerWheel.
+static uint32_t toTick (uint64_t nowUs)
+{
+    return (uint32_t) (nowUs / 1000);
+}
+
+/// The upper bound, in microseconds, of an RTT histogram bucket.
+static uint32_t bucketMaxUs (uint32_t bucket)
+{
+    uint64_t maxUs = bucket;
+    uint32_t shift = bucket >> RTT_TRACKER_SUB_BUCKET_BITS;
+
+    if (shift > 0)
+    {
+        shift--;
+        maxUs = ((uint64_t) ((bucket & ((1 << RTT_TRACKER_SUB_BUCKET_BITS) - 1)) +
+                             (1 << RTT_TRACKER_SUB_BUCKET_BITS) + 1) << shift) - 1;
+    }
+
+    return (uint32_t) maxUs;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+void RttTracker::lockShard (Shard_t * pShard)
+{
+    while (pShard->lock.test_and_set (std::memory_order_acquire))
+    {
+        // Spin; only contended if threads share a shard
+    }
+}
+
+void RttTracker::unlockShard (Shard_t * pShard)
+{
+    pShard->lock.clear (std::memory_order_release);
+}
+
+int64_t RttTracker::findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add)
+{
+    int64_t slot = -1;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (add && (pShard->numEntries < pShard->maxEntries))
+    {
+        // Devices are never removed so the other columns of an empty
+        // slot are still zero
+        pShard->pDeviceIds[x] = deviceId;
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+void RttTracker::addRtt (RttStats_t * pStats, uint32_t rttUs)
+{
+    uint32_t bucket = rttUs;
+    uint32_t shift = 0;
+
+    if (rttUs >= (1 << RTT_TRACKER_SUB_BUCKET_BITS))
+    {
+        // Find the shift that leaves the top bit and the sub-bucket bits
+        while ((rttUs >> shift) >= (2 << RTT_TRACKER_SUB_BUCKET_BITS))
+        {
+            shift++;
+        }
+        bucket = (shift << RTT_TRACKER_SUB_BUCKET_BITS) + (rttUs >> shift);
+    }
+
+    pStats->numConfirmed++;
+    pStats->totalUs += rttUs;
+    if (rttUs > pStats->maxUs)
+    {
+        pStats->maxUs = rttUs;
+    }
+    pStats->buckets[bucket]++;
+}
+
+uint32_t RttTracker::timeOutSlot (Shard_t * pShard, uint32_t slot, uint32_t nowUs)
+{
+    uint32_t numTimedOut = 0;
+    uint8_t outstanding = pShard->pOutstanding[slot];
+    uint32_t * pSentTimes = &(pShard->pSentTimes[slot * MAX_NUM_RTT_REQS]);
+    uint32_t ageUs;
+    uint32_t leftUs = m_timeoutUs;
+
+    for (uint32_t x = 0; x < MAX_NUM_RTT_REQS; x++)
+    {
+        if (outstanding & (1 << x))
+        {
+            ageUs = nowUs - pSentTimes[x];
+            if (ageUs >= m_timeoutUs)
+            {
+                outstanding &= ~(1 << x);
+                pShard->stats[x].numTimedOut++;
+                numTimedOut++;
+            }
+            else if (m_timeoutUs - ageUs < leftUs)
+            {
+                leftUs = m_timeoutUs - ageUs;
+            }
+        }
+    }
+    pShard->pOutstanding[slot] = outstanding;
+
+    if (outstanding != 0)
+    {
+        // Round up so as not to fire just before the first of the rest
+        pShard->wheel.arm (slot, toTick (nowUs) + (leftUs + 999) / 1000);
+    }
+
+    return numTimedOut;
+}
+
+void RttTracker::timerCallback (void * pContext, uint32_t timerIndex, uint32_t expiryTick)
+{
+    TimerContext_t * pTimerContext = (TimerContext_t *) pContext;
+
+    (void) expiryTick;
+    pTimerContext->numTimedOut += pTimerContext->pTracker->timeOutSlot (pTimerContext->pShard,
+                                                                        timerIndex,
+                                                                        pTimerContext->nowUs);
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+RttTracker::RttTracker (void)
+{
+    m_timeoutUs = 0;
+    m_numShards = 0;
+    m_memoryUsed = 0;
+    mp_shards = NULL;
+}
+
+RttTracker::~RttTracker (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        ::free (mp_shards[x].pDeviceIds);
+        ::free (mp_shards[x].pOutstanding);
+        ::free (mp_shards[x].pSentTimes);
+        mp_shards[x].~Shard_t ();
+    }
+    ::free (mp_shards);
+}
+
+bool RttTracker::init (uint32_t numShards, uint32_t maxDevices,
+                       uint32_t timeoutMs, uint64_t nowUs)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if ((mp_shards == NULL) && (maxDevices > 0) && (numShards > 0) && (numShards <= RTT_TRACKER_MAX_SHARDS) &&
+        (timeoutMs > 0) && (timeoutMs <= RTT_TRACKER_MAX_TIMEOUT_MS) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        m_timeoutUs = timeoutMs * 1000;
+        mp_shards = (Shard_t *) pMem;
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = new (&(mp_shards[m_numShards])) Shard_t;
+
+            pShard->lock.clear ();
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->numEntries = 0;
+            memset (pShard->stats, 0, sizeof (pShard->stats));
+            pShard->pDeviceIds = (DeviceId_t *) shardAllocColumn (capacity, sizeof (DeviceId_t), &m_memoryUsed);
+            pShard->pOutstanding = (uint8_t *) shardAllocColumn (capacity, sizeof (uint8_t), &m_memoryUsed);
+            pShard->pSentTimes = (uint32_t *) shardAllocColumn (capacity, sizeof (uint32_t) * MAX_NUM_RTT_REQS, &m_memoryUsed);
+            if ((pShard->pDeviceIds != NULL) && (pShard->pOutstanding != NULL) && (pShard->pSentTimes != NULL) &&
+                pShard->wheel.init (capacity, toTick (nowUs)))
+            {
+                m_memoryUsed += pShard->wheel.getMemoryUsed ();
+            }
+            else
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+RttReq_t RttTracker::getReq (MessageCodec::DecodeResult_t result)
+{
+    RttReq_t req = MAX_NUM_RTT_REQS;
+
+    switch (result)
+    {
+        case MessageCodec::DECODE_RESULT_INTERVALS_GET_REQ_DL_MSG:
+        case MessageCodec::DECODE_RESULT_INTERVALS_GET_CNF_UL_MSG:
+            req = RTT_REQ_INTERVALS_GET;
+        break;
+        case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_REQ_DL_MSG:
+        case MessageCodec::DECODE_RESULT_HEARTBEAT_SET_CNF_UL_MSG:
+            req = RTT_REQ_HEARTBEAT_SET;
+        break;
+        case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_REQ_DL_MSG:
+        case MessageCodec::DECODE_RESULT_REPORTING_INTERVAL_SET_CNF_UL_MSG:
+            req = RTT_REQ_REPORTING_INTERVAL_SET;
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_REQ_DL_MSG:
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+            req = RTT_REQ_SENSORS_REPORT_GET;
+        break;
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_REQ_DL_MSG:
+        case MessageCodec::DECODE_RESULT_TRAFFIC_REPORT_GET_CNF_UL_MSG:
+            req = RTT_REQ_TRAFFIC_REPORT_GET;
+        break;
+        default:
+        break;
+    }
+
+    return req;
+}
+
+bool RttTracker::reqSent (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                          uint64_t nowUs)
+{
+    bool success = false;
+    RttReq_t req = getReq (result);
+    Shard_t * pShard;
+    int64_t slot;
+
+    // A Cnf is not a Req
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID) && (req < MAX_NUM_RTT_REQS) &&
+        (result < MessageCodec::DECODE_RESULT_UL_MSG_BASE))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, deviceId, true);
+        if (slot >= 0)
+        {
+            pShard->stats[req].numSent++;
+            if (pShard->pOutstanding[slot] & (1 << req))
+            {
+                // The Cnf that comes back first is most likely to be
+                // for the first Req, so keep timing from that one
+                pShard->stats[req].numOverlapped++;
+            }
+            else
+            {
+                pShard->pOutstanding[slot] |= (1 << req);
+                pShard->pSentTimes[(slot * MAX_NUM_RTT_REQS) + req] = (uint32_t) nowUs;
+                // An armed timer is due no later than this Req
+                if (!pShard->wheel.isArmed ((uint32_t) slot))
+                {
+                    pShard->wheel.arm ((uint32_t) slot, toTick (nowUs) + (m_timeoutUs + 999) / 1000);
+                }
+            }
+            success = true;
+        }
+        else
+        {
+            pShard->stats[req].numNotTracked++;
+        }
+        unlockShard (pShard);
+    }
+
+    return success;
+}
+
+uint32_t RttTracker::dlMsgsSent (DeviceId_t deviceId, const char * pBuffer, uint32_t size,
+                                 MessageCodec * pCodec, uint64_t nowUs)
+{
+    uint32_t numReqs = 0;
+    const char * pEnd = pBuffer + size;
+    MessageCodec::DecodeResult_t result = MessageCodec::DECODE_RESULT_FAILURE;
+    DlMsgUnion_t msg;
+
+    // Decode the messages, stopping at anything that isn't one; they
+    // must be decoded into something, not just peeked at, as a peek
+    // doesn't move past the body of a message
+    while ((pBuffer < pEnd) && (result != MessageCodec::DECODE_RESULT_INPUT_TOO_SHORT) &&
+           (result != MessageCodec::DECODE_RESULT_UNKNOWN_MSG_ID))
+    {
+        result = pCodec->decodeDlMsg (&pBuffer, (uint32_t) (pEnd - pBuffer), &msg);
+        // A Req whose body runs off the end was never sent whole
+        if ((pBuffer <= pEnd) && reqSent (deviceId, result, nowUs))
+        {
+            numReqs++;
+        }
+    }
+
+    return numReqs;
+}
+
+int64_t RttTracker::ulMsgReceived (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                                   uint64_t nowUs)
+{
+    int64_t rttUs = -1;
+    RttReq_t req = getReq (result);
+    Shard_t * pShard;
+    int64_t slot;
+    uint32_t ageUs;
+
+    if ((m_numShards > 0) && (req < MAX_NUM_RTT_REQS) && (result >= MessageCodec::DECODE_RESULT_UL_MSG_BASE))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        lockShard (pShard);
+        slot = findSlot (pShard, deviceId, false);
+        if ((slot >= 0) && (pShard->pOutstanding[slot] & (1 << req)))
+        {
+            pShard->pOutstanding[slot] &= ~(1 << req);
+            ageUs = (uint32_t) nowUs - pShard->pSentTimes[(slot * MAX_NUM_RTT_REQS) + req];
+            if (ageUs < m_timeoutUs)
+            {
+                addRtt (&(pShard->stats[req]), ageUs);
+                rttUs = ageUs;
+            }
+            else
+            {
+                // Too late, whether or not checkTimeouts() has caught it
+                pShard->stats[req].numTimedOut++;
+                pShard->stats[req].numUnmatched++;
+            }
+            if (pShard->pOutstanding[slot] == 0)
+            {
+                pShard->wheel.cancel ((uint32_t) slot);
+            }
+        }
+        else
+        {
+            pShard->stats[req].numUnmatched++;
+        }
+        unlockShard (pShard);
+    }
+
+    return rttUs;
+}
+
+uint32_t RttTracker::checkTimeouts (uint64_t nowUs)
+{
+    TimerContext_t context;
+
+    context.pTracker = this;
+    context.nowUs = (uint32_t) nowUs;
+    context.numTimedOut = 0;
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        context.pShard = &(mp_shards[x]);
+        lockShard (context.pShard);
+        context.pShard->wheel.advance (toTick (nowUs), timerCallback, &context);
+        unlockShard (context.pShard);
+    }
+
+    return context.numTimedOut;
+}
+
+void RttTracker::getStats (RttReq_t req, RttStats_t * pStats)
+{
+    RttStats_t * pShardStats;
+
+    memset (pStats, 0, sizeof (*pStats));
+    for (uint32_t x = 0; (x < m_numShards) && (req < MAX_NUM_RTT_REQS); x++)
+    {
+        lockShard (&(mp_shards[x]));
+        pShardStats = &(mp_shards[x].stats[req]);
+        pStats->numSent += pShardStats->numSent;
+        pStats->numConfirmed += pShardStats->numConfirmed;
+        pStats->numTimedOut += pShardStats->numTimedOut;
+        pStats->numOverlapped += pShardStats->numOverlapped;
+        pStats->numUnmatched += pShardStats->numUnmatched;
+        pStats->numNotTracked += pShardStats->numNotTracked;
+        pStats->totalUs += pShardStats->totalUs;
+        if (pShardStats->maxUs > pStats->maxUs)
+        {
+            pStats->maxUs = pShardStats->maxUs;
+        }
+        for (uint32_t y = 0; y < RTT_TRACKER_NUM_BUCKETS; y++)
+        {
+            pStats->buckets[y] += pShardStats->buckets[y];
+        }
+        unlockShard (&(mp_shards[x]));
+    }
+}
+
+uint32_t RttTracker::getQuantileUs (const RttStats_t * pStats, uint32_t permille)
+{
+    uint32_t rttUs = 0;
+    uint64_t rank;
+    uint64_t count = 0;
+
+    if (pStats->numConfirmed > 0)
+    {
+        // The rank of the quantile, counting from one
+        rank = ((pStats->numConfirmed * permille) + 999) / 1000;
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        for (uint32_t x = 0; x < RTT_TRACKER_NUM_BUCKETS; x++)
+        {
+            count += pStats->buckets[x];
+            if (count >= rank)
+            {
+                rttUs = bucketMaxUs (x);
+                break;
+            }
+        }
+        if (rttUs > pStats->maxUs)
+        {
+            rttUs = pStats->maxUs;
+        }
+    }
+
+    return rttUs;
+}
+
+const char * RttTracker::getReqName (RttReq_t req)
+{
+    const char * pName = "unknown";
+
+    switch (req)
+    {
+        case RTT_REQ_INTERVALS_GET:
+            pName = "IntervalsGet";
+        break;
+        case RTT_REQ_HEARTBEAT_SET:
+            pName = "HeartbeatSet";
+        break;
+        case RTT_REQ_REPORTING_INTERVAL_SET:
+            pName = "ReportingIntervalSet";
+        break;
+        case RTT_REQ_SENSORS_REPORT_GET:
+            pName = "SensorsReportGet";
+        break;
+        case RTT_REQ_TRAFFIC_REPORT_GET:
+            pName = "TrafficReportGet";
+        break;
+        default:
+        break;
+    }
+
+    return pName;
+}
+
+uint32_t RttTracker::getNumDevices (void)
+{
+    uint32_t numDevices = 0;
+
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        lockShard (&(mp_shards[x]));
+        numDevices += mp_shards[x].numEntries;
+        unlockShard (&(mp_shards[x]));
+    }
+
+    return numDevices;
+}
+
+uint64_t RttTracker::getMemoryUsed (void)
+{
+    return m_memoryUsed;
+}
+
+// End Of File
@@ -0,0 +1,524 @@
+/* Teddy sensor readings query
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_sensor_query.cpp
+ * This file implements queries over the readings in a SensorStore.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for malloc(), realloc() and free()
+#include <string.h> // for memset() and memcpy()
+#include <pthread.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <teddy_server.hpp>
+#include <teddy_sensor_store.hpp>
+#include <teddy_sensor_query.hpp>
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A segment to be scanned.
+typedef struct WorkItemTag_t
+{
+    DeviceId_t deviceId;
+    uint32_t segmentNumber;
+} WorkItem_t;
+
+/// What is shared by the threads of a query.
+typedef struct QueryTag_t
+{
+    const char * pDirectory;
+    const SensorQuery_t * pQuery;
+    SensorQueryCallback_t callback;
+    void * pContext;
+    std::atomic<uint32_t> next;        //!< The next device or work item to take.
+    const WorkItem_t * pItems;         //!< The segments to scan.
+    uint32_t numItems;
+} Query_t;
+
+/// A query thread.
+typedef struct QueryThreadTag_t
+{
+    pthread_t thread;
+    Query_t * pQuery;
+    WorkItem_t * pItems;               //!< The segments this thread planned.
+    uint32_t numItems;
+    uint32_t maxItems;
+    uint32_t * pSelection;             //!< Matching rows of the current segment.
+    uint8_t * pColumns[MAX_NUM_SENSOR_COLUMNS]; //!< Where the matching rows are gathered.
+    uint32_t maxRows;                  //!< Rows that the buffers have room for.
+    bool outOfMemory;
+    SensorQueryStats_t stats;
+} QueryThread_t;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Check whether a value meets a predicate.
+static inline bool predicateMet (SensorPredicateOp_t op, int64_t value, int64_t operand)
+{
+    bool met = false;
+
+    switch (op)
+    {
+        case SENSOR_PREDICATE_EQ:
+            met = (value == operand);
+        break;
+        case SENSOR_PREDICATE_NE:
+            met = (value != operand);
+        break;
+        case SENSOR_PREDICATE_LT:
+            met = (value < operand);
+        break;
+        case SENSOR_PREDICATE_LE:
+            met = (value <= operand);
+        break;
+        case SENSOR_PREDICATE_GT:
+            met = (value > operand);
+        break;
+        case SENSOR_PREDICATE_GE:
+            met = (value >= operand);
+        break;
+        case SENSOR_PREDICATE_ALL_BITS_SET:
+            met = ((value & operand) == operand);
+        break;
+        default:
+        break;
+    }
+
+    return met;
+}
+
+/// Check whether any row of an indexed segment could meet all of the
+// predicates of a query.
+static bool zoneMapPasses (const SensorIndexEntry_t * pEntry, const SensorQuery_t * pQuery)
+{
+    bool passes = true;
+    const SensorPredicate_t * pPredicate;
+    int64_t min;
+    int64_t max;
+
+    for (uint32_t x = 0; (x < pQuery->numPredicates) && passes; x++)
+    {
+        pPredicate = &(pQuery->pPredicates[x]);
+        min = pEntry->columnMin[pPredicate->column];
+        max = pEntry->columnMax[pPredicate->column];
+        switch (pPredicate->op)
+        {
+            case SENSOR_PREDICATE_EQ:
+                passes = (min <= pPredicate->value) && (max >= pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_NE:
+                passes = (min != pPredicate->value) || (max != pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_LT:
+                passes = (min < pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_LE:
+                passes = (min <= pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_GT:
+                passes = (max > pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_GE:
+                passes = (max >= pPredicate->value);
+            break;
+            case SENSOR_PREDICATE_ALL_BITS_SET:
+                // Only the presence column has a union to go on
+                if (pPredicate->column == SENSOR_COLUMN_PRESENCE)
+                {
+                    passes = ((pEntry->presenceUnion & pPredicate->value) == pPredicate->value);
+                }
+            break;
+            default:
+            break;
+        }
+    }
+
+    return passes;
+}
+
+/// Add a segment to the work planned by a thread.
+static void addItem (QueryThread_t * pThread, DeviceId_t deviceId, uint32_t segmentNumber)
+{
+    WorkItem_t * pItems;
+    uint32_t maxItems;
+
+    if (pThread->numItems >= pThread->maxItems)
+    {
+        maxItems = (pThread->maxItems == 0) ? 256 : pThread->maxItems * 2;
+        pItems = (WorkItem_t *) realloc (pThread->pItems, maxItems * sizeof (WorkItem_t));
+        if (pItems != NULL)
+        {
+            pThread->pItems = pItems;
+            pThread->maxItems = maxItems;
+        }
+        else
+        {
+            pThread->outOfMemory = true;
+        }
+    }
+
+    if (pThread->numItems < pThread->maxItems)
+    {
+        pThread->pItems[pThread->numItems].deviceId = deviceId;
+        pThread->pItems[pThread->numItems].segmentNumber = segmentNumber;
+        pThread->numItems++;
+    }
+}
+
+/// Work out which segments of a device need scanning.
+static void planDevice (QueryThread_t * pThread, DeviceId_t deviceId)
+{
+    const SensorQuery_t * pQuery = pThread->pQuery->pQuery;
+    SensorIndexEntry_t * pEntries;
+    uint32_t numEntries;
+    uint32_t segmentNumber;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    struct stat status;
+
+    numEntries = sensorIndexRead (pThread->pQuery->pDirectory, deviceId, &pEntries);
+    for (segmentNumber = 0; segmentNumber < numEntries; segmentNumber++)
+    {
+        pThread->stats.numSegments++;
+        if ((pEntries[segmentNumber].lastTime < pQuery->startTime) ||
+            (pEntries[segmentNumber].firstTime >= pQuery->endTime))
+        {
+            pThread->stats.numSegmentsSkippedByTime++;
+        }
+        else if (!zoneMapPasses (&(pEntries[segmentNumber]), pQuery))
+        {
+            pThread->stats.numSegmentsSkippedByZoneMap++;
+        }
+        else
+        {
+            addItem (pThread, deviceId, segmentNumber);
+        }
+    }
+    free (pEntries);
+
+    // Whatever is beyond the index has to be looked at
+    while (sensorSegmentPath (pThread->pQuery->pDirectory, deviceId, segmentNumber, path) &&
+           (stat (path, &status) == 0))
+    {
+        pThread->stats.numSegments++;
+        addItem (pThread, deviceId, segmentNumber);
+        segmentNumber++;
+    }
+}
+
+/// Make sure that a thread's buffers have room for a segment.
+static bool reserveRows (QueryThread_t * pThread, uint32_t numRows)
+{
+    bool success = true;
+    void * pMem;
+
+    if (numRows > pThread->maxRows)
+    {
+        pMem = realloc (pThread->pSelection, numRows * sizeof (uint32_t));
+        success = (pMem != NULL);
+        if (success)
+        {
+            pThread->pSelection = (uint32_t *) pMem;
+        }
+        for (uint32_t x = 0; (x < MAX_NUM_SENSOR_COLUMNS) && success; x++)
+        {
+            if (pThread->pQuery->pQuery->columns & SENSOR_QUERY_COLUMN (x))
+            {
+                pMem = realloc (pThread->pColumns[x], numRows * sensorColumnElementSize ((SensorColumn_t) x));
+                success = (pMem != NULL);
+                if (success)
+                {
+                    pThread->pColumns[x] = (uint8_t *) pMem;
+                }
+            }
+        }
+        if (success)
+        {
+            pThread->maxRows = numRows;
+        }
+        else
+        {
+            pThread->outOfMemory = true;
+        }
+    }
+
+    return success;
+}
+
+/// Gather the selected rows of a column.
+static void gather (void * pTo, const void * pFrom, uint32_t elementSize,
+                    const uint32_t * pSelection, uint32_t numSelected)
+{
+    switch (elementSize)
+    {
+        case 1:
+            for (uint32_t x = 0; x < numSelected; x++)
+            {
+                ((uint8_t *) pTo)[x] = ((const uint8_t *) pFrom)[pSelection[x]];
+            }
+        break;
+        case 2:
+            for (uint32_t x = 0; x < numSelected; x++)
+            {
+                ((uint16_t *) pTo)[x] = ((const uint16_t *) pFrom)[pSelection[x]];
+            }
+        break;
+        default:
+            for (uint32_t x = 0; x < numSelected; x++)
+            {
+                ((uint32_t *) pTo)[x] = ((const uint32_t *) pFrom)[pSelection[x]];
+            }
+        break;
+    }
+}
+
+/// Scan a segment.
+static void scanSegment (QueryThread_t * pThread, const WorkItem_t * pItem)
+{
+    Query_t * pShared = pThread->pQuery;
+    const SensorQuery_t * pQuery = pShared->pQuery;
+    const SensorSegmentHeader_t * pHeader;
+    const SensorPredicate_t * pPredicate;
+    const void * ppColumns[MAX_NUM_SENSOR_COLUMNS];
+    SensorColumnSpan_t span;
+    SensorSegment segment;
+    uint32_t numSelected = 0;
+    uint32_t numKept;
+    uint32_t time;
+    bool success;
+
+    if (!segment.open (pShared->pDirectory, pItem->deviceId, pItem->segmentNumber))
+    {
+        return;
+    }
+
+    pHeader = segment.getHeader ();
+    if ((pHeader->numRows == 0) || (pHeader->lastTime < pQuery->startTime) ||
+        (pHeader->firstTime >= pQuery->endTime))
+    {
+        pThread->stats.numSegmentsSkippedByTime++;
+        return;
+    }
+
+    success = reserveRows (pThread, pHeader->numRows) &&
+              segment.getColumn (SENSOR_COLUMN_TIME, &span);
+    if (success)
+    {
+        pThread->stats.numSegmentsScanned++;
+        pThread->stats.numRowsScanned += pHeader->numRows;
+
+        // Select on time, then narrow down by each predicate in turn
+        for (uint32_t x = 0; x < span.numRows; x++)
+        {
+            time = ((const uint32_t *) span.pData)[x];
+            pThread->pSelection[numSelected] = x;
+            numSelected += (time >= pQuery->startTime) && (time < pQuery->endTime);
+        }
+        for (uint32_t x = 0; (x < pQuery->numPredicates) && (numSelected > 0) && success; x++)
+        {
+            pPredicate = &(pQuery->pPredicates[x]);
+            success = segment.getColumn (pPredicate->column, &span);
+            if (success)
+            {
+                numKept = 0;
+                for (uint32_t y = 0; y < numSelected; y++)
+                {
+                    pThread->pSelection[numKept] = pThread->pSelection[y];
+                    numKept += predicateMet (pPredicate->op,
+                                             sensorColumnGet (pPredicate->column, span.pData,
+                                                              pThread->pSelection[y]),
+                                             pPredicate->value);
+                }
+                numSelected = numKept;
+            }
+        }
+
+        if (success && (numSelected > 0))
+        {
+            for (uint32_t x = 0; (x < MAX_NUM_SENSOR_COLUMNS) && success; x++)
+            {
+                ppColumns[x] = NULL;
+                if (pQuery->columns & SENSOR_QUERY_COLUMN (x))
+                {
+                    success = segment.getColumn ((SensorColumn_t) x, &span);
+                    if (success)
+                    {
+                        gather (pThread->pColumns[x], span.pData, span.elementSize,
+                                pThread->pSelection, numSelected);
+                        ppColumns[x] = pThread->pColumns[x];
+                    }
+                }
+            }
+            if (success)
+            {
+                pThread->stats.numRowsMatched += numSelected;
+                pShared->callback (pShared->pContext, pItem->deviceId, pItem->segmentNumber,
+                                   numSelected, ppColumns);
+            }
+        }
+    }
+}
+
+/// The first phase: plan the segments of the devices.
+static void * planThread (void * pParam)
+{
+    QueryThread_t * pThread = (QueryThread_t *) pParam;
+    Query_t * pQuery = pThread->pQuery;
+    uint32_t x;
+
+    while ((x = pQuery->next.fetch_add (1)) < pQuery->pQuery->numDeviceIds)
+    {
+        planDevice (pThread, pQuery->pQuery->pDeviceIds[x]);
+    }
+
+    return NULL;
+}
+
+/// The second phase: scan the planned segments.
+static void * scanThread (void * pParam)
+{
+    QueryThread_t * pThread = (QueryThread_t *) pParam;
+    Query_t * pQuery = pThread->pQuery;
+    uint32_t x;
+
+    while ((x = pQuery->next.fetch_add (1)) < pQuery->numItems)
+    {
+        scanSegment (pThread, &(pQuery->pItems[x]));
+    }
+
+    return NULL;
+}
+
+/// Run a phase of a query on all of its threads.
+static bool runPhase (QueryThread_t * pThreads, uint32_t numThreads,
+                      void * (*pFunction) (void *))
+{
+    uint32_t numStarted = 0;
+
+    pThreads[0].pQuery->next = 0;
+    while ((numStarted < numThreads) &&
+           (pthread_create (&(pThreads[numStarted].thread), NULL, pFunction, &(pThreads[numStarted])) == 0))
+    {
+        numStarted++;
+    }
+    // Those that did start will have done all the work between them
+    for (uint32_t x = 0; x < numStarted; x++)
+    {
+        pthread_join (pThreads[x].thread, NULL);
+    }
+
+    return (numStarted == numThreads);
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+bool sensorQueryRun (const char * pDirectory, const SensorQuery_t * pQuery,
+                     uint32_t numThreads, SensorQueryCallback_t callback,
+                     void * pContext, SensorQueryStats_t * pStats)
+{
+    bool success = (pDirectory != NULL) && (pQuery != NULL) && (callback != NULL) &&
+                   (numThreads <= SENSOR_QUERY_MAX_THREADS) &&
+                   ((pQuery->numDeviceIds == 0) || (pQuery->pDeviceIds != NULL)) &&
+                   ((pQuery->numPredicates == 0) || (pQuery->pPredicates != NULL));
+    QueryThread_t threads[SENSOR_QUERY_MAX_THREADS];
+    WorkItem_t * pItems = NULL;
+    uint32_t numItems = 0;
+    Query_t query;
+
+    for (uint32_t x = 0; success && (x < pQuery->numPredicates); x++)
+    {
+        success = ((uint32_t) pQuery->pPredicates[x].column < MAX_NUM_SENSOR_COLUMNS) &&
+                  ((uint32_t) pQuery->pPredicates[x].op < MAX_NUM_SENSOR_PREDICATE_OPS);
+    }
+
+    if (success)
+    {
+        if (numThreads == 0)
+        {
+            numThreads = 1;
+        }
+        query.pDirectory = pDirectory;
+        query.pQuery = pQuery;
+        query.callback = callback;
+        query.pContext = pContext;
+        query.pItems = NULL;
+        query.numItems = 0;
+        memset (threads, 0, sizeof (threads[0]) * numThreads);
+        for (uint32_t x = 0; x < numThreads; x++)
+        {
+            threads[x].pQuery = &query;
+        }
+
+        // Plan, then gather up the segments planned by each thread
+        success = runPhase (threads, numThreads, planThread);
+        for (uint32_t x = 0; x < numThreads; x++)
+        {
+            numItems += threads[x].numItems;
+            success = success && !threads[x].outOfMemory;
+        }
+        if (success && (numItems > 0))
+        {
+            pItems = (WorkItem_t *) malloc (numItems * sizeof (WorkItem_t));
+            success = (pItems != NULL);
+            numItems = 0;
+            for (uint32_t x = 0; success && (x < numThreads); x++)
+            {
+                memcpy (pItems + numItems, threads[x].pItems, threads[x].numItems * sizeof (WorkItem_t));
+                numItems += threads[x].numItems;
+            }
+        }
+
+        // Scan
+        if (success && (numItems > 0))
+        {
+            query.pItems = pItems;
+            query.numItems = numItems;
+            success = runPhase (threads, numThreads, scanThread);
+        }
+
+        if (pStats != NULL)
+        {
+            memset (pStats, 0, sizeof (*pStats));
+        }
+        for (uint32_t x = 0; x < numThreads; x++)
+        {
+            success = success && !threads[x].outOfMemory;
+            if (pStats != NULL)
+            {
+                pStats->numSegments += threads[x].stats.numSegments;
+                pStats->numSegmentsSkippedByTime += threads[x].stats.numSegmentsSkippedByTime;
+                pStats->numSegmentsSkippedByZoneMap += threads[x].stats.numSegmentsSkippedByZoneMap;
+                pStats->numSegmentsScanned += threads[x].stats.numSegmentsScanned;
+                pStats->numRowsScanned += threads[x].stats.numRowsScanned;
+                pStats->numRowsMatched += threads[x].stats.numRowsMatched;
+            }
+            free (threads[x].pItems);
+            free (threads[x].pSelection);
+            for (uint32_t y = 0; y < MAX_NUM_SENSOR_COLUMNS; y++)
+            {
+                free (threads[x].pColumns[y]);
+            }
+        }
+        free (pItems);
+    }
+
+    return success;
+}
+
+// End Of File
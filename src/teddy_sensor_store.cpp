@@ -0,0 +1,916 @@
+/* Teddy sensor readings store
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_sensor_store.cpp
+ * This file implements the columnar sensor readings store.
+ */
+
+#include <stdint.h>
+#include <stdio.h>  // for snprintf() and rename()
+#include <stdlib.h> // for calloc(), malloc(), posix_memalign() and free()
+#include <string.h> // for memset(), memcpy(), strcpy() and strlen()
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_column_codec.hpp>
+#include <teddy_sensor_store.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The alignment of the header size and of each column in a segment
+#define SEGMENT_ALIGNMENT 64
+
+/// The alignment of the header size and of each column in a
+// compressed segment, enough for any column left uncompressed to be
+// accessed in place
+#define COMPRESSED_SEGMENT_ALIGNMENT 4
+
+/// Round up to the segment alignment
+#define ALIGN_UP(x) (((x) + SEGMENT_ALIGNMENT - 1) & ~(SEGMENT_ALIGNMENT - 1))
+
+/// Round up to the compressed segment alignment
+#define ALIGN_UP_COMPRESSED(x) (((x) + COMPRESSED_SEGMENT_ALIGNMENT - 1) & ~(COMPRESSED_SEGMENT_ALIGNMENT - 1))
+
+// ----------------------------------------------------------------
+// PRIVATE VARIABLES
+// ----------------------------------------------------------------
+
+/// The element size of each column, in SensorColumn_t order.
+static const uint8_t gColumnElementSizes[MAX_NUM_SENSOR_COLUMNS] =
+{
+    sizeof (uint32_t), // SENSOR_COLUMN_TIME
+    sizeof (int32_t),  // SENSOR_COLUMN_GPS_LATITUDE
+    sizeof (int32_t),  // SENSOR_COLUMN_GPS_LONGITUDE
+    sizeof (int32_t),  // SENSOR_COLUMN_GPS_ELEVATION
+    sizeof (int32_t),  // SENSOR_COLUMN_GPS_SPEED
+    sizeof (uint8_t),  // SENSOR_COLUMN_ORIENTATION
+    sizeof (uint8_t),  // SENSOR_COLUMN_HUGS
+    sizeof (uint8_t),  // SENSOR_COLUMN_SLAPS
+    sizeof (uint8_t),  // SENSOR_COLUMN_DROPS
+    sizeof (uint8_t),  // SENSOR_COLUMN_NUDGES
+    sizeof (uint16_t), // SENSOR_COLUMN_SOUND_LEVEL
+    sizeof (uint16_t), // SENSOR_COLUMN_LUMINOSITY
+    sizeof (int8_t),   // SENSOR_COLUMN_TEMPERATURE
+    sizeof (uint8_t),  // SENSOR_COLUMN_RSSI
+    sizeof (uint8_t),  // SENSOR_COLUMN_CHARGE_STATE
+    sizeof (uint16_t), // SENSOR_COLUMN_BATTERY_MV
+    sizeof (uint32_t), // SENSOR_COLUMN_ENERGY_UWH
+    sizeof (uint8_t)   // SENSOR_COLUMN_PRESENCE
+};
+
+/// Whether each column is signed, in SensorColumn_t order.
+static const bool gColumnIsSigned[MAX_NUM_SENSOR_COLUMNS] =
+{
+    false, // SENSOR_COLUMN_TIME
+    true,  // SENSOR_COLUMN_GPS_LATITUDE
+    true,  // SENSOR_COLUMN_GPS_LONGITUDE
+    true,  // SENSOR_COLUMN_GPS_ELEVATION
+    true,  // SENSOR_COLUMN_GPS_SPEED
+    false, // SENSOR_COLUMN_ORIENTATION
+    false, // SENSOR_COLUMN_HUGS
+    false, // SENSOR_COLUMN_SLAPS
+    false, // SENSOR_COLUMN_DROPS
+    false, // SENSOR_COLUMN_NUDGES
+    false, // SENSOR_COLUMN_SOUND_LEVEL
+    false, // SENSOR_COLUMN_LUMINOSITY
+    true,  // SENSOR_COLUMN_TEMPERATURE
+    false, // SENSOR_COLUMN_RSSI
+    false, // SENSOR_COLUMN_CHARGE_STATE
+    false, // SENSOR_COLUMN_BATTERY_MV
+    false, // SENSOR_COLUMN_ENERGY_UWH
+    false  // SENSOR_COLUMN_PRESENCE
+};
+
+/// The codec for each column in a compressed segment, in
+// SensorColumn_t order: time steps by the heartbeat, the enumerations
+// and the presence bitmap sit at one value for long stretches and
+// everything else moves by small amounts, if at all.
+static const ColumnCodec_t gColumnCodecs[MAX_NUM_SENSOR_COLUMNS] =
+{
+    COLUMN_CODEC_DELTA_OF_DELTA, // SENSOR_COLUMN_TIME
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_GPS_LATITUDE
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_GPS_LONGITUDE
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_GPS_ELEVATION
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_GPS_SPEED
+    COLUMN_CODEC_RLE,            // SENSOR_COLUMN_ORIENTATION
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_HUGS
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_SLAPS
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_DROPS
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_NUDGES
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_SOUND_LEVEL
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_LUMINOSITY
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_TEMPERATURE
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_RSSI
+    COLUMN_CODEC_RLE,            // SENSOR_COLUMN_CHARGE_STATE
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_BATTERY_MV
+    COLUMN_CODEC_DELTA,          // SENSOR_COLUMN_ENERGY_UWH
+    COLUMN_CODEC_RLE             // SENSOR_COLUMN_PRESENCE
+};
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Set up the header of an empty segment image.
+static void initImage (uint8_t * pImage, uint32_t imageSize, uint32_t rowsPerSegment,
+                       DeviceId_t deviceId, uint32_t segmentNumber)
+{
+    SensorSegmentHeader_t * pHeader = (SensorSegmentHeader_t *) pImage;
+    uint32_t offset = ALIGN_UP (sizeof (SensorSegmentHeader_t));
+
+    memset (pImage, 0, imageSize);
+    pHeader->magic = SENSOR_SEGMENT_MAGIC;
+    pHeader->version = SENSOR_SEGMENT_VERSION;
+    pHeader->headerSize = (uint16_t) offset;
+    pHeader->deviceId = deviceId;
+    pHeader->segmentNumber = segmentNumber;
+    pHeader->capacity = rowsPerSegment;
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        pHeader->columnOffsets[x] = offset;
+        pHeader->columnSizes[x] = gColumnElementSizes[x] * rowsPerSegment;
+        pHeader->columnCodecs[x] = COLUMN_CODEC_RAW;
+        offset += ALIGN_UP (pHeader->columnSizes[x]);
+    }
+}
+
+/// Check that the header of a segment of the given size is sane.
+static bool headerIsValid (const SensorSegmentHeader_t * pHeader, uint32_t size)
+{
+    bool valid = (size >= sizeof (*pHeader)) &&
+                 (pHeader->magic == SENSOR_SEGMENT_MAGIC) &&
+                 (pHeader->version == SENSOR_SEGMENT_VERSION) &&
+                 (pHeader->numRows <= pHeader->capacity);
+
+    // An uncompressed segment must have room for all of its rows, a
+    // compressed one must have its columns where it says they are and
+    // any raw column must have room for the valid rows
+    for (uint32_t x = 0; (x < MAX_NUM_SENSOR_COLUMNS) && valid; x++)
+    {
+        if ((pHeader->flags & SENSOR_SEGMENT_FLAG_COMPRESSED) == 0)
+        {
+            valid = (pHeader->columnCodecs[x] == COLUMN_CODEC_RAW) &&
+                    ((uint64_t) pHeader->columnOffsets[x] +
+                     (uint64_t) gColumnElementSizes[x] * pHeader->capacity <= size);
+        }
+        else
+        {
+            valid = (pHeader->columnCodecs[x] < MAX_NUM_COLUMN_CODECS) &&
+                    ((uint64_t) pHeader->columnOffsets[x] + pHeader->columnSizes[x] <= size) &&
+                    ((pHeader->columnCodecs[x] != COLUMN_CODEC_RAW) ||
+                     ((uint64_t) gColumnElementSizes[x] * pHeader->numRows <= pHeader->columnSizes[x]));
+        }
+    }
+
+    return valid;
+}
+
+/// Get a pointer to a row of a column in an image.
+#define COLUMN(pImage, type, column, row) (((type *) ((pImage) + ((SensorSegmentHeader_t *) (pImage))->columnOffsets[column]))[row])
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t sensorColumnElementSize (SensorColumn_t column)
+{
+    uint32_t size = 0;
+
+    if ((uint32_t) column < MAX_NUM_SENSOR_COLUMNS)
+    {
+        size = gColumnElementSizes[column];
+    }
+
+    return size;
+}
+
+ColumnCodec_t sensorColumnCodec (SensorColumn_t column)
+{
+    ColumnCodec_t codec = COLUMN_CODEC_RAW;
+
+    if ((uint32_t) column < MAX_NUM_SENSOR_COLUMNS)
+    {
+        codec = gColumnCodecs[column];
+    }
+
+    return codec;
+}
+
+uint32_t sensorSegmentFileSize (uint32_t rowsPerSegment)
+{
+    uint32_t size = ALIGN_UP (sizeof (SensorSegmentHeader_t));
+
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        size += ALIGN_UP (gColumnElementSizes[x] * rowsPerSegment);
+    }
+
+    return size;
+}
+
+bool sensorSegmentPath (const char * pDirectory, DeviceId_t deviceId,
+                        uint32_t segmentNumber, char * pPath)
+{
+    int length = snprintf (pPath, SENSOR_STORE_MAX_PATH_LEN, "%s/%02x/%016llx_%08x.seg",
+                           pDirectory, (unsigned int) (deviceIdHash (deviceId) & 0xFF),
+                           (unsigned long long) deviceId, segmentNumber);
+
+    return (length > 0) && (length < SENSOR_STORE_MAX_PATH_LEN);
+}
+
+int64_t sensorColumnGet (SensorColumn_t column, const void * pData, uint32_t row)
+{
+    int64_t value = 0;
+
+    switch (gColumnElementSizes[column])
+    {
+        case 1:
+            value = gColumnIsSigned[column] ? (int64_t) ((const int8_t *) pData)[row] :
+                                              (int64_t) ((const uint8_t *) pData)[row];
+        break;
+        case 2:
+            value = gColumnIsSigned[column] ? (int64_t) ((const int16_t *) pData)[row] :
+                                              (int64_t) ((const uint16_t *) pData)[row];
+        break;
+        default:
+            value = gColumnIsSigned[column] ? (int64_t) ((const int32_t *) pData)[row] :
+                                              (int64_t) ((const uint32_t *) pData)[row];
+        break;
+    }
+
+    return value;
+}
+
+bool sensorIndexPath (const char * pDirectory, DeviceId_t deviceId, char * pPath)
+{
+    int length = snprintf (pPath, SENSOR_STORE_MAX_PATH_LEN, "%s/%02x/%016llx.idx",
+                           pDirectory, (unsigned int) (deviceIdHash (deviceId) & 0xFF),
+                           (unsigned long long) deviceId);
+
+    return (length > 0) && (length < SENSOR_STORE_MAX_PATH_LEN);
+}
+
+uint32_t sensorIndexRead (const char * pDirectory, DeviceId_t deviceId,
+                          SensorIndexEntry_t ** ppEntries)
+{
+    uint32_t numEntries = 0;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    SensorIndexEntry_t * pEntries = NULL;
+    struct stat status;
+    uint32_t size;
+    ssize_t result = 0;
+    uint32_t got = 0;
+    int fd;
+
+    if (sensorIndexPath (pDirectory, deviceId, path))
+    {
+        fd = ::open (path, O_RDONLY);
+        if (fd >= 0)
+        {
+            if ((fstat (fd, &status) == 0) && (status.st_size >= (off_t) sizeof (SensorIndexEntry_t)))
+            {
+                // A torn final entry is ignored
+                size = (uint32_t) (status.st_size / sizeof (SensorIndexEntry_t)) * sizeof (SensorIndexEntry_t);
+                pEntries = (SensorIndexEntry_t *) malloc (size);
+                while ((pEntries != NULL) && (got < size) && (result >= 0))
+                {
+                    result = read (fd, ((uint8_t *) pEntries) + got, size - got);
+                    if (result > 0)
+                    {
+                        got += result;
+                    }
+                    else if ((result < 0) && (errno == EINTR))
+                    {
+                        result = 0;
+                    }
+                    else
+                    {
+                        result = -1;
+                    }
+                }
+                got /= sizeof (SensorIndexEntry_t);
+                while ((numEntries < got) && (pEntries[numEntries].segmentNumber == numEntries))
+                {
+                    numEntries++;
+                }
+            }
+            ::close (fd);
+        }
+    }
+
+    if (numEntries == 0)
+    {
+        free (pEntries);
+        pEntries = NULL;
+    }
+    *ppEntries = pEntries;
+
+    return numEntries;
+}
+
+// ----------------------------------------------------------------
+// SEGMENT: PUBLIC METHODS
+// ----------------------------------------------------------------
+
+SensorSegment::SensorSegment (void)
+{
+    mp_mapping = NULL;
+    m_mappingSize = 0;
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        mp_decoded[x] = NULL;
+    }
+}
+
+SensorSegment::~SensorSegment (void)
+{
+    close ();
+}
+
+bool SensorSegment::open (const char * pDirectory, DeviceId_t deviceId, uint32_t segmentNumber)
+{
+    bool success = false;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    struct stat status;
+    void * pMapping;
+    int fd;
+
+    close ();
+    if (sensorSegmentPath (pDirectory, deviceId, segmentNumber, path))
+    {
+        fd = ::open (path, O_RDONLY);
+        if (fd >= 0)
+        {
+            if ((fstat (fd, &status) == 0) && (status.st_size >= (off_t) sizeof (SensorSegmentHeader_t)))
+            {
+                pMapping = mmap (NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                if (pMapping != MAP_FAILED)
+                {
+                    mp_mapping = (const uint8_t *) pMapping;
+                    m_mappingSize = (uint32_t) status.st_size;
+                    success = headerIsValid ((const SensorSegmentHeader_t *) mp_mapping, m_mappingSize) &&
+                              (((const SensorSegmentHeader_t *) mp_mapping)->deviceId == deviceId);
+                    if (!success)
+                    {
+                        close ();
+                    }
+                }
+            }
+            // The mapping stays valid without the file descriptor
+            ::close (fd);
+        }
+    }
+
+    return success;
+}
+
+void SensorSegment::close (void)
+{
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        free (mp_decoded[x]);
+        mp_decoded[x] = NULL;
+    }
+    if (mp_mapping != NULL)
+    {
+        munmap ((void *) mp_mapping, m_mappingSize);
+        mp_mapping = NULL;
+        m_mappingSize = 0;
+    }
+}
+
+const SensorSegmentHeader_t * SensorSegment::getHeader (void)
+{
+    return (const SensorSegmentHeader_t *) mp_mapping;
+}
+
+bool SensorSegment::getColumn (SensorColumn_t column, SensorColumnSpan_t * pSpan)
+{
+    bool success = false;
+    const SensorSegmentHeader_t * pHeader = (const SensorSegmentHeader_t *) mp_mapping;
+    uint32_t elementSize;
+
+    if ((pHeader != NULL) && ((uint32_t) column < MAX_NUM_SENSOR_COLUMNS))
+    {
+        elementSize = gColumnElementSizes[column];
+        pSpan->pData = mp_mapping + pHeader->columnOffsets[column];
+        pSpan->numRows = pHeader->numRows;
+        pSpan->elementSize = elementSize;
+        success = true;
+        if (pHeader->columnCodecs[column] != COLUMN_CODEC_RAW)
+        {
+            if (mp_decoded[column] == NULL)
+            {
+                // Decode once, the copy lasting until close()
+                mp_decoded[column] = (uint8_t *) malloc (elementSize * pHeader->numRows + 1);
+                if ((mp_decoded[column] != NULL) &&
+                    !columnDecode ((ColumnCodec_t) pHeader->columnCodecs[column],
+                                   mp_mapping + pHeader->columnOffsets[column],
+                                   pHeader->columnSizes[column], pHeader->numRows,
+                                   elementSize, gColumnIsSigned[column], mp_decoded[column]))
+                {
+                    free (mp_decoded[column]);
+                    mp_decoded[column] = NULL;
+                }
+            }
+            pSpan->pData = mp_decoded[column];
+            success = (mp_decoded[column] != NULL);
+        }
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// STORE: PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t SensorStore::getSlot (Shard_t * pShard, DeviceId_t deviceId)
+{
+    int64_t slot = -1;
+    uint8_t * pImage = NULL;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+    uint32_t segmentNumber;
+    SensorSegment segment;
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if ((pShard->numEntries < pShard->maxEntries) &&
+             (posix_memalign ((void **) &pImage, SEGMENT_ALIGNMENT, m_imageSize) == 0))
+    {
+        // First time this device has been written to since we started:
+        // carry on from any segments already on disk, picking up a
+        // partly-filled last segment if it is the same shape as ours
+        segmentNumber = getNumSegments (deviceId);
+        if ((segmentNumber > 0) && segment.open (m_directory, deviceId, segmentNumber - 1) &&
+            ((segment.getHeader ()->flags & SENSOR_SEGMENT_FLAG_COMPRESSED) == 0) &&
+            (segment.getHeader ()->capacity == m_rowsPerSegment) &&
+            (segment.getHeader ()->numRows < m_rowsPerSegment))
+        {
+            memcpy (pImage, segment.getHeader (), m_imageSize);
+        }
+        else
+        {
+            initImage (pImage, m_imageSize, m_rowsPerSegment, deviceId, segmentNumber);
+        }
+        pShard->pDeviceIds[x] = deviceId;
+        pShard->ppImages[x] = pImage;
+        pShard->pDirty[x] = false;
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+uint32_t SensorStore::compressImage (Shard_t * pShard, const uint8_t * pImage)
+{
+    const SensorSegmentHeader_t * pHeader = (const SensorSegmentHeader_t *) pImage;
+    SensorSegmentHeader_t * pCompressedHeader = (SensorSegmentHeader_t *) pShard->pCompressed;
+    uint32_t offset = ALIGN_UP_COMPRESSED (sizeof (SensorSegmentHeader_t));
+    uint32_t rawSize;
+    uint32_t size;
+
+    // Every column either shrinks or is copied as it is, so the
+    // result is never bigger than the image and fits the buffer
+    memcpy (pCompressedHeader, pHeader, sizeof (*pHeader));
+    pCompressedHeader->headerSize = (uint16_t) offset;
+    pCompressedHeader->flags |= SENSOR_SEGMENT_FLAG_COMPRESSED;
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        rawSize = gColumnElementSizes[x] * pHeader->numRows;
+        size = 0;
+        if (rawSize > 1)
+        {
+            size = columnEncode (gColumnCodecs[x], pImage + pHeader->columnOffsets[x],
+                                 pHeader->numRows, gColumnElementSizes[x], gColumnIsSigned[x],
+                                 pShard->pCompressed + offset, rawSize - 1);
+        }
+        pCompressedHeader->columnCodecs[x] = gColumnCodecs[x];
+        if (size == 0)
+        {
+            memcpy (pShard->pCompressed + offset, pImage + pHeader->columnOffsets[x], rawSize);
+            pCompressedHeader->columnCodecs[x] = COLUMN_CODEC_RAW;
+            size = rawSize;
+        }
+        pCompressedHeader->columnOffsets[x] = offset;
+        pCompressedHeader->columnSizes[x] = size;
+        offset += ALIGN_UP_COMPRESSED (size);
+    }
+
+    return offset;
+}
+
+bool SensorStore::writeIndexEntry (const uint8_t * pImage)
+{
+    bool success = false;
+    const SensorSegmentHeader_t * pHeader = (const SensorSegmentHeader_t *) pImage;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    SensorIndexEntry_t entry;
+    const void * pData;
+    int64_t value;
+    int fd;
+
+    memset (&entry, 0, sizeof (entry));
+    entry.segmentNumber = pHeader->segmentNumber;
+    entry.numRows = pHeader->numRows;
+    entry.firstTime = pHeader->firstTime;
+    entry.lastTime = pHeader->lastTime;
+    for (uint32_t x = 0; x < MAX_NUM_SENSOR_COLUMNS; x++)
+    {
+        pData = pImage + pHeader->columnOffsets[x];
+        for (uint32_t y = 0; y < pHeader->numRows; y++)
+        {
+            value = sensorColumnGet ((SensorColumn_t) x, pData, y);
+            if ((y == 0) || (value < entry.columnMin[x]))
+            {
+                entry.columnMin[x] = value;
+            }
+            if ((y == 0) || (value > entry.columnMax[x]))
+            {
+                entry.columnMax[x] = value;
+            }
+        }
+    }
+    for (uint32_t y = 0; y < pHeader->numRows; y++)
+    {
+        entry.presenceUnion |= COLUMN (pImage, uint8_t, SENSOR_COLUMN_PRESENCE, y);
+    }
+
+    // An entry is small enough to go in a single append
+    if (sensorIndexPath (m_directory, pHeader->deviceId, path))
+    {
+        fd = ::open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0)
+        {
+            success = (write (fd, &entry, sizeof (entry)) == (ssize_t) sizeof (entry));
+            ::close (fd);
+        }
+    }
+
+    return success;
+}
+
+bool SensorStore::writeSegment (Shard_t * pShard, const uint8_t * pSegment, uint32_t size)
+{
+    bool success = false;
+    const SensorSegmentHeader_t * pHeader = (const SensorSegmentHeader_t *) pSegment;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    char tempPath[SENSOR_STORE_MAX_PATH_LEN + 4];
+    uint32_t written = 0;
+    ssize_t result = 0;
+    int fd;
+
+    // Write to a temporary file and rename it into place so that a
+    // reader never maps a part-written segment
+    if (sensorSegmentPath (m_directory, pHeader->deviceId, pHeader->segmentNumber, path))
+    {
+        snprintf (tempPath, sizeof (tempPath), "%s.tmp", path);
+        fd = ::open (tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            while ((written < size) && (result >= 0))
+            {
+                result = write (fd, pSegment + written, size - written);
+                if (result > 0)
+                {
+                    written += result;
+                }
+                else if ((result < 0) && (errno == EINTR))
+                {
+                    result = 0;
+                }
+                else
+                {
+                    result = -1;
+                }
+            }
+            ::close (fd);
+            if (written == size)
+            {
+                success = (rename (tempPath, path) == 0);
+            }
+            if (!success)
+            {
+                unlink (tempPath);
+            }
+        }
+    }
+
+    if (success)
+    {
+        pShard->numSegmentWrites++;
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// STORE: PUBLIC METHODS
+// ----------------------------------------------------------------
+
+SensorStore::SensorStore (void)
+{
+    m_directory[0] = 0;
+    m_rowsPerSegment = 0;
+    m_imageSize = 0;
+    m_compress = false;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+SensorStore::~SensorStore (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        Shard_t * pShard = &(mp_shards[x]);
+
+        if (pShard->ppImages != NULL)
+        {
+            for (uint32_t y = 0; y < pShard->capacity; y++)
+            {
+                free (pShard->ppImages[y]);
+            }
+        }
+        free (pShard->pDeviceIds);
+        free (pShard->ppImages);
+        free (pShard->pDirty);
+        free (pShard->pCompressed);
+    }
+    free (mp_shards);
+}
+
+bool SensorStore::init (const char * pDirectory, uint32_t numShards,
+                        uint32_t maxDevices, uint32_t rowsPerSegment, bool compress)
+{
+    bool success = false;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+
+    if (rowsPerSegment == 0)
+    {
+        rowsPerSegment = SENSOR_STORE_DEFAULT_ROWS_PER_SEGMENT;
+    }
+
+    if ((mp_shards == NULL) && (pDirectory != NULL) && (strlen (pDirectory) < sizeof (m_directory) - 32) &&
+        (numShards > 0) && (numShards <= SENSOR_STORE_MAX_SHARDS) && (maxDevices > 0) &&
+        ((mkdir (pDirectory, 0755) == 0) || (errno == EEXIST)))
+    {
+        success = true;
+        for (uint32_t x = 0; (x < 256) && success; x++)
+        {
+            snprintf (path, sizeof (path), "%s/%02x", pDirectory, x);
+            success = (mkdir (path, 0755) == 0) || (errno == EEXIST);
+        }
+
+        if (success)
+        {
+            success = false;
+            if (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0)
+            {
+                strcpy (m_directory, pDirectory);
+                m_rowsPerSegment = rowsPerSegment;
+                m_imageSize = sensorSegmentFileSize (rowsPerSegment);
+                m_compress = compress;
+                mp_shards = (Shard_t *) pMem;
+                memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+                capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+                success = true;
+                for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+                {
+                    Shard_t * pShard = &(mp_shards[m_numShards]);
+
+                    pShard->capacity = capacity;
+                    pShard->maxEntries = maxEntries;
+                    pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+                    pShard->ppImages = (uint8_t **) calloc (capacity, sizeof (uint8_t *));
+                    pShard->pDirty = (bool *) calloc (capacity, sizeof (bool));
+                    if (compress)
+                    {
+                        pShard->pCompressed = (uint8_t *) malloc (m_imageSize);
+                    }
+                    if ((pShard->pDeviceIds == NULL) || (pShard->ppImages == NULL) || (pShard->pDirty == NULL) ||
+                        (compress && (pShard->pCompressed == NULL)))
+                    {
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t SensorStore::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool SensorStore::append (uint32_t shardIndex, DeviceId_t deviceId,
+                          const PipelineReadings_t * pReadings, uint8_t presentBitmap)
+{
+    bool success = false;
+    Shard_t * pShard;
+    SensorSegmentHeader_t * pHeader;
+    uint8_t * pImage;
+    int64_t slot;
+    uint32_t row;
+    uint32_t size;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = getSlot (pShard, deviceId);
+        if (slot >= 0)
+        {
+            pImage = pShard->ppImages[slot];
+            pHeader = (SensorSegmentHeader_t *) pImage;
+            row = pHeader->numRows;
+
+            // Absent values are zero in a PipelineReadings_t already
+            COLUMN (pImage, uint32_t, SENSOR_COLUMN_TIME, row) = pReadings->time;
+            COLUMN (pImage, int32_t, SENSOR_COLUMN_GPS_LATITUDE, row) = pReadings->gpsLatitude;
+            COLUMN (pImage, int32_t, SENSOR_COLUMN_GPS_LONGITUDE, row) = pReadings->gpsLongitude;
+            COLUMN (pImage, int32_t, SENSOR_COLUMN_GPS_ELEVATION, row) = pReadings->gpsElevation;
+            COLUMN (pImage, int32_t, SENSOR_COLUMN_GPS_SPEED, row) = pReadings->gpsSpeed;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_ORIENTATION, row) = pReadings->orientation;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_HUGS, row) = pReadings->hugsThisPeriod;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_SLAPS, row) = pReadings->slapsThisPeriod;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_DROPS, row) = pReadings->dropsThisPeriod;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_NUDGES, row) = pReadings->nudgesThisPeriod;
+            COLUMN (pImage, uint16_t, SENSOR_COLUMN_SOUND_LEVEL, row) = pReadings->soundLevel;
+            COLUMN (pImage, uint16_t, SENSOR_COLUMN_LUMINOSITY, row) = pReadings->luminosity;
+            COLUMN (pImage, int8_t, SENSOR_COLUMN_TEMPERATURE, row) = pReadings->temperature;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_RSSI, row) = pReadings->rssi;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_CHARGE_STATE, row) = pReadings->chargeState;
+            COLUMN (pImage, uint16_t, SENSOR_COLUMN_BATTERY_MV, row) = pReadings->batteryMV;
+            COLUMN (pImage, uint32_t, SENSOR_COLUMN_ENERGY_UWH, row) = pReadings->energyUWH;
+            COLUMN (pImage, uint8_t, SENSOR_COLUMN_PRESENCE, row) = presentBitmap;
+
+            if ((row == 0) || (pReadings->time < pHeader->firstTime))
+            {
+                pHeader->firstTime = pReadings->time;
+            }
+            if ((row == 0) || (pReadings->time > pHeader->lastTime))
+            {
+                pHeader->lastTime = pReadings->time;
+            }
+            pHeader->numRows++;
+            pShard->numRows++;
+            pShard->pDirty[slot] = true;
+            success = true;
+
+            if (pHeader->numRows >= pHeader->capacity)
+            {
+                // Full: write it out for good, compressed if asked, and
+                // start the next one
+                if (m_compress)
+                {
+                    size = compressImage (pShard, pImage);
+                    success = writeSegment (pShard, pShard->pCompressed, size);
+                }
+                else
+                {
+                    size = m_imageSize;
+                    success = writeSegment (pShard, pImage, size);
+                }
+                if (success)
+                {
+                    pShard->numSegmentsSealed++;
+                    pShard->numBytesSealed += size;
+                    success = writeIndexEntry (pImage);
+                }
+                initImage (pImage, m_imageSize, m_rowsPerSegment, deviceId, pHeader->segmentNumber + 1);
+                pShard->pDirty[slot] = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+bool SensorStore::appendRecord (uint32_t shardIndex, const PipelineRecord_t * pRecord)
+{
+    bool success = false;
+
+    if ((pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG) ||
+        (pRecord->msgType == MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG))
+    {
+        success = append (shardIndex, pRecord->deviceId, &(pRecord->u.readings), pRecord->presentBitmap);
+    }
+
+    return success;
+}
+
+bool SensorStore::flush (uint32_t shardIndex)
+{
+    bool success = false;
+    Shard_t * pShard;
+
+    if (shardIndex < m_numShards)
+    {
+        pShard = &(mp_shards[shardIndex]);
+        success = true;
+        for (uint32_t x = 0; x < pShard->capacity; x++)
+        {
+            if (pShard->pDirty[x])
+            {
+                if (writeSegment (pShard, pShard->ppImages[x], m_imageSize))
+                {
+                    pShard->pDirty[x] = false;
+                }
+                else
+                {
+                    success = false;
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t SensorStore::getNumSegments (DeviceId_t deviceId)
+{
+    uint32_t numSegments = 0;
+    char path[SENSOR_STORE_MAX_PATH_LEN];
+    struct stat status;
+
+    while (sensorSegmentPath (m_directory, deviceId, numSegments, path) &&
+           (stat (path, &status) == 0))
+    {
+        numSegments++;
+    }
+
+    return numSegments;
+}
+
+const char * SensorStore::getDirectory (void)
+{
+    return m_directory;
+}
+
+void SensorStore::getStats (uint64_t * pNumRows, uint64_t * pNumSegmentWrites,
+                            uint64_t * pNumSegmentsSealed, uint64_t * pNumBytesSealed)
+{
+    uint64_t numRows = 0;
+    uint64_t numSegmentWrites = 0;
+    uint64_t numSegmentsSealed = 0;
+    uint64_t numBytesSealed = 0;
+
+    // Not synchronised with the writers, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numRows += mp_shards[x].numRows;
+        numSegmentWrites += mp_shards[x].numSegmentWrites;
+        numSegmentsSealed += mp_shards[x].numSegmentsSealed;
+        numBytesSealed += mp_shards[x].numBytesSealed;
+    }
+
+    if (pNumRows != NULL)
+    {
+        *pNumRows = numRows;
+    }
+    if (pNumSegmentWrites != NULL)
+    {
+        *pNumSegmentWrites = numSegmentWrites;
+    }
+    if (pNumSegmentsSealed != NULL)
+    {
+        *pNumSegmentsSealed = numSegmentsSealed;
+    }
+    if (pNumBytesSealed != NULL)
+    {
+        *pNumBytesSealed = numBytesSealed;
+    }
+}
+
+// End Of File
@@ -0,0 +1,91 @@
+/* Teddy server-side common functions
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_server.cpp
+ * This file implements the things that are common to all of the
+ * server-side modules.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for calloc()
+#include <time.h>   // for clock_gettime()
+#include <teddy_server.hpp>
+
+// ----------------------------------------------------------------
+// FUNCTIONS
+// ----------------------------------------------------------------
+
+uint32_t shardCapacity (uint32_t maxDevices, uint32_t numShards, uint32_t * pMaxEntries)
+{
+    uint32_t maxEntries = maxDevices / numShards + 1;
+
+    if (numShards > 1)
+    {
+        maxEntries += maxEntries / 8;
+    }
+    *pMaxEntries = maxEntries;
+
+    return (uint32_t) ((uint64_t) maxEntries * 100 / SHARD_LOAD_FACTOR_PERCENT) + 1;
+}
+
+void * shardAllocColumn (uint32_t numEntries, uint32_t entrySize, uint64_t * pTotal)
+{
+    void * pColumn = calloc (numEntries, entrySize);
+
+    if (pColumn != NULL)
+    {
+        *pTotal += (uint64_t) numEntries * entrySize;
+    }
+
+    return pColumn;
+}
+
+DeviceId_t deviceIdFromAddress (uint32_t ipAddress, uint16_t port)
+{
+    return ((DeviceId_t) ipAddress << 32) | port;
+}
+
+void deviceIdToAddress (DeviceId_t deviceId, uint32_t * pIpAddress, uint16_t * pPort)
+{
+    *pIpAddress = (uint32_t) (deviceId >> 32);
+    *pPort = (uint16_t) (deviceId & 0xFFFF);
+}
+
+uint64_t serverTimeUs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+uint64_t serverTimeNs (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+uint32_t serverTimeUtcSeconds (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_REALTIME, &ts);
+
+    return (uint32_t) ts.tv_sec;
+}
+
+// End Of File
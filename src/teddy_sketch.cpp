@@ -0,0 +1,1151 @@
+/* Teddy mergeable sketches
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_sketch.cpp
+ * This file implements the mergeable sketches.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for malloc(), calloc(), free() and qsort()
+#include <string.h> // for memset() and memcpy()
+#include <math.h>   // for ldexp(), log() and ceil()
+#include <teddy_msgs.hpp>
+#include <teddy_api.hpp>
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_sketch.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The size of a serialised SpaceSaving counter: key, count and error
+#define SPACE_SAVING_COUNTER_SIZE 24
+
+/// The size of the fixed part of a serialised SpaceSaving
+#define SPACE_SAVING_HEADER_SIZE 16
+
+/// The size of the fixed part of a serialised ValueHistogram
+#define HISTOGRAM_HEADER_SIZE 12
+
+// ----------------------------------------------------------------
+// TYPES
+// ----------------------------------------------------------------
+
+/// A counter, for sorting.
+typedef struct CounterTag_t
+{
+    uint64_t key;
+    uint64_t count;
+    uint64_t error;
+} Counter_t;
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Mix the bits of a key, e.g. a device ID, into a hash fit for a
+// HyperLogLog or an index.
+static inline uint64_t mix (uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+
+    return key;
+}
+
+static void putUint32 (char * pBuffer, uint32_t value)
+{
+    for (uint32_t x = 0; x < 4; x++)
+    {
+        pBuffer[x] = (char) (value >> (24 - (x * 8)));
+    }
+}
+
+static void putUint64 (char * pBuffer, uint64_t value)
+{
+    putUint32 (pBuffer, (uint32_t) (value >> 32));
+    putUint32 (pBuffer + 4, (uint32_t) value);
+}
+
+static uint32_t getUint32 (const char * pBuffer)
+{
+    uint32_t value = 0;
+
+    for (uint32_t x = 0; x < 4; x++)
+    {
+        value = (value << 8) | (uint8_t) pBuffer[x];
+    }
+
+    return value;
+}
+
+static uint64_t getUint64 (const char * pBuffer)
+{
+    return ((uint64_t) getUint32 (pBuffer) << 32) | getUint32 (pBuffer + 4);
+}
+
+/// Sort counters heaviest first.
+static int compareCounters (const void * pA, const void * pB)
+{
+    const Counter_t * pCounterA = (const Counter_t *) pA;
+    const Counter_t * pCounterB = (const Counter_t *) pB;
+
+    return (pCounterA->count < pCounterB->count) ? 1 : (pCounterA->count > pCounterB->count) ? -1 : 0;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS: HyperLogLog
+// ----------------------------------------------------------------
+
+HyperLogLog::HyperLogLog (void)
+{
+    m_precision = 0;
+    mp_registers = NULL;
+}
+
+HyperLogLog::~HyperLogLog (void)
+{
+    free (mp_registers);
+}
+
+bool HyperLogLog::init (uint32_t precision)
+{
+    bool success = false;
+
+    if ((mp_registers == NULL) &&
+        (precision >= SKETCH_HLL_MIN_PRECISION) && (precision <= SKETCH_HLL_MAX_PRECISION))
+    {
+        mp_registers = (uint8_t *) calloc ((size_t) 1 << precision, sizeof (uint8_t));
+        if (mp_registers != NULL)
+        {
+            m_precision = precision;
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+void HyperLogLog::add (uint64_t hash)
+{
+    uint32_t index;
+    uint64_t bits;
+    uint8_t rank = 1;
+
+    if (mp_registers != NULL)
+    {
+        // The top bits choose the register, the rest give the rank:
+        // the position of the first one bit
+        index = (uint32_t) (hash >> (64 - m_precision));
+        bits = hash << m_precision;
+        while ((rank <= 64 - m_precision) && !(bits & 0x8000000000000000ULL))
+        {
+            bits <<= 1;
+            rank++;
+        }
+        if (rank > mp_registers[index])
+        {
+            mp_registers[index] = rank;
+        }
+    }
+}
+
+uint64_t HyperLogLog::estimate (void)
+{
+    double sum = 0;
+    double numRegisters = (double) ((uint64_t) 1 << m_precision);
+    double alpha;
+    double estimate = 0;
+    uint32_t numZeros = 0;
+
+    if (mp_registers != NULL)
+    {
+        for (uint32_t x = 0; x < ((uint32_t) 1 << m_precision); x++)
+        {
+            sum += ldexp (1.0, -mp_registers[x]);
+            if (mp_registers[x] == 0)
+            {
+                numZeros++;
+            }
+        }
+        switch (m_precision)
+        {
+            case 4:
+                alpha = 0.673;
+            break;
+            case 5:
+                alpha = 0.697;
+            break;
+            case 6:
+                alpha = 0.709;
+            break;
+            default:
+                alpha = 0.7213 / (1 + (1.079 / numRegisters));
+            break;
+        }
+        estimate = alpha * numRegisters * numRegisters / sum;
+        if ((estimate <= 2.5 * numRegisters) && (numZeros > 0))
+        {
+            // Few keys: linear counting does better
+            estimate = numRegisters * log (numRegisters / numZeros);
+        }
+    }
+
+    return (uint64_t) (estimate + 0.5);
+}
+
+bool HyperLogLog::merge (const HyperLogLog * pOther)
+{
+    bool success = false;
+
+    if ((mp_registers != NULL) && (pOther->mp_registers != NULL) && (pOther->m_precision == m_precision))
+    {
+        for (uint32_t x = 0; x < ((uint32_t) 1 << m_precision); x++)
+        {
+            if (pOther->mp_registers[x] > mp_registers[x])
+            {
+                mp_registers[x] = pOther->mp_registers[x];
+            }
+        }
+        success = true;
+    }
+
+    return success;
+}
+
+void HyperLogLog::clear (void)
+{
+    if (mp_registers != NULL)
+    {
+        memset (mp_registers, 0, (size_t) 1 << m_precision);
+    }
+}
+
+uint32_t HyperLogLog::getSerialisedSize (void)
+{
+    return 1 + ((uint32_t) 1 << m_precision);
+}
+
+uint32_t HyperLogLog::serialise (char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+
+    if ((mp_registers != NULL) && (size >= getSerialisedSize ()))
+    {
+        pBuffer[0] = (char) m_precision;
+        memcpy (pBuffer + 1, mp_registers, (size_t) 1 << m_precision);
+        used = getSerialisedSize ();
+    }
+
+    return used;
+}
+
+uint32_t HyperLogLog::mergeSerialised (const char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+
+    if ((mp_registers != NULL) && (size >= getSerialisedSize ()) && ((uint8_t) pBuffer[0] == m_precision))
+    {
+        for (uint32_t x = 0; x < ((uint32_t) 1 << m_precision); x++)
+        {
+            if ((uint8_t) pBuffer[1 + x] > mp_registers[x])
+            {
+                mp_registers[x] = (uint8_t) pBuffer[1 + x];
+            }
+        }
+        used = getSerialisedSize ();
+    }
+
+    return used;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS: ValueHistogram
+// ----------------------------------------------------------------
+
+ValueHistogram::ValueHistogram (void)
+{
+    m_minValue = 0;
+    m_bucketWidth = 0;
+    m_numBuckets = 0;
+    m_count = 0;
+    mp_buckets = NULL;
+}
+
+ValueHistogram::~ValueHistogram (void)
+{
+    free (mp_buckets);
+}
+
+bool ValueHistogram::init (int32_t minValue, uint32_t bucketWidth, uint32_t numBuckets)
+{
+    bool success = false;
+
+    if ((mp_buckets == NULL) && (bucketWidth > 0) &&
+        (numBuckets > 0) && (numBuckets <= SKETCH_MAX_HISTOGRAM_BUCKETS))
+    {
+        mp_buckets = (uint64_t *) calloc (numBuckets, sizeof (uint64_t));
+        if (mp_buckets != NULL)
+        {
+            m_minValue = minValue;
+            m_bucketWidth = bucketWidth;
+            m_numBuckets = numBuckets;
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+void ValueHistogram::add (int32_t value)
+{
+    int64_t offset = (int64_t) value - m_minValue;
+    uint64_t bucket = 0;
+
+    if (mp_buckets != NULL)
+    {
+        if (offset > 0)
+        {
+            bucket = (uint64_t) offset / m_bucketWidth;
+            if (bucket >= m_numBuckets)
+            {
+                bucket = m_numBuckets - 1;
+            }
+        }
+        mp_buckets[bucket]++;
+        m_count++;
+    }
+}
+
+uint64_t ValueHistogram::getCount (void)
+{
+    return m_count;
+}
+
+int32_t ValueHistogram::quantile (double fraction)
+{
+    int32_t value = 0;
+    uint64_t target;
+    uint64_t count = 0;
+    uint32_t bucket = 0;
+
+    if (m_count > 0)
+    {
+        // The rank of the quantile, 1 to m_count
+        target = (uint64_t) ceil (fraction * m_count);
+        if (target < 1)
+        {
+            target = 1;
+        }
+        if (target > m_count)
+        {
+            target = m_count;
+        }
+        for (bucket = 0; bucket < m_numBuckets; bucket++)
+        {
+            count += mp_buckets[bucket];
+            if (count >= target)
+            {
+                break;
+            }
+        }
+        value = (int32_t) (m_minValue + ((int64_t) bucket * m_bucketWidth));
+    }
+
+    return value;
+}
+
+bool ValueHistogram::merge (const ValueHistogram * pOther)
+{
+    bool success = false;
+
+    if ((mp_buckets != NULL) && (pOther->mp_buckets != NULL) && (pOther->m_minValue == m_minValue) &&
+        (pOther->m_bucketWidth == m_bucketWidth) && (pOther->m_numBuckets == m_numBuckets))
+    {
+        for (uint32_t x = 0; x < m_numBuckets; x++)
+        {
+            mp_buckets[x] += pOther->mp_buckets[x];
+        }
+        m_count += pOther->m_count;
+        success = true;
+    }
+
+    return success;
+}
+
+void ValueHistogram::clear (void)
+{
+    if (mp_buckets != NULL)
+    {
+        memset (mp_buckets, 0, sizeof (uint64_t) * m_numBuckets);
+    }
+    m_count = 0;
+}
+
+uint32_t ValueHistogram::getSerialisedSize (void)
+{
+    return HISTOGRAM_HEADER_SIZE + (m_numBuckets * 8);
+}
+
+uint32_t ValueHistogram::serialise (char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+
+    if ((mp_buckets != NULL) && (size >= getSerialisedSize ()))
+    {
+        putUint32 (pBuffer, (uint32_t) m_minValue);
+        putUint32 (pBuffer + 4, m_bucketWidth);
+        putUint32 (pBuffer + 8, m_numBuckets);
+        for (uint32_t x = 0; x < m_numBuckets; x++)
+        {
+            putUint64 (pBuffer + HISTOGRAM_HEADER_SIZE + (x * 8), mp_buckets[x]);
+        }
+        used = getSerialisedSize ();
+    }
+
+    return used;
+}
+
+uint32_t ValueHistogram::mergeSerialised (const char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+    uint64_t count;
+
+    if ((mp_buckets != NULL) && (size >= getSerialisedSize ()) &&
+        ((int32_t) getUint32 (pBuffer) == m_minValue) && (getUint32 (pBuffer + 4) == m_bucketWidth) &&
+        (getUint32 (pBuffer + 8) == m_numBuckets))
+    {
+        for (uint32_t x = 0; x < m_numBuckets; x++)
+        {
+            count = getUint64 (pBuffer + HISTOGRAM_HEADER_SIZE + (x * 8));
+            mp_buckets[x] += count;
+            m_count += count;
+        }
+        used = getSerialisedSize ();
+    }
+
+    return used;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS: SpaceSaving
+// ----------------------------------------------------------------
+
+uint32_t SpaceSaving::findSlot (uint64_t key)
+{
+    uint32_t slot = (uint32_t) mix (key) & m_indexMask;
+
+    while ((mp_index[slot] != 0) && (mp_keys[mp_index[slot] - 1] != key))
+    {
+        slot = (slot + 1) & m_indexMask;
+    }
+
+    return slot;
+}
+
+void SpaceSaving::removeSlot (uint32_t slot)
+{
+    uint32_t next = slot;
+    uint32_t home;
+    bool done = false;
+
+    // Shift back any entries after it that would otherwise no longer
+    // be found, rather than leaving a tombstone
+    while (!done)
+    {
+        next = (next + 1) & m_indexMask;
+        if (mp_index[next] == 0)
+        {
+            mp_index[slot] = 0;
+            done = true;
+        }
+        else
+        {
+            home = (uint32_t) mix (mp_keys[mp_index[next] - 1]) & m_indexMask;
+            // Move the entry back only if its home is not cyclically
+            // in (slot, next]
+            if (((next > slot) && ((home <= slot) || (home > next))) ||
+                ((next < slot) && (home <= slot) && (home > next)))
+            {
+                mp_index[slot] = mp_index[next];
+                mp_slots[mp_index[slot] - 1] = slot;
+                slot = next;
+            }
+        }
+    }
+}
+
+void SpaceSaving::swap (uint32_t a, uint32_t b)
+{
+    uint64_t key = mp_keys[a];
+    uint64_t count = mp_counts[a];
+    uint64_t error = mp_errors[a];
+    uint32_t slot = mp_slots[a];
+
+    mp_keys[a] = mp_keys[b];
+    mp_counts[a] = mp_counts[b];
+    mp_errors[a] = mp_errors[b];
+    mp_slots[a] = mp_slots[b];
+    mp_keys[b] = key;
+    mp_counts[b] = count;
+    mp_errors[b] = error;
+    mp_slots[b] = slot;
+    mp_index[mp_slots[a]] = a + 1;
+    mp_index[mp_slots[b]] = b + 1;
+}
+
+void SpaceSaving::siftDown (uint32_t position)
+{
+    uint32_t child;
+
+    for (;;)
+    {
+        child = (position * 2) + 1;
+        if (child >= m_numUsed)
+        {
+            break;
+        }
+        if ((child + 1 < m_numUsed) && (mp_counts[child + 1] < mp_counts[child]))
+        {
+            child++;
+        }
+        if (mp_counts[child] >= mp_counts[position])
+        {
+            break;
+        }
+        swap (position, child);
+        position = child;
+    }
+}
+
+void SpaceSaving::siftUp (uint32_t position)
+{
+    uint32_t parent;
+
+    while (position > 0)
+    {
+        parent = (position - 1) / 2;
+        if (mp_counts[parent] <= mp_counts[position])
+        {
+            break;
+        }
+        swap (position, parent);
+        position = parent;
+    }
+}
+
+bool SpaceSaving::rebuild (uint64_t * pKeys, uint64_t * pCounts, uint64_t * pErrors, uint32_t num)
+{
+    bool success = false;
+    Counter_t * pCounters = (Counter_t *) malloc (sizeof (Counter_t) * (num + 1));
+    uint32_t slot;
+
+    if (pCounters != NULL)
+    {
+        for (uint32_t x = 0; x < num; x++)
+        {
+            pCounters[x].key = pKeys[x];
+            pCounters[x].count = pCounts[x];
+            pCounters[x].error = pErrors[x];
+        }
+        qsort (pCounters, num, sizeof (Counter_t), compareCounters);
+        memset (mp_index, 0, sizeof (uint32_t) * (m_indexMask + 1));
+        m_numUsed = 0;
+        for (uint32_t x = 0; (x < num) && (m_numUsed < m_numCounters); x++)
+        {
+            mp_keys[m_numUsed] = pCounters[x].key;
+            mp_counts[m_numUsed] = pCounters[x].count;
+            mp_errors[m_numUsed] = pCounters[x].error;
+            slot = findSlot (pCounters[x].key);
+            mp_index[slot] = m_numUsed + 1;
+            mp_slots[m_numUsed] = slot;
+            m_numUsed++;
+            siftUp (m_numUsed - 1);
+        }
+        free (pCounters);
+        success = true;
+    }
+
+    return success;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS: SpaceSaving
+// ----------------------------------------------------------------
+
+SpaceSaving::SpaceSaving (void)
+{
+    m_numCounters = 0;
+    m_numUsed = 0;
+    m_total = 0;
+    mp_keys = NULL;
+    mp_counts = NULL;
+    mp_errors = NULL;
+    mp_slots = NULL;
+    m_indexMask = 0;
+    mp_index = NULL;
+}
+
+SpaceSaving::~SpaceSaving (void)
+{
+    free (mp_keys);
+    free (mp_counts);
+    free (mp_errors);
+    free (mp_slots);
+    free (mp_index);
+}
+
+bool SpaceSaving::init (uint32_t numCounters)
+{
+    bool success = false;
+    uint32_t indexSize = 1;
+
+    if ((mp_keys == NULL) && (numCounters > 0) && (numCounters <= SKETCH_MAX_SPACE_SAVING_COUNTERS))
+    {
+        // An index at most half full
+        while (indexSize < numCounters * 2)
+        {
+            indexSize <<= 1;
+        }
+        mp_keys = (uint64_t *) malloc (sizeof (uint64_t) * numCounters);
+        mp_counts = (uint64_t *) malloc (sizeof (uint64_t) * numCounters);
+        mp_errors = (uint64_t *) malloc (sizeof (uint64_t) * numCounters);
+        mp_slots = (uint32_t *) malloc (sizeof (uint32_t) * numCounters);
+        mp_index = (uint32_t *) calloc (indexSize, sizeof (uint32_t));
+        if ((mp_keys != NULL) && (mp_counts != NULL) && (mp_errors != NULL) &&
+            (mp_slots != NULL) && (mp_index != NULL))
+        {
+            m_numCounters = numCounters;
+            m_indexMask = indexSize - 1;
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+void SpaceSaving::add (uint64_t key, uint64_t count)
+{
+    uint32_t slot;
+    uint32_t position;
+    uint64_t minCount;
+
+    if (mp_index != NULL)
+    {
+        m_total += count;
+        slot = findSlot (key);
+        if (mp_index[slot] != 0)
+        {
+            position = mp_index[slot] - 1;
+            mp_counts[position] += count;
+            siftDown (position);
+        }
+        else if (m_numUsed < m_numCounters)
+        {
+            position = m_numUsed;
+            mp_keys[position] = key;
+            mp_counts[position] = count;
+            mp_errors[position] = 0;
+            mp_index[slot] = position + 1;
+            mp_slots[position] = slot;
+            m_numUsed++;
+            siftUp (position);
+        }
+        else
+        {
+            // Take over the counter of the lightest key, inheriting
+            // its count as the possible error
+            minCount = mp_counts[0];
+            removeSlot (mp_slots[0]);
+            slot = findSlot (key);
+            mp_keys[0] = key;
+            mp_counts[0] = minCount + count;
+            mp_errors[0] = minCount;
+            mp_index[slot] = 1;
+            mp_slots[0] = slot;
+            siftDown (0);
+        }
+    }
+}
+
+uint32_t SpaceSaving::getTop (uint64_t * pKeys, uint64_t * pCounts, uint64_t * pErrors, uint32_t maxKeys)
+{
+    uint32_t numKeys = 0;
+    Counter_t * pCounters = (Counter_t *) malloc (sizeof (Counter_t) * (m_numUsed + 1));
+
+    if (pCounters != NULL)
+    {
+        for (uint32_t x = 0; x < m_numUsed; x++)
+        {
+            pCounters[x].key = mp_keys[x];
+            pCounters[x].count = mp_counts[x];
+            pCounters[x].error = mp_errors[x];
+        }
+        qsort (pCounters, m_numUsed, sizeof (Counter_t), compareCounters);
+        for (numKeys = 0; (numKeys < m_numUsed) && (numKeys < maxKeys); numKeys++)
+        {
+            pKeys[numKeys] = pCounters[numKeys].key;
+            if (pCounts != NULL)
+            {
+                pCounts[numKeys] = pCounters[numKeys].count;
+            }
+            if (pErrors != NULL)
+            {
+                pErrors[numKeys] = pCounters[numKeys].error;
+            }
+        }
+        free (pCounters);
+    }
+
+    return numKeys;
+}
+
+uint64_t SpaceSaving::getTotal (void)
+{
+    return m_total;
+}
+
+bool SpaceSaving::merge (const SpaceSaving * pOther)
+{
+    bool success = false;
+    uint32_t num;
+    uint32_t slot;
+    uint64_t minCount = 0;
+    uint64_t otherMinCount = 0;
+    uint64_t * pKeys = NULL;
+    uint64_t * pCounts = NULL;
+    uint64_t * pErrors = NULL;
+
+    if ((mp_index != NULL) && (pOther->mp_index != NULL))
+    {
+        num = m_numUsed + pOther->m_numUsed + 1;
+        pKeys = (uint64_t *) malloc (sizeof (uint64_t) * num);
+        pCounts = (uint64_t *) malloc (sizeof (uint64_t) * num);
+        pErrors = (uint64_t *) malloc (sizeof (uint64_t) * num);
+        success = (pKeys != NULL) && (pCounts != NULL) && (pErrors != NULL);
+    }
+
+    if (success)
+    {
+        // A key missing from a full sketch may have had up to its
+        // lightest count, so that is added to the count and the error
+        if (m_numUsed == m_numCounters)
+        {
+            minCount = mp_counts[0];
+        }
+        if (pOther->m_numUsed == pOther->m_numCounters)
+        {
+            otherMinCount = pOther->mp_counts[0];
+        }
+        for (num = 0; num < m_numUsed; num++)
+        {
+            pKeys[num] = mp_keys[num];
+            pCounts[num] = mp_counts[num] + otherMinCount;
+            pErrors[num] = mp_errors[num] + otherMinCount;
+        }
+        for (uint32_t x = 0; x < pOther->m_numUsed; x++)
+        {
+            slot = findSlot (pOther->mp_keys[x]);
+            if (mp_index[slot] != 0)
+            {
+                // In both, so no guesswork about either count
+                pCounts[mp_index[slot] - 1] += pOther->mp_counts[x] - otherMinCount;
+                pErrors[mp_index[slot] - 1] += pOther->mp_errors[x] - otherMinCount;
+            }
+            else
+            {
+                pKeys[num] = pOther->mp_keys[x];
+                pCounts[num] = pOther->mp_counts[x] + minCount;
+                pErrors[num] = pOther->mp_errors[x] + minCount;
+                num++;
+            }
+        }
+        m_total += pOther->m_total;
+        success = rebuild (pKeys, pCounts, pErrors, num);
+    }
+
+    free (pKeys);
+    free (pCounts);
+    free (pErrors);
+
+    return success;
+}
+
+void SpaceSaving::clear (void)
+{
+    if (mp_index != NULL)
+    {
+        memset (mp_index, 0, sizeof (uint32_t) * (m_indexMask + 1));
+    }
+    m_numUsed = 0;
+    m_total = 0;
+}
+
+uint32_t SpaceSaving::getSerialisedSize (void)
+{
+    return SPACE_SAVING_HEADER_SIZE + (m_numUsed * SPACE_SAVING_COUNTER_SIZE);
+}
+
+uint32_t SpaceSaving::serialise (char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+    char * pCounter;
+
+    if ((mp_index != NULL) && (size >= getSerialisedSize ()))
+    {
+        putUint32 (pBuffer, m_numCounters);
+        putUint32 (pBuffer + 4, m_numUsed);
+        putUint64 (pBuffer + 8, m_total);
+        for (uint32_t x = 0; x < m_numUsed; x++)
+        {
+            pCounter = pBuffer + SPACE_SAVING_HEADER_SIZE + (x * SPACE_SAVING_COUNTER_SIZE);
+            putUint64 (pCounter, mp_keys[x]);
+            putUint64 (pCounter + 8, mp_counts[x]);
+            putUint64 (pCounter + 16, mp_errors[x]);
+        }
+        used = getSerialisedSize ();
+    }
+
+    return used;
+}
+
+uint32_t SpaceSaving::mergeSerialised (const char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+    uint32_t numCounters;
+    uint32_t numUsed;
+    SpaceSaving other;
+    const char * pCounter;
+
+    if ((mp_index != NULL) && (size >= SPACE_SAVING_HEADER_SIZE))
+    {
+        numCounters = getUint32 (pBuffer);
+        numUsed = getUint32 (pBuffer + 4);
+        if ((numUsed <= numCounters) &&
+            (size >= SPACE_SAVING_HEADER_SIZE + ((uint64_t) numUsed * SPACE_SAVING_COUNTER_SIZE)) &&
+            other.init (numCounters))
+        {
+            // Unpack into a sketch of the sender's size, then merge
+            // that as usual
+            for (uint32_t x = 0; x < numUsed; x++)
+            {
+                pCounter = pBuffer + SPACE_SAVING_HEADER_SIZE + (x * SPACE_SAVING_COUNTER_SIZE);
+                other.mp_keys[x] = getUint64 (pCounter);
+                other.mp_counts[x] = getUint64 (pCounter + 8);
+                other.mp_errors[x] = getUint64 (pCounter + 16);
+            }
+            if (other.rebuild (other.mp_keys, other.mp_counts, other.mp_errors, numUsed))
+            {
+                other.m_total = getUint64 (pBuffer + 8);
+                if (merge (&other))
+                {
+                    used = SPACE_SAVING_HEADER_SIZE + (numUsed * SPACE_SAVING_COUNTER_SIZE);
+                }
+            }
+        }
+    }
+
+    return used;
+}
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS: FleetSketch
+// ----------------------------------------------------------------
+
+void FleetSketch::addCommon (DeviceId_t deviceId, uint32_t result)
+{
+    m_devices.add (mix (deviceId));
+    if (result < MessageCodec::MAX_NUM_DECODE_RESULTS)
+    {
+        m_numMsgs[result]++;
+    }
+    if (result == MessageCodec::DECODE_RESULT_DEBUG_IND_UL_MSG)
+    {
+        m_debugIndDevices.add (deviceId, 1);
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS: FleetSketch
+// ----------------------------------------------------------------
+
+FleetSketch::FleetSketch (void)
+{
+    memset (m_numMsgs, 0, sizeof (m_numMsgs));
+    memset (m_numWakeUps, 0, sizeof (m_numWakeUps));
+}
+
+FleetSketch::~FleetSketch (void)
+{
+}
+
+bool FleetSketch::init (uint32_t numHeavyHitters)
+{
+    if (numHeavyHitters == 0)
+    {
+        numHeavyHitters = SKETCH_FLEET_DEFAULT_HEAVY_HITTERS;
+    }
+
+    // RSSI and temperature are a byte on the air so can be counted
+    // exactly; battery voltage is in 63 steps up to 10000 mV
+    return m_devices.init (SKETCH_FLEET_HLL_PRECISION) &&
+           m_rssi.init (0, 1, 256) &&
+           m_batteryMV.init (0, SKETCH_FLEET_BATTERY_MV_BUCKET_WIDTH,
+                             (10000 / SKETCH_FLEET_BATTERY_MV_BUCKET_WIDTH) + 1) &&
+           m_temperature.init (-128, 1, 256) &&
+           m_debugIndDevices.init (numHeavyHitters) &&
+           m_watchdogDevices.init (numHeavyHitters);
+}
+
+void FleetSketch::addMsg (DeviceId_t deviceId, MessageCodec::DecodeResult_t result,
+                          const UlMsgUnion_t * pMsg)
+{
+    const SensorReadings_t * pReadings = NULL;
+
+    addCommon (deviceId, result);
+    switch (result)
+    {
+        case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+            if ((uint32_t) pMsg->initIndUlMsg.wakeUpCode < MAX_NUM_WAKE_UP_CODES)
+            {
+                m_numWakeUps[pMsg->initIndUlMsg.wakeUpCode]++;
+            }
+            if (pMsg->initIndUlMsg.wakeUpCode == WAKE_UP_CODE_WATCHDOG)
+            {
+                m_watchdogDevices.add (deviceId, 1);
+            }
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+            pReadings = &(pMsg->sensorsReportIndUlMsg.sensorReadings);
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+            pReadings = &(pMsg->sensorsReportGetCnfUlMsg.sensorReadings);
+        break;
+        default:
+        break;
+    }
+
+    if (pReadings != NULL)
+    {
+        if (pReadings->rssiPresent)
+        {
+            m_rssi.add (pReadings->rssi);
+        }
+        if (pReadings->powerStatePresent)
+        {
+            m_batteryMV.add (pReadings->powerState.batteryMV);
+        }
+        if (pReadings->temperaturePresent)
+        {
+            m_temperature.add (pReadings->temperature);
+        }
+    }
+}
+
+void FleetSketch::addRecord (const PipelineRecord_t * pRecord)
+{
+    addCommon (pRecord->deviceId, pRecord->msgType);
+    switch (pRecord->msgType)
+    {
+        case MessageCodec::DECODE_RESULT_INIT_IND_UL_MSG:
+            if (pRecord->u.initInd.wakeUpCode < MAX_NUM_WAKE_UP_CODES)
+            {
+                m_numWakeUps[pRecord->u.initInd.wakeUpCode]++;
+            }
+            if (pRecord->u.initInd.wakeUpCode == WAKE_UP_CODE_WATCHDOG)
+            {
+                m_watchdogDevices.add (pRecord->deviceId, 1);
+            }
+        break;
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_IND_UL_MSG:
+        case MessageCodec::DECODE_RESULT_SENSORS_REPORT_GET_CNF_UL_MSG:
+            if (pRecord->presentBitmap & PIPELINE_PRESENT_RSSI)
+            {
+                m_rssi.add (pRecord->u.readings.rssi);
+            }
+            if (pRecord->presentBitmap & PIPELINE_PRESENT_POWER_STATE)
+            {
+                m_batteryMV.add (pRecord->u.readings.batteryMV);
+            }
+            if (pRecord->presentBitmap & PIPELINE_PRESENT_TEMPERATURE)
+            {
+                m_temperature.add (pRecord->u.readings.temperature);
+            }
+        break;
+        default:
+        break;
+    }
+}
+
+bool FleetSketch::merge (FleetSketch * pOther)
+{
+    for (uint32_t x = 0; x < MessageCodec::MAX_NUM_DECODE_RESULTS; x++)
+    {
+        m_numMsgs[x] += pOther->m_numMsgs[x];
+    }
+    for (uint32_t x = 0; x < MAX_NUM_WAKE_UP_CODES; x++)
+    {
+        m_numWakeUps[x] += pOther->m_numWakeUps[x];
+    }
+
+    return m_devices.merge (&(pOther->m_devices)) &&
+           m_rssi.merge (&(pOther->m_rssi)) &&
+           m_batteryMV.merge (&(pOther->m_batteryMV)) &&
+           m_temperature.merge (&(pOther->m_temperature)) &&
+           m_debugIndDevices.merge (&(pOther->m_debugIndDevices)) &&
+           m_watchdogDevices.merge (&(pOther->m_watchdogDevices));
+}
+
+void FleetSketch::clear (void)
+{
+    m_devices.clear ();
+    m_rssi.clear ();
+    m_batteryMV.clear ();
+    m_temperature.clear ();
+    m_debugIndDevices.clear ();
+    m_watchdogDevices.clear ();
+    memset (m_numMsgs, 0, sizeof (m_numMsgs));
+    memset (m_numWakeUps, 0, sizeof (m_numWakeUps));
+}
+
+uint32_t FleetSketch::getSerialisedSize (void)
+{
+    return m_devices.getSerialisedSize () + m_rssi.getSerialisedSize () +
+           m_batteryMV.getSerialisedSize () + m_temperature.getSerialisedSize () +
+           m_debugIndDevices.getSerialisedSize () + m_watchdogDevices.getSerialisedSize () +
+           ((MessageCodec::MAX_NUM_DECODE_RESULTS + MAX_NUM_WAKE_UP_CODES) * 8);
+}
+
+uint32_t FleetSketch::serialise (char * pBuffer, uint32_t size)
+{
+    uint32_t used = 0;
+
+    if (size >= getSerialisedSize ())
+    {
+        used += m_devices.serialise (pBuffer + used, size - used);
+        used += m_rssi.serialise (pBuffer + used, size - used);
+        used += m_batteryMV.serialise (pBuffer + used, size - used);
+        used += m_temperature.serialise (pBuffer + used, size - used);
+        used += m_debugIndDevices.serialise (pBuffer + used, size - used);
+        used += m_watchdogDevices.serialise (pBuffer + used, size - used);
+        for (uint32_t x = 0; x < MessageCodec::MAX_NUM_DECODE_RESULTS; x++)
+        {
+            putUint64 (pBuffer + used, m_numMsgs[x]);
+            used += 8;
+        }
+        for (uint32_t x = 0; x < MAX_NUM_WAKE_UP_CODES; x++)
+        {
+            putUint64 (pBuffer + used, m_numWakeUps[x]);
+            used += 8;
+        }
+    }
+
+    return used;
+}
+
+uint32_t FleetSketch::mergeSerialised (const char * pBuffer, uint32_t size)
+{
+    uint32_t used;
+    uint32_t partSize;
+
+    used = m_devices.mergeSerialised (pBuffer, size);
+    partSize = (used > 0) ? m_rssi.mergeSerialised (pBuffer + used, size - used) : 0;
+    used = (partSize > 0) ? used + partSize : 0;
+    partSize = (used > 0) ? m_batteryMV.mergeSerialised (pBuffer + used, size - used) : 0;
+    used = (partSize > 0) ? used + partSize : 0;
+    partSize = (used > 0) ? m_temperature.mergeSerialised (pBuffer + used, size - used) : 0;
+    used = (partSize > 0) ? used + partSize : 0;
+    partSize = (used > 0) ? m_debugIndDevices.mergeSerialised (pBuffer + used, size - used) : 0;
+    used = (partSize > 0) ? used + partSize : 0;
+    partSize = (used > 0) ? m_watchdogDevices.mergeSerialised (pBuffer + used, size - used) : 0;
+    used = (partSize > 0) ? used + partSize : 0;
+    if ((used > 0) && (size - used >= (MessageCodec::MAX_NUM_DECODE_RESULTS + MAX_NUM_WAKE_UP_CODES) * 8))
+    {
+        for (uint32_t x = 0; x < MessageCodec::MAX_NUM_DECODE_RESULTS; x++)
+        {
+            m_numMsgs[x] += getUint64 (pBuffer + used);
+            used += 8;
+        }
+        for (uint32_t x = 0; x < MAX_NUM_WAKE_UP_CODES; x++)
+        {
+            m_numWakeUps[x] += getUint64 (pBuffer + used);
+            used += 8;
+        }
+    }
+    else
+    {
+        used = 0;
+    }
+
+    return used;
+}
+
+HyperLogLog * FleetSketch::getDevices (void)
+{
+    return &m_devices;
+}
+
+ValueHistogram * FleetSketch::getRssi (void)
+{
+    return &m_rssi;
+}
+
+ValueHistogram * FleetSketch::getBatteryMV (void)
+{
+    return &m_batteryMV;
+}
+
+ValueHistogram * FleetSketch::getTemperature (void)
+{
+    return &m_temperature;
+}
+
+SpaceSaving * FleetSketch::getDebugIndDevices (void)
+{
+    return &m_debugIndDevices;
+}
+
+SpaceSaving * FleetSketch::getWatchdogDevices (void)
+{
+    return &m_watchdogDevices;
+}
+
+uint64_t FleetSketch::getNumMsgs (MessageCodec::DecodeResult_t result)
+{
+    uint64_t numMsgs = 0;
+
+    if ((uint32_t) result < MessageCodec::MAX_NUM_DECODE_RESULTS)
+    {
+        numMsgs = m_numMsgs[result];
+    }
+
+    return numMsgs;
+}
+
+uint64_t FleetSketch::getNumWakeUps (WakeUpCode_t wakeUpCode)
+{
+    uint64_t numWakeUps = 0;
+
+    if ((uint32_t) wakeUpCode < MAX_NUM_WAKE_UP_CODES)
+    {
+        numWakeUps = m_numWakeUps[wakeUpCode];
+    }
+
+    return numWakeUps;
+}
+
+// End Of File
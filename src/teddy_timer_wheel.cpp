@@ -0,0 +1,260 @@
+/* Teddy server-side hierarchical timer wheel
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_timer_wheel.cpp
+ * This file implements the hierarchical timer wheel.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for malloc() and free()
+#include <teddy_timer_wheel.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The value of mp_slot[] for a timer that is not armed
+#define NOT_ARMED 0xFFFF
+
+/// Mask for a slot within a level
+#define SLOT_MASK (TIMER_WHEEL_SLOTS_PER_LEVEL - 1)
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+void TimerWheel::link (uint32_t timerIndex, bool cascading)
+{
+    uint32_t expiry = mp_expiry[timerIndex];
+    uint32_t delta = expiry - m_now;
+    uint32_t level = 0;
+    uint32_t slot;
+
+    // When cascading, m_now is the tick about to be fired so a timer
+    // due at it goes into its level 0 slot; otherwise m_now has already
+    // been fired and anything due goes into the next tick
+    if (((int32_t) delta < 0) || ((delta == 0) && !cascading))
+    {
+        expiry = m_now + 1;
+        delta = 1;
+    }
+
+    while ((level < TIMER_WHEEL_NUM_LEVELS - 1) &&
+           (delta >= (1U << (TIMER_WHEEL_LEVEL_BITS * (level + 1)))))
+    {
+        level++;
+    }
+
+    slot = (level << TIMER_WHEEL_LEVEL_BITS) + ((expiry >> (TIMER_WHEEL_LEVEL_BITS * level)) & SLOT_MASK);
+    mp_slot[timerIndex] = (uint16_t) slot;
+    mp_prev[timerIndex] = TIMER_WHEEL_INDEX_NONE;
+    mp_next[timerIndex] = m_heads[slot];
+    if (m_heads[slot] != TIMER_WHEEL_INDEX_NONE)
+    {
+        mp_prev[m_heads[slot]] = timerIndex;
+    }
+    m_heads[slot] = timerIndex;
+}
+
+void TimerWheel::unlink (uint32_t timerIndex)
+{
+    uint32_t next = mp_next[timerIndex];
+    uint32_t prev = mp_prev[timerIndex];
+
+    if (prev != TIMER_WHEEL_INDEX_NONE)
+    {
+        mp_next[prev] = next;
+    }
+    else
+    {
+        m_heads[mp_slot[timerIndex]] = next;
+    }
+    if (next != TIMER_WHEEL_INDEX_NONE)
+    {
+        mp_prev[next] = prev;
+    }
+    mp_slot[timerIndex] = NOT_ARMED;
+}
+
+void TimerWheel::cascade (uint32_t level, uint32_t slot)
+{
+    uint32_t listSlot = (level << TIMER_WHEEL_LEVEL_BITS) + slot;
+    uint32_t timerIndex = m_heads[listSlot];
+    uint32_t next;
+
+    // Detach the whole list then re-file each timer relative to
+    // the new time; all of them land in lower levels
+    m_heads[listSlot] = TIMER_WHEEL_INDEX_NONE;
+    while (timerIndex != TIMER_WHEEL_INDEX_NONE)
+    {
+        next = mp_next[timerIndex];
+        link (timerIndex, true);
+        timerIndex = next;
+    }
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+TimerWheel::TimerWheel (void)
+{
+    m_numTimers = 0;
+    m_numArmed = 0;
+    m_now = 0;
+    mp_next = NULL;
+    mp_prev = NULL;
+    mp_expiry = NULL;
+    mp_slot = NULL;
+    for (uint32_t x = 0; x < sizeof (m_heads) / sizeof (m_heads[0]); x++)
+    {
+        m_heads[x] = TIMER_WHEEL_INDEX_NONE;
+    }
+}
+
+TimerWheel::~TimerWheel (void)
+{
+    free (mp_next);
+    free (mp_prev);
+    free (mp_expiry);
+    free (mp_slot);
+}
+
+bool TimerWheel::init (uint32_t numTimers, uint32_t nowTick)
+{
+    bool success = false;
+
+    if ((mp_next == NULL) && (numTimers > 0) && (numTimers < TIMER_WHEEL_INDEX_NONE))
+    {
+        mp_next = (uint32_t *) malloc (sizeof (uint32_t) * numTimers);
+        mp_prev = (uint32_t *) malloc (sizeof (uint32_t) * numTimers);
+        mp_expiry = (uint32_t *) malloc (sizeof (uint32_t) * numTimers);
+        mp_slot = (uint16_t *) malloc (sizeof (uint16_t) * numTimers);
+        if ((mp_next != NULL) && (mp_prev != NULL) && (mp_expiry != NULL) && (mp_slot != NULL))
+        {
+            for (uint32_t x = 0; x < numTimers; x++)
+            {
+                mp_slot[x] = NOT_ARMED;
+            }
+            m_numTimers = numTimers;
+            m_now = nowTick;
+            success = true;
+        }
+    }
+
+    return success;
+}
+
+void TimerWheel::arm (uint32_t timerIndex, uint32_t expiryTick)
+{
+    if (timerIndex < m_numTimers)
+    {
+        if (mp_slot[timerIndex] != NOT_ARMED)
+        {
+            unlink (timerIndex);
+        }
+        else
+        {
+            m_numArmed++;
+        }
+        mp_expiry[timerIndex] = expiryTick;
+        link (timerIndex, false);
+    }
+}
+
+void TimerWheel::cancel (uint32_t timerIndex)
+{
+    if ((timerIndex < m_numTimers) && (mp_slot[timerIndex] != NOT_ARMED))
+    {
+        unlink (timerIndex);
+        m_numArmed--;
+    }
+}
+
+bool TimerWheel::isArmed (uint32_t timerIndex)
+{
+    return (timerIndex < m_numTimers) && (mp_slot[timerIndex] != NOT_ARMED);
+}
+
+uint32_t TimerWheel::getExpiry (uint32_t timerIndex)
+{
+    uint32_t expiry = 0;
+
+    if (timerIndex < m_numTimers)
+    {
+        expiry = mp_expiry[timerIndex];
+    }
+
+    return expiry;
+}
+
+uint32_t TimerWheel::advance (uint32_t nowTick, TimerWheelCallback_t callback, void * pContext)
+{
+    uint32_t numFired = 0;
+    uint32_t timerIndex;
+    uint32_t slot;
+    uint32_t level;
+
+    while ((int32_t) (nowTick - m_now) > 0)
+    {
+        if (m_numArmed == 0)
+        {
+            // Nothing to do on the way, jump straight there
+            m_now = nowTick;
+        }
+        else
+        {
+            m_now++;
+
+            // At each wrap of a level, cascade the next slot of the
+            // level above into it
+            level = 0;
+            slot = m_now & SLOT_MASK;
+            while ((slot == 0) && (level < TIMER_WHEEL_NUM_LEVELS - 1))
+            {
+                level++;
+                slot = (m_now >> (TIMER_WHEEL_LEVEL_BITS * level)) & SLOT_MASK;
+                cascade (level, slot);
+            }
+
+            // Everything left in the level 0 slot is due now; take
+            // the head each time as the callback may re-arm timers
+            slot = m_now & SLOT_MASK;
+            while (m_heads[slot] != TIMER_WHEEL_INDEX_NONE)
+            {
+                timerIndex = m_heads[slot];
+                unlink (timerIndex);
+                m_numArmed--;
+                numFired++;
+                if (callback != NULL)
+                {
+                    callback (pContext, timerIndex, mp_expiry[timerIndex]);
+                }
+            }
+        }
+    }
+
+    return numFired;
+}
+
+uint32_t TimerWheel::getNumArmed (void)
+{
+    return m_numArmed;
+}
+
+uint64_t TimerWheel::getMemoryUsed (void)
+{
+    return (uint64_t) m_numTimers * (sizeof (uint32_t) * 3 + sizeof (uint16_t)) + sizeof (m_heads);
+}
+
+// End Of File
@@ -0,0 +1,103 @@
+/* Teddy traffic accounting
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_traffic_accounting.cpp
+ * This file implements the traffic counter delta and loss functions.
+ */
+
+#include <stdint.h>
+#include <stddef.h> // for NULL
+#include <teddy_msgs.hpp>
+#include <teddy_traffic_accounting.hpp>
+
+// ----------------------------------------------------------------
+// PRIVATE FUNCTIONS
+// ----------------------------------------------------------------
+
+/// Classify the step of one counter: 0 if it went up (or stayed
+// the same), TRAFFIC_DELTA_WRAPPED if it wrapped, TRAFFIC_DELTA_RESET
+// if it can only have started again.
+static uint8_t counterStep (uint32_t previous, uint32_t current)
+{
+    uint8_t flags = 0;
+
+    if (current < previous)
+    {
+        flags = TRAFFIC_DELTA_RESET;
+        if ((previous >= TRAFFIC_WRAP_FROM) && (current < TRAFFIC_WRAP_TO))
+        {
+            flags = TRAFFIC_DELTA_WRAPPED;
+        }
+    }
+
+    return flags;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC FUNCTIONS
+// ----------------------------------------------------------------
+
+uint8_t trafficReportDelta (const TrafficReportIndUlMsg_t * pPrevious,
+                            const TrafficReportIndUlMsg_t * pCurrent,
+                            TrafficReportIndUlMsg_t * pDelta)
+{
+    uint8_t flags = TRAFFIC_DELTA_FIRST;
+
+    if (pPrevious != NULL)
+    {
+        flags = counterStep (pPrevious->numDatagramsSent, pCurrent->numDatagramsSent) |
+                counterStep (pPrevious->numBytesSent, pCurrent->numBytesSent) |
+                counterStep (pPrevious->numDatagramsReceived, pCurrent->numDatagramsReceived) |
+                counterStep (pPrevious->numBytesReceived, pCurrent->numBytesReceived);
+    }
+
+    if (flags & (TRAFFIC_DELTA_FIRST | TRAFFIC_DELTA_RESET))
+    {
+        // If any counter has started again they all have: the whole
+        // report is the delta
+        flags &= ~TRAFFIC_DELTA_WRAPPED;
+        *pDelta = *pCurrent;
+    }
+    else
+    {
+        // Unsigned subtraction takes care of wrap
+        pDelta->numDatagramsSent = pCurrent->numDatagramsSent - pPrevious->numDatagramsSent;
+        pDelta->numBytesSent = pCurrent->numBytesSent - pPrevious->numBytesSent;
+        pDelta->numDatagramsReceived = pCurrent->numDatagramsReceived - pPrevious->numDatagramsReceived;
+        pDelta->numBytesReceived = pCurrent->numBytesReceived - pPrevious->numBytesReceived;
+    }
+
+    return flags;
+}
+
+void trafficAddDelta (TrafficTotals_t * pTotals, const TrafficDelta_t * pDelta)
+{
+    pTotals->numUlDatagramsSent += pDelta->device.numDatagramsSent;
+    pTotals->numUlDatagramsReceived += pDelta->server.numUlDatagrams;
+    pTotals->numDlDatagramsSent += pDelta->server.numDlDatagrams;
+    pTotals->numDlDatagramsReceived += pDelta->device.numDatagramsReceived;
+}
+
+double trafficLossPercent (uint64_t numSent, uint64_t numReceived)
+{
+    double lossPercent = 0;
+
+    if (numSent > numReceived)
+    {
+        lossPercent = ((double) (numSent - numReceived)) * 100 / numSent;
+    }
+
+    return lossPercent;
+}
+
+// End Of File
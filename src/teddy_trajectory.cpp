@@ -0,0 +1,312 @@
+/* Teddy GPS trajectory simplifier
+ *
+ * Copyright (C) u-blox Melbourn Ltd
+ * u-blox Melbourn Ltd, Melbourn, UK
+ *
+ * All rights reserved.
+ *
+ * This source file is the sole property of u-blox Melbourn Ltd.
+ * Reproduction or utilization of this source in whole or part is
+ * forbidden without the written consent of u-blox Melbourn Ltd.
+ */
+
+/**
+ * @file teddy_trajectory.cpp
+ * This file implements the GPS trajectory simplifier.
+ */
+
+#include <stdint.h>
+#include <stdlib.h> // for calloc(), posix_memalign() and free()
+#include <string.h> // for memset()
+#include <math.h>   // for cos(), only when a position is kept
+#include <teddy_server.hpp>
+#include <teddy_pipeline.hpp>
+#include <teddy_trajectory.hpp>
+
+// ----------------------------------------------------------------
+// GENERAL COMPILE-TIME CONSTANTS
+// ----------------------------------------------------------------
+
+/// The number of GpsPosition_t units, thousandths of a minute of
+// arc, in a degree
+#define UNITS_PER_DEGREE 60000
+
+/// The millimetres in a GpsPosition_t unit of latitude
+#define MILLIMETRES_PER_UNIT 1852
+
+/// The smallest longitude scale, so that the error near the poles
+// stays bounded, 1.0 = 65536
+#define MIN_COS_Q16 1024
+
+/// The fraction bits of the distances compared with the error, and
+// the largest distance in each direction, in units, that is compared
+// rather than just taken to be beyond it, so that the squares fit
+#define DISTANCE_FRACTION_BITS 8
+#define MAX_DISTANCE_UNITS (1 << 20)
+
+/// The largest velocity, in units per second, to dead-reckon with;
+// about 1800 km/h, well beyond any teddy
+#define MAX_VELOCITY_UNITS_PER_SECOND 270
+
+// ----------------------------------------------------------------
+// PRIVATE METHODS
+// ----------------------------------------------------------------
+
+int64_t TrajectorySimplifier::findSlot (Shard_t * pShard, DeviceId_t deviceId, bool add)
+{
+    int64_t slot = -1;
+    uint32_t x = shardProbe (pShard->pDeviceIds, pShard->capacity, deviceId);
+
+    if (pShard->pDeviceIds[x] == deviceId)
+    {
+        slot = x;
+    }
+    else if (add && (pShard->numEntries < pShard->maxEntries))
+    {
+        pShard->pDeviceIds[x] = deviceId;
+        memset (&(pShard->pDevices[x]), 0, sizeof (pShard->pDevices[x]));
+        pShard->numEntries++;
+        slot = x;
+    }
+
+    return slot;
+}
+
+void TrajectorySimplifier::keep (Device_t * pDevice, const PipelineReadings_t * pReadings, bool isFirst)
+{
+    int64_t velocity;
+    int64_t seconds = 0;
+
+    if (!isFirst)
+    {
+        seconds = (int64_t) pReadings->time - pDevice->time;
+    }
+
+    // The velocity from the last position kept to this one, or none
+    // if there's no telling
+    pDevice->latitudeVelocityQ16 = 0;
+    pDevice->longitudeVelocityQ16 = 0;
+    if (seconds > 0)
+    {
+        velocity = (((int64_t) pReadings->gpsLatitude - pDevice->gpsLatitude) << 16) / seconds;
+        if ((velocity <= (int64_t) MAX_VELOCITY_UNITS_PER_SECOND << 16) &&
+            (velocity >= -((int64_t) MAX_VELOCITY_UNITS_PER_SECOND << 16)))
+        {
+            pDevice->latitudeVelocityQ16 = (int32_t) velocity;
+        }
+        velocity = (((int64_t) pReadings->gpsLongitude - pDevice->gpsLongitude) << 16) / seconds;
+        if ((velocity <= (int64_t) MAX_VELOCITY_UNITS_PER_SECOND << 16) &&
+            (velocity >= -((int64_t) MAX_VELOCITY_UNITS_PER_SECOND << 16)))
+        {
+            pDevice->longitudeVelocityQ16 = (int32_t) velocity;
+        }
+    }
+
+    pDevice->time = pReadings->time;
+    pDevice->gpsLatitude = pReadings->gpsLatitude;
+    pDevice->gpsLongitude = pReadings->gpsLongitude;
+    pDevice->gpsElevation = pReadings->gpsElevation;
+    pDevice->gpsSpeed = pReadings->gpsSpeed;
+    pDevice->cosQ16 = (uint32_t) (cos ((double) pReadings->gpsLatitude / UNITS_PER_DEGREE * M_PI / 180) * 65536);
+    if (pDevice->cosQ16 < MIN_COS_Q16)
+    {
+        pDevice->cosQ16 = MIN_COS_Q16;
+    }
+    pDevice->numKept++;
+}
+
+// ----------------------------------------------------------------
+// PUBLIC METHODS
+// ----------------------------------------------------------------
+
+TrajectorySimplifier::TrajectorySimplifier (void)
+{
+    m_errorSquared = 0;
+    m_numShards = 0;
+    mp_shards = NULL;
+}
+
+TrajectorySimplifier::~TrajectorySimplifier (void)
+{
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        free (mp_shards[x].pDeviceIds);
+        free (mp_shards[x].pDevices);
+    }
+    free (mp_shards);
+}
+
+bool TrajectorySimplifier::init (uint32_t numShards, uint32_t maxDevices, uint32_t errorMetres)
+{
+    bool success = false;
+    void * pMem = NULL;
+    uint32_t maxEntries;
+    uint32_t capacity;
+    uint64_t errorMillimetres;
+
+    if (errorMetres == 0)
+    {
+        errorMetres = TRAJECTORY_DEFAULT_ERROR_METRES;
+    }
+
+    if ((mp_shards == NULL) && (numShards > 0) && (numShards <= TRAJECTORY_MAX_SHARDS) &&
+        (maxDevices > 0) &&
+        (posix_memalign (&pMem, SERVER_CACHE_LINE_SIZE, sizeof (Shard_t) * numShards) == 0))
+    {
+        errorMillimetres = (uint64_t) errorMetres * 1000;
+        m_errorSquared = ((errorMillimetres << DISTANCE_FRACTION_BITS) / MILLIMETRES_PER_UNIT);
+        m_errorSquared *= m_errorSquared;
+        mp_shards = (Shard_t *) pMem;
+        memset (mp_shards, 0, sizeof (Shard_t) * numShards);
+        capacity = shardCapacity (maxDevices, numShards, &maxEntries);
+        success = true;
+        for (m_numShards = 0; m_numShards < numShards; m_numShards++)
+        {
+            Shard_t * pShard = &(mp_shards[m_numShards]);
+
+            pShard->capacity = capacity;
+            pShard->maxEntries = maxEntries;
+            pShard->pDeviceIds = (DeviceId_t *) calloc (capacity, sizeof (DeviceId_t));
+            pShard->pDevices = (Device_t *) calloc (capacity, sizeof (Device_t));
+            if ((pShard->pDeviceIds == NULL) || (pShard->pDevices == NULL))
+            {
+                success = false;
+            }
+        }
+    }
+
+    return success;
+}
+
+uint32_t TrajectorySimplifier::getShardIndex (DeviceId_t deviceId)
+{
+    uint32_t shardIndex = 0;
+
+    if (m_numShards > 0)
+    {
+        shardIndex = deviceIdShard (deviceId, m_numShards);
+    }
+
+    return shardIndex;
+}
+
+bool TrajectorySimplifier::simplify (uint32_t shardIndex, DeviceId_t deviceId,
+                                     PipelineReadings_t * pReadings, uint8_t * pPresentBitmap)
+{
+    bool dropped = false;
+    Shard_t * pShard = NULL;
+    Device_t * pDevice;
+    int64_t slot = -1;
+    int64_t seconds;
+    int64_t dLatitude;
+    int64_t dLongitude;
+
+    if ((shardIndex < m_numShards) && (deviceId != DEVICE_ID_INVALID) &&
+        (*pPresentBitmap & PIPELINE_PRESENT_GPS_POSITION))
+    {
+        pShard = &(mp_shards[shardIndex]);
+        slot = findSlot (pShard, deviceId, true);
+    }
+
+    if (slot >= 0)
+    {
+        pDevice = &(pShard->pDevices[slot]);
+        if (pDevice->numKept == 0)
+        {
+            keep (pDevice, pReadings, true);
+            pShard->numKept++;
+        }
+        else
+        {
+            // How far the position is from where the device should be
+            // by dead reckoning, with the longitude scaled to match the
+            // latitude, to a 256th of a unit
+            seconds = (int64_t) pReadings->time - pDevice->time;
+            if (seconds < 0)
+            {
+                seconds = 0;
+            }
+            dLatitude = ((((int64_t) pReadings->gpsLatitude - pDevice->gpsLatitude) << 16) -
+                         (pDevice->latitudeVelocityQ16 * seconds)) >> (16 - DISTANCE_FRACTION_BITS);
+            dLongitude = ((((int64_t) pReadings->gpsLongitude - pDevice->gpsLongitude) << 16) -
+                          (pDevice->longitudeVelocityQ16 * seconds)) >> (16 - DISTANCE_FRACTION_BITS);
+            dLongitude = (dLongitude * pDevice->cosQ16) >> 16;
+            if ((dLatitude < ((int64_t) MAX_DISTANCE_UNITS << DISTANCE_FRACTION_BITS)) &&
+                (dLatitude > -((int64_t) MAX_DISTANCE_UNITS << DISTANCE_FRACTION_BITS)) &&
+                (dLongitude < ((int64_t) MAX_DISTANCE_UNITS << DISTANCE_FRACTION_BITS)) &&
+                (dLongitude > -((int64_t) MAX_DISTANCE_UNITS << DISTANCE_FRACTION_BITS)) &&
+                ((uint64_t) ((dLatitude * dLatitude) + (dLongitude * dLongitude)) <= m_errorSquared))
+            {
+                pReadings->gpsLatitude = pDevice->gpsLatitude;
+                pReadings->gpsLongitude = pDevice->gpsLongitude;
+                pReadings->gpsElevation = pDevice->gpsElevation;
+                pReadings->gpsSpeed = pDevice->gpsSpeed;
+                *pPresentBitmap &= (uint8_t) ~PIPELINE_PRESENT_GPS_POSITION;
+                pDevice->numDropped++;
+                pShard->numDropped++;
+                dropped = true;
+            }
+            else
+            {
+                keep (pDevice, pReadings, false);
+                pShard->numKept++;
+            }
+        }
+    }
+
+    return dropped;
+}
+
+bool TrajectorySimplifier::getDeviceStats (DeviceId_t deviceId, uint32_t * pNumKept, uint32_t * pNumDropped)
+{
+    bool found = false;
+    Device_t * pDevice;
+    Shard_t * pShard = NULL;
+    int64_t slot = -1;
+
+    if ((m_numShards > 0) && (deviceId != DEVICE_ID_INVALID))
+    {
+        pShard = &(mp_shards[deviceIdShard (deviceId, m_numShards)]);
+        slot = findSlot (pShard, deviceId, false);
+    }
+
+    if (slot >= 0)
+    {
+        pDevice = &(pShard->pDevices[slot]);
+        if (pNumKept != NULL)
+        {
+            *pNumKept = pDevice->numKept;
+        }
+        if (pNumDropped != NULL)
+        {
+            *pNumDropped = pDevice->numDropped;
+        }
+        found = true;
+    }
+
+    return found;
+}
+
+void TrajectorySimplifier::getStats (uint64_t * pNumKept, uint64_t * pNumDropped)
+{
+    uint64_t numKept = 0;
+    uint64_t numDropped = 0;
+
+    // Not synchronised with the shards, near enough for reporting
+    for (uint32_t x = 0; x < m_numShards; x++)
+    {
+        numKept += mp_shards[x].numKept;
+        numDropped += mp_shards[x].numDropped;
+    }
+
+    if (pNumKept != NULL)
+    {
+        *pNumKept = numKept;
+    }
+    if (pNumDropped != NULL)
+    {
+        *pNumDropped = numDropped;
+    }
+}
+
+// End Of File